@@ -0,0 +1,33 @@
+/*
+ * apex_cache.h
+ * Contains the on-disk cache of simulation results shared by the clients
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+
+#include "apex.h"
+
+/* A key is 128 bits, written as hex */
+#define APEX_CACHE_KEY_SIZE 33
+
+/* Everything a finished run is reported with */
+typedef struct Cache_Result
+{
+    int watchdog_reason;
+    int cycles;
+    APEX_Stats stats;
+    APEX_ArchState state;  /* Status, retired, PC, flags, registers, memory */
+} Cache_Result;
+
+void apex_cache_key(char key[APEX_CACHE_KEY_SIZE], const APEX_Program *program,
+                    const int *data_memory, const APEX_Config *config,
+                    int max_cycles);
+int apex_cache_lookup(const char *dir, const char *key, Cache_Result *result);
+void apex_cache_capture(const APEX_CPU *cpu, Cache_Result *result);
+int apex_cache_store(const char *dir, const char *key, const Cache_Result *result);
+int apex_cache_prune(const char *dir, long long max_bytes);
+#endif
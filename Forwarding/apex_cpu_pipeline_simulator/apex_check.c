@@ -0,0 +1,475 @@
+/*
+ * apex_check.c
+ * apex-check, the self-check of libapex run by 'make check'
+ *
+ * Every program is run twice per memory and MUL latency of the matrix:
+ * once with APEX_cpu_run_until, which fast-forwards over idle cycles, and
+ * once one cycle at a time with APEX_cpu_step, which never does. Skipping
+ * must be exact, so the two runs must end in the same architectural state
+ * with the same statistics, skipped cycles aside, and the same CPI stack,
+ * having retired the same instructions with the same stalls before each.
+ *
+ * The fast-forwarded run also writes an interval series every
+ * CHECK_SERIES_CYCLES cycles. An interval ending in skipped cycles takes
+ * all of them, so its records are checked against the CPI stack of the
+ * stepped run at the cycles they start and end at.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+#define CHECK_MAX_CYCLES 1000000
+#define CHECK_SERIES_CYCLES 16
+
+static const int memory_latencies[] = {1, 2, 5, 100};
+static const int mul_latencies[] = {1, 3, 20};
+
+/* One of the two runs of a program, and what it retired */
+typedef struct Check_Run
+{
+    APEX_CPU *cpu;
+    APEX_RetireRecord *records;
+    int num_records;
+    int capacity;
+    APEX_CpiStack *stacks;      /* Stepped: at every clock from 0 */
+    int num_stacks;
+    int stack_capacity;
+    APEX_Series *series;        /* Fast-forwarded: the CSV series */
+    char *text;
+    size_t text_len;
+} Check_Run;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--data <file>] <input.asm>...\n",
+            prog);
+    exit(1);
+}
+
+static int *
+load_data(const char *path, int *count)
+{
+    int *words = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    size_t len;
+    char *text;
+
+    if (!words)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    *count = 0;
+    if (!path)
+    {
+        return words;
+    }
+
+    text = apex_read_file(path, &len);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    *count = APEX_parse_data(text, len, words, DATA_MEMORY_SIZE);
+    free(text);
+    if (*count < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", path);
+        exit(1);
+    }
+    return words;
+}
+
+static void *
+grow(void *data, size_t size)
+{
+    data = realloc(data, size);
+    if (!data)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    return data;
+}
+
+static void
+take_record(void *ctx, const APEX_RetireRecord *record)
+{
+    Check_Run *run = ctx;
+
+    if (run->num_records == run->capacity)
+    {
+        run->capacity = run->capacity ? 2 * run->capacity : 256;
+        run->records = grow(run->records,
+                            run->capacity * sizeof(APEX_RetireRecord));
+    }
+    run->records[run->num_records++] = *record;
+}
+
+static int
+take_text(void *ctx, const void *data, size_t len)
+{
+    Check_Run *run = ctx;
+
+    run->text = grow(run->text, run->text_len + len + 1);
+    memcpy(run->text + run->text_len, data, len);
+    run->text_len += len;
+    run->text[run->text_len] = '\0';
+    return 0;
+}
+
+static void
+start_run(Check_Run *run, APEX_Program *program, const APEX_Config *config,
+          const int *words, int count)
+{
+    memset(run, 0, sizeof(*run));
+    run->cpu = APEX_cpu_create(program, config);
+    if (!run->cpu || APEX_cpu_load_data(run->cpu, 0, words, count) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the pipeline model\n");
+        exit(1);
+    }
+    APEX_cpu_set_retire_fn(run->cpu, take_record, run);
+}
+
+static void
+finish_run(Check_Run *run)
+{
+    APEX_cpu_destroy(run->cpu);
+    if (run->series)
+    {
+        APEX_series_destroy(run->series);
+    }
+    free(run->records);
+    free(run->stacks);
+    free(run->text);
+}
+
+/* Reports a difference between the runs, returns 1 */
+static int
+differ(const char *what, unsigned long long run, unsigned long long step)
+{
+    printf("  %s: %llu when run, %llu when stepped\n", what, run, step);
+    return 1;
+}
+
+static int
+compare_state(const APEX_CPU *run, const APEX_CPU *step)
+{
+    const int *run_regs = APEX_cpu_get_regs(run);
+    const int *step_regs = APEX_cpu_get_regs(step);
+    const int *run_mem = APEX_cpu_get_data_memory(run);
+    const int *step_mem = APEX_cpu_get_data_memory(step);
+    int run_cc[3], step_cc[3];
+    int failed = 0;
+    int i;
+
+    if (APEX_cpu_get_status(run) != APEX_cpu_get_status(step))
+    {
+        failed |= differ("status", APEX_cpu_get_status(run),
+                         APEX_cpu_get_status(step));
+    }
+    if (APEX_cpu_get_clock(run) != APEX_cpu_get_clock(step))
+    {
+        failed |= differ("cycles", APEX_cpu_get_clock(run),
+                         APEX_cpu_get_clock(step));
+    }
+    if (APEX_cpu_get_retired(run) != APEX_cpu_get_retired(step))
+    {
+        failed |= differ("instructions", APEX_cpu_get_retired(run),
+                         APEX_cpu_get_retired(step));
+    }
+    if (APEX_cpu_get_pc(run) != APEX_cpu_get_pc(step))
+    {
+        failed |= differ("pc", APEX_cpu_get_pc(run), APEX_cpu_get_pc(step));
+    }
+    APEX_cpu_get_cc(run, &run_cc[0], &run_cc[1], &run_cc[2]);
+    APEX_cpu_get_cc(step, &step_cc[0], &step_cc[1], &step_cc[2]);
+    if (memcmp(run_cc, step_cc, sizeof(run_cc)) != 0)
+    {
+        failed |= differ("flags", run_cc[0] | run_cc[1] << 1 | run_cc[2] << 2,
+                         step_cc[0] | step_cc[1] << 1 | step_cc[2] << 2);
+    }
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (run_regs[i] != step_regs[i])
+        {
+            printf("  R%d: %d when run, %d when stepped\n", i, run_regs[i],
+                   step_regs[i]);
+            failed = 1;
+        }
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (run_mem[i] != step_mem[i])
+        {
+            printf("  [%d]: %d when run, %d when stepped\n", i, run_mem[i],
+                   step_mem[i]);
+            failed = 1;
+            break;
+        }
+    }
+    return failed;
+}
+
+static int
+compare_stats(const APEX_Stats *run, const APEX_Stats *step)
+{
+    int failed = 0;
+
+    if (run->execute_busy_cycles != step->execute_busy_cycles)
+    {
+        failed |= differ("execute_busy", run->execute_busy_cycles,
+                         step->execute_busy_cycles);
+    }
+    if (run->memory_busy_cycles != step->memory_busy_cycles)
+    {
+        failed |= differ("memory_busy", run->memory_busy_cycles,
+                         step->memory_busy_cycles);
+    }
+    if (run->structural_stalls != step->structural_stalls)
+    {
+        failed |= differ("structural_stalls", run->structural_stalls,
+                         step->structural_stalls);
+    }
+    if (run->data_stalls != step->data_stalls)
+    {
+        failed |= differ("data_stalls", run->data_stalls, step->data_stalls);
+    }
+    if (run->flushes != step->flushes)
+    {
+        failed |= differ("flushes", run->flushes, step->flushes);
+    }
+    return failed;
+}
+
+static int
+compare_cpi_stacks(const APEX_CpiStack *run, const APEX_CpiStack *step)
+{
+    char what[32];
+    int failed = 0;
+    int cause;
+
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        if (run->cycles[cause] != step->cycles[cause])
+        {
+            snprintf(what, sizeof(what), "cpi %s",
+                     APEX_cpi_cause_name(cause));
+            failed |= differ(what, run->cycles[cause], step->cycles[cause]);
+        }
+    }
+    return failed;
+}
+
+static int
+same_record(const APEX_RetireRecord *a, const APEX_RetireRecord *b)
+{
+    return a->cycle == b->cycle && a->pc == b->pc && a->opcode == b->opcode &&
+           a->rd == b->rd && a->rd_value == b->rd_value &&
+           a->mem_address == b->mem_address &&
+           a->mem_value == b->mem_value && a->flags == b->flags &&
+           memcmp(a->stalls, b->stalls, sizeof(a->stalls)) == 0;
+}
+
+/* Reports the first retirement the runs disagree on */
+static int
+compare_records(const Check_Run *run, const Check_Run *step)
+{
+    const APEX_RetireRecord *a, *b;
+    int i, cause;
+
+    for (i = 0; i < run->num_records && i < step->num_records; ++i)
+    {
+        a = &run->records[i];
+        b = &step->records[i];
+        if (same_record(a, b))
+        {
+            continue;
+        }
+        printf("  retirement %d: cycle %llu pc %d when run, "
+               "cycle %llu pc %d when stepped\n", i + 1,
+               (unsigned long long)a->cycle, a->pc,
+               (unsigned long long)b->cycle, b->pc);
+        for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+        {
+            if (a->stalls[cause] != b->stalls[cause])
+            {
+                printf("    %s stalls: %u when run, %u when stepped\n",
+                       APEX_cpi_cause_name(cause), a->stalls[cause],
+                       b->stalls[cause]);
+            }
+        }
+        return 1;
+    }
+    if (run->num_records != step->num_records)
+    {
+        return differ("retirements", run->num_records, step->num_records);
+    }
+    return 0;
+}
+
+/*
+ * Checks every record of the series of 'run' against the CPI stacks
+ * 'step' went through
+ */
+static int
+compare_series(const Check_Run *run, const Check_Run *step)
+{
+    const char *line = run->text ? strchr(run->text, '\n') : NULL;
+    unsigned long long interval, start, cycles, retired, count;
+    uint64_t expected;
+    char *end;
+    int cause;
+
+    for (; line && line[1]; line = strchr(line, '\n'))
+    {
+        interval = strtoull(line + 1, &end, 10);
+        start = strtoull(end + 1, &end, 10);
+        cycles = strtoull(end + 1, &end, 10);
+        retired = strtoull(end + 1, &end, 10);
+        strtod(end + 1, &end);
+        if (start + cycles >= (unsigned long long)step->num_stacks)
+        {
+            return differ("series end", start + cycles, step->num_stacks - 1);
+        }
+        for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+        {
+            count = strtoull(end + 1, &end, 10);
+            expected = step->stacks[start + cycles].cycles[cause] -
+                       step->stacks[start].cycles[cause];
+            if (count != expected)
+            {
+                printf("  interval %llu (cycles %llu to %llu, %llu retired): "
+                       "%s %llu when run, %llu when stepped\n", interval,
+                       start, start + cycles, retired,
+                       APEX_cpi_cause_name(cause), count,
+                       (unsigned long long)expected);
+                return 1;
+            }
+        }
+        line = end;
+    }
+    return 0;
+}
+
+/* Runs 'program' both ways under 'config', returns 1 if they differ */
+static int
+check_program(const char *path, APEX_Program *program,
+              const APEX_Config *config, const int *words, int count)
+{
+    Check_Run run, step;
+    int failed;
+
+    start_run(&run, program, config, words, count);
+    start_run(&step, program, config, words, count);
+
+    run.series = APEX_series_create(APEX_SERIES_CSV, APEX_SERIES_CYCLES,
+                                    CHECK_SERIES_CYCLES, take_text, &run);
+    if (!run.series)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    APEX_cpu_set_series(run.cpu, run.series);
+    APEX_cpu_run_until(run.cpu, NULL, NULL, CHECK_MAX_CYCLES);
+    APEX_cpu_set_series(run.cpu, NULL);
+    APEX_series_finish(run.series);
+
+    for (;;)
+    {
+        if (step.num_stacks == step.stack_capacity)
+        {
+            step.stack_capacity =
+                step.stack_capacity ? 2 * step.stack_capacity : 256;
+            step.stacks = grow(step.stacks,
+                               step.stack_capacity * sizeof(APEX_CpiStack));
+        }
+        step.stacks[step.num_stacks++] = *APEX_cpu_get_cpi_stack(step.cpu);
+        if (APEX_cpu_get_status(step.cpu) != APEX_STATUS_RUNNING ||
+            APEX_cpu_get_clock(step.cpu) >= CHECK_MAX_CYCLES)
+        {
+            break;
+        }
+        APEX_cpu_step(step.cpu, 1);
+    }
+
+    printf("APEX_Check: %s --mem-latency %d --mul-latency %d\n", path,
+           config->memory_latency, config->mul_latency);
+    failed = compare_state(run.cpu, step.cpu);
+    failed |= compare_stats(APEX_cpu_get_stats(run.cpu),
+                            APEX_cpu_get_stats(step.cpu));
+    failed |= compare_cpi_stacks(APEX_cpu_get_cpi_stack(run.cpu),
+                                 APEX_cpu_get_cpi_stack(step.cpu));
+    failed |= compare_records(&run, &step);
+    failed |= compare_series(&run, &step);
+
+    finish_run(&run);
+    finish_run(&step);
+    return failed;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    const char *data_file = NULL;
+    APEX_Config config;
+    int *words;
+    int count, i, mem, mul;
+    int checked = 0, failed = 0;
+
+    for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i)
+    {
+        if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+        {
+            data_file = argv[++i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+        }
+    }
+    if (i == argc)
+    {
+        print_usage(argv[0]);
+    }
+
+    words = load_data(data_file, &count);
+    for (; i < argc; ++i)
+    {
+        APEX_Program *program = apex_load_program(argv[i]);
+
+        if (!program)
+        {
+            fprintf(stderr, "APEX_Error: Unable to load %s\n", argv[i]);
+            exit(1);
+        }
+        for (mem = 0; mem < (int)(sizeof(memory_latencies) / sizeof(int));
+             ++mem)
+        {
+            for (mul = 0; mul < (int)(sizeof(mul_latencies) / sizeof(int));
+                 ++mul)
+            {
+                APEX_config_default(&config);
+                config.memory_latency = memory_latencies[mem];
+                config.mul_latency = mul_latencies[mul];
+                failed += check_program(argv[i], program, &config, words,
+                                        count);
+                checked++;
+            }
+        }
+        APEX_program_release(program);
+    }
+    free(words);
+
+    printf("APEX_Check: %d of %d runs differ when stepped\n", failed, checked);
+    return failed ? 1 : 0;
+}
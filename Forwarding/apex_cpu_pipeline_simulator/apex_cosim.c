@@ -0,0 +1,506 @@
+/*
+ * apex_cosim.c
+ * Contains lockstep co-simulation of the pipeline against the functional
+ * model, the golden reference of what every instruction does
+ *
+ * The functional model of apex_func.c starts from the data memory the run
+ * starts from and steps once for every instruction Writeback retires. In
+ * full mode each retirement is checked against its step: its pc against
+ * where the instruction before it went, then the register it wrote and the
+ * value, then the data address it accessed and the value it stored. An
+ * instruction the model faults on (DIV by zero, an address outside data
+ * memory) diverges as well. Once both have halted, their registers and
+ * data memory must be the same.
+ *
+ * In hash mode both sides fold the same fields into an FNV-1a hash, and
+ * the two hashes are compared every 'period' retirements and at the halt.
+ * A divergence is then only known to be somewhere in the interval; full
+ * mode finds the instruction.
+ *
+ * The first divergence stops the run with APEX_STATUS_DIVERGED, and the
+ * pipeline around it is logged on APEX_LOG_DIAG.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define HASH_INIT 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+struct APEX_Cosim
+{
+    int period;                 /* Retirements per hash check, 0 for none */
+    APEX_CosimReport report;
+    APEX_ArchState golden;
+    uint64_t actual_hash;       /* Of the retirements since the last check */
+    uint64_t expected_hash;
+    int stopped;                /* The divergence has stopped the run */
+};
+
+/*
+ * Creates a co-simulation that checks every retirement, or with a 'period'
+ * > 0 the state hash of every 'period' retirements. NULL if out of memory.
+ */
+APEX_Cosim *
+APEX_cosim_create(int period)
+{
+    APEX_Cosim *cosim = calloc(1, sizeof(APEX_Cosim));
+
+    if (cosim)
+    {
+        cosim->period = period > 0 ? period : 0;
+    }
+    return cosim;
+}
+
+void
+APEX_cosim_destroy(APEX_Cosim *cosim)
+{
+    free(cosim);
+}
+
+const APEX_CosimReport *
+APEX_cosim_report(const APEX_Cosim *cosim)
+{
+    return &cosim->report;
+}
+
+/* Called before the first cycle, once the data memory has been loaded */
+void
+apex_cosim_start(APEX_CPU *cpu)
+{
+    APEX_Cosim *cosim = cpu->cosim;
+
+    memset(&cosim->report, 0, sizeof(cosim->report));
+    cosim->report.first = 1;
+    cosim->stopped = FALSE;
+    cosim->actual_hash = HASH_INIT;
+    cosim->expected_hash = HASH_INIT;
+    APEX_func_init(&cosim->golden);
+    memcpy(cosim->golden.data_memory, cpu->data_memory,
+           sizeof(cosim->golden.data_memory));
+}
+
+static uint64_t
+fold(uint64_t hash, int value)
+{
+    return (hash ^ (uint32_t)value) * HASH_PRIME;
+}
+
+/*
+ * Folds what a retirement did into 'hash', the same fields full mode
+ * checks: the value loaded is that of the register
+ */
+static uint64_t
+fold_retirement(uint64_t hash, int pc, int rd, int rd_value, int address,
+                int store, int value)
+{
+    hash = fold(hash, pc);
+    hash = fold(hash, rd);
+    hash = fold(hash, rd >= 0 ? rd_value : 0);
+    hash = fold(hash, address);
+    return fold(hash, store ? value : 0);
+}
+
+static int
+is_store(int opcode)
+{
+    return opcode == OPCODE_STORE || opcode == OPCODE_STR;
+}
+
+/* Data address the model accessed, -1 if none */
+static int
+expected_address(const APEX_FuncEffect *effect)
+{
+    return effect->mem_address >= 0 ? effect->mem_address
+                                    : effect->load_address;
+}
+
+static int
+compare(const APEX_RetireRecord *actual, const APEX_FuncEffect *expected)
+{
+    if (actual->rd != expected->rd ||
+        (actual->rd >= 0 && actual->rd_value != expected->rd_value))
+    {
+        return APEX_COSIM_REGISTER;
+    }
+    if (actual->mem_address != expected_address(expected) ||
+        (is_store(actual->opcode) && actual->mem_value != expected->mem_value))
+    {
+        return APEX_COSIM_MEMORY;
+    }
+    return APEX_COSIM_NONE;
+}
+
+/* Notes the first divergence, found at the clock 'cycle' */
+static void
+diverge(APEX_CPU *cpu, int mismatch, int cycle)
+{
+    APEX_CosimReport *report = &cpu->cosim->report;
+    int pc = report->actual.pc;
+    int index = (pc - 4000) / 4;
+
+    report->mismatch = mismatch;
+    report->cycle = cycle;
+    report->insn[0] = '\0';
+    if (pc >= 4000 && (pc - 4000) % 4 == 0 && index < cpu->code_memory_size)
+    {
+        snprintf(report->insn, sizeof(report->insn), "%.*s",
+                 (int)sizeof(report->insn) - 1,
+                 cpu->code_memory[index].opcode_str);
+    }
+}
+
+/* Called by Writeback for every instruction a co-simulated instance retires */
+void
+apex_cosim_retire(APEX_CPU *cpu)
+{
+    APEX_Cosim *cosim = cpu->cosim;
+    APEX_CosimReport *report = &cosim->report;
+    APEX_ArchState *golden = &cosim->golden;
+    int running = golden->status == APEX_STATUS_RUNNING;
+    int mismatch = APEX_COSIM_NONE;
+
+    if (report->mismatch)
+    {
+        return;
+    }
+
+    apex_retire_fill(cpu, &report->actual);
+    APEX_func_step(golden, cpu->program, &report->expected);
+    report->checked++;
+    report->retirement = report->checked;
+    if (!cosim->period)
+    {
+        report->first = report->checked;
+    }
+
+    if (!running)
+    {
+        mismatch = APEX_COSIM_PAST_HALT;
+    }
+    else if (cosim->period)
+    {
+        /* Faults have no effect to hash, they diverge straight away */
+        if (golden->status == APEX_STATUS_FAULT)
+        {
+            mismatch = APEX_COSIM_FAULT;
+        }
+        else
+        {
+            const APEX_RetireRecord *actual = &report->actual;
+            const APEX_FuncEffect *expected = &report->expected;
+
+            cosim->actual_hash = fold_retirement(
+                cosim->actual_hash, actual->pc, actual->rd, actual->rd_value,
+                actual->mem_address, is_store(actual->opcode),
+                actual->mem_value);
+            cosim->expected_hash = fold_retirement(
+                cosim->expected_hash, expected->pc, expected->rd,
+                expected->rd_value, expected_address(expected),
+                is_store(expected->opcode), expected->mem_value);
+            if (report->checked - report->first + 1 ==
+                (uint64_t)cosim->period)
+            {
+                if (cosim->actual_hash != cosim->expected_hash)
+                {
+                    mismatch = APEX_COSIM_HASH;
+                    report->actual_hash = cosim->actual_hash;
+                    report->expected_hash = cosim->expected_hash;
+                }
+                else
+                {
+                    report->first = report->checked + 1;
+                    cosim->actual_hash = HASH_INIT;
+                    cosim->expected_hash = HASH_INIT;
+                }
+            }
+        }
+    }
+    else if (report->actual.pc != report->expected.pc)
+    {
+        mismatch = APEX_COSIM_PC;
+    }
+    else if (golden->status == APEX_STATUS_FAULT)
+    {
+        mismatch = APEX_COSIM_FAULT;
+    }
+    else
+    {
+        mismatch = compare(&report->actual, &report->expected);
+    }
+
+    if (mismatch)
+    {
+        diverge(cpu, mismatch, (int)report->actual.cycle);
+    }
+}
+
+/* Checks the hashes of the retirements since the last check */
+static int
+check_interval(APEX_Cosim *cosim)
+{
+    APEX_CosimReport *report = &cosim->report;
+
+    if (cosim->actual_hash == cosim->expected_hash)
+    {
+        return APEX_COSIM_NONE;
+    }
+    report->actual_hash = cosim->actual_hash;
+    report->expected_hash = cosim->expected_hash;
+    return APEX_COSIM_HASH;
+}
+
+/*
+ * Checks the state both sides halted in: whether the model halted too,
+ * then registers and data memory
+ */
+static int
+check_halt(APEX_CPU *cpu)
+{
+    APEX_Cosim *cosim = cpu->cosim;
+    APEX_CosimReport *report = &cosim->report;
+    APEX_ArchState *golden = &cosim->golden;
+    int i;
+
+    if (golden->status != APEX_STATUS_HALTED)
+    {
+        report->expected.pc = golden->pc;
+        return APEX_COSIM_NO_HALT;
+    }
+
+    report->first = report->checked + 1;
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (cpu->regs[i] != golden->regs[i])
+        {
+            report->actual.rd = report->expected.rd = i;
+            report->actual.rd_value = cpu->regs[i];
+            report->expected.rd_value = golden->regs[i];
+            return APEX_COSIM_REG_FILE;
+        }
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (cpu->data_memory[i] != golden->data_memory[i])
+        {
+            report->actual.mem_address = report->expected.mem_address = i;
+            report->actual.mem_value = cpu->data_memory[i];
+            report->expected.mem_value = golden->data_memory[i];
+            return APEX_COSIM_DATA_MEMORY;
+        }
+    }
+    return APEX_COSIM_NONE;
+}
+
+/*
+ * Called after every cycle of a co-simulated instance. Once the run has
+ * stopped, the last hash interval is checked, then the state it halted in.
+ * Returns TRUE once, after the cycle the first divergence was found in.
+ */
+int
+apex_cosim_check(APEX_CPU *cpu)
+{
+    APEX_Cosim *cosim = cpu->cosim;
+    int mismatch = APEX_COSIM_NONE;
+
+    if (!cosim->report.mismatch && cpu->status != APEX_STATUS_RUNNING)
+    {
+        if (cosim->period)
+        {
+            mismatch = check_interval(cosim);
+        }
+        if (!mismatch && cpu->status == APEX_STATUS_HALTED)
+        {
+            mismatch = check_halt(cpu);
+        }
+        if (mismatch)
+        {
+            diverge(cpu, mismatch, cpu->clock);
+        }
+    }
+    if (!cosim->report.mismatch || cosim->stopped)
+    {
+        return FALSE;
+    }
+    cosim->stopped = TRUE;
+    return TRUE;
+}
+
+/*
+ * Checks every instruction 'cpu' retires against 'cosim', whose functional
+ * model starts from the data memory 'cpu' has on its first cycle. NULL
+ * stops it, checking the hash of the retirements since the last check, as
+ * do APEX_cpu_reset and APEX_cpu_resume without that, the model having no
+ * state for the cycle a run resumes at. Returns -1 if 'cpu' has already
+ * run.
+ */
+int
+APEX_cpu_set_cosim(APEX_CPU *cpu, APEX_Cosim *cosim)
+{
+    /* A run stopped short of its end has an interval left unchecked */
+    if (cpu->cosim && cpu->cosim->period && !cpu->cosim->report.mismatch &&
+        cpu->clock != 0 && check_interval(cpu->cosim))
+    {
+        diverge(cpu, APEX_COSIM_HASH, cpu->clock);
+    }
+    cpu->cosim = NULL;
+    if (!cosim)
+    {
+        return 0;
+    }
+    if (cpu->clock != 0)
+    {
+        return -1;
+    }
+    cpu->cosim = cosim;
+    return 0;
+}
+
+/* snprintf at the end of what has been written so far */
+#define APPEND(buf, size, len, ...)                                            \
+    ((len) += snprintf((len) < (size) ? (buf) + (len) : NULL,                  \
+                       (len) < (size) ? (size) - (len) : 0, __VA_ARGS__))
+
+/* What was written to a register, or "no register" */
+static void
+append_write(char *buf, size_t size, size_t *len, int rd, int value)
+{
+    if (rd >= 0)
+    {
+        APPEND(buf, size, *len, "R%d = %d", rd, value);
+    }
+    else
+    {
+        APPEND(buf, size, *len, "no register");
+    }
+}
+
+/* The data access, or "no access" */
+static void
+append_access(char *buf, size_t size, size_t *len, int address, int store,
+              int value)
+{
+    if (address < 0)
+    {
+        APPEND(buf, size, *len, "no access");
+    }
+    else if (store)
+    {
+        APPEND(buf, size, *len, "%d to [%d]", value, address);
+    }
+    else
+    {
+        APPEND(buf, size, *len, "a load from [%d]", address);
+    }
+}
+
+/*
+ * Writes the report as one line into 'buf', without a newline. Returns the
+ * length of the whole line, like snprintf.
+ */
+int
+APEX_cosim_describe(const APEX_Cosim *cosim, char *buf, size_t size)
+{
+    const APEX_CosimReport *report = &cosim->report;
+    const APEX_RetireRecord *actual = &report->actual;
+    const APEX_FuncEffect *expected = &report->expected;
+    size_t len = 0;
+
+    if (buf && size)
+    {
+        buf[0] = '\0';
+    }
+    switch (report->mismatch)
+    {
+        case APEX_COSIM_NONE:
+            APPEND(buf, size, len,
+                   "%llu retirements match the functional model",
+                   (unsigned long long)report->checked);
+            return len;
+
+        case APEX_COSIM_REG_FILE:
+        case APEX_COSIM_DATA_MEMORY:
+        case APEX_COSIM_NO_HALT:
+            APPEND(buf, size, len, "at the halt, cycle %d: ", report->cycle);
+            break;
+
+        case APEX_COSIM_HASH:
+            APPEND(buf, size, len, "retirements %llu-%llu, cycle %d: ",
+                   (unsigned long long)report->first,
+                   (unsigned long long)report->retirement, report->cycle);
+            break;
+
+        default:
+            APPEND(buf, size, len, "retirement %llu, cycle %d: pc(%d) %s ",
+                   (unsigned long long)report->retirement, report->cycle,
+                   actual->pc, report->insn[0] ? report->insn : "?");
+            break;
+    }
+
+    switch (report->mismatch)
+    {
+        case APEX_COSIM_PC:
+            APPEND(buf, size, len, "retired where the functional model is "
+                                   "at pc(%d)",
+                   expected->pc);
+            break;
+
+        case APEX_COSIM_FAULT:
+            APPEND(buf, size, len, "retired, the functional model faults "
+                                   "on it");
+            break;
+
+        case APEX_COSIM_REGISTER:
+            APPEND(buf, size, len, "wrote ");
+            append_write(buf, size, &len, actual->rd, actual->rd_value);
+            APPEND(buf, size, len, ", the functional model ");
+            append_write(buf, size, &len, expected->rd, expected->rd_value);
+            break;
+
+        case APEX_COSIM_MEMORY:
+            APPEND(buf, size, len, "made ");
+            append_access(buf, size, &len, actual->mem_address,
+                          is_store(actual->opcode), actual->mem_value);
+            APPEND(buf, size, len, ", the functional model ");
+            append_access(buf, size, &len, expected_address(expected),
+                          is_store(expected->opcode), expected->mem_value);
+            break;
+
+        case APEX_COSIM_PAST_HALT:
+            APPEND(buf, size, len, "retired after the functional model "
+                                   "halted");
+            break;
+
+        case APEX_COSIM_NO_HALT:
+            APPEND(buf, size, len, "the functional model is still at "
+                                   "pc(%d)",
+                   expected->pc);
+            break;
+
+        case APEX_COSIM_REG_FILE:
+            APPEND(buf, size, len, "R%d = %d, the functional model %d",
+                   actual->rd, actual->rd_value, expected->rd_value);
+            break;
+
+        case APEX_COSIM_DATA_MEMORY:
+            APPEND(buf, size, len, "[%d] = %d, the functional model %d",
+                   actual->mem_address, actual->mem_value,
+                   expected->mem_value);
+            break;
+
+        case APEX_COSIM_HASH:
+            APPEND(buf, size, len, "state hash %016llx, the functional "
+                                   "model %016llx",
+                   (unsigned long long)report->actual_hash,
+                   (unsigned long long)report->expected_hash);
+            break;
+    }
+    return len;
+}
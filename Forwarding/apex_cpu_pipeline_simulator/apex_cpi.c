@@ -0,0 +1,207 @@
+/*
+ * apex_cpi.c
+ * Contains the CPI stack, every cycle of a run charged to one cause
+ *
+ * A cycle that retires an instruction is a base cycle. Any other cycle is
+ * charged to the bubble Writeback found in its latch, and every bubble is
+ * labelled with a cause when it appears: a stage left empty at the end of
+ * a cycle either had its instruction squashed by a taken branch, or got
+ * nothing from the stage above because that stage was held (a load-use
+ * hazard in Decode, a multi-cycle MUL or memory access, a full latch), or
+ * because that stage was empty itself, in which case the bubble moves
+ * down with its label. Decode is labelled after what Fetch failed to
+ * deliver. Once a HALT has stopped fetch, cycles retiring nothing are the
+ * pipeline draining behind it. Skipped idle cycles repeat the cycle before
+ * them, bubbles still moving down one stage a cycle, and are charged one
+ * by one as if stepped, so the causes always add up to the clock.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+static const char *const cause_names[APEX_CPI_CAUSES] = {
+    "base", "data", "branch", "fetch", "halt", "structural", "mul", "memory"};
+
+const char *
+APEX_cpi_cause_name(int cause)
+{
+    return cause >= 0 && cause < APEX_CPI_CAUSES ? cause_names[cause] : "";
+}
+
+const APEX_CpiStack *
+APEX_cpu_get_cpi_stack(const APEX_CPU *cpu)
+{
+    return &cpu->cpi;
+}
+
+static int
+stage_occupancy(const APEX_CPU *cpu)
+{
+    return (cpu->decode.has_insn << APEX_STAGE_DECODE) |
+           (cpu->execute.has_insn << APEX_STAGE_EXECUTE) |
+           (cpu->memory1.has_insn << APEX_STAGE_MEMORY1) |
+           (cpu->memory.has_insn << APEX_STAGE_MEMORY) |
+           (cpu->writeback.has_insn << APEX_STAGE_WRITEBACK);
+}
+
+/* Why the instruction in 'stage' did not move down during the cycle */
+int
+apex_cpi_held_cause(const APEX_CPU *cpu, const APEX_Stats *before, int stage)
+{
+    if (stage == APEX_STAGE_DECODE &&
+        cpu->stats.data_stalls != before->data_stalls)
+    {
+        return APEX_CPI_DATA;
+    }
+    if (cpu->stats.memory_busy_cycles != before->memory_busy_cycles)
+    {
+        return APEX_CPI_MEMORY;
+    }
+    if (stage <= APEX_STAGE_EXECUTE &&
+        cpu->stats.execute_busy_cycles != before->execute_busy_cycles)
+    {
+        return APEX_CPI_MUL;
+    }
+    return APEX_CPI_STRUCTURAL;
+}
+
+/* Why Fetch left Decode empty */
+static int
+fetch_cause(const APEX_CPU *cpu)
+{
+    if (cpu->branch_pending || cpu->redirect_pc >= 0)
+    {
+        return APEX_CPI_BRANCH;
+    }
+    if (cpu->halt_pending)
+    {
+        return APEX_CPI_HALT;
+    }
+    return APEX_CPI_FETCH;
+}
+
+/*
+ * Labels the bubbles a cycle left, given the stages that held an
+ * instruction before and after it. Returns TRUE if a label changed.
+ */
+static int
+label_bubbles(APEX_CPU *cpu, const APEX_Stats *before, int was_occupied,
+              int occupied)
+{
+    unsigned char labels[APEX_NUM_STAGES];
+    int stage, changed;
+
+    labels[APEX_STAGE_FETCH] = APEX_CPI_FETCH;
+    labels[APEX_STAGE_DECODE] = fetch_cause(cpu);
+    for (stage = APEX_STAGE_EXECUTE; stage < APEX_NUM_STAGES; ++stage)
+    {
+        int above = 1 << (stage - 1);
+
+        if (stage == APEX_STAGE_EXECUTE &&
+            (cpu->branch_pending || cpu->redirect_pc >= 0))
+        {
+            labels[stage] = APEX_CPI_BRANCH;
+        }
+        else if ((was_occupied & above) && (occupied & above))
+        {
+            labels[stage] = apex_cpi_held_cause(cpu, before, stage - 1);
+        }
+        else
+        {
+            labels[stage] = cpu->cpi_bubble[stage - 1];
+        }
+    }
+
+    changed = memcmp(cpu->cpi_bubble, labels, sizeof(labels)) != 0;
+    memcpy(cpu->cpi_bubble, labels, sizeof(labels));
+    return changed;
+}
+
+/*
+ * Called after every advance, with the clock, statistics and retirements
+ * from before it: charges the cycles to their cause and labels the
+ * bubbles each cycle left. Only the first cycle of an advance can retire;
+ * the idle cycles skipped after it repeat it, nothing moving but the
+ * bubbles, until their labels settle and every further cycle is charged
+ * to the same cause.
+ */
+void
+apex_cpi_cycle(APEX_CPU *cpu, const APEX_Stats *before, int start_clock,
+               int start_retired)
+{
+    int occupied = stage_occupancy(cpu);
+    int was_occupied = cpu->cpi_occupied;
+    int cycles = cpu->clock - start_clock;
+    int cause;
+
+    while (cycles > 0)
+    {
+        if (cpu->insn_completed != start_retired)
+        {
+            cause = APEX_CPI_BASE;
+            start_retired = cpu->insn_completed;
+        }
+        else if (cpu->halt_pending)
+        {
+            cause = APEX_CPI_HALT;
+        }
+        else
+        {
+            cause = cpu->cpi_bubble[APEX_STAGE_WRITEBACK];
+        }
+        cpu->cpi.cycles[cause]++;
+        cycles--;
+
+        if (!label_bubbles(cpu, before, was_occupied, occupied) &&
+            was_occupied == occupied && cause != APEX_CPI_BASE)
+        {
+            cpu->cpi.cycles[cause] += cycles;
+            break;
+        }
+        was_occupied = occupied;
+    }
+    cpu->cpi_occupied = occupied;
+}
+
+/*
+ * Writes 'stack' as a JSON object into 'buf', with the cycles and CPI of
+ * each cause. Returns the length of the object, which was cut short if it
+ * is 'size' or more.
+ */
+int
+APEX_cpi_stack_json(const APEX_CpiStack *stack, char *buf, size_t size)
+{
+    uint64_t instructions = stack->cycles[APEX_CPI_BASE];
+    uint64_t cycles = 0;
+    size_t len;
+    int cause;
+
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        cycles += stack->cycles[cause];
+    }
+
+    len = snprintf(buf, size,
+                   "{\"cycles\": %llu, \"instructions\": %llu, \"cpi\": %.6f, "
+                   "\"stack\": {",
+                   (unsigned long long)cycles,
+                   (unsigned long long)instructions,
+                   instructions ? (double)cycles / instructions : 0.0);
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        len += snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0,
+                        "%s\"%s\": {\"cycles\": %llu, \"cpi\": %.6f}",
+                        cause ? ", " : "", cause_names[cause],
+                        (unsigned long long)stack->cycles[cause],
+                        instructions ? (double)stack->cycles[cause] / instructions
+                                     : 0.0);
+    }
+    len += snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0,
+                    "}}");
+    return len;
+}
@@ -9,25 +9,11 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include "apex.h"
 #include "apex_macros.h"
+#include "apex_event.h"
 #include <stdbool.h>
 
-/* Format of an APEX instruction  */
-typedef struct APEX_Instruction
-{
-    char opcode_str[128];
-    int opcode;
-    int rd;
-    int rs1;
-    int rs2;
-    int rs3;
-    int imm;
-    int N;
-    int P;
-    int Z;
-    int cc;
-} APEX_Instruction;
-
 /* Model of CPU stage latch */
 typedef struct CPU_Stage
 {
@@ -57,6 +43,13 @@ typedef struct CPU_Stage
     
     int branch_target;
     bool branch_pending;
+
+    bool in_progress;   /* A multi-cycle operation has started in this stage */
+    int ready_cycle;    /* Cycle on which that operation completes */
+    int flags;          /* APEX_FLAG_* once Execute is done with it */
+    uint64_t seq;       /* Sequence number, in fetch order from 0 */
+    int stage_cycle[APEX_NUM_STAGES]; /* Clock it entered each stage on */
+    int next_pc;        /* Pc Fetch went on to after it */
 } CPU_Stage;
 
 typedef struct {
@@ -65,9 +58,17 @@ typedef struct {
     int p;  // Positive flag
 }ConditionCodes;
 
+/* Parsed program, shared read-only by every instance running it */
+struct APEX_Program
+{
+    int size;                      /* Number of instructions */
+    APEX_Instruction *code;
+    int refs;                      /* Reference count, updated atomically */
+};
+
 
 /* Model of APEX CPU */
-typedef struct APEX_CPU
+struct APEX_CPU
 {
     int pc;                  /* Current program counter */
     int clock;                     /* Clock cycles elapsed */
@@ -75,8 +76,7 @@ typedef struct APEX_CPU
     int regs[REG_FILE_SIZE];       /* Integer register file */
     int code_memory_size;          /* Number of instruction in the input file */
     APEX_Instruction *code_memory; /* Code Memory */
-    int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
-    int single_step;               /* Wait for user input after every cycle */
+    int *data_memory;              /* Data Memory, a private mapping */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int fetch_from_next_cycle;
     bool stall;
@@ -99,13 +99,74 @@ typedef struct APEX_CPU
     CPU_Stage memory1;
     CPU_Stage memory;
     CPU_Stage writeback;
-} APEX_CPU;
 
-APEX_Instruction *create_code_memory(const char *filename, int *size);
-APEX_CPU *APEX_cpu_init(const char *filename);
-void APEX_cpu_run(APEX_CPU *cpu);
-void APEX_cpu_stop(APEX_CPU *cpu);
-void SetMem(APEX_CPU *cpu, const char *filename);
+    APEX_Config config;
+    APEX_Stats stats;
+    APEX_EventWheel events;        /* Completion cycles of multi-cycle ops */
+    int progress;                  /* Some latch moved during this cycle */
+
+    int last_retire_cycle;         /* Cycle of the most recent retirement */
+    int retired_count;             /* Entries written to retired_pcs */
+    int retired_pcs[RETIRED_PC_HISTORY]; /* Ring of the last retired PCs */
+    int watchdog_reason;           /* Non-zero once the watchdog tripped */
+
+    APEX_Program *program;         /* Owner of code_memory */
+    int status;                    /* APEX_STATUS_* */
+    APEX_LogFn log_fn;             /* Sink for all output, may be NULL */
+    void *log_ctx;
+    APEX_Recording *recording;     /* Reference run being recorded, or NULL */
+    APEX_RetireWriter *retire_trace; /* Receives every retirement, or NULL */
+    APEX_RetireFn retire_fn;       /* Is handed every retirement, or NULL */
+    void *retire_ctx;
+    uint64_t retire_cpi[APEX_CPI_CAUSES]; /* CPI stack at the last one */
+    APEX_Stream *stream;           /* Receives every cycle, or NULL */
+    int forwards;                  /* APEX_FORWARD_* used this cycle */
+    int redirect_pc;               /* Fetch redirected this cycle, or -1 */
+    uint64_t next_seq;             /* Sequence number of the next fetch */
+    APEX_Monitor *monitor;         /* Publishes the counters, or NULL */
+    int monitor_due;               /* Clock of the next publication */
+    APEX_CpiStack cpi;             /* Cycles so far by cause */
+    int cpi_occupied;              /* Stages holding an instruction, by bit */
+    unsigned char cpi_bubble[APEX_NUM_STAGES]; /* Cause of each empty latch */
+    APEX_Profile *profile;         /* Cost of every instruction, or NULL */
+    APEX_PipeView *pipeview;       /* Shows every cycle, or NULL */
+    APEX_Latencies latencies;      /* Of the instructions retired so far */
+    APEX_Series *series;           /* Statistics of every interval, or NULL */
+    APEX_MemTrace *memtrace;       /* Analyses every data access, or NULL */
+    APEX_Dataflow *dataflow;       /* Analyses every retirement, or NULL */
+    APEX_ArchState *oracle;        /* Path of zero-penalty branches, or NULL */
+    APEX_Cosim *cosim;             /* Checks every retirement, or NULL */
+};
+
 void Initialize(APEX_CPU *cpu);
-void APEX_cpu_simulate(APEX_CPU *cpu, int num_cycles);
+int get_code_memory_index_from_pc(const int pc);
+int apex_operands_valid(const APEX_Instruction *insn);
+int *apex_memory_map(int *memory, const APEX_Image *image);
+void apex_memory_unmap(int *memory);
+void apex_record_access(APEX_CPU *cpu, int address);
+void apex_record_cycle(APEX_CPU *cpu);
+void apex_retire_fill(const APEX_CPU *cpu, APEX_RetireRecord *record);
+void apex_retire_record(APEX_CPU *cpu);
+void apex_stream_cycle(APEX_CPU *cpu, const APEX_Stats *before);
+void apex_monitor_publish(APEX_CPU *cpu);
+int apex_monitor_snapshot_requested(const APEX_Monitor *monitor);
+void apex_log_snapshot(const APEX_CPU *cpu);
+void apex_cpi_cycle(APEX_CPU *cpu, const APEX_Stats *before, int start_clock,
+                    int start_retired);
+int apex_cpi_held_cause(const APEX_CPU *cpu, const APEX_Stats *before, int stage);
+void apex_profile_retire(APEX_CPU *cpu);
+void apex_profile_cycle(APEX_CPU *cpu, const APEX_Stats *before);
+void apex_pipeview_cycle(APEX_CPU *cpu, const APEX_Stats *before,
+                         int start_clock, int start_retired);
+void apex_latency_retire(APEX_CPU *cpu);
+void apex_series_cycle(APEX_CPU *cpu, int start_clock);
+void apex_memtrace_access(APEX_CPU *cpu, int address, int write);
+void apex_dataflow_retire(APEX_CPU *cpu);
+int apex_ideal_reset(APEX_CPU *cpu, APEX_ArchState *oracle);
+int apex_ideal_next_pc(APEX_CPU *cpu, int pc);
+void apex_ideal_resolve(APEX_CPU *cpu, int decode_valid, int fetch_held);
+void apex_cosim_start(APEX_CPU *cpu);
+void apex_cosim_retire(APEX_CPU *cpu);
+int apex_cosim_check(APEX_CPU *cpu);
+void apex_histogram_add(APEX_Histogram *hist, uint64_t value);
 #endif
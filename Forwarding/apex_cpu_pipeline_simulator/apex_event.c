@@ -0,0 +1,181 @@
+/*
+ * apex_event.c
+ * Contains the timing-wheel event queue used to skip idle pipeline cycles
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <string.h>
+
+#include "apex_event.h"
+
+#define EVENT_SLOT_MASK (EVENT_WHEEL_SLOTS - 1)
+
+static void
+clear_slot(APEX_EventWheel *wheel, int slot)
+{
+    wheel->pending -= wheel->slot_count[slot];
+    wheel->slot_count[slot] = 0;
+    wheel->slot_kinds[slot] = 0;
+    wheel->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+}
+
+static void
+insert_slot(APEX_EventWheel *wheel, int cycle, int kind)
+{
+    int slot = cycle & EVENT_SLOT_MASK;
+
+    wheel->slot_count[slot]++;
+    wheel->slot_kinds[slot] |= kind;
+    wheel->occupied[slot >> 6] |= 1ULL << (slot & 63);
+    wheel->pending++;
+}
+
+/*
+ * Moves the cursor up to 'now', dropping events of the cycles passed over
+ * and pulling overflow events that are now within the horizon into slots
+ */
+static void
+advance_to(APEX_EventWheel *wheel, int now)
+{
+    int i;
+
+    if (now <= wheel->now)
+    {
+        return;
+    }
+
+    if (now - wheel->now >= EVENT_WHEEL_SLOTS)
+    {
+        for (i = 0; i < EVENT_WHEEL_SLOTS; ++i)
+        {
+            clear_slot(wheel, i);
+        }
+    }
+    else
+    {
+        for (i = wheel->now; i < now; ++i)
+        {
+            clear_slot(wheel, i & EVENT_SLOT_MASK);
+        }
+    }
+    wheel->now = now;
+
+    i = 0;
+    while (i < wheel->overflow_size)
+    {
+        int cycle = wheel->overflow_cycle[i];
+
+        if (cycle < now || cycle - now < EVENT_WHEEL_SLOTS)
+        {
+            if (cycle >= now)
+            {
+                insert_slot(wheel, cycle, wheel->overflow_kind[i]);
+            }
+            wheel->overflow_size--;
+            wheel->overflow_cycle[i] = wheel->overflow_cycle[wheel->overflow_size];
+            wheel->overflow_kind[i] = wheel->overflow_kind[wheel->overflow_size];
+            continue;
+        }
+        i++;
+    }
+}
+
+void
+apex_event_init(APEX_EventWheel *wheel, int now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+/*
+ * Schedules an event of the given kind on 'cycle'. Returns 0 on success and
+ * -1 if the overflow list is full.
+ */
+int
+apex_event_schedule(APEX_EventWheel *wheel, int cycle, int kind)
+{
+    if (cycle < wheel->now)
+    {
+        cycle = wheel->now;
+    }
+
+    if (cycle - wheel->now >= EVENT_WHEEL_SLOTS)
+    {
+        if (wheel->overflow_size == EVENT_OVERFLOW_SIZE)
+        {
+            return -1;
+        }
+        wheel->overflow_cycle[wheel->overflow_size] = cycle;
+        wheel->overflow_kind[wheel->overflow_size] = kind;
+        wheel->overflow_size++;
+        return 0;
+    }
+
+    insert_slot(wheel, cycle, kind);
+    return 0;
+}
+
+/*
+ * Returns the earliest cycle >= now that has an event scheduled, or -1 when
+ * the wheel is empty. The kinds of the events on that cycle are stored in
+ * 'kinds' if it is not NULL.
+ */
+int
+apex_event_next(APEX_EventWheel *wheel, int now, int *kinds)
+{
+    int start, word, i, best = -1, best_kinds = 0;
+
+    advance_to(wheel, now);
+
+    if (wheel->pending)
+    {
+        start = now & EVENT_SLOT_MASK;
+        word = start >> 6;
+
+        /* The start word is visited twice: high bits first, low bits on wrap */
+        for (i = 0; i <= EVENT_WHEEL_WORDS; ++i)
+        {
+            int w = (word + i) % EVENT_WHEEL_WORDS;
+            uint64_t bits = wheel->occupied[w];
+
+            if (i == 0)
+            {
+                bits &= ~0ULL << (start & 63);
+            }
+            else if (i == EVENT_WHEEL_WORDS)
+            {
+                bits &= (1ULL << (start & 63)) - 1;
+            }
+
+            if (bits)
+            {
+                int slot = (w << 6) + __builtin_ctzll(bits);
+
+                best = now + ((slot - start) & EVENT_SLOT_MASK);
+                best_kinds = wheel->slot_kinds[slot];
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < wheel->overflow_size; ++i)
+    {
+        if (best == -1 || wheel->overflow_cycle[i] < best)
+        {
+            best = wheel->overflow_cycle[i];
+            best_kinds = wheel->overflow_kind[i];
+        }
+        else if (wheel->overflow_cycle[i] == best)
+        {
+            best_kinds |= wheel->overflow_kind[i];
+        }
+    }
+
+    if (kinds)
+    {
+        *kinds = best_kinds;
+    }
+    return best;
+}
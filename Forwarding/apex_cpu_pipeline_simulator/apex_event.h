@@ -0,0 +1,45 @@
+/*
+ * apex_event.h
+ * Contains the timing-wheel event queue used to skip idle pipeline cycles
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_EVENT_H_
+#define _APEX_EVENT_H_
+
+#include <stdint.h>
+
+/* Number of slots in the wheel, must be a power of two */
+#define EVENT_WHEEL_SLOTS 256
+#define EVENT_WHEEL_WORDS (EVENT_WHEEL_SLOTS / 64)
+
+/* Events that are further away than the wheel horizon wait here */
+#define EVENT_OVERFLOW_SIZE 64
+
+/* Kinds of timed events, used as bits in a slot mask */
+#define EVENT_EXECUTE_DONE 0x1
+#define EVENT_MEMORY_DONE 0x2
+
+/*
+ * Each slot holds the events that fire on one cycle. Slot i covers cycle
+ * (base + ((i - base) mod EVENT_WHEEL_SLOTS)), so a cycle owns a slot only
+ * while it is within EVENT_WHEEL_SLOTS of the cursor.
+ */
+typedef struct APEX_EventWheel
+{
+    int now;                                  /* Cursor, earliest live cycle */
+    int pending;                              /* Events in the wheel proper */
+    uint64_t occupied[EVENT_WHEEL_WORDS];     /* One bit per non-empty slot */
+    int slot_count[EVENT_WHEEL_SLOTS];
+    int slot_kinds[EVENT_WHEEL_SLOTS];
+    int overflow_size;
+    int overflow_cycle[EVENT_OVERFLOW_SIZE];
+    int overflow_kind[EVENT_OVERFLOW_SIZE];
+} APEX_EventWheel;
+
+void apex_event_init(APEX_EventWheel *wheel, int now);
+int apex_event_schedule(APEX_EventWheel *wheel, int cycle, int kind);
+int apex_event_next(APEX_EventWheel *wheel, int now, int *kinds);
+#endif
@@ -0,0 +1,366 @@
+/*
+ * apex_func.c
+ * Contains the ISA-level functional model of APEX, one instruction per step
+ *
+ * The model executes the architectural semantics directly, without a
+ * pipeline: no timing, no forwarding, no stalls. It is the reference the
+ * batched lanes engine must agree with, lane by lane.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <string.h>
+
+#include "apex_cpu.h"
+
+void
+APEX_func_init(APEX_ArchState *state)
+{
+    memset(state, 0, sizeof(APEX_ArchState));
+    state->pc = 4000;
+    state->status = APEX_STATUS_RUNNING;
+}
+
+static int
+valid_reg(int reg)
+{
+    return reg >= 0 && reg < REG_FILE_SIZE;
+}
+
+/*
+ * Registers an instruction names must exist, unused fields are -1. Shared
+ * with the lanes engine, which checks every instruction once up front.
+ */
+int
+apex_operands_valid(const APEX_Instruction *insn)
+{
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_LDR:
+            return valid_reg(insn->rd) && valid_reg(insn->rs1) &&
+                   valid_reg(insn->rs2);
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+        case OPCODE_JALR:
+            return valid_reg(insn->rd) && valid_reg(insn->rs1);
+        case OPCODE_MOVC:
+            return valid_reg(insn->rd);
+        case OPCODE_STORE:
+        case OPCODE_CMP:
+            return valid_reg(insn->rs1) && valid_reg(insn->rs2);
+        case OPCODE_STR:
+            return valid_reg(insn->rs1) && valid_reg(insn->rs2) &&
+                   valid_reg(insn->rs3);
+        case OPCODE_CML:
+        case OPCODE_JUMP:
+            return valid_reg(insn->rs1);
+    }
+    return TRUE;
+}
+
+static void
+set_flags(APEX_ArchState *state, int result)
+{
+    state->z = result == 0;
+    state->n = result < 0;
+    state->p = result > 0;
+}
+
+/* Arithmetic wraps at 32 bits, as the hardware would */
+static int
+wrap(unsigned int value)
+{
+    return (int)value;
+}
+
+/*
+ * Executes the instruction at state->pc. A fault (a PC outside the code, an
+ * invalid register, a data address outside memory or a division by zero)
+ * leaves the state untouched apart from its status. 'effect', when not
+ * NULL, receives what the instruction changed. Returns the new status.
+ */
+int
+APEX_func_step(APEX_ArchState *state, const APEX_Program *program,
+               APEX_FuncEffect *effect)
+{
+    const APEX_Instruction *insn;
+    int index = (state->pc - 4000) / 4;
+    int next_pc = state->pc + 4;
+    int rd = -1, result = 0, address = -1, load_address = -1, value = 0;
+    int a, b, offset;
+
+    if (effect)
+    {
+        effect->pc = state->pc;
+        effect->opcode = -1;
+        effect->rd = -1;
+        effect->mem_address = -1;
+        effect->load_address = -1;
+    }
+
+    if (state->status != APEX_STATUS_RUNNING)
+    {
+        return state->status;
+    }
+
+    if (state->pc < 4000 || (state->pc - 4000) % 4 || index >= program->size)
+    {
+        state->status = APEX_STATUS_FAULT;
+        return state->status;
+    }
+
+    insn = &program->code[index];
+    if (!apex_operands_valid(insn))
+    {
+        state->status = APEX_STATUS_FAULT;
+        return state->status;
+    }
+
+    a = valid_reg(insn->rs1) ? state->regs[insn->rs1] : 0;
+    b = valid_reg(insn->rs2) ? state->regs[insn->rs2] : 0;
+
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+            rd = insn->rd;
+            result = wrap((unsigned int)a + (unsigned int)b);
+            break;
+        case OPCODE_SUB:
+            rd = insn->rd;
+            result = wrap((unsigned int)a - (unsigned int)b);
+            break;
+        case OPCODE_MUL:
+            rd = insn->rd;
+            result = wrap((unsigned int)a * (unsigned int)b);
+            break;
+        case OPCODE_DIV:
+            if (b == 0)
+            {
+                state->status = APEX_STATUS_FAULT;
+                return state->status;
+            }
+            rd = insn->rd;
+            result = (b == -1) ? wrap(0u - (unsigned int)a) : a / b;
+            break;
+        case OPCODE_AND:
+            rd = insn->rd;
+            result = a & b;
+            break;
+        case OPCODE_OR:
+            rd = insn->rd;
+            result = a | b;
+            break;
+        case OPCODE_XOR:
+            rd = insn->rd;
+            result = a ^ b;
+            break;
+        case OPCODE_ADDL:
+            rd = insn->rd;
+            result = wrap((unsigned int)a + (unsigned int)insn->imm);
+            break;
+        case OPCODE_SUBL:
+            rd = insn->rd;
+            result = wrap((unsigned int)a - (unsigned int)insn->imm);
+            break;
+        case OPCODE_MOVC:
+            rd = insn->rd;
+            result = insn->imm;
+            break;
+        case OPCODE_CML:
+            b = insn->imm;
+            /* fall through */
+        case OPCODE_CMP:
+            state->z = a == b;
+            state->n = a < b;
+            state->p = a > b;
+            break;
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+            offset = insn->opcode == OPCODE_LOAD ? insn->imm : b;
+            address = wrap((unsigned int)a + (unsigned int)offset);
+            if (address < 0 || address >= DATA_MEMORY_SIZE)
+            {
+                state->status = APEX_STATUS_FAULT;
+                return state->status;
+            }
+            rd = insn->rd;
+            result = state->data_memory[address];
+            load_address = address;
+            address = -1;
+            break;
+        case OPCODE_STORE:
+        case OPCODE_STR:
+            offset = insn->opcode == OPCODE_STORE ? insn->imm
+                                                  : state->regs[insn->rs3];
+            address = wrap((unsigned int)b + (unsigned int)offset);
+            if (address < 0 || address >= DATA_MEMORY_SIZE)
+            {
+                state->status = APEX_STATUS_FAULT;
+                return state->status;
+            }
+            value = a;
+            state->data_memory[address] = value;
+            break;
+        case OPCODE_BZ:
+            if (state->z)
+            {
+                next_pc = state->pc + insn->imm;
+            }
+            break;
+        case OPCODE_BNZ:
+            if (!state->z)
+            {
+                next_pc = state->pc + insn->imm;
+            }
+            break;
+        case OPCODE_BP:
+            if (state->p)
+            {
+                next_pc = state->pc + insn->imm;
+            }
+            break;
+        case OPCODE_BN:
+            if (state->n)
+            {
+                next_pc = state->pc + insn->imm;
+            }
+            break;
+        case OPCODE_BNP:
+            if (state->n || state->z)
+            {
+                next_pc = state->pc + insn->imm;
+            }
+            break;
+        case OPCODE_JALR:
+            rd = insn->rd;
+            result = state->pc + 4;
+            /* fall through */
+        case OPCODE_JUMP:
+            next_pc = wrap((unsigned int)a + (unsigned int)insn->imm);
+            break;
+        case OPCODE_HALT:
+            state->status = APEX_STATUS_HALTED;
+            break;
+    }
+
+    if (rd >= 0)
+    {
+        state->regs[rd] = result;
+        if (insn->opcode != OPCODE_LOAD && insn->opcode != OPCODE_LDR &&
+            insn->opcode != OPCODE_JALR)
+        {
+            set_flags(state, result);
+        }
+    }
+
+    if (effect)
+    {
+        effect->opcode = insn->opcode;
+        effect->rd = rd;
+        effect->rd_value = result;
+        effect->mem_address = address;
+        effect->mem_value = value;
+        effect->load_address = load_address;
+        effect->next_pc = next_pc;
+    }
+
+    state->pc = next_pc;
+    state->retired++;
+    return state->status;
+}
+
+/*
+ * Steps until the state halts, faults or has retired 'max_insns'
+ * instructions in total (max_insns <= 0: no limit)
+ */
+int
+APEX_func_run(APEX_ArchState *state, const APEX_Program *program, int max_insns)
+{
+    while (state->status == APEX_STATUS_RUNNING &&
+           (max_insns <= 0 || state->retired < max_insns))
+    {
+        APEX_func_step(state, program, NULL);
+    }
+    return state->status;
+}
+
+/*
+ * Describes the instruction at 'pc' for the trace timing model, given the
+ * data address it accessed (-1 for none) and the PC it went on to. Returns
+ * -1 if 'pc' is not an instruction of 'program'.
+ */
+int
+APEX_trace_record_fill(APEX_TraceRecord *record, const APEX_Program *program,
+                       int pc, int mem_address, int next_pc)
+{
+    const APEX_Instruction *insn;
+    int index = (pc - 4000) / 4;
+
+    if (pc < 4000 || (pc - 4000) % 4 || index >= program->size)
+    {
+        return -1;
+    }
+
+    insn = &program->code[index];
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        case OPCODE_JALR:
+            record->rd = insn->rd;
+            break;
+        default:
+            record->rd = -1;
+            break;
+    }
+
+    record->pc = pc;
+    record->opcode = insn->opcode;
+    record->rs1 = insn->rs1;
+    record->rs2 = insn->rs2;
+    record->rs3 = insn->rs3;
+    record->mem_address = mem_address;
+    record->next_pc = next_pc;
+    return 0;
+}
+
+/*
+ * Steps like APEX_func_step and, if an instruction retired, describes it in
+ * 'record' for the trace timing model. Returns the new status.
+ */
+int
+APEX_func_trace(APEX_ArchState *state, const APEX_Program *program,
+                APEX_TraceRecord *record)
+{
+    APEX_FuncEffect effect;
+    int retired = state->retired;
+    int status = APEX_func_step(state, program, &effect);
+
+    if (state->retired != retired)
+    {
+        APEX_trace_record_fill(record, program, effect.pc,
+                               effect.mem_address >= 0 ? effect.mem_address
+                                                       : effect.load_address,
+                               effect.next_pc);
+    }
+    return status;
+}
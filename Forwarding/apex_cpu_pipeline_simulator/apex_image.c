@@ -0,0 +1,140 @@
+/*
+ * apex_image.c
+ * Contains data memory images shared copy-on-write between instances
+ *
+ * The data memory of every instance is a private mapping. Without an image
+ * it maps anonymous zero pages; with one it maps the image's in-memory
+ * file. Either way the kernel shares the pages until the instance stores
+ * to them, and then copies only the page written, so an instance costs
+ * the pages its STORE/STR instructions touch rather than all of memory.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+
+#define DATA_MEMORY_BYTES (sizeof(int) * DATA_MEMORY_SIZE)
+
+/* Read-only data memory contents, backed by an anonymous in-memory file */
+struct APEX_Image
+{
+    int fd;
+    int refs;                      /* Reference count, updated atomically */
+};
+
+/*
+ * Creates an image holding 'count' words from address 0, the rest of
+ * memory zero. Returns NULL if it cannot be created.
+ */
+APEX_Image *
+APEX_image_create(const int *words, int count)
+{
+    APEX_Image *image;
+
+    if (count < 0)
+    {
+        return NULL;
+    }
+    if (count > DATA_MEMORY_SIZE)
+    {
+        count = DATA_MEMORY_SIZE;
+    }
+
+    image = malloc(sizeof(APEX_Image));
+    if (!image)
+    {
+        return NULL;
+    }
+
+    image->refs = 1;
+    image->fd = memfd_create("apex-image", MFD_CLOEXEC);
+    if (image->fd < 0 || ftruncate(image->fd, DATA_MEMORY_BYTES) != 0 ||
+        pwrite(image->fd, words, sizeof(int) * count, 0) !=
+            (ssize_t)(sizeof(int) * count))
+    {
+        if (image->fd >= 0)
+        {
+            close(image->fd);
+        }
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+APEX_Image *
+APEX_image_retain(APEX_Image *image)
+{
+    __atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+    return image;
+}
+
+/* Drops a reference, the image is freed with the last one */
+void
+APEX_image_release(APEX_Image *image)
+{
+    if (image && __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(image->fd);
+        free(image);
+    }
+}
+
+/*
+ * Maps a private view of 'image' (zero pages for NULL) as data memory, in
+ * place of the mapping at 'memory' if it is not NULL. Private copies made
+ * by earlier stores are dropped. Returns NULL, with 'memory' unmapped, if
+ * the mapping fails.
+ */
+int *
+apex_memory_map(int *memory, const APEX_Image *image)
+{
+    void *map;
+    int flags = MAP_PRIVATE;
+
+    if (memory)
+    {
+        flags |= MAP_FIXED;
+    }
+    if (!image)
+    {
+        flags |= MAP_ANONYMOUS;
+    }
+
+    map = mmap(memory, DATA_MEMORY_BYTES, PROT_READ | PROT_WRITE, flags,
+               image ? image->fd : -1, 0);
+    if (map == MAP_FAILED)
+    {
+        apex_memory_unmap(memory);
+        return NULL;
+    }
+    return map;
+}
+
+void
+apex_memory_unmap(int *memory)
+{
+    if (memory)
+    {
+        munmap(memory, DATA_MEMORY_BYTES);
+    }
+}
+
+/*
+ * Replaces the whole data memory of 'cpu', which should not have started,
+ * with a copy-on-write view of 'image' (all zero for NULL). The instance
+ * does not keep a reference to the image. Returns -1 if the mapping fails;
+ * the instance can then only be destroyed.
+ */
+int
+APEX_cpu_map_image(APEX_CPU *cpu, const APEX_Image *image)
+{
+    cpu->data_memory = apex_memory_map(cpu->data_memory, image);
+    return cpu->data_memory ? 0 : -1;
+}
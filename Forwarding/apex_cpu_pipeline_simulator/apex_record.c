@@ -0,0 +1,388 @@
+/*
+ * apex_record.c
+ * Contains the recordings behind incremental re-simulation
+ *
+ * A run only depends on the data memory words it has read, so a run of a
+ * changed data image follows the reference run exactly up to the first
+ * cycle that touches a changed word. The recording keeps, per page of data
+ * memory, the first cycle a LOAD/LDR read it or a STORE/STR wrote it.
+ * Writes count as well, because a page written before a checkpoint no
+ * longer holds its initial words there, and patching the new image into it
+ * would undo the store. Checkpoints are copies of the whole instance; when
+ * APEX_RECORD_CHECKPOINTS are taken every other one is dropped and the
+ * interval doubles, so a run of any length keeps a bounded set.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define RECORD_PAGES (DATA_MEMORY_SIZE / APEX_RECORD_PAGE_WORDS)
+#define RECORD_MAGIC "APEXREC1"
+#define RECORD_MODEL_SIZE 32
+
+/* The instance, and a copy of the data memory it maps */
+typedef struct Record_Checkpoint
+{
+    APEX_CPU cpu;
+    int data_memory[DATA_MEMORY_SIZE];
+} Record_Checkpoint;
+
+struct APEX_Recording
+{
+    int initial_interval;          /* Interval a new recording starts with */
+    int interval;                  /* Cycles between checkpoints */
+    int next_checkpoint;           /* Clock the next checkpoint is due at */
+    int num_checkpoints;
+    uint32_t fingerprint;          /* Of the program that was recorded */
+    int image[DATA_MEMORY_SIZE];   /* Data memory the run started from */
+    int first_access[RECORD_PAGES]; /* Cycle of the first access, INT_MAX if none */
+    Record_Checkpoint checkpoints[APEX_RECORD_CHECKPOINTS]; /* Ordered by clock */
+};
+
+/* Saved form, followed by the recording up to its last checkpoint */
+typedef struct Record_Header
+{
+    char magic[8];
+    char model[RECORD_MODEL_SIZE];
+    int cpu_size;
+    int page_words;
+    int num_checkpoints;
+} Record_Header;
+
+/* FNV-1a over every field of every instruction the timing depends on */
+static uint32_t
+program_fingerprint(const APEX_Program *program)
+{
+    uint32_t hash = 2166136261u;
+    int i, j;
+
+    for (i = 0; i < program->size; ++i)
+    {
+        const APEX_Instruction *insn = &program->code[i];
+        int fields[6] = {insn->opcode, insn->rd, insn->rs1, insn->rs2,
+                         insn->rs3, insn->imm};
+
+        for (j = 0; j < 6; ++j)
+        {
+            hash = (hash ^ (uint32_t)fields[j]) * 16777619u;
+        }
+    }
+    return (hash ^ (uint32_t)program->size) * 16777619u;
+}
+
+/*
+ * Creates an empty recording that checkpoints every 'interval' cycles
+ * (<= 0: DEFAULT_CHECKPOINT_INTERVAL) until the set is full
+ */
+APEX_Recording *
+APEX_recording_create(int interval)
+{
+    APEX_Recording *recording = calloc(1, sizeof(APEX_Recording));
+
+    if (!recording)
+    {
+        return NULL;
+    }
+
+    recording->initial_interval =
+        interval > 0 ? interval : DEFAULT_CHECKPOINT_INTERVAL;
+    return recording;
+}
+
+void
+APEX_recording_destroy(APEX_Recording *recording)
+{
+    free(recording);
+}
+
+int
+APEX_recording_checkpoints(const APEX_Recording *recording)
+{
+    return recording->num_checkpoints;
+}
+
+static void
+take_checkpoint(APEX_CPU *cpu, APEX_Recording *recording)
+{
+    Record_Checkpoint *checkpoint;
+    int i;
+
+    if (recording->num_checkpoints == APEX_RECORD_CHECKPOINTS)
+    {
+        for (i = 1; i < APEX_RECORD_CHECKPOINTS / 2; ++i)
+        {
+            recording->checkpoints[i] = recording->checkpoints[2 * i];
+        }
+        recording->num_checkpoints = APEX_RECORD_CHECKPOINTS / 2;
+        recording->interval *= 2;
+    }
+
+    /* Pointers are not part of the state, the resumed instance keeps its own */
+    checkpoint = &recording->checkpoints[recording->num_checkpoints++];
+    checkpoint->cpu = *cpu;
+    checkpoint->cpu.data_memory = NULL;
+    checkpoint->cpu.code_memory = NULL;
+    checkpoint->cpu.program = NULL;
+    checkpoint->cpu.log_fn = NULL;
+    checkpoint->cpu.log_ctx = NULL;
+    checkpoint->cpu.recording = NULL;
+    checkpoint->cpu.retire_trace = NULL;
+    checkpoint->cpu.retire_fn = NULL;
+    checkpoint->cpu.retire_ctx = NULL;
+    checkpoint->cpu.stream = NULL;
+    checkpoint->cpu.monitor = NULL;
+    checkpoint->cpu.profile = NULL;
+    checkpoint->cpu.pipeview = NULL;
+    checkpoint->cpu.series = NULL;
+    checkpoint->cpu.memtrace = NULL;
+    checkpoint->cpu.dataflow = NULL;
+    checkpoint->cpu.oracle = NULL;
+    checkpoint->cpu.cosim = NULL;
+    memcpy(checkpoint->data_memory, cpu->data_memory,
+           sizeof(checkpoint->data_memory));
+
+    recording->next_checkpoint = cpu->clock > INT_MAX - recording->interval
+                                     ? INT_MAX
+                                     : cpu->clock + recording->interval;
+}
+
+/*
+ * Starts recording the run of 'cpu', which must not have advanced yet and
+ * whose data memory is the reference image. The recording must outlive the
+ * run; a NULL recording, or APEX_cpu_reset, stops it. Returns -1 if 'cpu'
+ * has already run.
+ */
+int
+APEX_cpu_record(APEX_CPU *cpu, APEX_Recording *recording)
+{
+    int i;
+
+    cpu->recording = NULL;
+    if (!recording)
+    {
+        return 0;
+    }
+    /* The oracle of zero-penalty branches is no part of a checkpoint */
+    if (cpu->clock != 0 || cpu->oracle)
+    {
+        return -1;
+    }
+
+    recording->interval = recording->initial_interval;
+    recording->num_checkpoints = 0;
+    recording->fingerprint = program_fingerprint(cpu->program);
+    memcpy(recording->image, cpu->data_memory, sizeof(recording->image));
+    for (i = 0; i < RECORD_PAGES; ++i)
+    {
+        recording->first_access[i] = INT_MAX;
+    }
+
+    take_checkpoint(cpu, recording);
+    cpu->recording = recording;
+    return 0;
+}
+
+/* Called by the memory stage, and by forwarding, for every data access */
+void
+apex_record_access(APEX_CPU *cpu, int address)
+{
+    int page;
+
+    if (address < 0 || address >= DATA_MEMORY_SIZE)
+    {
+        return;
+    }
+
+    page = address / APEX_RECORD_PAGE_WORDS;
+    if (cpu->recording->first_access[page] == INT_MAX)
+    {
+        cpu->recording->first_access[page] = cpu->clock;
+    }
+}
+
+/* Called after every advance of a recorded instance */
+void
+apex_record_cycle(APEX_CPU *cpu)
+{
+    if (cpu->status != APEX_STATUS_RUNNING ||
+        cpu->clock >= cpu->recording->next_checkpoint)
+    {
+        take_checkpoint(cpu, cpu->recording);
+    }
+}
+
+/*
+ * Moves 'cpu', which must not have advanced yet, to the latest checkpoint
+ * of 'recording' that its own data memory does not make diverge, with that
+ * data memory patched in. Checkpoints past 'max_cycle' are not used
+ * (<= 0: no limit). Returns the clock resumed at, 0 when the run has to
+ * start over, or -1 if the recording is of another program or timing.
+ */
+int
+APEX_cpu_resume(APEX_CPU *cpu, const APEX_Recording *recording, int max_cycle)
+{
+    const Record_Checkpoint *checkpoint;
+    APEX_CPU resumed;
+    APEX_Monitor *monitor;
+    APEX_Series *series;
+    int changed[RECORD_PAGES];
+    int limit = max_cycle > 0 ? max_cycle : INT_MAX;
+    int page, i;
+
+    if (cpu->clock != 0 || recording->num_checkpoints == 0 ||
+        recording->fingerprint != program_fingerprint(cpu->program) ||
+        memcmp(&recording->checkpoints[0].cpu.config, &cpu->config,
+               sizeof(APEX_Config)) != 0)
+    {
+        return -1;
+    }
+
+    for (page = 0; page < RECORD_PAGES; ++page)
+    {
+        int first = page * APEX_RECORD_PAGE_WORDS;
+
+        changed[page] = memcmp(&recording->image[first], &cpu->data_memory[first],
+                               sizeof(int) * APEX_RECORD_PAGE_WORDS) != 0;
+        if (changed[page] && recording->first_access[page] < limit)
+        {
+            limit = recording->first_access[page];
+        }
+    }
+
+    /* Accesses during cycle c are part of checkpoints with a clock above c */
+    for (i = recording->num_checkpoints - 1; i > 0; --i)
+    {
+        if (recording->checkpoints[i].cpu.clock <= limit)
+        {
+            break;
+        }
+    }
+    if (i == 0)
+    {
+        return 0;
+    }
+
+    /*
+     * Changed pages are untouched at the checkpoint, the instance already
+     * holds them. Of the others only those the run has stored to differ, and
+     * only those are written, so the rest stays shared with the image.
+     */
+    checkpoint = &recording->checkpoints[i];
+    for (page = 0; page < RECORD_PAGES; ++page)
+    {
+        int first = page * APEX_RECORD_PAGE_WORDS;
+        size_t size = sizeof(int) * APEX_RECORD_PAGE_WORDS;
+
+        if (!changed[page] && memcmp(&cpu->data_memory[first],
+                                     &checkpoint->data_memory[first], size) != 0)
+        {
+            memcpy(&cpu->data_memory[first], &checkpoint->data_memory[first],
+                   size);
+        }
+    }
+
+    resumed = checkpoint->cpu;
+    resumed.data_memory = cpu->data_memory;
+    resumed.code_memory = cpu->code_memory;
+    resumed.program = cpu->program;
+    resumed.log_fn = cpu->log_fn;
+    resumed.log_ctx = cpu->log_ctx;
+    resumed.retire_trace = cpu->retire_trace;
+    resumed.retire_fn = cpu->retire_fn;
+    resumed.retire_ctx = cpu->retire_ctx;
+    resumed.stream = cpu->stream;
+    resumed.profile = cpu->profile;
+    resumed.pipeview = cpu->pipeview;
+    resumed.memtrace = cpu->memtrace;
+    resumed.dataflow = cpu->dataflow;
+    monitor = cpu->monitor;
+    series = cpu->series;
+    *cpu = resumed;
+    APEX_cpu_set_stream(cpu, cpu->stream);
+    APEX_cpu_set_monitor(cpu, monitor);
+    APEX_cpu_set_series(cpu, series);
+    return cpu->clock;
+}
+
+/*
+ * Serializes 'recording' into a malloc'ed buffer of '*len' bytes, NULL if
+ * out of memory
+ */
+void *
+APEX_recording_save(const APEX_Recording *recording, size_t *len)
+{
+    Record_Header header;
+    size_t body = offsetof(APEX_Recording, checkpoints) +
+                  sizeof(Record_Checkpoint) * recording->num_checkpoints;
+    char *data;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    strncpy(header.model, APEX_model_version(), RECORD_MODEL_SIZE - 1);
+    header.cpu_size = sizeof(APEX_CPU);
+    header.page_words = APEX_RECORD_PAGE_WORDS;
+    header.num_checkpoints = recording->num_checkpoints;
+
+    data = malloc(sizeof(header) + body);
+    if (!data)
+    {
+        return NULL;
+    }
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), recording, body);
+    *len = sizeof(header) + body;
+    return data;
+}
+
+/*
+ * Reads back a recording written by APEX_recording_save. Returns NULL if
+ * 'data' is not one, or was saved by a different build of the model.
+ */
+APEX_Recording *
+APEX_recording_load(const void *data, size_t len)
+{
+    APEX_Recording *recording;
+    Record_Header header;
+    size_t body;
+
+    if (len < sizeof(header))
+    {
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+        strncmp(header.model, APEX_model_version(), RECORD_MODEL_SIZE) != 0 ||
+        header.cpu_size != (int)sizeof(APEX_CPU) ||
+        header.page_words != APEX_RECORD_PAGE_WORDS ||
+        header.num_checkpoints < 1 ||
+        header.num_checkpoints > APEX_RECORD_CHECKPOINTS)
+    {
+        return NULL;
+    }
+
+    body = offsetof(APEX_Recording, checkpoints) +
+           sizeof(Record_Checkpoint) * header.num_checkpoints;
+    if (len != sizeof(header) + body)
+    {
+        return NULL;
+    }
+
+    recording = calloc(1, sizeof(APEX_Recording));
+    if (!recording)
+    {
+        return NULL;
+    }
+    memcpy(recording, (const char *)data + sizeof(header), body);
+    if (recording->num_checkpoints != header.num_checkpoints)
+    {
+        free(recording);
+        return NULL;
+    }
+    return recording;
+}
@@ -0,0 +1,1047 @@
+/*
+ * apex_retime.c
+ * apex-retime, times a program on the trace timing model, with the
+ * functional model and the timing model running on two threads
+ *
+ * The front thread executes the program on the ISA-level functional model
+ * and pushes a record of every retired instruction into a ring; the back
+ * thread pops the records and times them. The ring has one producer and one
+ * consumer and no lock: each side owns its index, publishes it with a
+ * release store every RETIME_BATCH records, and reloads the other side's
+ * index only when it runs out of room or records, so the threads exchange
+ * a cache line once per batch rather than once per instruction. --serial
+ * runs both models on one thread, as a baseline; --compare also runs the
+ * cycle-level pipeline on the same input and reports how far the trace
+ * timing model is from it.
+ *
+ * Every record is timed under each configuration given with --config, so a
+ * sweep costs one functional run. --record-trace saves the run instead, as
+ * a dynamic trace of 4 bytes per instruction, and --trace times a saved
+ * trace without executing anything: the file is mapped and read front to
+ * back, once for all the configurations.
+ *
+ * --segments K cuts a saved trace into K segments timed on K threads. A
+ * segment is started on fresh models, which time the --warmup instructions
+ * before it first to fill the pipeline and the register ready times, and
+ * only what it adds after them is counted; the segments are then summed.
+ * Hazards reaching further back than the warmup are lost, so the sum is an
+ * estimate. --check also times the trace serially and reports the error.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+#define DEFAULT_MAX_INSNS 1000000
+#define DEFAULT_WARMUP 1000
+
+/* Records in the ring, a power of two, and records per published index */
+#define RETIME_QUEUE_SIZE 4096
+#define RETIME_BATCH 64
+
+/* Trace files, and the entries written at a time when recording one */
+#define TRACE_MAGIC "APEXDYN1"
+#define TRACE_BUFFER_ENTRIES 65536
+#define TRACE_MAX_PROGRAM 65536
+
+/* Each index sits on its own cache line, next to what only its owner writes */
+typedef struct Retime_Queue
+{
+    APEX_TraceRecord records[RETIME_QUEUE_SIZE];
+    unsigned int head __attribute__((aligned(64)));  /* Written by the front */
+    int done;                                         /* Front has finished */
+    unsigned int tail __attribute__((aligned(64)));  /* Written by the back */
+} Retime_Queue;
+
+/* The functional front end: a program and its architectural state */
+typedef struct Retime_Front
+{
+    const APEX_Program *program;
+    APEX_ArchState *state;
+    int max_insns;
+    Retime_Queue *queue;
+} Retime_Front;
+
+/* The configurations every record is timed under, one model each */
+typedef struct Retime_Sweep
+{
+    APEX_TimingConfig *configs;
+    APEX_Timing **timings;
+    int num_configs;
+} Retime_Sweep;
+
+/* A range of a trace timed on its own thread, after a warmup prefix */
+typedef struct Retime_Segment
+{
+    const struct Retime_Trace *trace;
+    const APEX_Program *program;
+    Retime_Sweep sweep;         /* Models of this segment only */
+    uint64_t warmup_start;      /* Entries timed, but not counted */
+    uint64_t first;             /* Entries counted */
+    uint64_t last;
+    APEX_TimingStats *counted;  /* Per configuration, what the range added */
+    pthread_t thread;
+} Retime_Segment;
+
+/*
+ * Saved trace, followed by one 32-bit entry per retired instruction: the
+ * instruction index in the low half, the data address plus one (0 for
+ * none) in the high half. Opcodes and registers are taken from the program
+ * and the next PC of an entry is the PC of the one after it.
+ */
+typedef struct Trace_Header
+{
+    char magic[8];
+    uint64_t program_hash;
+    uint64_t num_entries;
+    int32_t program_size;
+    int32_t status;             /* Of the functional model after the run */
+    int32_t final_pc;           /* Next PC of the last entry */
+    int32_t reserved;
+} Trace_Header;
+
+/* A trace file, mapped read-only */
+typedef struct Retime_Trace
+{
+    const Trace_Header *header;
+    const uint32_t *entries;
+    size_t size;
+} Retime_Trace;
+
+static const char *const stage_names[APEX_NUM_STAGES] = {
+    "fetch", "decode", "execute", "memory1", "memory", "writeback"};
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--forwarding <on|off>]"
+                    " [--mem-latency <cycles>] [--mul-latency <cycles>]"
+                    " [--branch-stage <stage>] [--config <option=value,...>]..."
+                    " [--max-insns <N>] [--serial] [--compare]"
+                    " [--record-trace <file> | --trace <file>"
+                    " [--segments <K>] [--warmup <N>] [--check]]"
+                    " <program.asm> [<data file>]\n", prog);
+    exit(1);
+}
+
+static int
+parse_stage(const char *name)
+{
+    int stage;
+
+    for (stage = APEX_STAGE_DECODE; stage < APEX_NUM_STAGES; ++stage)
+    {
+        if (strcmp(name, stage_names[stage]) == 0)
+        {
+            return stage;
+        }
+    }
+    return -1;
+}
+
+/* Applies the timing option 'name' to 'config', -1 if either is invalid */
+static int
+parse_timing_option(APEX_TimingConfig *config, const char *name,
+                    const char *value)
+{
+    if (strcmp(name, "forwarding") == 0)
+    {
+        if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+        {
+            return -1;
+        }
+        config->forwarding = strcmp(value, "on") == 0;
+    }
+    else if (strcmp(name, "mem-latency") == 0)
+    {
+        config->memory_latency = atoi(value);
+        return config->memory_latency < 1 ? -1 : 0;
+    }
+    else if (strcmp(name, "mul-latency") == 0)
+    {
+        config->mul_latency = atoi(value);
+        return config->mul_latency < 1 ? -1 : 0;
+    }
+    else if (strcmp(name, "branch-stage") == 0)
+    {
+        config->branch_stage = parse_stage(value);
+        return config->branch_stage < 0 ? -1 : 0;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Parses '--config' options, comma separated 'option=value' pairs */
+static int
+parse_config(APEX_TimingConfig *config, const char *spec)
+{
+    char *copy = strdup(spec);
+    char *item, *save = NULL;
+    int result = copy ? 0 : -1;
+
+    for (item = copy ? strtok_r(copy, ",", &save) : NULL; item && !result;
+         item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+
+        if (!value)
+        {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+        result = parse_timing_option(config, item, value);
+    }
+    if (result)
+    {
+        fprintf(stderr, "APEX_Error: Invalid configuration '%s'\n", spec);
+    }
+    free(copy);
+    return result;
+}
+
+static void
+sweep_issue(Retime_Sweep *sweep, const APEX_TraceRecord *record)
+{
+    int i;
+
+    for (i = 0; i < sweep->num_configs; ++i)
+    {
+        APEX_timing_issue(sweep->timings[i], record);
+    }
+}
+
+static int
+front_running(const Retime_Front *front)
+{
+    return front->state->status == APEX_STATUS_RUNNING &&
+           (front->max_insns <= 0 || front->state->retired < front->max_insns);
+}
+
+static void *
+front_main(void *arg)
+{
+    Retime_Front *front = arg;
+    Retime_Queue *queue = front->queue;
+    unsigned int head = 0, published = 0, tail = 0;
+
+    while (front_running(front))
+    {
+        int retired = front->state->retired;
+
+        if (head - tail == RETIME_QUEUE_SIZE)
+        {
+            __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+            published = head;
+            while ((tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) ==
+                   head - RETIME_QUEUE_SIZE)
+            {
+                sched_yield();
+            }
+        }
+
+        APEX_func_trace(front->state, front->program,
+                        &queue->records[head & (RETIME_QUEUE_SIZE - 1)]);
+        if (front->state->retired != retired)
+        {
+            head++;
+        }
+        if (head - published == RETIME_BATCH)
+        {
+            __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+            published = head;
+        }
+    }
+
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->done, TRUE, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Times records until the front has finished and the ring is empty */
+static void
+back_main(Retime_Queue *queue, Retime_Sweep *sweep)
+{
+    unsigned int head, tail = 0;
+    int done;
+
+    for (;;)
+    {
+        /* The final head is published before done */
+        done = __atomic_load_n(&queue->done, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            if (done)
+            {
+                return;
+            }
+            sched_yield();
+            continue;
+        }
+
+        while (tail != head)
+        {
+            sweep_issue(sweep, &queue->records[tail & (RETIME_QUEUE_SIZE - 1)]);
+            tail++;
+            if (tail % RETIME_BATCH == 0)
+            {
+                __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+            }
+        }
+        __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static int
+run_threaded(Retime_Front *front, Retime_Sweep *sweep)
+{
+    pthread_t thread;
+
+    front->queue = calloc(1, sizeof(Retime_Queue));
+    if (!front->queue)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, front_main, front) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to start the front thread\n");
+        free(front->queue);
+        return -1;
+    }
+
+    back_main(front->queue, sweep);
+    pthread_join(thread, NULL);
+    free(front->queue);
+    return 0;
+}
+
+static void
+run_serial(Retime_Front *front, Retime_Sweep *sweep)
+{
+    APEX_TraceRecord record;
+
+    while (front_running(front))
+    {
+        int retired = front->state->retired;
+
+        APEX_func_trace(front->state, front->program, &record);
+        if (front->state->retired != retired)
+        {
+            sweep_issue(sweep, &record);
+        }
+    }
+}
+
+/* Identifies the program a trace was recorded from */
+static uint64_t
+program_hash(const APEX_Program *program)
+{
+    uint64_t hash = APEX_HASH_INIT;
+    int i;
+
+    for (i = 0; i < APEX_program_size(program); ++i)
+    {
+        const APEX_Instruction *insn = APEX_program_instruction(program, i);
+        int fields[6] = {insn->opcode, insn->rd, insn->rs1, insn->rs2,
+                         insn->rs3, insn->imm};
+
+        hash = apex_hash(hash, fields, sizeof(fields));
+    }
+    return hash;
+}
+
+/* Runs the functional model alone and saves its trace to 'path' */
+static int
+record_trace(Retime_Front *front, const char *path, uint64_t *num_entries)
+{
+    Trace_Header header;
+    APEX_TraceRecord record;
+    uint32_t *buffer;
+    FILE *fp;
+    int count = 0, failed;
+
+    if (APEX_program_size(front->program) > TRACE_MAX_PROGRAM)
+    {
+        fprintf(stderr, "APEX_Error: Traces hold programs of up to %d"
+                        " instructions\n", TRACE_MAX_PROGRAM);
+        return -1;
+    }
+
+    fp = fopen(path, "wb");
+    buffer = malloc(sizeof(uint32_t) * TRACE_BUFFER_ENTRIES);
+    if (!fp || !buffer)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        if (fp)
+        {
+            fclose(fp);
+        }
+        free(buffer);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.program_hash = program_hash(front->program);
+    header.program_size = APEX_program_size(front->program);
+    failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+
+    while (!failed && front_running(front))
+    {
+        int retired = front->state->retired;
+
+        APEX_func_trace(front->state, front->program, &record);
+        if (front->state->retired == retired)
+        {
+            continue;
+        }
+
+        buffer[count++] = (uint32_t)((record.pc - 4000) / 4) |
+                          (uint32_t)(record.mem_address + 1) << 16;
+        header.num_entries++;
+        if (count == TRACE_BUFFER_ENTRIES)
+        {
+            failed = fwrite(buffer, sizeof(uint32_t), count, fp) != (size_t)count;
+            count = 0;
+        }
+    }
+
+    header.status = front->state->status;
+    header.final_pc = front->state->pc;
+    if (!failed && count)
+    {
+        failed = fwrite(buffer, sizeof(uint32_t), count, fp) != (size_t)count;
+    }
+    if (!failed)
+    {
+        failed = fseek(fp, 0, SEEK_SET) != 0 ||
+                 fwrite(&header, sizeof(header), 1, fp) != 1;
+    }
+    failed |= fclose(fp) != 0;
+    free(buffer);
+
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        return -1;
+    }
+    *num_entries = header.num_entries;
+    return 0;
+}
+
+static int
+trace_open(Retime_Trace *trace, const char *path, const APEX_Program *program)
+{
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Trace_Header))
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "APEX_Error: Unable to map %s\n", path);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    trace->header = map;
+    trace->entries = (const uint32_t *)(trace->header + 1);
+    trace->size = st.st_size;
+    if (memcmp(trace->header->magic, TRACE_MAGIC, sizeof(trace->header->magic)) ||
+        trace->size != sizeof(Trace_Header) +
+                           sizeof(uint32_t) * trace->header->num_entries)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a trace\n", path);
+        munmap(map, trace->size);
+        return -1;
+    }
+    if (trace->header->program_hash != program_hash(program) ||
+        trace->header->program_size != APEX_program_size(program))
+    {
+        fprintf(stderr, "APEX_Error: %s is a trace of another program\n", path);
+        munmap(map, trace->size);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+trace_close(Retime_Trace *trace)
+{
+    munmap((void *)trace->header, trace->size);
+}
+
+static int
+entry_pc(uint32_t entry)
+{
+    return 4000 + 4 * (int)(entry & 0xffff);
+}
+
+/* Times entries 'first' to 'last' of the mapped trace, read once for all */
+static void
+run_trace(const Retime_Trace *trace, const APEX_Program *program,
+          Retime_Sweep *sweep, uint64_t first, uint64_t last)
+{
+    APEX_TraceRecord record;
+    uint64_t num_entries = trace->header->num_entries;
+    uint64_t i;
+
+    for (i = first; i < last; ++i)
+    {
+        uint32_t entry = trace->entries[i];
+
+        APEX_trace_record_fill(&record, program, entry_pc(entry),
+                               (int)(entry >> 16) - 1,
+                               i + 1 < num_entries
+                                   ? entry_pc(trace->entries[i + 1])
+                                   : trace->header->final_pc);
+        sweep_issue(sweep, &record);
+    }
+}
+
+/* Creates a model per configuration of 'sweep', which has the configurations */
+static int
+sweep_create(Retime_Sweep *sweep)
+{
+    int i;
+
+    sweep->timings = calloc(sweep->num_configs, sizeof(APEX_Timing *));
+    for (i = 0; sweep->timings && i < sweep->num_configs; ++i)
+    {
+        sweep->timings[i] = APEX_timing_create(&sweep->configs[i]);
+        if (!sweep->timings[i])
+        {
+            return -1;
+        }
+    }
+    return sweep->timings ? 0 : -1;
+}
+
+static void
+sweep_destroy(Retime_Sweep *sweep)
+{
+    int i;
+
+    for (i = 0; sweep->timings && i < sweep->num_configs; ++i)
+    {
+        APEX_timing_destroy(sweep->timings[i]);
+    }
+    free(sweep->timings);
+}
+
+/* Every field of APEX_TimingStats is a uint64_t counter */
+static void
+stats_add(APEX_TimingStats *total, const APEX_TimingStats *add,
+          const APEX_TimingStats *sub)
+{
+    uint64_t *counters = (uint64_t *)total;
+    const uint64_t *plus = (const uint64_t *)add;
+    const uint64_t *minus = (const uint64_t *)sub;
+    size_t i;
+
+    for (i = 0; i < sizeof(APEX_TimingStats) / sizeof(uint64_t); ++i)
+    {
+        counters[i] += plus[i] - minus[i];
+    }
+}
+
+static void *
+segment_main(void *arg)
+{
+    Retime_Segment *segment = arg;
+    APEX_TimingStats *warm = calloc(segment->sweep.num_configs,
+                                    sizeof(APEX_TimingStats));
+    int i;
+
+    if (!warm)
+    {
+        return warm;
+    }
+
+    run_trace(segment->trace, segment->program, &segment->sweep,
+              segment->warmup_start, segment->first);
+    for (i = 0; i < segment->sweep.num_configs; ++i)
+    {
+        warm[i] = *APEX_timing_get_stats(segment->sweep.timings[i]);
+    }
+
+    run_trace(segment->trace, segment->program, &segment->sweep,
+              segment->first, segment->last);
+    for (i = 0; i < segment->sweep.num_configs; ++i)
+    {
+        stats_add(&segment->counted[i],
+                  APEX_timing_get_stats(segment->sweep.timings[i]), &warm[i]);
+    }
+    free(warm);
+    return segment;
+}
+
+/*
+ * Times the trace as 'num_segments' segments in parallel and sums what each
+ * added into 'totals', one per configuration of 'sweep'
+ */
+static int
+run_segments(const Retime_Trace *trace, const APEX_Program *program,
+             const Retime_Sweep *sweep, int num_segments, uint64_t warmup,
+             APEX_TimingStats *totals)
+{
+    Retime_Segment *segments = calloc(num_segments, sizeof(Retime_Segment));
+    APEX_TimingStats none;
+    uint64_t num_entries = trace->header->num_entries;
+    void *result;
+    int started, i, j, failed = !segments;
+
+    for (started = 0; !failed && started < num_segments; ++started)
+    {
+        Retime_Segment *segment = &segments[started];
+
+        segment->trace = trace;
+        segment->program = program;
+        segment->sweep.configs = sweep->configs;
+        segment->sweep.num_configs = sweep->num_configs;
+        segment->first = num_entries * started / num_segments;
+        segment->last = num_entries * (started + 1) / num_segments;
+        segment->warmup_start = segment->first > warmup ? segment->first - warmup : 0;
+        segment->counted = calloc(sweep->num_configs, sizeof(APEX_TimingStats));
+        failed = !segment->counted || sweep_create(&segment->sweep) ||
+                 pthread_create(&segment->thread, NULL, segment_main, segment);
+        if (failed)
+        {
+            sweep_destroy(&segment->sweep);
+            free(segment->counted);
+            break;
+        }
+    }
+
+    /* Joins the started ones even after a failure */
+    memset(&none, 0, sizeof(none));
+    memset(totals, 0, sizeof(APEX_TimingStats) * sweep->num_configs);
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(segments[i].thread, &result);
+        failed |= !result;
+        for (j = 0; j < sweep->num_configs; ++j)
+        {
+            stats_add(&totals[j], &segments[i].counted[j], &none);
+        }
+        sweep_destroy(&segments[i].sweep);
+        free(segments[i].counted);
+    }
+    free(segments);
+
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to time the segments\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Runs the cycle-level pipeline on the same input, for --compare */
+static void
+compare_pipeline(APEX_Program *program, const int *words, int count,
+                 const APEX_TimingConfig *timing_config,
+                 const APEX_TimingStats *stats)
+{
+    APEX_TimingConfig native;
+    APEX_Config config;
+    APEX_CPU *cpu;
+    int cycles;
+
+    APEX_timing_config_default(&native);
+    if (timing_config->forwarding != native.forwarding ||
+        timing_config->branch_stage != native.branch_stage)
+    {
+        printf("pipeline n/a, this build has forwarding=%s branch_stage=%s\n",
+               native.forwarding ? "on" : "off",
+               stage_names[native.branch_stage]);
+        return;
+    }
+
+    APEX_config_default(&config);
+    config.memory_latency = timing_config->memory_latency;
+    config.mul_latency = timing_config->mul_latency;
+    cpu = APEX_cpu_create(program, &config);
+    if (!cpu || APEX_cpu_load_data(cpu, 0, words, count) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the pipeline model\n");
+        exit(1);
+    }
+
+    APEX_cpu_run_until(cpu, NULL, NULL, 10 * (int)stats->cycles + 10000);
+    cycles = APEX_cpu_get_clock(cpu);
+    printf("pipeline status=%s cycles=%d instructions=%d error=%+.2f%%\n",
+           apex_status_name(APEX_cpu_get_status(cpu),
+                            APEX_cpu_get_watchdog_reason(cpu)),
+           cycles, APEX_cpu_get_retired(cpu),
+           cycles ? 100.0 * ((double)stats->cycles - cycles) / cycles : 0.0);
+    APEX_cpu_destroy(cpu);
+}
+
+static void
+print_result(const APEX_TimingConfig *config, const APEX_TimingStats *stats,
+             int status)
+{
+    printf("forwarding=%s mem_latency=%d mul_latency=%d branch_stage=%s"
+           " status=%s instructions=%llu cycles=%llu cpi=%.3f data_stalls=%llu"
+           " structural_stalls=%llu flush_cycles=%llu taken_branches=%llu\n",
+           config->forwarding ? "on" : "off", config->memory_latency,
+           config->mul_latency, stage_names[config->branch_stage],
+           apex_status_name(status, 0),
+           (unsigned long long)stats->instructions,
+           (unsigned long long)stats->cycles,
+           stats->instructions ? (double)stats->cycles / stats->instructions : 0.0,
+           (unsigned long long)stats->data_stalls,
+           (unsigned long long)stats->structural_stalls,
+           (unsigned long long)stats->flush_cycles,
+           (unsigned long long)stats->taken_branches);
+}
+
+static int *
+load_data(const char *path, int *count)
+{
+    int *words = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    size_t len;
+    char *text;
+
+    if (!words)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    *count = 0;
+    if (!path)
+    {
+        return words;
+    }
+
+    text = apex_read_file(path, &len);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    *count = APEX_parse_data(text, len, words, DATA_MEMORY_SIZE);
+    free(text);
+    if (*count < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", path);
+        exit(1);
+    }
+    return words;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_Program *program;
+    APEX_ArchState *state;
+    APEX_TimingConfig base;
+    Retime_Sweep sweep;
+    Retime_Front front;
+    Retime_Trace trace;
+    struct timespec start, end;
+    const char *program_file = NULL;
+    const char *data_file = NULL;
+    const char *record_path = NULL;
+    const char *trace_path = NULL;
+    const char **specs;
+    APEX_TimingStats *results, *serial_results = NULL;
+    uint64_t warmup = DEFAULT_WARMUP;
+    int max_insns = DEFAULT_MAX_INSNS;
+    int serial = FALSE, compare = FALSE, check = FALSE;
+    int num_specs = 0, num_segments = 1, status;
+    int *words;
+    int count, i;
+    uint64_t instructions;
+    double seconds, serial_seconds = 0;
+
+    specs = calloc(argc, sizeof(const char *));
+    if (!specs)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+
+    APEX_timing_config_default(&base);
+    for (i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc &&
+            (strcmp(argv[i], "--forwarding") == 0 ||
+             strcmp(argv[i], "--mem-latency") == 0 ||
+             strcmp(argv[i], "--mul-latency") == 0 ||
+             strcmp(argv[i], "--branch-stage") == 0))
+        {
+            if (parse_timing_option(&base, argv[i] + 2, argv[i + 1]))
+            {
+                print_usage(argv[0]);
+            }
+            ++i;
+        }
+        else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+        {
+            specs[num_specs++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc)
+        {
+            /* 0 runs until the program halts or faults */
+            max_insns = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record-trace") == 0 && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--segments") == 0 && i + 1 < argc)
+        {
+            num_segments = atoi(argv[++i]);
+            if (num_segments < 1)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+        {
+            warmup = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            check = TRUE;
+        }
+        else if (strcmp(argv[i], "--serial") == 0)
+        {
+            serial = TRUE;
+        }
+        else if (strcmp(argv[i], "--compare") == 0)
+        {
+            compare = TRUE;
+        }
+        else if (argv[i][0] == '-')
+        {
+            print_usage(argv[0]);
+        }
+        else if (!program_file)
+        {
+            program_file = argv[i];
+        }
+        else if (!data_file)
+        {
+            data_file = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+        }
+    }
+    if (!program_file || (record_path && trace_path) ||
+        (trace_path && (data_file || compare)) ||
+        (!trace_path && (num_segments > 1 || check)))
+    {
+        print_usage(argv[0]);
+    }
+
+    /* Each --config starts from the options, without one they are the only one */
+    sweep.num_configs = num_specs ? num_specs : 1;
+    sweep.configs = malloc(sizeof(APEX_TimingConfig) * sweep.num_configs);
+    results = calloc(sweep.num_configs, sizeof(APEX_TimingStats));
+    if (!sweep.configs || !results)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < sweep.num_configs; ++i)
+    {
+        sweep.configs[i] = base;
+        if (num_specs && parse_config(&sweep.configs[i], specs[i]))
+        {
+            exit(1);
+        }
+    }
+    if (sweep_create(&sweep))
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+
+    program = apex_load_program(program_file);
+    if (!program)
+    {
+        exit(1);
+    }
+
+    state = malloc(sizeof(APEX_ArchState));
+    if (!state)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    words = load_data(data_file, &count);
+    APEX_func_init(state);
+    memcpy(state->data_memory, words, sizeof(int) * count);
+    front.program = program;
+    front.state = state;
+    front.max_insns = max_insns;
+    front.queue = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (record_path)
+    {
+        if (record_trace(&front, record_path, &instructions))
+        {
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "APEX_Retime: Recorded %llu instructions to %s in"
+                        " %.3f s, status %s\n",
+                (unsigned long long)instructions, record_path, seconds,
+                apex_status_name(state->status, 0));
+        exit(0);
+    }
+
+    if (trace_path)
+    {
+        if (trace_open(&trace, trace_path, program))
+        {
+            exit(1);
+        }
+        status = trace.header->status;
+        if (num_segments > 1 &&
+            run_segments(&trace, program, &sweep, num_segments, warmup, results))
+        {
+            exit(1);
+        }
+        if (num_segments == 1)
+        {
+            run_trace(&trace, program, &sweep, 0, trace.header->num_entries);
+        }
+    }
+    else if (serial)
+    {
+        run_serial(&front, &sweep);
+        status = state->status;
+    }
+    else if (run_threaded(&front, &sweep))
+    {
+        exit(1);
+    }
+    else
+    {
+        status = state->status;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (num_segments == 1)
+    {
+        for (i = 0; i < sweep.num_configs; ++i)
+        {
+            results[i] = *APEX_timing_get_stats(sweep.timings[i]);
+        }
+    }
+
+    if (check)
+    {
+        serial_results = calloc(sweep.num_configs, sizeof(APEX_TimingStats));
+        if (!serial_results)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < sweep.num_configs; ++i)
+        {
+            APEX_timing_reset(sweep.timings[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run_trace(&trace, program, &sweep, 0, trace.header->num_entries);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        serial_seconds = (end.tv_sec - start.tv_sec) +
+                         (end.tv_nsec - start.tv_nsec) / 1e9;
+        for (i = 0; i < sweep.num_configs; ++i)
+        {
+            serial_results[i] = *APEX_timing_get_stats(sweep.timings[i]);
+        }
+    }
+    if (trace_path)
+    {
+        trace_close(&trace);
+    }
+
+    for (i = 0; i < sweep.num_configs; ++i)
+    {
+        print_result(&sweep.configs[i], &results[i], status);
+        if (compare)
+        {
+            compare_pipeline(program, words, count, &sweep.configs[i],
+                             &results[i]);
+        }
+        if (check)
+        {
+            printf("serial cycles=%llu error=%+.4f%%\n",
+                   (unsigned long long)serial_results[i].cycles,
+                   serial_results[i].cycles
+                       ? 100.0 * ((double)results[i].cycles -
+                                  serial_results[i].cycles) /
+                             serial_results[i].cycles
+                       : 0.0);
+        }
+    }
+
+    instructions = results[0].instructions;
+    fprintf(stderr, "APEX_Retime: %llu instructions, %d configurations in %.3f s"
+                    " (%.1f million per second), %s\n",
+            (unsigned long long)instructions, sweep.num_configs, seconds,
+            seconds > 0 ? instructions / seconds / 1e6 : 0.0,
+            trace_path ? "from the trace"
+                       : serial ? "serial" : "front and back threads");
+    if (check)
+    {
+        fprintf(stderr, "APEX_Retime: %d segments with %llu warmup"
+                        " instructions, %.2fx the speed of one serial pass"
+                        " (%.3f s)\n",
+                num_segments, (unsigned long long)warmup,
+                seconds > 0 ? serial_seconds / seconds : 0.0, serial_seconds);
+    }
+
+    sweep_destroy(&sweep);
+    free(sweep.configs);
+    free(serial_results);
+    free(results);
+    free(specs);
+    free(words);
+    free(state);
+    APEX_program_release(program);
+    return 0;
+}
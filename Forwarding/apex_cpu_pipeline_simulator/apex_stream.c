@@ -0,0 +1,365 @@
+/*
+ * apex_stream.c
+ * Contains event streams, the cycles of a running instance published to
+ * other processes through shared memory
+ *
+ * The stream is a ring of APEX_PipeEvent in a POSIX shared memory object,
+ * mapped by the simulator and by any number of readers. The simulator is
+ * the only writer: it fills the slot after the last published one and
+ * stores the new head with release semantics every STREAM_BATCH events, so
+ * the cycle loop costs a few stores per cycle and no system call. Readers
+ * load the head, use the events in place and never write to the mapping.
+ * Nothing stops the simulator from lapping a slow reader; the events it
+ * overwrote are reported as lost. Up to STREAM_BATCH slots past the head
+ * may be in the middle of being written, so a reader only trusts the
+ * capacity - STREAM_BATCH events below the head.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+
+#define STREAM_MAGIC "APEXSTR1"
+#define STREAM_BATCH 64
+#define STREAM_MAX_EVENTS (1u << 26)
+
+/* Offset of the ring in the mapping, past the header */
+#define STREAM_EVENTS_OFFSET 128
+
+/* Start of the shared mapping; the head has a cache line to itself */
+typedef struct Stream_Header
+{
+    char magic[8];
+    uint32_t capacity;                          /* Events, a power of two */
+    uint32_t event_size;
+    uint64_t head __attribute__((aligned(64))); /* Events published */
+    uint32_t done;                              /* Run over, the head is final */
+} Stream_Header;
+
+struct APEX_Stream
+{
+    char *name;
+    Stream_Header *shared;
+    APEX_PipeEvent *events;
+    size_t size;                /* Of the mapping */
+    uint32_t mask;
+    uint64_t head;              /* Events written, published or not */
+    int clock;                  /* Of the instance after the last event */
+    int retired;
+};
+
+struct APEX_StreamReader
+{
+    const Stream_Header *shared;
+    const APEX_PipeEvent *events;
+    size_t size;
+    uint32_t capacity;
+    uint64_t tail;              /* Next event to read */
+    uint64_t lost;
+};
+
+/*
+ * Creates the shared memory object 'name' (as for shm_open, e.g.
+ * "/apex-run") holding a ring of at least 'capacity' events, replacing a
+ * stale one of that name. Returns NULL if it cannot be created.
+ */
+APEX_Stream *
+APEX_stream_create(const char *name, int capacity)
+{
+    APEX_Stream *stream;
+    uint32_t events = STREAM_BATCH * 2;
+    void *map;
+    int fd;
+
+    while (events < (uint32_t)capacity && events < STREAM_MAX_EVENTS)
+    {
+        events <<= 1;
+    }
+
+    stream = calloc(1, sizeof(APEX_Stream));
+    if (!stream)
+    {
+        return NULL;
+    }
+    stream->name = strdup(name);
+    stream->size = STREAM_EVENTS_OFFSET + sizeof(APEX_PipeEvent) * events;
+    stream->mask = events - 1;
+
+    shm_unlink(name);
+    fd = stream->name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600)
+                      : -1;
+    if (fd < 0)
+    {
+        free(stream->name);
+        free(stream);
+        return NULL;
+    }
+    map = ftruncate(fd, stream->size) == 0
+              ? mmap(NULL, stream->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+              : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name);
+        free(stream->name);
+        free(stream);
+        return NULL;
+    }
+
+    /* The magic goes last, a reader ignores the object until it is there */
+    stream->shared = map;
+    stream->events = (APEX_PipeEvent *)((char *)map + STREAM_EVENTS_OFFSET);
+    stream->shared->capacity = events;
+    stream->shared->event_size = sizeof(APEX_PipeEvent);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(stream->shared->magic, STREAM_MAGIC, sizeof(stream->shared->magic));
+    return stream;
+}
+
+static void
+stream_publish(APEX_Stream *stream)
+{
+    __atomic_store_n(&stream->shared->head, stream->head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Publishes the last events and marks the stream done. Readers already
+ * attached keep their mapping; the name is removed.
+ */
+void
+APEX_stream_destroy(APEX_Stream *stream)
+{
+    if (stream)
+    {
+        stream_publish(stream);
+        __atomic_store_n(&stream->shared->done, TRUE, __ATOMIC_RELEASE);
+        munmap(stream->shared, stream->size);
+        shm_unlink(stream->name);
+        free(stream->name);
+        free(stream);
+    }
+}
+
+/*
+ * Publishes every cycle 'cpu' simulates from now on to 'stream', which must
+ * outlive the run and serve only this instance; NULL stops it, as does
+ * APEX_cpu_reset
+ */
+void
+APEX_cpu_set_stream(APEX_CPU *cpu, APEX_Stream *stream)
+{
+    cpu->stream = stream;
+    if (stream)
+    {
+        stream->clock = cpu->clock;
+        stream->retired = cpu->insn_completed;
+    }
+}
+
+/*
+ * Called after every advance of a streamed instance, with the statistics
+ * taken before it. Fast-forwarded idle cycles are part of the same event.
+ */
+void
+apex_stream_cycle(APEX_CPU *cpu, const APEX_Stats *before)
+{
+    APEX_Stream *stream = cpu->stream;
+    APEX_PipeEvent *event = &stream->events[stream->head & stream->mask];
+    const CPU_Stage *stages[APEX_NUM_STAGES] = {
+        &cpu->fetch, &cpu->decode, &cpu->execute,
+        &cpu->memory1, &cpu->memory, &cpu->writeback};
+    int stalls = 0;
+    int i;
+
+    for (i = 0; i < APEX_NUM_STAGES; ++i)
+    {
+        event->pc[i] = stages[i]->has_insn ? stages[i]->pc : -1;
+    }
+
+    if (cpu->stall && cpu->decode.has_insn)
+    {
+        stalls |= APEX_STALL_DATA;
+    }
+    if (cpu->stats.structural_stalls != before->structural_stalls)
+    {
+        stalls |= APEX_STALL_STRUCTURAL;
+    }
+    if (cpu->stats.execute_busy_cycles != before->execute_busy_cycles)
+    {
+        stalls |= APEX_STALL_MUL;
+    }
+    if (cpu->stats.memory_busy_cycles != before->memory_busy_cycles)
+    {
+        stalls |= APEX_STALL_MEMORY;
+    }
+
+    event->cycle = (uint64_t)stream->clock + 1;
+    event->cycles = cpu->clock - stream->clock;
+    event->redirect_pc = cpu->redirect_pc;
+    event->stalls = stalls;
+    event->forwards = cpu->forwards;
+    event->retired = cpu->insn_completed - stream->retired;
+    stream->clock = cpu->clock;
+    stream->retired = cpu->insn_completed;
+
+    if ((++stream->head & (STREAM_BATCH - 1)) == 0 ||
+        cpu->status != APEX_STATUS_RUNNING)
+    {
+        stream_publish(stream);
+    }
+}
+
+/*
+ * Maps the stream 'name' for reading, starting at its oldest event still
+ * in the ring. Returns NULL if there is no such stream yet.
+ */
+APEX_StreamReader *
+APEX_stream_attach(const char *name)
+{
+    APEX_StreamReader *reader;
+    const Stream_Header *shared;
+    struct stat st;
+    void *map;
+    uint64_t head;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < STREAM_EVENTS_OFFSET)
+    {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    shared = map;
+    if (memcmp(shared->magic, STREAM_MAGIC, sizeof(shared->magic)) != 0)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (shared->event_size != sizeof(APEX_PipeEvent) ||
+        shared->capacity < STREAM_BATCH * 2 ||
+        (shared->capacity & (shared->capacity - 1)) != 0 ||
+        (size_t)st.st_size < STREAM_EVENTS_OFFSET +
+                                 sizeof(APEX_PipeEvent) * shared->capacity)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    reader = calloc(1, sizeof(APEX_StreamReader));
+    if (!reader)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    reader->shared = shared;
+    reader->events =
+        (const APEX_PipeEvent *)((const char *)map + STREAM_EVENTS_OFFSET);
+    reader->size = st.st_size;
+    reader->capacity = shared->capacity;
+
+    head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+    if (head + STREAM_BATCH > reader->capacity)
+    {
+        reader->tail = head + STREAM_BATCH - reader->capacity;
+    }
+    return reader;
+}
+
+void
+APEX_stream_detach(APEX_StreamReader *reader)
+{
+    if (reader)
+    {
+        munmap((void *)reader->shared, reader->size);
+        free(reader);
+    }
+}
+
+/* Index of the oldest event the writer cannot be overwriting at 'head' */
+static uint64_t
+stream_oldest(const APEX_StreamReader *reader, uint64_t head)
+{
+    return head + STREAM_BATCH > reader->capacity
+               ? head + STREAM_BATCH - reader->capacity
+               : 0;
+}
+
+/*
+ * Points '*events' at the next events, in the ring itself, and returns how
+ * many follow in order there: 0 if none yet, -1 once the stream is done
+ * and every event has been read
+ */
+int
+APEX_stream_poll(APEX_StreamReader *reader, const APEX_PipeEvent **events)
+{
+    int done = __atomic_load_n(&reader->shared->done, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&reader->shared->head, __ATOMIC_ACQUIRE);
+    uint64_t oldest = stream_oldest(reader, head);
+    uint32_t index, count;
+
+    if (reader->tail < oldest)
+    {
+        reader->lost += oldest - reader->tail;
+        reader->tail = oldest;
+    }
+    if (reader->tail == head)
+    {
+        return done ? -1 : 0;
+    }
+
+    index = reader->tail & (reader->capacity - 1);
+    count = head - reader->tail;
+    if (count > reader->capacity - index)
+    {
+        count = reader->capacity - index;
+    }
+    *events = &reader->events[index];
+    return count;
+}
+
+/*
+ * Moves past the first 'count' events of the last poll. Returns -1 if the
+ * simulator overwrote any of them while they were being used; those are
+ * counted as lost.
+ */
+int
+APEX_stream_consume(APEX_StreamReader *reader, int count)
+{
+    uint64_t head = __atomic_load_n(&reader->shared->head, __ATOMIC_ACQUIRE);
+    uint64_t oldest = stream_oldest(reader, head);
+    uint64_t first = reader->tail;
+
+    reader->tail += count;
+    if (first >= oldest)
+    {
+        return 0;
+    }
+    reader->lost += (reader->tail < oldest ? reader->tail : oldest) - first;
+    return -1;
+}
+
+/* Events the reader never saw or saw overwritten */
+uint64_t
+APEX_stream_lost(const APEX_StreamReader *reader)
+{
+    return reader->lost;
+}
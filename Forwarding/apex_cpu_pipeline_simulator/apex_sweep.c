@@ -0,0 +1,285 @@
+/*
+ * apex_sweep.c
+ * apex-sweep, runs one program over many data images on the batched
+ * functional engine, APEX_LANES_MAX (or --lanes) images at a time
+ *
+ * Only the architectural outcome is computed, there is no pipeline timing.
+ * --check also runs every image on the scalar functional model and fails on
+ * the first lane whose final state differs; --scalar runs the scalar model
+ * alone, as a throughput baseline.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+#define DEFAULT_MAX_INSNS 1000000
+
+typedef struct Sweep_Image
+{
+    const char *path;
+    int *words;
+    int count;
+} Sweep_Image;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--lanes <1-%d>] [--isa <name>]"
+                    " [--max-insns <N>] [--check | --scalar] <program.asm>"
+                    " <data file>...\n", prog, APEX_LANES_MAX);
+    exit(1);
+}
+
+static int
+load_image(Sweep_Image *image)
+{
+    size_t len;
+    char *text;
+
+    text = apex_read_file(image->path, &len);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", image->path);
+        return -1;
+    }
+
+    image->words = malloc(sizeof(int) * DATA_MEMORY_SIZE);
+    image->count = image->words
+                       ? APEX_parse_data(text, len, image->words, DATA_MEMORY_SIZE)
+                       : -1;
+    free(text);
+    if (image->count < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", image->path);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+print_result(int index, const Sweep_Image *image, const APEX_ArchState *state)
+{
+    printf("image=%d data=%s status=%s instructions=%d pc=%d state=%08x\n",
+           index, image->path, apex_status_name(state->status, 0),
+           state->retired, state->pc, apex_arch_state_hash(state));
+}
+
+/* Names the first difference between two final states, 0 if they agree */
+static int
+compare_states(const APEX_ArchState *lane, const APEX_ArchState *scalar)
+{
+    int i;
+
+    if (lane->status != scalar->status || lane->pc != scalar->pc ||
+        lane->retired != scalar->retired)
+    {
+        fprintf(stderr, "  status %d/%d pc %d/%d instructions %d/%d\n",
+                lane->status, scalar->status, lane->pc, scalar->pc,
+                lane->retired, scalar->retired);
+        return -1;
+    }
+    if (lane->z != scalar->z || lane->n != scalar->n || lane->p != scalar->p)
+    {
+        fprintf(stderr, "  flags z%d n%d p%d / z%d n%d p%d\n", lane->z,
+                lane->n, lane->p, scalar->z, scalar->n, scalar->p);
+        return -1;
+    }
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (lane->regs[i] != scalar->regs[i])
+        {
+            fprintf(stderr, "  R%d %d/%d\n", i, lane->regs[i], scalar->regs[i]);
+            return -1;
+        }
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (lane->data_memory[i] != scalar->data_memory[i])
+        {
+            fprintf(stderr, "  MEM[%d] %d/%d\n", i, lane->data_memory[i],
+                    scalar->data_memory[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+run_scalar(APEX_Program *program, const Sweep_Image *image, int max_insns,
+           APEX_ArchState *state)
+{
+    APEX_func_init(state);
+    memcpy(state->data_memory, image->words, sizeof(int) * image->count);
+    APEX_func_run(state, program, max_insns);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_Program *program;
+    APEX_ArchState *state, *reference;
+    Sweep_Image *images;
+    struct timespec start, end;
+    const char *program_file = NULL;
+    const char *isa = NULL;
+    int num_lanes = APEX_LANES_MAX;
+    int max_insns = DEFAULT_MAX_INSNS;
+    int check = FALSE, scalar = FALSE, mismatches = 0;
+    int num_images = 0, i, first, lane;
+    double seconds, instructions = 0;
+
+    images = calloc(argc, sizeof(Sweep_Image));
+    state = malloc(sizeof(APEX_ArchState));
+    reference = malloc(sizeof(APEX_ArchState));
+    if (!images || !state || !reference)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)
+        {
+            num_lanes = atoi(argv[++i]);
+            if (num_lanes < 1 || num_lanes > APEX_LANES_MAX)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+        {
+            isa = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc)
+        {
+            /* 0 runs until every image halts or faults */
+            max_insns = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            check = TRUE;
+        }
+        else if (strcmp(argv[i], "--scalar") == 0)
+        {
+            scalar = TRUE;
+        }
+        else if (argv[i][0] == '-')
+        {
+            print_usage(argv[0]);
+        }
+        else if (!program_file)
+        {
+            program_file = argv[i];
+        }
+        else
+        {
+            images[num_images++].path = argv[i];
+        }
+    }
+    if (!program_file || !num_images || (check && scalar))
+    {
+        print_usage(argv[0]);
+    }
+
+    program = apex_load_program(program_file);
+    if (!program)
+    {
+        exit(1);
+    }
+    for (i = 0; i < num_images; ++i)
+    {
+        if (load_image(&images[i]))
+        {
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (first = 0; first < num_images; first += num_lanes)
+    {
+        int count = num_images - first < num_lanes ? num_images - first : num_lanes;
+        APEX_Lanes *lanes = NULL;
+
+        if (scalar)
+        {
+            for (lane = 0; lane < count; ++lane)
+            {
+                run_scalar(program, &images[first + lane], max_insns, state);
+                instructions += state->retired;
+                print_result(first + lane, &images[first + lane], state);
+            }
+            continue;
+        }
+
+        lanes = APEX_lanes_create(program, count);
+        if (!lanes)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory\n");
+            exit(1);
+        }
+        if (isa && APEX_lanes_set_isa(lanes, isa))
+        {
+            fprintf(stderr, "APEX_Error: Instruction set '%s' is not available\n",
+                    isa);
+            exit(1);
+        }
+        for (lane = 0; lane < count; ++lane)
+        {
+            APEX_lanes_load_data(lanes, lane, 0, images[first + lane].words,
+                                 images[first + lane].count);
+        }
+
+        APEX_lanes_run(lanes, max_insns);
+
+        for (lane = 0; lane < count; ++lane)
+        {
+            APEX_lanes_get_state(lanes, lane, state);
+            instructions += state->retired;
+            print_result(first + lane, &images[first + lane], state);
+
+            if (check)
+            {
+                run_scalar(program, &images[first + lane], max_insns, reference);
+                if (compare_states(state, reference))
+                {
+                    fprintf(stderr, "APEX_Error: image %d (%s) differs from the"
+                                    " scalar model\n",
+                            first + lane, images[first + lane].path);
+                    mismatches++;
+                }
+            }
+        }
+        if (first == 0)
+        {
+            fprintf(stderr, "APEX_Sweep: %d lanes, %s\n", num_lanes,
+                    APEX_lanes_get_isa(lanes));
+        }
+        APEX_lanes_destroy(lanes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "APEX_Sweep: %d images, %.0f instructions in %.3f s"
+                    " (%.1f million per second)\n",
+            num_images, instructions, seconds,
+            seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+
+    for (i = 0; i < num_images; ++i)
+    {
+        free(images[i].words);
+    }
+    free(images);
+    free(state);
+    free(reference);
+    APEX_program_release(program);
+    return mismatches ? 1 : 0;
+}
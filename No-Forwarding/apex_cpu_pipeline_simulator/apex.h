@@ -0,0 +1,552 @@
+/*
+ * apex.h
+ * Public interface of libapex, the APEX pipeline simulator as a library
+ *
+ * Every APEX_CPU is an independent instance without global state, so
+ * separate instances can be driven from separate threads. A parsed
+ * APEX_Program is immutable and may be shared by any number of instances.
+ * The library performs no I/O: trace output and diagnostics are handed to
+ * the log sink installed with APEX_cpu_set_log.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_H_
+#define _APEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "apex_macros.h"
+
+/* Format of an APEX instruction  */
+typedef struct APEX_Instruction
+{
+    char opcode_str[128];
+    int opcode;
+    int rd;
+    int rs1;
+    int rs2;
+    int rs3;
+    int imm;
+    int N;
+    int P;
+    int Z;
+    int cc;
+} APEX_Instruction;
+
+/* Timing parameters of the pipeline model */
+typedef struct APEX_Config
+{
+    int memory_latency;  /* Cycles LOAD/STORE/LDR/STR occupy the Memory stage */
+    int mul_latency;     /* Cycles MUL occupies the Execute stage */
+    int watchdog_cycles; /* Cycles without retirement before aborting, 0 = off */
+    int ideal;           /* APEX_IDEAL_* bottlenecks removed, 0 = none */
+} APEX_Config;
+
+/*
+ * Per-cycle statistics. Every field must be a uint64_t counter: cycles that
+ * are fast-forwarded by the event wheel are accounted for by replaying the
+ * counter deltas of the idle cycle that preceded them.
+ */
+typedef struct APEX_Stats
+{
+    uint64_t skipped_cycles;        /* Cycles fast-forwarded, not simulated */
+    uint64_t execute_busy_cycles;   /* Extra cycles of multi-cycle MULs */
+    uint64_t memory_busy_cycles;    /* Extra cycles of multi-cycle memory ops */
+    uint64_t structural_stalls;     /* Stage-cycles held behind a full latch */
+    uint64_t data_stalls;           /* Cycles Decode waited for an operand */
+    uint64_t flushes;               /* Branch redirects squashing the front end */
+} APEX_Stats;
+
+/* Cycles of a run by APEX_CPI_* cause; every cycle has exactly one */
+typedef struct APEX_CpiStack
+{
+    uint64_t cycles[APEX_CPI_CAUSES];
+} APEX_CpiStack;
+
+/*
+ * Histogram with log2 buckets: bucket 0 counts the zeros, bucket b the
+ * values from 2^(b-1) to 2^b - 1
+ */
+typedef struct APEX_Histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[APEX_HIST_BUCKETS];
+} APEX_Histogram;
+
+/* Lifecycles of the instructions a run retired, by APEX_OPCLASS_* */
+typedef struct APEX_Latencies
+{
+    APEX_Histogram fetch_to_retire[APEX_OPCLASSES]; /* Cycles, both ends included */
+    APEX_Histogram decode_wait[APEX_OPCLASSES];     /* Cycles Decode held it past one */
+} APEX_Latencies;
+
+/* Data accesses of a traced run */
+typedef struct APEX_MemStats
+{
+    uint64_t reads;             /* LOAD and LDR */
+    uint64_t writes;            /* STORE and STR */
+    uint64_t outside;           /* At an address outside data memory */
+    uint64_t cold;              /* First accesses to a block */
+    APEX_Histogram reuse;       /* Reuse distances of the others, in blocks */
+} APEX_MemStats;
+
+/* Dataflow limit of the instructions a run retired */
+typedef struct APEX_DataflowStats
+{
+    uint64_t instructions;      /* Retired while analysed */
+    uint64_t critical_path;     /* Longest dependence chain, in instructions */
+    uint64_t critical_cycles;   /* Longest chain, in cycles of its latencies */
+    uint64_t dependences;       /* True ones, through registers, flags, memory */
+    uint64_t memory_dependences; /* Loads of a value stored while analysed */
+    APEX_Histogram distance;    /* Instructions from producer to consumer */
+} APEX_DataflowStats;
+
+/* Cost of one instruction of the program over a profiled run */
+typedef struct APEX_PcProfile
+{
+    uint64_t executions;        /* Times it retired */
+    uint64_t stall_cycles;      /* Cycles Decode held it for an operand */
+    uint64_t flushes;           /* Times it redirected fetch */
+    uint64_t latency_cycles;    /* From fetch to retirement, summed */
+} APEX_PcProfile;
+
+/* Architectural state of the ISA-level functional model */
+typedef struct APEX_ArchState
+{
+    int pc;
+    int status;                        /* APEX_STATUS_* */
+    int retired;                       /* Instructions executed */
+    int z;                             /* Condition codes, 0 or 1 */
+    int n;
+    int p;
+    int regs[REG_FILE_SIZE];
+    int data_memory[DATA_MEMORY_SIZE];
+} APEX_ArchState;
+
+/* What one functional step changed, -1 for no register or memory write */
+typedef struct APEX_FuncEffect
+{
+    int pc;
+    int opcode;
+    int rd;
+    int rd_value;
+    int mem_address;
+    int mem_value;
+    int load_address;  /* Data address a LOAD/LDR read, -1 if none */
+    int next_pc;
+} APEX_FuncEffect;
+
+/* One retired instruction, as the trace timing model sees it */
+typedef struct APEX_TraceRecord
+{
+    int pc;
+    int opcode;
+    int rd;            /* Register written, -1 if none */
+    int rs1;           /* Registers read, -1 if unused */
+    int rs2;
+    int rs3;
+    int mem_address;   /* Data address read or written, -1 if none */
+    int next_pc;       /* Differs from pc + 4 for taken branches and jumps */
+} APEX_TraceRecord;
+
+/* Parameters of the trace timing model */
+typedef struct APEX_TimingConfig
+{
+    int forwarding;      /* Results bypass to Execute, else wait for Writeback */
+    int memory_latency;  /* Cycles LOAD/STORE/LDR/STR occupy the Memory stage */
+    int mul_latency;     /* Cycles MUL occupies the Execute stage */
+    int branch_stage;    /* APEX_STAGE_* redirecting fetch on a taken branch */
+} APEX_TimingConfig;
+
+typedef struct APEX_TimingStats
+{
+    uint64_t cycles;            /* Clock at which the last instruction retired */
+    uint64_t instructions;
+    uint64_t data_stalls;       /* Cycles Decode held an instruction for operands */
+    uint64_t structural_stalls; /* Stage-cycles held behind a full latch */
+    uint64_t flush_cycles;      /* Fetch cycles lost to taken branches */
+    uint64_t taken_branches;
+} APEX_TimingStats;
+
+/* One instruction retired by the pipeline, as the retirement trace holds it */
+typedef struct APEX_RetireRecord
+{
+    uint64_t cycle;    /* Clock of the cycle it left Writeback in, from 1 */
+    int pc;
+    int opcode;        /* As in the program, branches are not NOPs here */
+    int rd;            /* Register written, -1 if none */
+    int rd_value;
+    int mem_address;   /* Data address read or written, -1 if none */
+    int mem_value;     /* Word loaded or stored */
+    int flags;         /* APEX_FLAG_* after the instruction */
+    uint32_t stalls[APEX_CPI_CAUSES]; /* Cycles since the last retirement,
+                                         by CPI stack cause, 0 for base */
+} APEX_RetireRecord;
+
+/* How far a co-simulated run agrees with the functional model */
+typedef struct APEX_CosimReport
+{
+    uint64_t checked;           /* Retirements stepped in lockstep */
+    int mismatch;               /* APEX_COSIM_*, APEX_COSIM_NONE if none yet */
+    uint64_t retirement;        /* Index of the divergent one, from 1 */
+    uint64_t first;             /* First retirement its check covered */
+    int cycle;                  /* Clock it was found at */
+    APEX_RetireRecord actual;   /* What the pipeline retired, or holds */
+    APEX_FuncEffect expected;   /* What the functional model did, or holds */
+    uint64_t actual_hash;       /* APEX_COSIM_HASH: of the interval */
+    uint64_t expected_hash;
+    char insn[32];              /* Mnemonic at the pc, "" outside the code */
+} APEX_CosimReport;
+
+/*
+ * Progress of a running instance as a monitor publishes it. The simulator
+ * rewrites it in place; APEX_counters_read takes a consistent copy.
+ */
+typedef struct APEX_Counters
+{
+    char magic[8];
+    uint32_t sequence;              /* Odd while being rewritten */
+    int32_t pid;                    /* Of the simulator */
+    int32_t status;                 /* APEX_STATUS_* */
+    int32_t pc;
+    uint64_t cycles;
+    uint64_t retired;
+    uint64_t data_stalls;
+    uint64_t structural_stalls;
+    uint64_t execute_busy_cycles;
+    uint64_t memory_busy_cycles;
+    uint64_t flushes;
+    uint64_t skipped_cycles;
+    uint64_t host_ns;               /* Wall time since the monitor started */
+    uint64_t cycles_per_sec;        /* Host speed over the last interval */
+} APEX_Counters;
+
+/* The pipeline during one cycle, as an event stream publishes it */
+typedef struct APEX_PipeEvent
+{
+    uint64_t cycle;                /* From 1 */
+    uint32_t cycles;               /* Cycles it stands for, idle ones repeat it */
+    int32_t pc[APEX_NUM_STAGES];   /* In each stage after the cycle, -1 if none */
+    int32_t redirect_pc;           /* Target fetch was redirected to, -1 if none */
+    uint16_t stalls;               /* APEX_STALL_* */
+    uint8_t forwards;              /* APEX_FORWARD_* */
+    uint8_t retired;               /* Instructions retired */
+} APEX_PipeEvent;
+
+typedef struct APEX_Program APEX_Program;
+typedef struct APEX_CPU APEX_CPU;
+typedef struct APEX_Lanes APEX_Lanes;
+typedef struct APEX_Recording APEX_Recording;
+typedef struct APEX_Image APEX_Image;
+typedef struct APEX_Timing APEX_Timing;
+typedef struct APEX_RetireWriter APEX_RetireWriter;
+typedef struct APEX_RetireReader APEX_RetireReader;
+typedef struct APEX_Stream APEX_Stream;
+typedef struct APEX_StreamReader APEX_StreamReader;
+typedef struct APEX_Monitor APEX_Monitor;
+typedef struct APEX_Profile APEX_Profile;
+typedef struct APEX_PipeView APEX_PipeView;
+typedef struct APEX_Series APEX_Series;
+typedef struct APEX_MemTrace APEX_MemTrace;
+typedef struct APEX_Dataflow APEX_Dataflow;
+typedef struct APEX_Cosim APEX_Cosim;
+
+/*
+ * Receives the text the simulator would print, on one of the APEX_LOG_*
+ * channels. 'text' is not necessarily a whole line.
+ */
+typedef void (*APEX_LogFn)(void *ctx, int channel, const char *text);
+
+/* Receives the bytes of a serialized stream, returns 0 once all are written */
+typedef int (*APEX_WriteFn)(void *ctx, const void *data, size_t len);
+
+/* Receives every instruction an instance retires, as it leaves Writeback */
+typedef void (*APEX_RetireFn)(void *ctx, const APEX_RetireRecord *record);
+
+/* Polled by APEX_cpu_run_until after every simulated cycle, TRUE stops */
+typedef int (*APEX_StopFn)(const APEX_CPU *cpu, void *ctx);
+
+/* Changes whenever the timing model may produce different results */
+const char *APEX_model_version(void);
+void APEX_config_default(APEX_Config *config);
+
+/* Programs, parsed from the text of an .asm file */
+APEX_Program *APEX_program_parse(const char *text, size_t len, char *error,
+                                 size_t error_size);
+APEX_Program *APEX_program_retain(APEX_Program *program);
+void APEX_program_release(APEX_Program *program);
+int APEX_program_size(const APEX_Program *program);
+const APEX_Instruction *APEX_program_instruction(const APEX_Program *program,
+                                                 int index);
+void APEX_format_instruction(const APEX_Instruction *insn, char *buf,
+                             size_t size);
+
+/* Parses the text of a data memory file, a list of comma separated words */
+int APEX_parse_data(const char *text, size_t len, int *words, int max_words);
+
+/*
+ * Data memory images, immutable and shared copy-on-write by every instance
+ * mapping them: an instance only owns the pages it has stored to
+ */
+APEX_Image *APEX_image_create(const int *words, int count);
+APEX_Image *APEX_image_retain(APEX_Image *image);
+void APEX_image_release(APEX_Image *image);
+
+/* Instances */
+APEX_CPU *APEX_cpu_create(APEX_Program *program, const APEX_Config *config);
+int APEX_cpu_reset(APEX_CPU *cpu, APEX_Program *program,
+                   const APEX_Config *config);
+APEX_CPU *APEX_cpu_create_from_buffer(const char *text, size_t len,
+                                      const APEX_Config *config);
+void APEX_cpu_destroy(APEX_CPU *cpu);
+void APEX_cpu_set_log(APEX_CPU *cpu, APEX_LogFn log_fn, void *ctx);
+int APEX_cpu_load_data(APEX_CPU *cpu, int address, const int *words, int count);
+int APEX_cpu_map_image(APEX_CPU *cpu, const APEX_Image *image);
+
+/* Running, all return the APEX_STATUS_* the instance is left in */
+int APEX_cpu_step(APEX_CPU *cpu, int cycles);
+int APEX_cpu_run_until(APEX_CPU *cpu, APEX_StopFn stop, void *ctx,
+                       int max_cycles);
+int APEX_cpu_run_until_pc(APEX_CPU *cpu, int pc, int max_cycles);
+int APEX_cpu_run_until_cycle(APEX_CPU *cpu, int cycle);
+
+/* Queries */
+int APEX_cpu_get_status(const APEX_CPU *cpu);
+int APEX_cpu_get_watchdog_reason(const APEX_CPU *cpu);
+int APEX_cpu_get_pc(const APEX_CPU *cpu);
+int APEX_cpu_get_clock(const APEX_CPU *cpu);
+int APEX_cpu_get_retired(const APEX_CPU *cpu);
+int APEX_cpu_get_reg(const APEX_CPU *cpu, int reg);
+int APEX_cpu_get_mem(const APEX_CPU *cpu, int address);
+const int *APEX_cpu_get_regs(const APEX_CPU *cpu);
+const int *APEX_cpu_get_data_memory(const APEX_CPU *cpu);
+void APEX_cpu_get_cc(const APEX_CPU *cpu, int *z, int *n, int *p);
+const APEX_Stats *APEX_cpu_get_stats(const APEX_CPU *cpu);
+const APEX_CpiStack *APEX_cpu_get_cpi_stack(const APEX_CPU *cpu);
+const APEX_Latencies *APEX_cpu_get_latencies(const APEX_CPU *cpu);
+
+/* ISA-level functional model, no timing */
+void APEX_func_init(APEX_ArchState *state);
+int APEX_func_step(APEX_ArchState *state, const APEX_Program *program,
+                   APEX_FuncEffect *effect);
+int APEX_func_run(APEX_ArchState *state, const APEX_Program *program,
+                  int max_insns);
+int APEX_func_trace(APEX_ArchState *state, const APEX_Program *program,
+                    APEX_TraceRecord *record);
+int APEX_trace_record_fill(APEX_TraceRecord *record, const APEX_Program *program,
+                           int pc, int mem_address, int next_pc);
+
+/*
+ * Trace timing model: the pipeline timing of a stream of retired
+ * instructions, as produced by APEX_func_trace, without their semantics.
+ * Records are timed one at a time and in order; the model keeps only the
+ * state the next record depends on.
+ */
+void APEX_timing_config_default(APEX_TimingConfig *config);
+APEX_Timing *APEX_timing_create(const APEX_TimingConfig *config);
+void APEX_timing_destroy(APEX_Timing *timing);
+void APEX_timing_reset(APEX_Timing *timing);
+void APEX_timing_issue(APEX_Timing *timing, const APEX_TraceRecord *record);
+const APEX_TimingStats *APEX_timing_get_stats(const APEX_Timing *timing);
+
+/*
+ * Batched functional engine: up to APEX_LANES_MAX instances of one program,
+ * each with its own registers, condition codes and data memory, executed
+ * together with SIMD instructions. Every lane ends in the state
+ * APEX_func_run would leave it in.
+ */
+APEX_Lanes *APEX_lanes_create(APEX_Program *program, int num_lanes);
+void APEX_lanes_destroy(APEX_Lanes *lanes);
+int APEX_lanes_count(const APEX_Lanes *lanes);
+const char *APEX_lanes_get_isa(const APEX_Lanes *lanes);
+int APEX_lanes_set_isa(APEX_Lanes *lanes, const char *isa);
+int APEX_lanes_load_data(APEX_Lanes *lanes, int lane, int address,
+                         const int *words, int count);
+int APEX_lanes_run(APEX_Lanes *lanes, int max_insns);
+void APEX_lanes_get_state(const APEX_Lanes *lanes, int lane,
+                          APEX_ArchState *state);
+
+/*
+ * Incremental re-simulation. A recording attached to an instance before it
+ * starts notes the first cycle each page of data memory is read or written
+ * and keeps periodic checkpoints of the whole instance. APEX_cpu_resume
+ * moves a new instance of the same program and timing, whose data memory
+ * differs in a few words, to the last checkpoint taken before any changed
+ * page was touched, so that only the divergent suffix is simulated again.
+ * A saved recording is only valid for the build of the model that made it.
+ */
+APEX_Recording *APEX_recording_create(int interval);
+void APEX_recording_destroy(APEX_Recording *recording);
+int APEX_recording_checkpoints(const APEX_Recording *recording);
+void *APEX_recording_save(const APEX_Recording *recording, size_t *len);
+APEX_Recording *APEX_recording_load(const void *data, size_t len);
+int APEX_cpu_record(APEX_CPU *cpu, APEX_Recording *recording);
+int APEX_cpu_resume(APEX_CPU *cpu, const APEX_Recording *recording,
+                    int max_cycle);
+
+/*
+ * Retirement trace: one record per instruction leaving Writeback, delta
+ * encoded and compressed in blocks of APEX_RETIRE_BLOCK_RECORDS. A writer
+ * attached to an instance before it starts receives every retirement; the
+ * stream is only complete after APEX_retire_writer_finish has appended the
+ * block index. A reader works on the whole stream in memory and can start
+ * at any block. A retire function is handed the same records directly.
+ */
+APEX_RetireWriter *APEX_retire_writer_create(APEX_WriteFn write_fn, void *ctx);
+void APEX_retire_writer_destroy(APEX_RetireWriter *writer);
+int APEX_retire_writer_append(APEX_RetireWriter *writer,
+                              const APEX_RetireRecord *record);
+int APEX_retire_writer_finish(APEX_RetireWriter *writer);
+uint64_t APEX_retire_writer_records(const APEX_RetireWriter *writer);
+uint64_t APEX_retire_writer_bytes(const APEX_RetireWriter *writer);
+void APEX_cpu_set_retire_trace(APEX_CPU *cpu, APEX_RetireWriter *writer);
+void APEX_cpu_set_retire_fn(APEX_CPU *cpu, APEX_RetireFn retire_fn, void *ctx);
+
+APEX_RetireReader *APEX_retire_reader_open(const void *data, size_t len);
+void APEX_retire_reader_close(APEX_RetireReader *reader);
+uint64_t APEX_retire_reader_records(const APEX_RetireReader *reader);
+int APEX_retire_reader_blocks(const APEX_RetireReader *reader);
+int APEX_retire_reader_version(const APEX_RetireReader *reader);
+int APEX_retire_reader_block_info(const APEX_RetireReader *reader, int block,
+                                  uint64_t *first_record, uint64_t *first_cycle);
+int APEX_retire_reader_seek(APEX_RetireReader *reader, int block);
+int APEX_retire_reader_seek_record(APEX_RetireReader *reader, uint64_t record);
+int APEX_retire_reader_next(APEX_RetireReader *reader, APEX_RetireRecord *record);
+
+/*
+ * Event streams: every cycle of an instance is published as an
+ * APEX_PipeEvent into a ring in named shared memory, which other processes
+ * read in place. The simulator never waits for them; a reader that falls
+ * more than a ring behind loses the oldest events and is told how many.
+ */
+APEX_Stream *APEX_stream_create(const char *name, int capacity);
+void APEX_stream_destroy(APEX_Stream *stream);
+void APEX_cpu_set_stream(APEX_CPU *cpu, APEX_Stream *stream);
+
+APEX_StreamReader *APEX_stream_attach(const char *name);
+void APEX_stream_detach(APEX_StreamReader *reader);
+int APEX_stream_poll(APEX_StreamReader *reader, const APEX_PipeEvent **events);
+int APEX_stream_consume(APEX_StreamReader *reader, int count);
+uint64_t APEX_stream_lost(const APEX_StreamReader *reader);
+
+/*
+ * Monitors: every 'interval' cycles an instance publishes its APEX_Counters
+ * into a memory-mapped file other processes poll, and logs a snapshot of
+ * the pipeline on APEX_LOG_DIAG at the end of the cycle a snapshot is
+ * requested in. Requesting one is async-signal-safe.
+ */
+APEX_Monitor *APEX_monitor_create(const char *path, int interval);
+void APEX_monitor_destroy(APEX_Monitor *monitor);
+void APEX_monitor_request_snapshot(APEX_Monitor *monitor);
+void APEX_cpu_set_monitor(APEX_CPU *cpu, APEX_Monitor *monitor);
+int APEX_counters_read(const APEX_Counters *shared, APEX_Counters *copy);
+
+/*
+ * Profiles: the executions, Decode stall cycles, flushes and fetch to
+ * retirement cycles of every instruction of a program, over the runs of
+ * the instances they are attached to
+ */
+APEX_Profile *APEX_profile_create(const APEX_Program *program);
+void APEX_profile_destroy(APEX_Profile *profile);
+const APEX_PcProfile *APEX_profile_entries(const APEX_Profile *profile,
+                                           int *count);
+int APEX_cpu_set_profile(APEX_CPU *cpu, APEX_Profile *profile);
+
+/*
+ * Pipeline views: when every dynamic instruction entered and left each
+ * stage, the cycles a stage held it and the instructions squashed by taken
+ * branches, streamed as text for a pipeline diagram viewer. A view attached
+ * to an instance before it starts shows its whole run; it is only complete
+ * after APEX_pipeview_finish.
+ */
+APEX_PipeView *APEX_pipeview_create(int format, APEX_WriteFn write_fn,
+                                    void *ctx);
+void APEX_pipeview_destroy(APEX_PipeView *view);
+int APEX_pipeview_finish(APEX_PipeView *view);
+uint64_t APEX_pipeview_instructions(const APEX_PipeView *view);
+void APEX_cpu_set_pipeview(APEX_CPU *cpu, APEX_PipeView *view);
+
+/*
+ * Interval series: a record every 'length' cycles or retired instructions
+ * with the IPC, cycles by CPI stack cause, branch redirects, loads, stores
+ * and stage occupancy of the interval, streamed as CSV or a binary
+ * columnar file. Detach the series before APEX_series_finish, which
+ * closes its last interval.
+ */
+APEX_Series *APEX_series_create(int format, int unit, int length,
+                                APEX_WriteFn write_fn, void *ctx);
+void APEX_series_destroy(APEX_Series *series);
+int APEX_series_finish(APEX_Series *series);
+uint64_t APEX_series_records(const APEX_Series *series);
+void APEX_cpu_set_series(APEX_CPU *cpu, APEX_Series *series);
+
+/*
+ * Memory traces: every data access analysed in one pass, for the reuse
+ * distances of its blocks and the LRU misses they imply, a heatmap of the
+ * pages over the run, and the reads and writes. With a write function the
+ * accesses are written out too, complete after APEX_memtrace_finish.
+ */
+APEX_MemTrace *APEX_memtrace_create(int block_words, APEX_WriteFn write_fn,
+                                    void *ctx);
+void APEX_memtrace_destroy(APEX_MemTrace *trace);
+int APEX_memtrace_finish(APEX_MemTrace *trace);
+const APEX_MemStats *APEX_memtrace_stats(const APEX_MemTrace *trace);
+uint64_t APEX_memtrace_lru_misses(const APEX_MemTrace *trace, int blocks);
+void APEX_memtrace_page(const APEX_MemTrace *trace, int page, uint64_t *reads,
+                        uint64_t *writes);
+int APEX_memtrace_json(const APEX_MemTrace *trace, char *buf, size_t size);
+void APEX_cpu_set_memtrace(APEX_CPU *cpu, APEX_MemTrace *trace);
+
+/*
+ * Dataflow analyses: the critical path through the true dependences of the
+ * retired instructions, the ILP it leaves, and the distances of the
+ * dependences, as stats or a JSON object set against the cycles the
+ * pipeline took.
+ */
+APEX_Dataflow *APEX_dataflow_create(void);
+void APEX_dataflow_destroy(APEX_Dataflow *dataflow);
+const APEX_DataflowStats *APEX_dataflow_stats(const APEX_Dataflow *dataflow);
+int APEX_dataflow_json(const APEX_Dataflow *dataflow, uint64_t cycles,
+                       char *buf, size_t size);
+void APEX_cpu_set_dataflow(APEX_CPU *cpu, APEX_Dataflow *dataflow);
+
+/*
+ * Co-simulation: a functional model run in lockstep with the pipeline,
+ * checking every retirement, or the state hash of every 'period'
+ * retirements, until the first divergence, which stops the run with
+ * APEX_STATUS_DIVERGED. APEX_cosim_describe writes the report as one line.
+ */
+APEX_Cosim *APEX_cosim_create(int period);
+void APEX_cosim_destroy(APEX_Cosim *cosim);
+const APEX_CosimReport *APEX_cosim_report(const APEX_Cosim *cosim);
+int APEX_cosim_describe(const APEX_Cosim *cosim, char *buf, size_t size);
+int APEX_cpu_set_cosim(APEX_CPU *cpu, APEX_Cosim *cosim);
+
+/*
+ * Idealized limits: the name of the idealization of bit 'mode' of
+ * APEX_Config.ideal, and the APEX_IDEAL_* bit of a name, 0 if unknown
+ */
+const char *APEX_ideal_name(int mode);
+int APEX_ideal_parse(const char *name);
+
+/* CPI stacks: names of the causes, and the stack as a JSON object */
+const char *APEX_cpi_cause_name(int cause);
+int APEX_cpi_stack_json(const APEX_CpiStack *stack, char *buf, size_t size);
+
+/*
+ * Latency histograms: the opcode classes, an upper bound of a percentile,
+ * and the histograms as a JSON object or CSV table. The writers return the
+ * length of the whole text, like snprintf, so a first call with a size of
+ * 0 tells how large a buffer has to be.
+ */
+int APEX_opcode_class(int opcode);
+const char *APEX_opclass_name(int opclass);
+uint64_t APEX_histogram_percentile(const APEX_Histogram *hist, double fraction);
+int APEX_latencies_json(const APEX_Latencies *latencies, char *buf, size_t size);
+int APEX_latencies_csv(const APEX_Latencies *latencies, char *buf, size_t size);
+#endif
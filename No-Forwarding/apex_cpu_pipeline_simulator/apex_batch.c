@@ -0,0 +1,642 @@
+/*
+ * apex_batch.c
+ * apex-batch, runs a manifest of simulation jobs on a work-stealing pool of
+ * threads, one APEX_CPU per job
+ *
+ * Manifest lines are '<program.asm> <data file or -> [options]', where the
+ * options are the timing options of apex_sim plus '--cycles <budget>'. Blank
+ * lines and lines starting with '#' are ignored. Programs and data files are
+ * parsed once and shared read-only by every job that uses them. With
+ * --cache, results are taken from and added to an on-disk result cache.
+ * With --limits, every job is run again under each idealization of the
+ * pipeline on its own, and its record gives the cycles of those runs next
+ * to its own.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_cache.h"
+#include "apex_client.h"
+
+#define MANIFEST_LINE_SIZE 4096
+#define MANIFEST_MAX_TOKENS 64
+
+/* A program or data file, loaded once per distinct path */
+typedef struct Batch_Input
+{
+    char *path;
+    APEX_Program *program;
+    APEX_Image *image;          /* Mapped copy-on-write by every job */
+} Batch_Input;
+
+typedef struct Batch_Job
+{
+    int line;                   /* Manifest line, for error messages */
+    int program;                /* Index into the program inputs */
+    int data;                   /* Index into the data inputs, -1 for none */
+    APEX_Config config;
+    int max_cycles;             /* Cycle budget, 0 = until HALT or watchdog */
+
+    int status;
+    int watchdog_reason;
+    int cycles;
+    int retired;
+    int pc;
+    APEX_Stats stats;
+    uint32_t state_hash;        /* Hash of the final registers and memory */
+    int cached;                 /* The result came from the cache */
+    int ideal_cycles[APEX_IDEAL_MODES]; /* Under each idealization, -1 failed */
+    int done;
+} Batch_Job;
+
+/*
+ * Work-stealing deque of job indices. The owner takes jobs from the front,
+ * in manifest order, thieves take them from the back. Jobs are coarse, so a
+ * lock per deque costs nothing measurable; each worker sits on its own cache
+ * lines so owners never contend with each other.
+ */
+typedef struct Batch_Worker
+{
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+    int *jobs;
+    int id;
+    pthread_t thread;
+    struct Batch *batch;
+} __attribute__((aligned(64))) Batch_Worker;
+
+typedef struct Batch
+{
+    Batch_Input *programs;
+    int num_programs;
+    Batch_Input *data;
+    int num_data;
+    Batch_Job *jobs;
+    int num_jobs;
+
+    Batch_Worker *workers;
+    int num_workers;
+
+    /* Records are written in manifest order as soon as they are complete */
+    pthread_mutex_t output_lock;
+    FILE *output;
+    int next_record;
+
+    const char *cache_dir;      /* Result cache, NULL for none */
+    int limits;                 /* Run every job under each idealization */
+} Batch;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [-j <threads>] [-o <results>]"
+                    " [--cache <dir> [--cache-limit <MB>]] [--limits] <manifest>\n",
+            prog);
+    exit(1);
+}
+
+/* Returns the index of 'path' in 'inputs', adding it if it is new */
+static int
+find_input(Batch_Input **inputs, int *num_inputs, const char *path)
+{
+    int i;
+
+    for (i = 0; i < *num_inputs; ++i)
+    {
+        if (strcmp((*inputs)[i].path, path) == 0)
+        {
+            return i;
+        }
+    }
+
+    *inputs = realloc(*inputs, sizeof(Batch_Input) * (*num_inputs + 1));
+    if (!*inputs)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    memset(&(*inputs)[i], 0, sizeof(Batch_Input));
+    (*inputs)[i].path = strdup(path);
+    (*num_inputs)++;
+    return i;
+}
+
+static int
+load_data(Batch_Input *input)
+{
+    size_t len;
+    char *text;
+    int *words;
+    int count;
+
+    text = apex_read_file(input->path, &len);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", input->path);
+        return -1;
+    }
+
+    words = malloc(sizeof(int) * DATA_MEMORY_SIZE);
+    count = words ? APEX_parse_data(text, len, words, DATA_MEMORY_SIZE) : -1;
+    free(text);
+    if (count < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", input->path);
+        free(words);
+        return -1;
+    }
+
+    input->image = APEX_image_create(words, count);
+    free(words);
+    if (!input->image)
+    {
+        fprintf(stderr, "APEX_Error: Unable to map %s\n", input->path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Parses one manifest line into a job. Returns -1 on a malformed line. */
+static int
+parse_job(Batch *batch, Batch_Job *job, char *line, int line_number)
+{
+    const char *argv[MANIFEST_MAX_TOKENS];
+    int argc = 0, i;
+    char *save, *token;
+
+    for (token = strtok_r(line, " \t\r\n", &save);
+         token && argc < MANIFEST_MAX_TOKENS;
+         token = strtok_r(NULL, " \t\r\n", &save))
+    {
+        argv[argc++] = token;
+    }
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "APEX_Error: manifest line %d: expected "
+                        "'<program> <data> [options]'\n", line_number);
+        return -1;
+    }
+
+    memset(job, 0, sizeof(Batch_Job));
+    job->line = line_number;
+    APEX_config_default(&job->config);
+    job->program = find_input(&batch->programs, &batch->num_programs, argv[0]);
+    job->data = strcmp(argv[1], "-") == 0
+                    ? -1
+                    : find_input(&batch->data, &batch->num_data, argv[1]);
+
+    for (i = 2; i < argc; ++i)
+    {
+        int parsed = apex_parse_config_option(&job->config, argc, argv, &i);
+
+        if (parsed == 0 && strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            job->max_cycles = atoi(argv[++i]);
+            parsed = job->max_cycles >= 0 ? 1 : -1;
+        }
+        if (parsed != 1)
+        {
+            fprintf(stderr, "APEX_Error: manifest line %d: bad option '%s'\n",
+                    line_number, argv[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+read_manifest(Batch *batch, const char *filename)
+{
+    char line[MANIFEST_LINE_SIZE];
+    int line_number = 0, capacity = 0, i;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *start = line + strspn(line, " \t\r\n");
+
+        line_number++;
+        if (*start == '\0' || *start == '#')
+        {
+            continue;
+        }
+
+        if (batch->num_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            batch->jobs = realloc(batch->jobs, sizeof(Batch_Job) * capacity);
+            if (!batch->jobs)
+            {
+                fprintf(stderr, "APEX_Error: Out of memory\n");
+                exit(1);
+            }
+        }
+
+        if (parse_job(batch, &batch->jobs[batch->num_jobs], start, line_number))
+        {
+            fclose(fp);
+            return -1;
+        }
+        batch->num_jobs++;
+    }
+    fclose(fp);
+
+    /* Every distinct program and data file is parsed exactly once */
+    for (i = 0; i < batch->num_programs; ++i)
+    {
+        batch->programs[i].program = apex_load_program(batch->programs[i].path);
+        if (!batch->programs[i].program)
+        {
+            fprintf(stderr, "APEX_Error: Unable to load %s\n",
+                    batch->programs[i].path);
+            return -1;
+        }
+    }
+    for (i = 0; i < batch->num_data; ++i)
+    {
+        if (load_data(&batch->data[i]))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+set_cached_result(Batch_Job *job, const Cache_Result *result)
+{
+    job->status = result->state.status;
+    job->watchdog_reason = result->watchdog_reason;
+    job->cycles = result->cycles;
+    job->retired = result->state.retired;
+    job->pc = result->state.pc;
+    job->stats = result->stats;
+    job->state_hash = apex_arch_state_hash(&result->state);
+    job->cached = TRUE;
+}
+
+static void
+run_job(Batch *batch, Batch_Job *job)
+{
+    APEX_Program *program = batch->programs[job->program].program;
+    char key[APEX_CACHE_KEY_SIZE];
+    Cache_Result result;
+    APEX_CPU *cpu;
+
+    cpu = APEX_cpu_create(program, &job->config);
+    if (!cpu)
+    {
+        job->status = -1;
+        return;
+    }
+
+    if (job->data >= 0 &&
+        APEX_cpu_map_image(cpu, batch->data[job->data].image))
+    {
+        job->status = -1;
+        APEX_cpu_destroy(cpu);
+        return;
+    }
+
+    if (batch->cache_dir)
+    {
+        apex_cache_key(key, program, APEX_cpu_get_data_memory(cpu),
+                       &job->config, job->max_cycles);
+        if (apex_cache_lookup(batch->cache_dir, key, &result) == 0)
+        {
+            set_cached_result(job, &result);
+            APEX_cpu_destroy(cpu);
+            return;
+        }
+    }
+
+    job->status = APEX_cpu_run_until(cpu, NULL, NULL, job->max_cycles);
+    job->watchdog_reason = APEX_cpu_get_watchdog_reason(cpu);
+    job->cycles = APEX_cpu_get_clock(cpu);
+    job->retired = APEX_cpu_get_retired(cpu);
+    job->pc = APEX_cpu_get_pc(cpu);
+    job->stats = *APEX_cpu_get_stats(cpu);
+    job->state_hash = apex_state_hash(cpu);
+
+    if (batch->cache_dir)
+    {
+        apex_cache_capture(cpu, &result);
+        apex_cache_store(batch->cache_dir, key, &result);
+    }
+    APEX_cpu_destroy(cpu);
+}
+
+/*
+ * Runs 'job' again with idealization 'mode' on top of its own timing,
+ * bypassing the cache, for the cycles it takes
+ */
+static void
+run_ideal(Batch *batch, Batch_Job *job, int mode)
+{
+    APEX_Config config = job->config;
+    APEX_CPU *cpu;
+
+    job->ideal_cycles[mode] = -1;
+    config.ideal |= 1 << mode;
+    cpu = APEX_cpu_create(batch->programs[job->program].program, &config);
+    if (!cpu)
+    {
+        return;
+    }
+
+    if (job->data < 0 ||
+        APEX_cpu_map_image(cpu, batch->data[job->data].image) == 0)
+    {
+        APEX_cpu_run_until(cpu, NULL, NULL, job->max_cycles);
+        job->ideal_cycles[mode] = APEX_cpu_get_clock(cpu);
+    }
+    APEX_cpu_destroy(cpu);
+}
+
+static void
+write_record(Batch *batch, int index)
+{
+    const Batch_Job *job = &batch->jobs[index];
+    int mode;
+
+    fprintf(batch->output,
+            "job=%d line=%d program=%s data=%s mem_latency=%d mul_latency=%d "
+            "status=%s cycles=%d instructions=%d pc=%d execute_busy=%llu "
+            "memory_busy=%llu structural_stalls=%llu skipped=%llu state=%08x",
+            index, job->line, batch->programs[job->program].path,
+            job->data >= 0 ? batch->data[job->data].path : "-",
+            job->config.memory_latency, job->config.mul_latency,
+            apex_status_name(job->status, job->watchdog_reason), job->cycles,
+            job->retired, job->pc,
+            (unsigned long long)job->stats.execute_busy_cycles,
+            (unsigned long long)job->stats.memory_busy_cycles,
+            (unsigned long long)job->stats.structural_stalls,
+            (unsigned long long)job->stats.skipped_cycles, job->state_hash);
+    for (mode = 0; batch->limits && mode < APEX_IDEAL_MODES; ++mode)
+    {
+        fprintf(batch->output, " ideal_%s=%d", APEX_ideal_name(mode),
+                job->ideal_cycles[mode]);
+    }
+    fputc('\n', batch->output);
+}
+
+/* Marks a job done and writes every record that is now next in order */
+static void
+complete_job(Batch *batch, int index)
+{
+    pthread_mutex_lock(&batch->output_lock);
+    batch->jobs[index].done = TRUE;
+    while (batch->next_record < batch->num_jobs &&
+           batch->jobs[batch->next_record].done)
+    {
+        write_record(batch, batch->next_record++);
+    }
+    pthread_mutex_unlock(&batch->output_lock);
+}
+
+static int
+take_own_job(Batch_Worker *worker)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head < worker->tail)
+    {
+        job = worker->jobs[worker->head++];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return job;
+}
+
+static int
+steal_job(Batch_Worker *victim)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->head < victim->tail)
+    {
+        job = victim->jobs[--victim->tail];
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return job;
+}
+
+/*
+ * No jobs are created while the pool runs, so a worker that finds its own
+ * deque and every victim's empty can exit.
+ */
+static void *
+worker_main(void *arg)
+{
+    Batch_Worker *worker = arg;
+    Batch *batch = worker->batch;
+    int job, i;
+
+    for (;;)
+    {
+        job = take_own_job(worker);
+        for (i = 1; job < 0 && i < batch->num_workers; ++i)
+        {
+            job = steal_job(&batch->workers[(worker->id + i) % batch->num_workers]);
+        }
+        if (job < 0)
+        {
+            return NULL;
+        }
+
+        run_job(batch, &batch->jobs[job]);
+        for (i = 0; batch->limits && i < APEX_IDEAL_MODES; ++i)
+        {
+            run_ideal(batch, &batch->jobs[job], i);
+        }
+        complete_job(batch, job);
+    }
+}
+
+/* Gives every worker a contiguous slice of the manifest and runs the pool */
+static void
+run_batch(Batch *batch, int num_workers)
+{
+    int i, j;
+
+    if (num_workers > batch->num_jobs)
+    {
+        num_workers = batch->num_jobs > 0 ? batch->num_jobs : 1;
+    }
+
+    batch->num_workers = num_workers;
+    batch->workers = aligned_alloc(64, sizeof(Batch_Worker) * num_workers);
+    if (!batch->workers)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < num_workers; ++i)
+    {
+        Batch_Worker *worker = &batch->workers[i];
+        int first = (int)((long long)batch->num_jobs * i / num_workers);
+        int last = (int)((long long)batch->num_jobs * (i + 1) / num_workers);
+
+        memset(worker, 0, sizeof(Batch_Worker));
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->id = i;
+        worker->batch = batch;
+        worker->tail = last - first;
+        worker->jobs = malloc(sizeof(int) * (last - first + 1));
+        for (j = first; j < last; ++j)
+        {
+            worker->jobs[j - first] = j;
+        }
+    }
+
+    for (i = 1; i < num_workers; ++i)
+    {
+        pthread_create(&batch->workers[i].thread, NULL, worker_main,
+                       &batch->workers[i]);
+    }
+    worker_main(&batch->workers[0]);
+    for (i = 1; i < num_workers; ++i)
+    {
+        pthread_join(batch->workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < num_workers; ++i)
+    {
+        pthread_mutex_destroy(&batch->workers[i].lock);
+        free(batch->workers[i].jobs);
+    }
+    free(batch->workers);
+}
+
+static void
+free_inputs(Batch_Input *inputs, int num_inputs)
+{
+    int i;
+
+    for (i = 0; i < num_inputs; ++i)
+    {
+        APEX_program_release(inputs[i].program);
+        APEX_image_release(inputs[i].image);
+        free(inputs[i].path);
+    }
+    free(inputs);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    Batch batch;
+    const char *manifest = NULL;
+    const char *output = NULL;
+    const char *cache_dir = NULL;
+    long long cache_limit = 0;
+    int limits = FALSE;
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int i, hits = 0;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            num_workers = atoi(argv[++i]);
+            if (num_workers < 1)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-limit") == 0 && i + 1 < argc)
+        {
+            /* Megabytes the cache is pruned to after the batch, 0 = no limit */
+            cache_limit = atoll(argv[++i]) * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "--limits") == 0)
+        {
+            limits = TRUE;
+        }
+        else if (!manifest && argv[i][0] != '-')
+        {
+            manifest = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+        }
+    }
+    if (!manifest)
+    {
+        print_usage(argv[0]);
+    }
+    if (num_workers < 1)
+    {
+        num_workers = 1;
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.cache_dir = cache_dir;
+    batch.limits = limits;
+    if (read_manifest(&batch, manifest))
+    {
+        exit(1);
+    }
+
+    batch.output = output ? fopen(output, "w") : stdout;
+    if (!batch.output)
+    {
+        perror(output);
+        exit(1);
+    }
+    pthread_mutex_init(&batch.output_lock, NULL);
+
+    run_batch(&batch, num_workers);
+
+    if (cache_dir)
+    {
+        for (i = 0; i < batch.num_jobs; ++i)
+        {
+            hits += batch.jobs[i].cached;
+        }
+        fprintf(stderr, "APEX_Batch: %d of %d results from the cache\n", hits,
+                batch.num_jobs);
+        if (cache_limit > 0)
+        {
+            apex_cache_prune(cache_dir, cache_limit);
+        }
+    }
+
+    pthread_mutex_destroy(&batch.output_lock);
+    if (batch.output != stdout)
+    {
+        fclose(batch.output);
+    }
+    free_inputs(batch.programs, batch.num_programs);
+    free_inputs(batch.data, batch.num_data);
+    free(batch.jobs);
+    return 0;
+}
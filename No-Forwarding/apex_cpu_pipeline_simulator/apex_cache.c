@@ -0,0 +1,479 @@
+/*
+ * apex_cache.c
+ * Contains the on-disk cache of simulation results shared by the clients
+ *
+ * A run is fully determined by the parsed program, the data memory it
+ * starts from, the timing configuration, the cycle budget and the timing
+ * model itself, so a hash of those names its result. Entries live in
+ * '<dir>/<model version>/<first two key digits>/<key>' as small text files.
+ *
+ * Any number of processes may share a directory. Entries are written to a
+ * temporary file and renamed into place, so a reader sees a whole entry or
+ * none; concurrent writers of one key write the same content. Entries that
+ * do not parse completely are treated as misses. Pruning deletes the least
+ * recently used entries, which readers holding them open do not notice.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "apex_cache.h"
+#include "apex_client.h"
+
+/* Version of the entry format, part of every key */
+#define CACHE_FORMAT 2
+
+/* Temporary files of writers that died are removed after this many seconds */
+#define CACHE_STALE_SECONDS 3600
+
+#define CACHE_PATH_SIZE 4096
+#define CACHE_LINE_SIZE 1024
+
+typedef struct Cache_Entry
+{
+    char *path;
+    long long size;
+    time_t used;
+} Cache_Entry;
+
+typedef struct Cache_Listing
+{
+    Cache_Entry *entries;
+    int count;
+    int capacity;
+    long long bytes;
+} Cache_Listing;
+
+static unsigned int temp_counter;
+
+static void
+hash_words(uint64_t hash[2], const int *words, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        hash[0] = (hash[0] ^ (uint32_t)words[i]) * 1099511628211ULL;
+        hash[1] = (hash[1] ^ (uint32_t)words[i]) * 1099511628211ULL;
+        hash[1] ^= hash[1] >> 29;
+    }
+}
+
+/*
+ * Computes the key of a run of 'program' from 'data_memory' (all
+ * DATA_MEMORY_SIZE words, as loaded) with 'config' and a budget of
+ * 'max_cycles' (0 = none). Only the fields of an instruction that take part
+ * in simulation are hashed, not its text.
+ */
+void
+apex_cache_key(char key[APEX_CACHE_KEY_SIZE], const APEX_Program *program,
+               const int *data_memory, const APEX_Config *config,
+               int max_cycles)
+{
+    const char *model = APEX_model_version();
+    uint64_t hash[2] = {APEX_HASH_INIT, APEX_HASH_INIT ^ 0x9e3779b97f4a7c15ULL};
+    int header[7];
+    int i;
+
+    header[0] = CACHE_FORMAT;
+    header[1] = config->memory_latency;
+    header[2] = config->mul_latency;
+    header[3] = config->watchdog_cycles;
+    header[4] = max_cycles;
+    header[5] = APEX_program_size(program);
+    header[6] = config->ideal;
+    hash[0] = apex_hash(hash[0], model, strlen(model) + 1);
+    hash[1] = apex_hash(hash[1], model, strlen(model) + 1);
+    hash_words(hash, header, 7);
+
+    for (i = 0; i < APEX_program_size(program); ++i)
+    {
+        const APEX_Instruction *insn = APEX_program_instruction(program, i);
+        int fields[6] = {insn->opcode, insn->rd, insn->rs1, insn->rs2,
+                         insn->rs3, insn->imm};
+
+        hash_words(hash, fields, 6);
+    }
+    hash_words(hash, data_memory, DATA_MEMORY_SIZE);
+
+    snprintf(key, APEX_CACHE_KEY_SIZE, "%016llx%016llx",
+             (unsigned long long)hash[0], (unsigned long long)hash[1]);
+}
+
+/* Returns -1 if the path does not fit */
+static int
+entry_path(char *path, size_t size, const char *dir, const char *key)
+{
+    int len = snprintf(path, size, "%s/%s/%.2s/%s", dir, APEX_model_version(),
+                       key, key);
+
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+static int
+read_line(FILE *fp, char *line, const char *tag)
+{
+    size_t len = strlen(tag);
+
+    if (!fgets(line, CACHE_LINE_SIZE, fp))
+    {
+        return -1;
+    }
+    return strncmp(line, tag, len) == 0 && line[len] == ' ' ? 0 : -1;
+}
+
+static int
+read_entry(FILE *fp, const char *key, Cache_Result *result)
+{
+    char line[CACHE_LINE_SIZE];
+    char model[128], entry_key[APEX_CACHE_KEY_SIZE];
+    unsigned long long stats[6];
+    APEX_ArchState *state = &result->state;
+    int format, address, value, i;
+    char *pos, *end;
+
+    memset(result, 0, sizeof(Cache_Result));
+
+    if (read_line(fp, line, "APEX-CACHE") ||
+        sscanf(line, "APEX-CACHE %d", &format) != 1 || format != CACHE_FORMAT ||
+        read_line(fp, line, "model") || sscanf(line, "model %127s", model) != 1 ||
+        strcmp(model, APEX_model_version()) != 0 ||
+        read_line(fp, line, "key") ||
+        sscanf(line, "key %32s", entry_key) != 1 || strcmp(entry_key, key) != 0)
+    {
+        return -1;
+    }
+
+    if (read_line(fp, line, "status") ||
+        sscanf(line, "status %d %d", &state->status,
+               &result->watchdog_reason) != 2 ||
+        read_line(fp, line, "cycles") ||
+        sscanf(line, "cycles %d retired %d pc %d", &result->cycles,
+               &state->retired, &state->pc) != 3 ||
+        read_line(fp, line, "cc") ||
+        sscanf(line, "cc %d %d %d", &state->z, &state->n, &state->p) != 3 ||
+        read_line(fp, line, "stats") ||
+        sscanf(line, "stats %llu %llu %llu %llu %llu %llu", &stats[0],
+               &stats[1], &stats[2], &stats[3], &stats[4], &stats[5]) != 6 ||
+        read_line(fp, line, "regs"))
+    {
+        return -1;
+    }
+    result->stats.skipped_cycles = stats[0];
+    result->stats.execute_busy_cycles = stats[1];
+    result->stats.memory_busy_cycles = stats[2];
+    result->stats.structural_stalls = stats[3];
+    result->stats.data_stalls = stats[4];
+    result->stats.flushes = stats[5];
+
+    pos = line + strlen("regs");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        state->regs[i] = (int)strtol(pos, &end, 10);
+        if (end == pos)
+        {
+            return -1;
+        }
+        pos = end;
+    }
+
+    /* Only the non-zero words of data memory are listed */
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strcmp(line, "end\n") == 0)
+        {
+            return 0;
+        }
+        if (sscanf(line, "mem %d %d", &address, &value) != 2 || address < 0 ||
+            address >= DATA_MEMORY_SIZE)
+        {
+            return -1;
+        }
+        state->data_memory[address] = value;
+    }
+    return -1;
+}
+
+/*
+ * Looks 'key' up in the cache at 'dir'. Returns 0 and fills 'result' on a
+ * hit, -1 on a miss.
+ */
+int
+apex_cache_lookup(const char *dir, const char *key, Cache_Result *result)
+{
+    char path[CACHE_PATH_SIZE];
+    FILE *fp;
+    int rc;
+
+    if (entry_path(path, sizeof(path), dir, key))
+    {
+        return -1;
+    }
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+    rc = read_entry(fp, key, result);
+    fclose(fp);
+
+    if (rc == 0)
+    {
+        /* Pruning goes by modification time, a hit makes the entry recent */
+        utime(path, NULL);
+    }
+    return rc;
+}
+
+/* Takes the result of a finished run from 'cpu' */
+void
+apex_cache_capture(const APEX_CPU *cpu, Cache_Result *result)
+{
+    APEX_ArchState *state = &result->state;
+
+    result->watchdog_reason = APEX_cpu_get_watchdog_reason(cpu);
+    result->cycles = APEX_cpu_get_clock(cpu);
+    result->stats = *APEX_cpu_get_stats(cpu);
+    state->status = APEX_cpu_get_status(cpu);
+    state->retired = APEX_cpu_get_retired(cpu);
+    state->pc = APEX_cpu_get_pc(cpu);
+    APEX_cpu_get_cc(cpu, &state->z, &state->n, &state->p);
+    memcpy(state->regs, APEX_cpu_get_regs(cpu), sizeof(state->regs));
+    memcpy(state->data_memory, APEX_cpu_get_data_memory(cpu),
+           sizeof(state->data_memory));
+}
+
+static int
+make_dir(const char *path)
+{
+    return mkdir(path, 0777) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/* Creates the directories of an entry path, any of which may exist */
+static int
+make_entry_dirs(const char *dir, const char *key)
+{
+    char path[CACHE_PATH_SIZE];
+
+    snprintf(path, sizeof(path), "%s", dir);
+    if (make_dir(path))
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, APEX_model_version());
+    if (make_dir(path))
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s/%.2s", dir, APEX_model_version(), key);
+    return make_dir(path);
+}
+
+static void
+write_entry(FILE *fp, const char *key, const Cache_Result *result)
+{
+    const APEX_ArchState *state = &result->state;
+    int i;
+
+    fprintf(fp, "APEX-CACHE %d\nmodel %s\nkey %s\n", CACHE_FORMAT,
+            APEX_model_version(), key);
+    fprintf(fp, "status %d %d\n", state->status, result->watchdog_reason);
+    fprintf(fp, "cycles %d retired %d pc %d\n", result->cycles, state->retired,
+            state->pc);
+    fprintf(fp, "cc %d %d %d\n", state->z, state->n, state->p);
+    fprintf(fp, "stats %llu %llu %llu %llu %llu %llu\n",
+            (unsigned long long)result->stats.skipped_cycles,
+            (unsigned long long)result->stats.execute_busy_cycles,
+            (unsigned long long)result->stats.memory_busy_cycles,
+            (unsigned long long)result->stats.structural_stalls,
+            (unsigned long long)result->stats.data_stalls,
+            (unsigned long long)result->stats.flushes);
+
+    fprintf(fp, "regs");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        fprintf(fp, " %d", state->regs[i]);
+    }
+    fprintf(fp, "\n");
+
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        if (state->data_memory[i])
+        {
+            fprintf(fp, "mem %d %d\n", i, state->data_memory[i]);
+        }
+    }
+    fprintf(fp, "end\n");
+}
+
+/* Adds an entry to the cache at 'dir'. Returns -1 if it could not. */
+int
+apex_cache_store(const char *dir, const char *key, const Cache_Result *result)
+{
+    char path[CACHE_PATH_SIZE], temp[CACHE_PATH_SIZE + 32];
+    FILE *fp;
+    int failed;
+
+    if (entry_path(path, sizeof(path), dir, key) || make_entry_dirs(dir, key))
+    {
+        return -1;
+    }
+
+    snprintf(temp, sizeof(temp), "%s.tmp.%d.%u", path, (int)getpid(),
+             __atomic_add_fetch(&temp_counter, 1, __ATOMIC_RELAXED));
+
+    fp = fopen(temp, "w");
+    if (!fp)
+    {
+        return -1;
+    }
+    write_entry(fp, key, result);
+    failed = ferror(fp);
+    failed |= fclose(fp);
+
+    if (failed || rename(temp, path))
+    {
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+list_entry(Cache_Listing *listing, const char *path, const struct stat *st)
+{
+    if (listing->count == listing->capacity)
+    {
+        Cache_Entry *entries;
+
+        listing->capacity = listing->capacity ? listing->capacity * 2 : 256;
+        entries = realloc(listing->entries,
+                          sizeof(Cache_Entry) * listing->capacity);
+        if (!entries)
+        {
+            return;
+        }
+        listing->entries = entries;
+    }
+
+    listing->entries[listing->count].path = strdup(path);
+    listing->entries[listing->count].size = (long long)st->st_blocks * 512;
+    listing->entries[listing->count].used = st->st_mtime;
+    listing->count++;
+    listing->bytes += (long long)st->st_blocks * 512;
+}
+
+/*
+ * Lists the entries below 'path', which is 'depth' directory levels above
+ * them, and deletes temporary files left behind by writers that died
+ */
+static void
+list_entries(Cache_Listing *listing, const char *path, int depth, time_t now)
+{
+    char child[CACHE_PATH_SIZE];
+    struct dirent *dent;
+    struct stat st;
+    DIR *dp;
+
+    dp = opendir(path);
+    if (!dp)
+    {
+        return;
+    }
+
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dent->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, dent->d_name);
+        if (lstat(child, &st))
+        {
+            continue;
+        }
+
+        if (depth > 0 && S_ISDIR(st.st_mode))
+        {
+            list_entries(listing, child, depth - 1, now);
+        }
+        else if (depth == 0 && S_ISREG(st.st_mode))
+        {
+            if (!strstr(dent->d_name, ".tmp."))
+            {
+                list_entry(listing, child, &st);
+            }
+            else if (now - st.st_mtime > CACHE_STALE_SECONDS)
+            {
+                unlink(child);
+            }
+        }
+    }
+    closedir(dp);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const Cache_Entry *x = a;
+    const Cache_Entry *y = b;
+
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+/*
+ * Deletes the least recently used entries, of every model version, until
+ * the cache at 'dir' holds at most 'max_bytes'. Only one process prunes a
+ * directory at a time; the others skip it. Returns the number of entries
+ * deleted, or -1 if the directory can't be locked.
+ */
+int
+apex_cache_prune(const char *dir, long long max_bytes)
+{
+    char path[CACHE_PATH_SIZE];
+    Cache_Listing listing;
+    int fd, i, removed = 0;
+
+    snprintf(path, sizeof(path), "%s/.prune.lock", dir);
+    fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB))
+    {
+        close(fd);
+        return 0;
+    }
+
+    memset(&listing, 0, sizeof(listing));
+    list_entries(&listing, dir, 2, time(NULL));
+    qsort(listing.entries, listing.count, sizeof(Cache_Entry), compare_entries);
+
+    for (i = 0; i < listing.count; ++i)
+    {
+        if (listing.bytes > max_bytes && unlink(listing.entries[i].path) == 0)
+        {
+            listing.bytes -= listing.entries[i].size;
+            removed++;
+        }
+        free(listing.entries[i].path);
+    }
+    free(listing.entries);
+
+    flock(fd, LOCK_UN);
+    close(fd);
+    return removed;
+}
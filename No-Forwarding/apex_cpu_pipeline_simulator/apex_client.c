@@ -0,0 +1,272 @@
+/*
+ * apex_client.c
+ * Contains helpers shared by the command line clients of libapex
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_client.h"
+
+/* Reads a whole file into a malloc'ed buffer, NULL if it can't be read */
+char *
+apex_read_file(const char *filename, size_t *len)
+{
+    FILE *fp;
+    char *text;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    text = malloc(size + 1);
+    if (text && fread(text, 1, size, fp) != (size_t)size)
+    {
+        free(text);
+        text = NULL;
+    }
+    fclose(fp);
+
+    if (text)
+    {
+        text[size] = '\0';
+        *len = size;
+    }
+    return text;
+}
+
+/* Reads and parses an .asm file, reporting parse errors on stderr */
+APEX_Program *
+apex_load_program(const char *filename)
+{
+    char error[256];
+    APEX_Program *program;
+    size_t len;
+    char *text;
+
+    text = apex_read_file(filename, &len);
+    if (!text)
+    {
+        return NULL;
+    }
+
+    program = APEX_program_parse(text, len, error, sizeof(error));
+    if (!program)
+    {
+        fprintf(stderr, "APEX_Error: %s: %s\n", filename, error);
+    }
+    free(text);
+    return program;
+}
+
+/* Parses a latency option value, latencies are at least one cycle */
+static int
+parse_latency(const char *value, int *latency)
+{
+    *latency = atoi(value);
+
+    if (*latency < 1)
+    {
+        fprintf(stderr, "APEX_Error: Invalid latency '%s'\n", value);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Parses the timing option at argv[*i] into 'config', moving *i past its
+ * value. Returns 1 if it was a timing option, 0 if it was not and -1 if its
+ * value is missing or invalid.
+ */
+int
+apex_parse_config_option(APEX_Config *config, int argc, const char *argv[],
+                         int *i)
+{
+    const char *option = argv[*i];
+
+    if (strcmp(option, "--mem-latency") != 0 &&
+        strcmp(option, "--mul-latency") != 0 &&
+        strcmp(option, "--watchdog") != 0 &&
+        strcmp(option, "--ideal") != 0)
+    {
+        return 0;
+    }
+
+    if (*i + 1 >= argc)
+    {
+        return -1;
+    }
+    (*i)++;
+
+    if (strcmp(option, "--mem-latency") == 0)
+    {
+        return parse_latency(argv[*i], &config->memory_latency) ? -1 : 1;
+    }
+    if (strcmp(option, "--mul-latency") == 0)
+    {
+        return parse_latency(argv[*i], &config->mul_latency) ? -1 : 1;
+    }
+
+    /* Idealizations add up, one option each */
+    if (strcmp(option, "--ideal") == 0)
+    {
+        int ideal = APEX_ideal_parse(argv[*i]);
+
+        if (!ideal)
+        {
+            fprintf(stderr, "APEX_Error: Unknown idealization '%s'\n", argv[*i]);
+            return -1;
+        }
+        config->ideal |= ideal;
+        return 1;
+    }
+
+    /* 0 disables the watchdog */
+    config->watchdog_cycles = atoi(argv[*i]);
+    return 1;
+}
+
+uint64_t
+apex_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint32_t
+hash_state_words(const int *regs, const int *memory)
+{
+    uint64_t hash = APEX_HASH_INIT;
+    int i;
+
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        hash = (hash ^ (uint32_t)regs[i]) * 1099511628211ULL;
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        hash = (hash ^ (uint32_t)memory[i]) * 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/*
+ * Hash of the final architectural state, the registers and data memory.
+ * It is computed for every job, so it mixes whole words, not bytes.
+ */
+uint32_t
+apex_state_hash(const APEX_CPU *cpu)
+{
+    return hash_state_words(APEX_cpu_get_regs(cpu),
+                            APEX_cpu_get_data_memory(cpu));
+}
+
+/* The same hash of a functional model state */
+uint32_t
+apex_arch_state_hash(const APEX_ArchState *state)
+{
+    return hash_state_words(state->regs, state->data_memory);
+}
+
+/* Name of a run outcome in result records */
+const char *
+apex_status_name(int status, int watchdog_reason)
+{
+    switch (status)
+    {
+        case APEX_STATUS_HALTED:
+            return "halted";
+        case APEX_STATUS_WATCHDOG:
+            return watchdog_reason == WATCHDOG_PC_OUT_OF_RANGE
+                       ? "watchdog-pc"
+                       : "watchdog-stall";
+        case APEX_STATUS_FAULT:
+            return "fault";
+        case APEX_STATUS_DIVERGED:
+            return "diverged";
+        case APEX_STATUS_RUNNING:
+            return "budget";
+    }
+    return "error";
+}
+
+/* Mnemonic of an OPCODE_* value, as it is written in the .asm file */
+const char *
+apex_opcode_name(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+            return "ADD";
+        case OPCODE_ADDL:
+            return "ADDL";
+        case OPCODE_SUB:
+            return "SUB";
+        case OPCODE_SUBL:
+            return "SUBL";
+        case OPCODE_MUL:
+            return "MUL";
+        case OPCODE_DIV:
+            return "DIV";
+        case OPCODE_AND:
+            return "AND";
+        case OPCODE_OR:
+            return "OR";
+        case OPCODE_XOR:
+            return "XOR";
+        case OPCODE_MOVC:
+            return "MOVC";
+        case OPCODE_LOAD:
+            return "LOAD";
+        case OPCODE_LDR:
+            return "LDR";
+        case OPCODE_STORE:
+            return "STORE";
+        case OPCODE_STR:
+            return "STR";
+        case OPCODE_CMP:
+            return "CMP";
+        case OPCODE_CML:
+            return "CML";
+        case OPCODE_BZ:
+            return "BZ";
+        case OPCODE_BNZ:
+            return "BNZ";
+        case OPCODE_BP:
+            return "BP";
+        case OPCODE_BNP:
+            return "BNP";
+        case OPCODE_BN:
+            return "BN";
+        case OPCODE_JUMP:
+            return "JUMP";
+        case OPCODE_JALR:
+            return "JALR";
+        case OPCODE_NOP:
+            return "NOP";
+        case OPCODE_HALT:
+            return "HALT";
+    }
+    return "?";
+}
@@ -0,0 +1,29 @@
+/*
+ * apex_client.h
+ * Contains helpers shared by the command line clients of libapex
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_CLIENT_H_
+#define _APEX_CLIENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "apex.h"
+
+char *apex_read_file(const char *filename, size_t *len);
+APEX_Program *apex_load_program(const char *filename);
+int apex_parse_config_option(APEX_Config *config, int argc, const char *argv[],
+                             int *i);
+
+/* FNV-1a, the content hash used for program caches and result records */
+#define APEX_HASH_INIT 14695981039346656037ULL
+uint64_t apex_hash(uint64_t hash, const void *data, size_t len);
+uint32_t apex_state_hash(const APEX_CPU *cpu);
+uint32_t apex_arch_state_hash(const APEX_ArchState *state);
+const char *apex_status_name(int status, int watchdog_reason);
+const char *apex_opcode_name(int opcode);
+#endif
@@ -6,6 +6,7 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,13 @@
 #include "apex_cpu.h"
 #include "apex_macros.h"
 #include <stdint.h>
+#include <limits.h>
+
+/*
+ * Identifies this timing model to result caches. Bump it with every change
+ * that can alter a cycle count, a statistic or a final state.
+ */
+#define APEX_MODEL_VERSION "no-forwarding-1"
 
 
 /* Converts the PC(4000 series) into array index for code memory
@@ -23,23 +31,93 @@
 void Initialize(APEX_CPU *cpu) {
     cpu->pc = 4000;
     // Initialize other components of the CPU (registers, flags, etc.)
-    printf("Simulator initialized. PC set to 4000.\n");
 }
 
 
 
 
-static int
+int
 get_code_memory_index_from_pc(const int pc)
 {
     return (pc - 4000) / 4;
 }
 
+/* TRUE if 'pc' addresses an instruction of the loaded program */
+static int
+pc_in_code_segment(const APEX_CPU *cpu, int pc)
+{
+    return pc >= 4000 && (pc - 4000) % 4 == 0 &&
+           get_code_memory_index_from_pc(pc) < cpu->code_memory_size;
+}
 
+static int
+is_memory_op(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_STORE ||
+           opcode == OPCODE_LDR || opcode == OPCODE_STR;
+}
+
+/*
+ * Starts or continues a multi-cycle operation in 'stage'. The completion
+ * cycle is put on the event wheel so idle cycles can be skipped. Returns
+ * TRUE while the operation is busy and the stage has to hold its latch.
+ */
+static int
+stage_busy(APEX_CPU *cpu, CPU_Stage *stage, int latency, int event_kind)
+{
+    if (latency <= 1)
+    {
+        return FALSE;
+    }
+
+    if (!stage->in_progress)
+    {
+        stage->in_progress = TRUE;
+        stage->ready_cycle = cpu->clock + latency - 1;
+        apex_event_schedule(&cpu->events, stage->ready_cycle, event_kind);
+    }
+
+    if (cpu->clock < stage->ready_cycle)
+    {
+        return TRUE;
+    }
+
+    stage->in_progress = FALSE;
+    return FALSE;
+}
+
+
+
+/*
+ * Hands formatted text to the client's log sink. The core never writes to a
+ * stream itself; without a sink the text is dropped unformatted.
+ */
+static void
+apex_log(const APEX_CPU *cpu, int channel, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void
+apex_log(const APEX_CPU *cpu, int channel, const char *fmt, ...)
+{
+    char text[512];
+    va_list args;
+
+    if (!cpu->log_fn)
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    cpu->log_fn(cpu->log_ctx, channel, text);
+}
 
 static void
-print_instruction(const CPU_Stage *stage)
+format_instruction(char *buf, size_t size, const CPU_Stage *stage)
 {
+    buf[0] = '\0';
+
     switch (stage->opcode)
     {
         case OPCODE_ADD:
@@ -51,68 +129,68 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_XOR:
         case OPCODE_LDR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1, stage->rs2);
+            snprintf(buf, size, "%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1, stage->rs2);
             break;
         }
         case OPCODE_JALR:
         {
-            printf("%s,R%d,R%d,#%d", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
             break;
         }
         case OPCODE_JUMP:
         {
-            printf("%s,R%d,#%d", stage->opcode_str, stage->rs1, stage->imm);
+            snprintf(buf, size, "%s,R%d,#%d", stage->opcode_str, stage->rs1, stage->imm);
             break;
         }
         case OPCODE_NOP:
         {
-            printf("%s", stage->opcode_str);
+            snprintf(buf, size, "%s", stage->opcode_str);
             
             break;
         }
         case OPCODE_ADDL:
         case OPCODE_SUBL:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
             break;
         }
         
 
         case OPCODE_MOVC:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
+            snprintf(buf, size, "%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
             break;
         }
 
          case OPCODE_CML:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rs1 , stage->imm);
+            snprintf(buf, size, "%s,R%d,#%d ", stage->opcode_str, stage->rs1 , stage->imm);
             break;
         }
         case OPCODE_CMP:
                 {
-            printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1 , stage->rs2);
+            snprintf(buf, size, "%s,R%d,R%d ", stage->opcode_str, stage->rs1 , stage->rs2);
             break;
         }
 
 
         case OPCODE_LOAD:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
                    stage->imm);
             break;
         }
 
         case OPCODE_STORE:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
+            snprintf(buf, size, "%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
                    stage->imm);
             break;
         }
 
         case OPCODE_STR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rs1, stage->rs2, stage->rs3);
+            snprintf(buf, size, "%s,R%d,R%d,R%d ", stage->opcode_str, stage->rs1, stage->rs2, stage->rs3);
             break;
         }
 
@@ -124,13 +202,13 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_BN:
         case OPCODE_BNP:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            snprintf(buf, size, "%s,#%d ", stage->opcode_str, stage->imm);
             break;
         }
 
         case OPCODE_HALT:
         {
-            printf("%s", stage->opcode_str);
+            snprintf(buf, size, "%s", stage->opcode_str);
             break;
         }
 
@@ -138,16 +216,46 @@ print_instruction(const CPU_Stage *stage)
     }
 }
 
+/* Formats an instruction of the program as the stage trace shows it */
+void
+APEX_format_instruction(const APEX_Instruction *insn, char *buf, size_t size)
+{
+    CPU_Stage stage;
+
+    memset(&stage, 0, sizeof(stage));
+    strcpy(stage.opcode_str, insn->opcode_str);
+    stage.opcode = insn->opcode;
+    stage.rd = insn->rd;
+    stage.rs1 = insn->rs1;
+    stage.rs2 = insn->rs2;
+    stage.rs3 = insn->rs3;
+    stage.imm = insn->imm;
+    format_instruction(buf, size, &stage);
+}
+
 /* Debug function which prints the CPU stage content
  *
  * Note: You can edit this function to print in more detail
  */
 static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+log_stage_content(const APEX_CPU *cpu, int channel, const char *name,
+                  const CPU_Stage *stage)
+{
+    char insn[256];
+
+    if (!cpu->log_fn)
+    {
+        return;
+    }
+
+    format_instruction(insn, sizeof(insn), stage);
+    apex_log(cpu, channel, "%-15s: pc(%d) %s\n", name, stage->pc, insn);
+}
+
+static void
+print_stage_content(const APEX_CPU *cpu, const char *name, const CPU_Stage *stage)
 {
-    printf("%-15s: pc(%d) ", name, stage->pc);
-    print_instruction(stage);
-    printf("\n");
+    log_stage_content(cpu, APEX_LOG_TRACE, name, stage);
 }
 
 /* Debug function which prints the register file
@@ -159,21 +267,21 @@ print_reg_file(const APEX_CPU *cpu)
 {
     int i;
 
-    printf("----------\n%s\n----------\n", "Registers:");
+    apex_log(cpu, APEX_LOG_TRACE, "----------\n%s\n----------\n", "Registers:");
 
     for (int i = 0; i < REG_FILE_SIZE / 2; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        apex_log(cpu, APEX_LOG_TRACE, "R%-3d[%-3d] ", i, cpu->regs[i]);
     }
 
-    printf("\n");
+    apex_log(cpu, APEX_LOG_TRACE, "\n");
 
     for (i = (REG_FILE_SIZE / 2); i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        apex_log(cpu, APEX_LOG_TRACE, "R%-3d[%-3d] ", i, cpu->regs[i]);
     }
 
-    printf("\n");
+    apex_log(cpu, APEX_LOG_TRACE, "\n");
 }
 
 /*
@@ -184,6 +292,13 @@ print_reg_file(const APEX_CPU *cpu)
 // Check dependency and stall condition in decode stage
 int check_dependency_in_decode_stage(APEX_CPU *cpu) {
     int stall_detected = FALSE;
+
+    /* Perfect forwarding idealized: every operand reaches Execute in time */
+    if (cpu->config.ideal & APEX_IDEAL_FORWARDING)
+    {
+        cpu->stall = FALSE;
+        return FALSE;
+    }
     if(cpu->decode.opcode==OPCODE_NOP){
         // cpu->stall=FALSE;
         stall_detected = FALSE;
@@ -282,12 +397,34 @@ static void
 APEX_fetch(APEX_CPU *cpu)
 {
     APEX_Instruction *current_ins;
+    int outside_code;
 
     if (cpu->fetch.has_insn)
     {
+        /* Not the instruction the latch held last cycle */
+        if (cpu->fetch.pc != cpu->pc)
+        {
+            cpu->fetch.seq = cpu->next_seq++;
+            cpu->fetch.stage_cycle[APEX_STAGE_FETCH] = cpu->clock;
+        }
+        cpu->fetch.pc = cpu->pc;
+        outside_code = !pc_in_code_segment(cpu, cpu->pc);
+        if (outside_code)
+        {
+            /* Nothing to fetch outside the code segment: the latch holds a
+             * bubble that is never passed on, until a redirect or HALT */
+            strcpy(cpu->fetch.opcode_str, "");
+            cpu->fetch.opcode = OPCODE_NOP;
+            cpu->fetch.rd = -1;
+            cpu->fetch.rs1 = -1;
+            cpu->fetch.rs2 = -1;
+            cpu->fetch.rs3 = -1;
+            cpu->fetch.imm = 0;
+        }
+        else
+        {
         /* Index into code memory using this pc and copy all instruction fields
          * into fetch latch  */
-        cpu->fetch.pc = cpu->pc;
         current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
         strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
         cpu->fetch.opcode = current_ins->opcode;
@@ -296,18 +433,31 @@ APEX_fetch(APEX_CPU *cpu)
         cpu->fetch.rs2 = current_ins->rs2;
         cpu->fetch.rs3= current_ins->rs3;
         cpu->fetch.imm  = current_ins->imm;
+        }
 
         if (cpu->fetch_from_next_cycle == TRUE)
         {
             if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Fetch", &cpu->fetch);
+            print_stage_content(cpu, "Fetch", &cpu->fetch);
         }
             // cpu->fetch.has_insn = TRUE;
             cpu->fetch_from_next_cycle = FALSE;
             return;
 
         }
+
+        /* Decode is still holding an instruction, keep this one in Fetch */
+        if (cpu->decode.has_insn)
+        {
+            cpu->stats.structural_stalls++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_content(cpu, "Fetch", &cpu->fetch);
+            }
+            return;
+        }
+
         /* Copy data from fetch latch to decode latch*/
         if (cpu->halt_pending) 
         {
@@ -324,18 +474,33 @@ APEX_fetch(APEX_CPU *cpu)
 
             if (ENABLE_DEBUG_MESSAGES)
             {
-                print_stage_content("Fetch", &cpu->fetch);
+                print_stage_content(cpu, "Fetch", &cpu->fetch);
             }
             cpu->pc += 4;
             cpu->decode = cpu->fetch;
+            cpu->decode.stage_cycle[APEX_STAGE_DECODE] = cpu->clock + 1;
+            cpu->progress = TRUE;
             return;
         }
-            cpu->pc += 4;
+        if (outside_code)
+        {
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                apex_log(cpu, APEX_LOG_TRACE, "%-15s: pc(%d) <outside code segment>\n", "Fetch", cpu->pc);
+            }
+            return;
+        }
+
+            cpu->pc = cpu->oracle ? apex_ideal_next_pc(cpu, cpu->pc)
+                                  : cpu->pc + 4;
             cpu->decode = cpu->fetch;
+            cpu->decode.next_pc = cpu->pc;
+            cpu->decode.stage_cycle[APEX_STAGE_DECODE] = cpu->clock + 1;
+            cpu->progress = TRUE;
          
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Fetch", &cpu->fetch);
+            print_stage_content(cpu, "Fetch", &cpu->fetch);
         }
     }
 }
@@ -361,9 +526,13 @@ APEX_decode(APEX_CPU *cpu)
         // Then, check for new dependencies in the current decode instruction
         if (check_dependency_in_decode_stage(cpu)) {
             // printf("Decode stage is stalled due to a dependency.\n");
+            if (cpu->decode.has_insn)
+            {
+                cpu->stats.data_stalls++;
+            }
             if (ENABLE_DEBUG_MESSAGES)
                 {
-                    print_stage_content("Decode/RF", &cpu->decode);
+                    print_stage_content(cpu, "Decode/RF", &cpu->decode);
                 }
                 cpu->fetch_from_next_cycle=TRUE;
             return;  // Exit early if a stall is detected
@@ -372,6 +541,17 @@ APEX_decode(APEX_CPU *cpu)
     
     if (cpu->stall == FALSE && cpu->decode.has_insn) {
     {
+        /* Execute is busy with a multi-cycle operation */
+        if (cpu->execute.has_insn)
+        {
+            cpu->stats.structural_stalls++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_content(cpu, "Decode/RF", &cpu->decode);
+            }
+            return;
+        }
+
         // printf("Before decoding: R1= %d, R2 = %d, R3= %d, R4 =%d , R5= %d \n", cpu->regs[1],cpu->regs[2],cpu->regs[3],cpu->regs[4], cpu->regs[5]);
         /* Read operands from register file based on the instruction type */
          if (cpu->decode.opcode == OPCODE_HALT) {
@@ -466,15 +646,45 @@ APEX_decode(APEX_CPU *cpu)
 
         /* Copy data from decode latch to execute latch*/
         cpu->execute = cpu->decode;
+        cpu->execute.stage_cycle[APEX_STAGE_EXECUTE] = cpu->clock + 1;
         cpu->decode.has_insn = FALSE;
+        cpu->progress = TRUE;
 
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Decode/RF", &cpu->decode);
+            print_stage_content(cpu, "Decode/RF", &cpu->decode);
         }
     }
 }
 }
+/*
+ * Operand 'reg' of the instruction in Execute as perfect forwarding gives
+ * it: the result of the instruction ahead that writes it, what a load will
+ * read from data memory, or else the register file. Memory1 is always empty
+ * when Execute runs.
+ */
+static int
+ideal_operand(const APEX_CPU *cpu, int reg)
+{
+    const CPU_Stage *memory = &cpu->memory;
+
+    if (memory->has_insn && memory->rd == reg)
+    {
+        if ((memory->opcode == OPCODE_LOAD || memory->opcode == OPCODE_LDR) &&
+            memory->memory_address > 0 &&
+            memory->memory_address < DATA_MEMORY_SIZE)
+        {
+            return cpu->data_memory[memory->memory_address];
+        }
+        return memory->result_buffer;
+    }
+    if (cpu->writeback.has_insn && cpu->writeback.rd == reg)
+    {
+        return cpu->writeback.result_buffer;
+    }
+    return cpu->regs[reg];
+}
+
 /*
  * Execute Stage of APEX Pipeline
  *
@@ -483,6 +693,7 @@ APEX_decode(APEX_CPU *cpu)
 static void
 APEX_execute(APEX_CPU *cpu)
 {
+    int decode_valid, fetch_held;
 
     // if (cpu->execute.opcode == OPCODE_HALT) {
     //         cpu->execute.opcode = OPCODE_NOP;  // Replace with NOP
@@ -497,6 +708,47 @@ APEX_execute(APEX_CPU *cpu)
         }
     if (cpu->execute.has_insn)
     {
+        /* Memory1 has not drained yet, hold the instruction in Execute */
+        if (cpu->memory1.has_insn)
+        {
+            cpu->stats.structural_stalls++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_content(cpu, "Execute", &cpu->execute);
+            }
+            return;
+        }
+
+        if (cpu->execute.opcode == OPCODE_MUL &&
+            stage_busy(cpu, &cpu->execute, cpu->config.mul_latency,
+                       EVENT_EXECUTE_DONE))
+        {
+            cpu->stats.execute_busy_cycles++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_content(cpu, "Execute", &cpu->execute);
+            }
+            return;
+        }
+
+        /* Perfect forwarding idealized: read the operands again, bypassed */
+        if (cpu->config.ideal & APEX_IDEAL_FORWARDING)
+        {
+            if (cpu->execute.rs1 >= 0)
+            {
+                cpu->execute.rs1_value = ideal_operand(cpu, cpu->execute.rs1);
+            }
+            if (cpu->execute.rs2 >= 0)
+            {
+                cpu->execute.rs2_value = ideal_operand(cpu, cpu->execute.rs2);
+            }
+            if (cpu->execute.rs3 >= 0)
+            {
+                cpu->execute.rs3_value = ideal_operand(cpu, cpu->execute.rs3);
+            }
+        }
+        decode_valid = cpu->decode.has_insn;
+        fetch_held = cpu->fetch_from_next_cycle;
 
         switch (cpu->execute.opcode)
         {
@@ -645,7 +897,7 @@ APEX_execute(APEX_CPU *cpu)
             {
                 if(cpu->execute.rs1_value == cpu->execute.imm) {
                     cpu->cc.z = 1;
-                    printf("Z FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "Z FLAG is TRUE\n");
                     
                 }
                 else{
@@ -654,14 +906,14 @@ APEX_execute(APEX_CPU *cpu)
                 }
                 if(cpu->execute.rs1_value < cpu->execute.imm) {
                     cpu->cc.n = 1;
-                    printf("N FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "N FLAG is TRUE\n");
                 }
                 else{
                     cpu->cc.n=0;   
                 }
                 if(cpu->execute.rs1_value > cpu->execute.imm) {
                     cpu->cc.p = 1;
-                    printf("P FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "P FLAG is TRUE\n");
                 }
                 else{
                     cpu->cc.p=0;   
@@ -672,7 +924,7 @@ APEX_execute(APEX_CPU *cpu)
             {
                 if(cpu->execute.rs1_value == cpu->execute.rs2_value) {
                     cpu->cc.z = 1;
-                    printf("Z FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "Z FLAG is TRUE\n");
                     cpu->cc.z=1;
                 }
                 else{
@@ -681,14 +933,14 @@ APEX_execute(APEX_CPU *cpu)
 
                 if(cpu->execute.rs1_value < cpu->execute.rs2_value) {
                     cpu->cc.n = 1;
-                    printf("N FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "N FLAG is TRUE\n");
                 }
                 else{
                     cpu->cc.n=0;   
                 }
                 if(cpu->execute.rs1_value > cpu->execute.rs2_value) {
                     cpu->cc.p = 1;
-                    printf("P FLAG is TRUE\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "P FLAG is TRUE\n");
                 }
                 else{
                     cpu->cc.p=0;   
@@ -837,7 +1089,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->branch_target = cpu->execute.pc + cpu->execute.imm;
                     cpu->branch_pending = TRUE; // Mark the branch as pending
 
-                    printf("BZ: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
+                    apex_log(cpu, APEX_LOG_TRACE, "BZ: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
 
                     // Stop fetching new instructions since the branch will be taken soon
                     cpu->fetch_from_next_cycle= TRUE;
@@ -846,7 +1098,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->decode.has_insn = FALSE;
                 } else {
                     // No branch is taken if the zero flag is FALSE
-                    printf("BZ: No branch taken because zero flag is FALSE.\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "BZ: No branch taken because zero flag is FALSE.\n");
                 }
 
                 
@@ -863,7 +1115,7 @@ APEX_execute(APEX_CPU *cpu)
                    
                     cpu->branch_pending = TRUE; // Mark the branch as pending
 
-                    printf("BNZ: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
+                    apex_log(cpu, APEX_LOG_TRACE, "BNZ: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
 
                     // Stop fetching new instructions since the branch will be taken soon
                     cpu->fetch_from_next_cycle= TRUE;;
@@ -872,7 +1124,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->decode.has_insn = FALSE;
                 } else {
                     // No branch is taken if the zero flag is FALSE
-                    printf("BNZ: No branch taken because zero flag is TRUE.\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "BNZ: No branch taken because zero flag is TRUE.\n");
                 }
 
                 // Mark the Execute stage as completed for BZ
@@ -886,7 +1138,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->branch_target = cpu->execute.pc + cpu->execute.imm;
                     cpu->branch_pending = TRUE; // Mark the branch as pending
 
-                    printf("BP: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
+                    apex_log(cpu, APEX_LOG_TRACE, "BP: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
 
                     // Stop fetching new instructions since the branch will be taken soon
                     cpu->fetch_from_next_cycle= TRUE; 
@@ -895,7 +1147,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->decode.has_insn = FALSE;
                 } else {
                     // No branch is taken if the zero flag is FALSE
-                    printf("BP: No branch taken because positve flag is FALSE.\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "BP: No branch taken because positve flag is FALSE.\n");
                 }
 
                 // Mark the Execute stage as completed for BZ
@@ -909,7 +1161,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->branch_target = cpu->execute.pc + cpu->execute.imm;
                     cpu->branch_pending = TRUE; // Mark the branch as pending
 
-                    printf("BN: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
+                    apex_log(cpu, APEX_LOG_TRACE, "BN: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
 
                     // Stop fetching new instructions since the branch will be taken soon
                     cpu->fetch_from_next_cycle= TRUE;
@@ -918,7 +1170,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->decode.has_insn = FALSE;
                 } else {
                     // No branch is taken if the zero flag is FALSE
-                    printf("BN: No branch taken because negative flag is FALSE.\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "BN: No branch taken because negative flag is FALSE.\n");
                 }
 
                 // Mark the Execute stage as completed for BZ
@@ -932,7 +1184,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->branch_target = cpu->execute.pc + cpu->execute.imm;
                     cpu->branch_pending = TRUE; // Mark the branch as pending
 
-                    printf("BNP: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
+                    apex_log(cpu, APEX_LOG_TRACE, "BNP: Branch target calculated. PC: %d -> New PC: %d\n", cpu->execute.pc, cpu->branch_target);
 
                     // Stop fetching new instructions since the branch will be taken soon
                     cpu->fetch_from_next_cycle= TRUE;
@@ -941,7 +1193,7 @@ APEX_execute(APEX_CPU *cpu)
                     cpu->decode.has_insn = FALSE;
                 } else {
                     // No branch is taken if the zero flag is FALSE
-                    printf("BNP: No branch taken because positive is set.\n");
+                    apex_log(cpu, APEX_LOG_TRACE, "BNP: No branch taken because positive is set.\n");
                 }
 
                 // Mark the Execute stage as completed for BZ
@@ -994,14 +1246,27 @@ APEX_execute(APEX_CPU *cpu)
 
 
 
+        /* Zero-penalty branches: Fetch may already be where it goes */
+        if (cpu->oracle &&
+            APEX_opcode_class(cpu->execute.opcode) == APEX_OPCLASS_BRANCH)
+        {
+            apex_ideal_resolve(cpu, decode_valid, fetch_held);
+        }
+
+        cpu->execute.flags = (cpu->cc.z ? APEX_FLAG_Z : 0) |
+                             (cpu->cc.n ? APEX_FLAG_N : 0) |
+                             (cpu->cc.p ? APEX_FLAG_P : 0);
+
         /* Copy data from execute latch to memory latch*/
         cpu->memory1 = cpu->execute;
+        cpu->memory1.stage_cycle[APEX_STAGE_MEMORY1] = cpu->clock + 1;
         cpu->execute.has_insn = FALSE;
+        cpu->progress = TRUE;
         /*cpu->execute.is_stalled  = FALSE;*/
 
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Execute", &cpu->execute);
+            print_stage_content(cpu, "Execute", &cpu->execute);
         }
 
 
@@ -1035,19 +1300,32 @@ APEX_memory1(APEX_CPU *cpu)
                 return;
             }
 
+    /* Memory is still busy, hold the instruction in Memory1 */
+    if (cpu->memory.has_insn)
+    {
+        cpu->stats.structural_stalls++;
+        if (ENABLE_DEBUG_MESSAGES)
+        {
+            print_stage_content(cpu, "Memory1", &cpu->memory1);
+        }
+        return;
+    }
+
     
 
 
     if (ENABLE_DEBUG_MESSAGES)
     {
-        print_stage_content("Memory1", &cpu->memory1);
+        print_stage_content(cpu, "Memory1", &cpu->memory1);
     }
      if (cpu->branch_pending == TRUE) {
             
             // All previous instructions have completed, so we can safely branch now
             cpu->pc = cpu->branch_target;
+            cpu->redirect_pc = cpu->branch_target;
+            cpu->stats.flushes++;
             cpu->branch_pending = FALSE;  // Branch has been taken
-            printf(" Branch / jump taken. New PC: %d\n", cpu->pc);
+            apex_log(cpu, APEX_LOG_TRACE, " Branch / jump taken. New PC: %d\n", cpu->pc);
             cpu->decode.has_insn = FALSE;
             cpu->execute.has_insn = FALSE;
      }
@@ -1067,7 +1345,9 @@ APEX_memory1(APEX_CPU *cpu)
         }
 
         cpu->memory = cpu->memory1;
+        cpu->memory.stage_cycle[APEX_STAGE_MEMORY] = cpu->clock + 1;
     cpu->memory1.has_insn = FALSE;
+    cpu->progress = TRUE;
 }
 
 
@@ -1076,6 +1356,21 @@ APEX_memory(APEX_CPU *cpu)
 {
     if (cpu->memory.has_insn)
     {
+        if (is_memory_op(cpu->memory.opcode) &&
+            stage_busy(cpu, &cpu->memory,
+                       cpu->config.ideal & APEX_IDEAL_MEMORY
+                           ? 1
+                           : cpu->config.memory_latency,
+                       EVENT_MEMORY_DONE))
+        {
+            cpu->stats.memory_busy_cycles++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_content(cpu, "Memory", &cpu->memory);
+            }
+            return;
+        }
+
         switch (cpu->memory.opcode)
         {
             case OPCODE_ADD:
@@ -1104,6 +1399,14 @@ APEX_memory(APEX_CPU *cpu)
                 /* Read from data memory */
                // printf("MEMORY ADRESS: %d \n",  cpu->memory.memory_address);
                 if (cpu->memory.memory_address > 0 && cpu->memory.memory_address < DATA_MEMORY_SIZE){
+                if (cpu->recording)
+                {
+                    apex_record_access(cpu, cpu->memory.memory_address);
+                }
+                if (cpu->memtrace)
+                {
+                    apex_memtrace_access(cpu, cpu->memory.memory_address, FALSE);
+                }
                 cpu->memory.result_buffer= cpu->data_memory[cpu->memory.memory_address];
                //printf("EXTRACTED VALUE FROM MEMORY ADRESS: %d \n",  cpu->memory.result_buffer);
                 break;
@@ -1114,6 +1417,14 @@ APEX_memory(APEX_CPU *cpu)
                 /* Read from data memory */
                // printf("MEMORY ADRESS: OF STORE(rs2+#5) %d , MEM VALUE OF STORE:(rs1) %d \n",  cpu->memory.memory_address, cpu->memory.memory_value);
                 
+                if (cpu->recording)
+                {
+                    apex_record_access(cpu, cpu->memory.memory_address);
+                }
+                if (cpu->memtrace)
+                {
+                    apex_memtrace_access(cpu, cpu->memory.memory_address, TRUE);
+                }
                  cpu->data_memory[cpu->memory.memory_address]= cpu->memory.memory_value;
 
                 // printf("final check: %d \n", cpu->data_memory[cpu->memory.memory_address]);
@@ -1126,6 +1437,14 @@ APEX_memory(APEX_CPU *cpu)
                 /* Read from data memory */
                // printf("MEMORY ADRESS: LDR %d \n",  cpu->memory.memory_address);
                 if (cpu->memory.memory_address > 0 && cpu->memory.memory_address < DATA_MEMORY_SIZE){
+                if (cpu->recording)
+                {
+                    apex_record_access(cpu, cpu->memory.memory_address);
+                }
+                if (cpu->memtrace)
+                {
+                    apex_memtrace_access(cpu, cpu->memory.memory_address, FALSE);
+                }
                 cpu->memory.result_buffer= cpu->data_memory[cpu->memory.memory_address];
                //printf("EXTRACTED VALUE FROM MEMORY ADRESS LDR: %d \n",  cpu->memory.result_buffer);
                 break;
@@ -1136,6 +1455,14 @@ APEX_memory(APEX_CPU *cpu)
                 /* Read from data memory */
                // printf("MEMORY ADRESS: OF STORE(rs2+rs3) %d , MEM VALUE OF STORE:(rs1) %d \n",  cpu->memory.memory_address, cpu->memory.memory_value);
                 
+                if (cpu->recording)
+                {
+                    apex_record_access(cpu, cpu->memory.memory_address);
+                }
+                if (cpu->memtrace)
+                {
+                    apex_memtrace_access(cpu, cpu->memory.memory_address, TRUE);
+                }
                  cpu->data_memory[cpu->memory.memory_address]= cpu->memory.memory_value;
 
     
@@ -1146,11 +1473,13 @@ APEX_memory(APEX_CPU *cpu)
 
         /* Copy data from memory latch to writeback latch*/
         cpu->writeback = cpu->memory;
+        cpu->writeback.stage_cycle[APEX_STAGE_WRITEBACK] = cpu->clock + 1;
         cpu->memory.has_insn = FALSE;
+        cpu->progress = TRUE;
 
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Memory", &cpu->memory);
+            print_stage_content(cpu, "Memory", &cpu->memory);
         }
     }
 }
@@ -1231,7 +1560,7 @@ APEX_writeback(APEX_CPU *cpu)
                 // If debugging is enabled, print the action
                 if (ENABLE_DEBUG_MESSAGES)
                 {
-                    printf("Writeback: JALR completed. Return address %d written to register R%d\n",
+                    apex_log(cpu, APEX_LOG_TRACE, "Writeback: JALR completed. Return address %d written to register R%d\n",
                         cpu->writeback.result_buffer, cpu->writeback.rd);
                 }
                 break;
@@ -1245,15 +1574,34 @@ APEX_writeback(APEX_CPU *cpu)
 
         }
 
-        
-
+        if (cpu->retire_trace || cpu->retire_fn)
+        {
+            apex_retire_record(cpu);
+        }
+        if (cpu->profile)
+        {
+            apex_profile_retire(cpu);
+        }
+        apex_latency_retire(cpu);
+        if (cpu->dataflow)
+        {
+            apex_dataflow_retire(cpu);
+        }
+        if (cpu->cosim)
+        {
+            apex_cosim_retire(cpu);
+        }
 
         cpu->insn_completed++;
+        cpu->last_retire_cycle = cpu->clock;
+        cpu->retired_pcs[cpu->retired_count % RETIRED_PC_HISTORY] = cpu->writeback.pc;
+        cpu->retired_count++;
         cpu->writeback.has_insn = FALSE;
+        cpu->progress = TRUE;
 
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_content("Writeback", &cpu->writeback);
+            print_stage_content(cpu, "Writeback", &cpu->writeback);
         }
 
           if (cpu->fetch.has_insn == FALSE&&cpu->writeback.opcode==OPCODE_HALT) {
@@ -1267,45 +1615,109 @@ APEX_writeback(APEX_CPU *cpu)
     /* Default */
     return 0;
 }
-void SetMem(APEX_CPU *cpu, const char *filename) {
-    FILE *file = fopen(filename, "r"); // Open the data file
-    if (file == NULL) {
-        perror("Error opening file"); // Print error if file can't be opened
-        return;
+const char *
+APEX_model_version(void)
+{
+    return APEX_MODEL_VERSION;
+}
+
+void
+APEX_config_default(APEX_Config *config)
+{
+    config->memory_latency = DEFAULT_MEMORY_LATENCY;
+    config->mul_latency = DEFAULT_MUL_LATENCY;
+    config->watchdog_cycles = DEFAULT_WATCHDOG_CYCLES;
+    config->ideal = 0;
+}
+
+/* The trace timing model of this pipeline, with its default latencies */
+void
+APEX_timing_config_default(APEX_TimingConfig *config)
+{
+    config->forwarding = FALSE;
+    config->memory_latency = DEFAULT_MEMORY_LATENCY;
+    config->mul_latency = DEFAULT_MUL_LATENCY;
+    config->branch_stage = APEX_STAGE_MEMORY1;
+}
+
+/*
+ * Puts 'cpu' back into its initial state, running 'program' (which it keeps
+ * a reference to) from the first instruction, so that instances can be
+ * recycled instead of freed. The log sink is kept, data memory is zero
+ * again. A NULL 'config' selects the default timing. Returns -1 if there is
+ * no program, or if data memory cannot be mapped.
+ */
+int
+APEX_cpu_reset(APEX_CPU *cpu, APEX_Program *program, const APEX_Config *config)
+{
+    APEX_Program *previous = cpu->program;
+    APEX_LogFn log_fn = cpu->log_fn;
+    void *log_ctx = cpu->log_ctx;
+    int *data_memory = cpu->data_memory;
+    APEX_ArchState *oracle = cpu->oracle;
+
+    if (!program)
+    {
+        return -1;
     }
 
+    memset(cpu, 0, sizeof(APEX_CPU));
+    cpu->log_fn = log_fn;
+    cpu->log_ctx = log_ctx;
 
-    int address = 0;
-    int data;
+    /* Fresh zero pages, the pages the last run stored to are given back */
+    cpu->data_memory = apex_memory_map(data_memory, NULL);
+    if (!cpu->data_memory)
+    {
+        APEX_program_release(previous);
+        return -1;
+    }
 
-    while (fscanf(file, "%d,", &data) != EOF && address < DATA_MEMORY_SIZE) {
-        cpu->data_memory[address] = data; // Set data in the CPU's data memory
-        address++;
+    /* Initialize PC, Registers and all pipeline stages */
+    Initialize(cpu);
+    cpu->cmp_completed = FALSE;
+    cpu->stall = 0; 
+    cpu->cc.z = 0;
+    cpu->cc.n = 0;
+    cpu->cc.p = 0;
+    if (config)
+    {
+        cpu->config = *config;
     }
-    
-    fclose(file); // Close the file
-    printf("Memory initialized from file.\n");
-    printf("Data Memory Contents:\n");
-    for (int i = 0; i < 10; i++) {
-        printf("Address %d: %d\n", i, cpu->data_memory[i]);
+    else
+    {
+        APEX_config_default(&cpu->config);
+    }
+    apex_event_init(&cpu->events, 0);
+    if (apex_ideal_reset(cpu, oracle))
+    {
+        APEX_program_release(previous);
+        return -1;
     }
 
+    cpu->program = APEX_program_retain(program);
+    cpu->code_memory = program->code;
+    cpu->code_memory_size = program->size;
+    cpu->status = APEX_STATUS_RUNNING;
+    APEX_program_release(previous);
+
+    /* To start fetch stage */
+    cpu->fetch.has_insn = TRUE;
+    memset(cpu->cpi_bubble, APEX_CPI_FETCH, sizeof(cpu->cpi_bubble));
+    return 0;
 }
 
 /*
- * This function creates and initializes APEX cpu.
+ * This function creates and initializes an APEX cpu, see APEX_cpu_reset
  *
  * Note: You are free to edit this function according to your implementation
  */
 APEX_CPU *
-APEX_cpu_init(const char *filename)
+APEX_cpu_create(APEX_Program *program, const APEX_Config *config)
 {
-    int i;
     APEX_CPU *cpu;
 
-    
-
-    if (!filename)
+    if (!program)
     {
         return NULL;
     }
@@ -1317,243 +1729,546 @@ APEX_cpu_init(const char *filename)
         return NULL;
     }
 
-    /* Initialize PC, Registers and all pipeline stages */
-    //cpu->pc = 4000;
-    Initialize(cpu);
-    cpu->cmp_completed = FALSE;
-    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
-    /*cpu->data_memory[248] = 10; */// explicitly filling value in data mem
-    cpu->single_step = ENABLE_SINGLE_STEP;
-    cpu->stall = 0; 
-    cpu->cc.z = 0;
-    cpu->cc.n = 0;
-    cpu->cc.p = 0;
-
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    if (APEX_cpu_reset(cpu, program, config))
     {
         free(cpu);
         return NULL;
     }
+    return cpu;
+}
 
-    if (ENABLE_DEBUG_MESSAGES)
+/* Parses 'text' as an .asm program and creates a cpu running it */
+APEX_CPU *
+APEX_cpu_create_from_buffer(const char *text, size_t len,
+                            const APEX_Config *config)
+{
+    APEX_Program *program;
+    APEX_CPU *cpu;
+
+    program = APEX_program_parse(text, len, NULL, 0);
+    if (!program)
     {
-        fprintf(stderr,
-                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
-        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
-        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
-               "imm");
-
-        for (i = 0; i < cpu->code_memory_size; ++i)
-        {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
-        }
+        return NULL;
     }
-    
-    /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
+
+    cpu = APEX_cpu_create(program, config);
+    APEX_program_release(program);
     return cpu;
 }
 
+void
+APEX_cpu_set_log(APEX_CPU *cpu, APEX_LogFn log_fn, void *ctx)
+{
+    cpu->log_fn = log_fn;
+    cpu->log_ctx = ctx;
+}
+
 /*
- * APEX CPU simulation loop
- *
- * Note: You are free to edit this function according to your implementation
+ * Copies 'count' words into data memory starting at 'address'. Returns the
+ * number of words stored, which stops at the end of data memory, or -1 if
+ * 'address' is outside it.
  */
-void APEX_cpu_simulate(APEX_CPU *cpu, int num_cycles) {
-    int cycle = 0;
-
-    while (cycle < num_cycles) {
-        printf("implementing simulate\n");
-        if (ENABLE_DEBUG_MESSAGES) {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            printf("--------------------------------------------\n");
-        }
+int
+APEX_cpu_load_data(APEX_CPU *cpu, int address, const int *words, int count)
+{
+    if (address < 0 || address >= DATA_MEMORY_SIZE || count < 0)
+    {
+        return -1;
+    }
 
-        if (APEX_writeback(cpu)) {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d, instructions completed = %d\n", cpu->clock+1, cpu->insn_completed);
-            break;
-        }
+    if (count > DATA_MEMORY_SIZE - address)
+    {
+        count = DATA_MEMORY_SIZE - address;
+    }
+    memcpy(&cpu->data_memory[address], words, sizeof(int) * count);
+    return count;
+}
 
-        APEX_memory(cpu);
-        APEX_memory1(cpu);
-        // if (!cpu->stall) {
-            APEX_execute(cpu);
-        
+/*
+ * Runs every pipeline stage once for the current clock cycle. Returns TRUE
+ * when HALT retires in the writeback stage.
+ */
+static int
+APEX_cpu_cycle(APEX_CPU *cpu)
+{
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        apex_log(cpu, APEX_LOG_TRACE, "--------------------------------------------\n");
+        apex_log(cpu, APEX_LOG_TRACE, "Clock Cycle #: %d\n", cpu->clock);
+        apex_log(cpu, APEX_LOG_TRACE, "--------------------------------------------\n");
+    }
+
+    cpu->progress = FALSE;
+    cpu->forwards = 0;
+    cpu->redirect_pc = -1;
+    if (APEX_writeback(cpu))
+    {
+        return TRUE;
+    }
+
+    APEX_memory(cpu);
+    APEX_memory1(cpu);
+    APEX_execute(cpu);
+    /* Infinite decode bandwidth: an empty Decode has nothing to hold Fetch
+     * for, and what Fetch hands over goes on in the same cycle. Fetch has
+     * already run then, so a stall there does not hold it next cycle. */
+    if (!(cpu->config.ideal & APEX_IDEAL_DECODE) || cpu->decode.has_insn)
+    {
         APEX_decode(cpu);
-        APEX_fetch(cpu);
-        print_reg_file(cpu);
+    }
+    APEX_fetch(cpu);
 
-        /* Increment both cycle count and cpu->clock */
-        cycle++;
-        cpu->clock++;
+    if ((cpu->config.ideal & APEX_IDEAL_DECODE) && cpu->decode.has_insn &&
+        cpu->decode.stage_cycle[APEX_STAGE_DECODE] == cpu->clock + 1)
+    {
+        int fetch_held = cpu->fetch_from_next_cycle;
 
-        /* Check if reached the specified number of cycles */
-        if (cycle >= num_cycles) {
-            printf("APEX_CPU: Simulation stopped after %d cycles, instructions completed = %d\n", cpu->clock, cpu->insn_completed);
-            break;
-        }
+        cpu->decode.stage_cycle[APEX_STAGE_DECODE] = cpu->clock;
+        APEX_decode(cpu);
+        cpu->fetch_from_next_cycle = fetch_held;
     }
+    print_reg_file(cpu);
+    return FALSE;
 }
-// Function to display the current state of the APEX CPU
-void APEX_cpu_display(APEX_CPU *cpu) {
-    printf("=== APEX CPU State ===\n");
-    printf("Program Counter (PC): %d\n", cpu->pc);
-    printf("Instructions Completed: %d\n", cpu->insn_completed);
-    
-    // Display Registers
-    printf("\nRegisters:\n");
-    for (int i = 0; i < REG_FILE_SIZE; i++) {
-        printf("R%d: %d\n", i, cpu->regs[i]);
+
+/*
+ * Called after a cycle in which no latch moved, with the statistics taken at
+ * the start of that cycle. Until the next event on the wheel fires, every
+ * cycle would repeat the idle one exactly, so the clock jumps straight to the
+ * event and the idle cycle's counter deltas are replayed once per skipped
+ * cycle. At most 'limit' cycles are skipped; returns the number skipped.
+ */
+static int
+APEX_cpu_skip_idle_cycles(APEX_CPU *cpu, const APEX_Stats *before, int limit)
+{
+    uint64_t *counters = (uint64_t *)&cpu->stats;
+    const uint64_t *start = (const uint64_t *)before;
+    int next, kinds, skip;
+    size_t i;
+
+    if (cpu->progress)
+    {
+        return 0;
+    }
+
+    next = apex_event_next(&cpu->events, cpu->clock, &kinds);
+    if (next <= cpu->clock)
+    {
+        return 0;
     }
-    // Display Data Memory Contents (First 10 locations)
-    printf("\nData Memory Contents (First 10 Locations):\n");
-    for (int i = 0; i < 10; i++) {
-        printf("Data Memory[%d]: %d\n", i, cpu->data_memory[i]);
+
+    skip = next - cpu->clock;
+    if (skip > limit)
+    {
+        skip = limit;
+    }
+
+    for (i = 0; i < sizeof(APEX_Stats) / sizeof(uint64_t); ++i)
+    {
+        counters[i] += (counters[i] - start[i]) * skip;
     }
+    cpu->stats.skipped_cycles += skip;
 
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        apex_log(cpu, APEX_LOG_TRACE, "Skipping idle cycles %d-%d, waiting on %s\n", cpu->clock,
+               cpu->clock + skip - 1,
+               (kinds & EVENT_MEMORY_DONE) ? "Memory" : "Execute");
+    }
 
-    printf("======================\n");
+    cpu->clock += skip;
+    return skip;
 }
 
-// Function to display memory values
-void show_memory(APEX_CPU *cpu, int start_address, int end_address) {
-    if (start_address < 0 || start_address >= DATA_MEMORY_SIZE ||
-        end_address < 0 || end_address >= DATA_MEMORY_SIZE || start_address > end_address) {
-        printf("Error: Invalid memory range [%d, %d]. Valid range is 0 to %d.\n",
-               start_address, end_address, DATA_MEMORY_SIZE - 1);
-        return;
+/*
+ * Dumps the stage latches, the registers in flight and the last retired
+ * PCs, each part headed by 'tag'
+ */
+static void
+dump_pipeline_state(const APEX_CPU *cpu, const char *tag)
+{
+    const CPU_Stage *stages[] = {&cpu->fetch, &cpu->decode, &cpu->execute,
+                                 &cpu->memory1, &cpu->memory, &cpu->writeback};
+    const char *names[] = {"Fetch", "Decode/RF", "Execute",
+                           "Memory1", "Memory", "Writeback"};
+    int i, first;
+
+    apex_log(cpu, APEX_LOG_DIAG, "%s: Stage latches\n", tag);
+    for (i = 0; i < 6; ++i)
+    {
+        if (i == 0 && stages[i]->has_insn && !pc_in_code_segment(cpu, cpu->pc))
+        {
+            apex_log(cpu, APEX_LOG_DIAG, "%-15s: pc(%d) <outside code segment>\n", names[i], cpu->pc);
+        }
+        else if (stages[i]->has_insn)
+        {
+            log_stage_content(cpu, APEX_LOG_DIAG, names[i], stages[i]);
+        }
+        else
+        {
+            apex_log(cpu, APEX_LOG_DIAG, "%-15s: <empty>\n", names[i]);
+        }
     }
 
-    printf("Memory Values [%d to %d]:\n", start_address, end_address);
-    for (int i = start_address; i <= end_address; i++) {
-        printf("Memory[0x%04X] = %d\n", i, cpu->data_memory[i]);
+    /* Destination registers still in flight, youngest writer first */
+    apex_log(cpu, APEX_LOG_DIAG, "%s: Scoreboard\n", tag);
+    for (i = 1; i < 6; ++i)
+    {
+        if (stages[i]->has_insn && stages[i]->rd >= 0)
+        {
+            apex_log(cpu, APEX_LOG_DIAG, "  R%-3d <- %-10s pc(%d) %s\n", stages[i]->rd,
+                    names[i], stages[i]->pc, stages[i]->opcode_str);
+        }
     }
+    apex_log(cpu, APEX_LOG_DIAG, "  stall=%d rs1_ready=%d rs2_ready=%d rs3_ready=%d "
+                 "fetch_from_next_cycle=%d halt_pending=%d "
+                 "branch_pending=%d branch_target=%d\n",
+            cpu->stall, cpu->rs1_ready, cpu->rs2_ready, cpu->rs3_ready,
+            cpu->fetch_from_next_cycle, cpu->halt_pending,
+            cpu->branch_pending, cpu->branch_target);
+
+    apex_log(cpu, APEX_LOG_DIAG, "%s: Last retired PCs (oldest first):", tag);
+    first = cpu->retired_count > RETIRED_PC_HISTORY
+                ? cpu->retired_count - RETIRED_PC_HISTORY
+                : 0;
+    for (i = first; i < cpu->retired_count; ++i)
+    {
+        apex_log(cpu, APEX_LOG_DIAG, " %d", cpu->retired_pcs[i % RETIRED_PC_HISTORY]);
+    }
+    apex_log(cpu, APEX_LOG_DIAG, "\n");
 }
 
+/* Dumps the pipeline state that explains why the watchdog tripped */
+static void
+dump_watchdog_diagnostics(const APEX_CPU *cpu)
+{
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_WATCHDOG: %s at cycle %d, last retirement at cycle %d\n",
+            cpu->watchdog_reason == WATCHDOG_PC_OUT_OF_RANGE
+                ? "PC outside the code segment"
+                : "No instruction retired",
+            cpu->clock, cpu->last_retire_cycle);
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_WATCHDOG: PC = %d, code segment = [4000, %d)\n", cpu->pc,
+            4000 + 4 * cpu->code_memory_size);
+    dump_pipeline_state(cpu, "APEX_WATCHDOG");
+}
 
+/* Dumps the first divergence from the functional model and the pipeline */
+static void
+dump_cosim_diagnostics(const APEX_CPU *cpu)
+{
+    const APEX_CosimReport *report = APEX_cosim_report(cpu->cosim);
+    char what[256];
+
+    APEX_cosim_describe(cpu->cosim, what, sizeof(what));
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_COSIM: Diverged from the functional model, %s\n", what);
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_COSIM: Cycle %d, PC = %d, %llu retirements checked\n",
+            cpu->clock, cpu->pc, (unsigned long long)report->checked);
+    dump_pipeline_state(cpu, "APEX_COSIM");
+}
 
-
+/* Logs how far the run got and what each stage holds, between two cycles */
 void
-APEX_cpu_run(APEX_CPU *cpu)
+apex_log_snapshot(const APEX_CPU *cpu)
 {
-    char user_prompt_val;
-    int num_cycles = 0;
-    printf("Do you want to set memory from a file? (y/n): ");
-    scanf(" %c", &user_prompt_val); // Note the space before %c to consume newline
+    const CPU_Stage *stages[] = {&cpu->fetch, &cpu->decode, &cpu->execute,
+                                 &cpu->memory1, &cpu->memory, &cpu->writeback};
+    const char *names[] = {"Fetch", "Decode/RF", "Execute",
+                           "Memory1", "Memory", "Writeback"};
+    int i;
 
-    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
-        char filename[256]; // Adjust size as needed
-        printf("Enter the filename: ");
-        scanf("%s", filename); // Read filename from user
-        SetMem(cpu, filename); // Call SetMem with the user-provided filename
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_SNAPSHOT: cycle %d, instructions completed = %d, IPC = %.3f\n",
+            cpu->clock, cpu->insn_completed,
+            cpu->clock ? (double)cpu->insn_completed / cpu->clock : 0.0);
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_SNAPSHOT: data stalls = %llu, structural stalls = %llu, "
+                 "Execute busy = %llu, Memory busy = %llu, flushes = %llu\n",
+            (unsigned long long)cpu->stats.data_stalls,
+            (unsigned long long)cpu->stats.structural_stalls,
+            (unsigned long long)cpu->stats.execute_busy_cycles,
+            (unsigned long long)cpu->stats.memory_busy_cycles,
+            (unsigned long long)cpu->stats.flushes);
+    apex_log(cpu, APEX_LOG_DIAG, "APEX_SNAPSHOT: PC = %d\n", cpu->pc);
+    for (i = 0; i < 6; ++i)
+    {
+        if (stages[i]->has_insn)
+        {
+            log_stage_content(cpu, APEX_LOG_DIAG, names[i], stages[i]);
+        }
+        else
+        {
+            apex_log(cpu, APEX_LOG_DIAG, "%-15s: <empty>\n", names[i]);
+        }
+    }
+}
+
+/*
+ * Detects runs that can no longer make forward progress: no retirement for
+ * longer than the watchdog period plus the longest operation latency, or a
+ * fetch PC outside the code segment with nothing left in flight that could
+ * redirect it or halt. Dumps diagnostics and returns TRUE when it trips.
+ */
+static int
+APEX_watchdog(APEX_CPU *cpu)
+{
+    int limit = cpu->config.watchdog_cycles + cpu->config.memory_latency +
+                cpu->config.mul_latency;
+
+    if (cpu->config.watchdog_cycles > 0 &&
+        cpu->clock - cpu->last_retire_cycle > limit)
+    {
+        cpu->watchdog_reason = WATCHDOG_NO_RETIREMENT;
+    }
+    else if (cpu->fetch.has_insn && !pc_in_code_segment(cpu, cpu->pc) &&
+             !cpu->decode.has_insn && !cpu->execute.has_insn &&
+             !cpu->memory1.has_insn && !cpu->memory.has_insn &&
+             !cpu->writeback.has_insn)
+    {
+        cpu->watchdog_reason = WATCHDOG_PC_OUT_OF_RANGE;
     }
-    printf("Do you want to simulate? (y/n): ");
-    scanf(" %c", &user_prompt_val);
-    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
+    else
+    {
+        return FALSE;
+    }
+
+    dump_watchdog_diagnostics(cpu);
+    return TRUE;
+}
 
-    printf("Enter the number of cycles to simulate (or enter 0 to run indefinitely): ");
-    scanf("%d", &num_cycles);
+/*
+ * Simulates one clock cycle, then fast-forwards over the idle cycles that
+ * follow it without moving the clock past 'limit'. Returns the new status.
+ */
+static int
+APEX_cpu_advance(APEX_CPU *cpu, int limit)
+{
+    APEX_Stats before = cpu->stats;
+    int start_clock = cpu->clock;
+    int start_retired = cpu->insn_completed;
+
+    /* The data the run starts from is loaded before the first cycle */
+    if (cpu->cosim && cpu->clock == 0)
+    {
+        apex_cosim_start(cpu);
     }
 
-    if (num_cycles > 0) {
-        /* Run simulation for specified number of cycles */
-        APEX_cpu_simulate(cpu, num_cycles);
-    } 
+    if (APEX_cpu_cycle(cpu))
+    {
+        /* Halt in writeback stage */
+        cpu->clock++;
+        cpu->status = APEX_STATUS_HALTED;
+    }
     else
-     {
-    while (TRUE)
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        cpu->clock++;
+        APEX_cpu_skip_idle_cycles(cpu, &before, limit - cpu->clock);
+        if (APEX_watchdog(cpu))
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            printf("--------------------------------------------\n");
+            cpu->status = APEX_STATUS_WATCHDOG;
         }
+    }
+    if (cpu->cosim && apex_cosim_check(cpu))
+    {
+        cpu->status = APEX_STATUS_DIVERGED;
+        dump_cosim_diagnostics(cpu);
+    }
 
-        if (APEX_writeback(cpu))
+    apex_cpi_cycle(cpu, &before, start_clock, start_retired);
+    if (cpu->profile)
+    {
+        apex_profile_cycle(cpu, &before);
+    }
+    if (cpu->pipeview)
+    {
+        apex_pipeview_cycle(cpu, &before, start_clock, start_retired);
+    }
+    if (cpu->series)
+    {
+        apex_series_cycle(cpu, start_clock);
+    }
+    if (cpu->recording)
+    {
+        apex_record_cycle(cpu);
+    }
+    if (cpu->stream)
+    {
+        apex_stream_cycle(cpu, &before);
+    }
+    if (cpu->monitor && (cpu->clock >= cpu->monitor_due ||
+                         cpu->status != APEX_STATUS_RUNNING ||
+                         apex_monitor_snapshot_requested(cpu->monitor)))
+    {
+        apex_monitor_publish(cpu);
+    }
+    return cpu->status;
+}
+
+/* Clock value 'cycles' from now, saturated at INT_MAX */
+static int
+clock_after(const APEX_CPU *cpu, int cycles)
+{
+    if (cycles > INT_MAX - cpu->clock)
+    {
+        return INT_MAX;
+    }
+    return cpu->clock + cycles;
+}
+
+/*
+ * Advances the clock by up to 'cycles' cycles, fewer if the program halts
+ * or the watchdog trips first
+ */
+int
+APEX_cpu_step(APEX_CPU *cpu, int cycles)
+{
+    int limit;
+
+    if (cycles <= 0)
+    {
+        return cpu->status;
+    }
+
+    limit = clock_after(cpu, cycles);
+    while (cpu->status == APEX_STATUS_RUNNING && cpu->clock < limit)
+    {
+        APEX_cpu_advance(cpu, limit);
+    }
+    return cpu->status;
+}
+
+/*
+ * Runs until 'stop' returns TRUE, the program halts, the watchdog trips or
+ * 'max_cycles' cycles have passed. 'stop' may be NULL and 'max_cycles' <= 0
+ * means no cycle limit. Fast-forwarded cycles are not polled individually,
+ * the pipeline state does not change during them.
+ */
+int
+APEX_cpu_run_until(APEX_CPU *cpu, APEX_StopFn stop, void *ctx, int max_cycles)
+{
+    int limit = max_cycles > 0 ? clock_after(cpu, max_cycles) : INT_MAX;
+
+    while (cpu->status == APEX_STATUS_RUNNING && cpu->clock < limit)
+    {
+        if (APEX_cpu_advance(cpu, limit) == APEX_STATUS_RUNNING && stop &&
+            stop(cpu, ctx))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
             break;
         }
+    }
+    return cpu->status;
+}
 
-        APEX_memory(cpu);
-        APEX_memory1(cpu);
-        
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-        print_reg_file(cpu);
-        
-        
+typedef struct PC_Watch
+{
+    int pc;
+    int retired_count;
+} PC_Watch;
 
+static int
+retired_watched_pc(const APEX_CPU *cpu, void *ctx)
+{
+    PC_Watch *watch = ctx;
+    int fired = cpu->retired_count != watch->retired_count &&
+                cpu->retired_pcs[(cpu->retired_count - 1) % RETIRED_PC_HISTORY] ==
+                    watch->pc;
 
+    watch->retired_count = cpu->retired_count;
+    return fired;
+}
 
+/* Runs until the instruction at 'pc' retires, see APEX_cpu_run_until */
+int
+APEX_cpu_run_until_pc(APEX_CPU *cpu, int pc, int max_cycles)
+{
+    PC_Watch watch = {pc, cpu->retired_count};
 
+    return APEX_cpu_run_until(cpu, retired_watched_pc, &watch, max_cycles);
+}
 
-        if (cpu->single_step)
-        {
-            printf("Press any key to advance CPU Clock or <q> to quit:\n");
-            scanf("%c", &user_prompt_val);
+/* Runs until the clock reaches 'cycle' */
+int
+APEX_cpu_run_until_cycle(APEX_CPU *cpu, int cycle)
+{
+    return APEX_cpu_step(cpu, cycle - cpu->clock);
+}
 
-            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
-            {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
-                break;
-            }
-        }
+int
+APEX_cpu_get_status(const APEX_CPU *cpu)
+{
+    return cpu->status;
+}
 
+int
+APEX_cpu_get_watchdog_reason(const APEX_CPU *cpu)
+{
+    return cpu->watchdog_reason;
+}
 
-        cpu->clock++;
-        
-        
-        }
-    
-    printf("Do you want to display the CPU state? (y/n): ");
-    scanf(" %c", &user_prompt_val);  // Note the space before %c to consume newline
+int
+APEX_cpu_get_pc(const APEX_CPU *cpu)
+{
+    return cpu->pc;
+}
 
-    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
-        APEX_cpu_display(cpu);  // Call the display function if user wants
-            }
+int
+APEX_cpu_get_clock(const APEX_CPU *cpu)
+{
+    return cpu->clock;
+}
 
-       char command[100]; // Buffer to hold user commands
-    while (TRUE) {
-        printf("\nEnter command ('ShowMem <start_address> <end_address>' or 'q' to quit): ");
-        fgets(command, sizeof(command), stdin); // Get user input
-        command[strcspn(command, "\n")] = 0; // Remove newline character
-
-        if (strncmp(command, "ShowMem", 7) == 0) {
-            int start_address, end_address;
-
-            // Parse the command for memory addresses
-            if (sscanf(command + 8, "%d %d", &start_address, &end_address) == 2) {
-                show_memory(cpu, start_address, end_address);
-            } else if (sscanf(command + 8, "%d", &start_address) == 1) {
-                show_memory(cpu, start_address, start_address);
-            } else {
-                printf("Invalid command.\n");
-            }
-        } else if (strcmp(command, "q") == 0) {
-         
-            break;
-        } else {
-            printf("Unknown command. V\n");
-        }
-        
+int
+APEX_cpu_get_retired(const APEX_CPU *cpu)
+{
+    return cpu->insn_completed;
+}
+
+/* Returns 0 for a register number outside the register file */
+int
+APEX_cpu_get_reg(const APEX_CPU *cpu, int reg)
+{
+    if (reg < 0 || reg >= REG_FILE_SIZE)
+    {
+        return 0;
+    }
+    return cpu->regs[reg];
+}
+
+/* Returns 0 for an address outside data memory */
+int
+APEX_cpu_get_mem(const APEX_CPU *cpu, int address)
+{
+    if (address < 0 || address >= DATA_MEMORY_SIZE)
+    {
+        return 0;
     }
+    return cpu->data_memory[address];
 }
+
+/* The REG_FILE_SIZE registers, read-only */
+const int *
+APEX_cpu_get_regs(const APEX_CPU *cpu)
+{
+    return cpu->regs;
 }
 
+/* The DATA_MEMORY_SIZE words of data memory, read-only */
+const int *
+APEX_cpu_get_data_memory(const APEX_CPU *cpu)
+{
+    return cpu->data_memory;
+}
+
+void
+APEX_cpu_get_cc(const APEX_CPU *cpu, int *z, int *n, int *p)
+{
+    *z = cpu->cc.z;
+    *n = cpu->cc.n;
+    *p = cpu->cc.p;
+}
 
+const APEX_Stats *
+APEX_cpu_get_stats(const APEX_CPU *cpu)
+{
+    return &cpu->stats;
+}
 
 /*
  * This function deallocates APEX CPU.
@@ -1561,11 +2276,15 @@ APEX_cpu_run(APEX_CPU *cpu)
  * Note: You are free to edit this function according to your implementation
  */
 void
-APEX_cpu_stop(APEX_CPU *cpu){
-    free(cpu->code_memory);
+APEX_cpu_destroy(APEX_CPU *cpu)
+{
+    if (!cpu)
+    {
+        return;
+    }
+
+    APEX_program_release(cpu->program);
+    apex_memory_unmap(cpu->data_memory);
+    free(cpu->oracle);
     free(cpu);
 }
-
-
-
-
@@ -0,0 +1,280 @@
+/*
+ * apex_dataflow.c
+ * Contains dataflow analyses, the limit the true dependences of a run put
+ * on its speed, whatever the pipeline
+ *
+ * Writeback hands over every instruction it retires. Each one is placed in
+ * the dynamic dependence graph one step after the latest of its producers:
+ * the last writers of its source registers, of the condition flags for a
+ * branch, and the last STORE or STR to its address for a LOAD or LDR. Only
+ * true dependences count, as if registers and memory were renamed, and
+ * branches are taken as perfectly predicted. Keeping the step and retire
+ * index of the last writer of every register, the flags and every data
+ * memory word is all the state the analysis needs; the graph itself is
+ * never stored.
+ *
+ * The longest chain is the critical path, in instructions, and in cycles
+ * when every instruction takes the cycles the configuration gives it. The
+ * instructions over the critical path are the ILP the program offers. The
+ * distance of a dependence is the number of instructions retired from its
+ * producer to its consumer.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+
+/* Last writer of a register, the flags or a word of data memory */
+typedef struct Flow_Writer
+{
+    uint64_t step;              /* In the dependence graph, 0 if no writer */
+    uint64_t cycles;            /* Its result ready, on the weighted path */
+    uint64_t index;             /* Of its retirement, from 1 */
+} Flow_Writer;
+
+struct APEX_Dataflow
+{
+    APEX_DataflowStats stats;
+    Flow_Writer regs[REG_FILE_SIZE];
+    Flow_Writer flags;
+    Flow_Writer memory[DATA_MEMORY_SIZE];
+};
+
+/* Creates an empty analysis, NULL if out of memory */
+APEX_Dataflow *
+APEX_dataflow_create(void)
+{
+    return calloc(1, sizeof(APEX_Dataflow));
+}
+
+void
+APEX_dataflow_destroy(APEX_Dataflow *dataflow)
+{
+    free(dataflow);
+}
+
+const APEX_DataflowStats *
+APEX_dataflow_stats(const APEX_Dataflow *dataflow)
+{
+    return &dataflow->stats;
+}
+
+/*
+ * Analyses every instruction 'cpu' retires from now on; NULL stops it, as
+ * does APEX_cpu_reset
+ */
+void
+APEX_cpu_set_dataflow(APEX_CPU *cpu, APEX_Dataflow *dataflow)
+{
+    cpu->dataflow = dataflow;
+}
+
+static int
+writes_flags(const APEX_Instruction *insn)
+{
+    switch (insn->opcode)
+    {
+        case OPCODE_CMP:
+        case OPCODE_CML:
+            return TRUE;
+
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        case OPCODE_JALR:
+            return FALSE;
+
+        default:
+            return insn->rd >= 0;
+    }
+}
+
+static int
+reads_flags(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ ||
+           opcode == OPCODE_BP || opcode == OPCODE_BN || opcode == OPCODE_BNP;
+}
+
+/* Cycles the instruction takes once its operands are ready */
+static uint64_t
+insn_cycles(const APEX_CPU *cpu, int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_MUL:
+            return cpu->config.mul_latency;
+
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        case OPCODE_STORE:
+        case OPCODE_STR:
+            return cpu->config.memory_latency;
+
+        default:
+            return 1;
+    }
+}
+
+/* Accounts for the dependence on 'writer', pushing the consumer after it */
+static void
+depend(APEX_Dataflow *dataflow, const Flow_Writer *writer, Flow_Writer *at)
+{
+    if (!writer->step)
+    {
+        return;
+    }
+    dataflow->stats.dependences++;
+    apex_histogram_add(&dataflow->stats.distance, at->index - writer->index);
+    if (writer->step >= at->step)
+    {
+        at->step = writer->step + 1;
+    }
+    if (writer->cycles > at->cycles)
+    {
+        at->cycles = writer->cycles;
+    }
+}
+
+static int
+valid_reg(int reg)
+{
+    return reg >= 0 && reg < REG_FILE_SIZE;
+}
+
+/*
+ * Called by Writeback for every instruction an analysed instance retires.
+ * The registers are those of the instruction in code memory, as Memory1
+ * clears them from branches and jumps.
+ */
+void
+apex_dataflow_retire(APEX_CPU *cpu)
+{
+    APEX_Dataflow *dataflow = cpu->dataflow;
+    const APEX_Instruction *insn;
+    int index = get_code_memory_index_from_pc(cpu->writeback.pc);
+    int address = cpu->writeback.memory_address;
+    int in_memory = address >= 0 && address < DATA_MEMORY_SIZE;
+    Flow_Writer at;
+
+    if ((unsigned)index >= (unsigned)cpu->code_memory_size)
+    {
+        return;
+    }
+    insn = &cpu->code_memory[index];
+    at.step = 1;
+    at.cycles = 0;
+    at.index = ++dataflow->stats.instructions;
+
+    if (valid_reg(insn->rs1))
+    {
+        depend(dataflow, &dataflow->regs[insn->rs1], &at);
+    }
+    if (valid_reg(insn->rs2))
+    {
+        depend(dataflow, &dataflow->regs[insn->rs2], &at);
+    }
+    if (valid_reg(insn->rs3))
+    {
+        depend(dataflow, &dataflow->regs[insn->rs3], &at);
+    }
+    if (reads_flags(insn->opcode))
+    {
+        depend(dataflow, &dataflow->flags, &at);
+    }
+    if (in_memory &&
+        (insn->opcode == OPCODE_LOAD || insn->opcode == OPCODE_LDR) &&
+        dataflow->memory[address].step)
+    {
+        dataflow->stats.memory_dependences++;
+        depend(dataflow, &dataflow->memory[address], &at);
+    }
+    at.cycles += insn_cycles(cpu, insn->opcode);
+
+    if (at.step > dataflow->stats.critical_path)
+    {
+        dataflow->stats.critical_path = at.step;
+    }
+    if (at.cycles > dataflow->stats.critical_cycles)
+    {
+        dataflow->stats.critical_cycles = at.cycles;
+    }
+
+    if (valid_reg(insn->rd))
+    {
+        dataflow->regs[insn->rd] = at;
+    }
+    if (writes_flags(insn))
+    {
+        dataflow->flags = at;
+    }
+    if (in_memory &&
+        (insn->opcode == OPCODE_STORE || insn->opcode == OPCODE_STR))
+    {
+        dataflow->memory[address] = at;
+    }
+}
+
+/* snprintf at the end of what has been written so far */
+#define APPEND(buf, size, len, ...)                                            \
+    ((len) += snprintf((len) < (size) ? (buf) + (len) : NULL,                  \
+                       (len) < (size) ? (size) - (len) : 0, __VA_ARGS__))
+
+static double
+ratio(uint64_t num, uint64_t den)
+{
+    return den ? (double)num / den : 0.0;
+}
+
+/*
+ * Writes the analysis as a JSON object into 'buf', against the 'cycles'
+ * the pipeline took for the instructions analysed. Returns the length of
+ * the whole object, like snprintf.
+ */
+int
+APEX_dataflow_json(const APEX_Dataflow *dataflow, uint64_t cycles, char *buf,
+                   size_t size)
+{
+    const APEX_DataflowStats *stats = &dataflow->stats;
+    const APEX_Histogram *distance = &stats->distance;
+    size_t len = 0;
+    int bucket;
+
+    APPEND(buf, size, len,
+           "{\"instructions\": %llu, \"cycles\": %llu, \"ipc\": %.4f, "
+           "\"critical_path\": %llu, \"ilp\": %.4f, "
+           "\"critical_cycles\": %llu, \"ipc_limit\": %.4f, "
+           "\"dependences\": %llu, \"memory_dependences\": %llu, ",
+           (unsigned long long)stats->instructions, (unsigned long long)cycles,
+           ratio(stats->instructions, cycles),
+           (unsigned long long)stats->critical_path,
+           ratio(stats->instructions, stats->critical_path),
+           (unsigned long long)stats->critical_cycles,
+           ratio(stats->instructions, stats->critical_cycles),
+           (unsigned long long)stats->dependences,
+           (unsigned long long)stats->memory_dependences);
+    APPEND(buf, size, len,
+           "\"distance\": {\"count\": %llu, \"mean\": %.3f, \"p50\": %llu, "
+           "\"p99\": %llu, \"max\": %llu, \"bucket_low\": [",
+           (unsigned long long)distance->count,
+           ratio(distance->sum, distance->count),
+           (unsigned long long)APEX_histogram_percentile(distance, 0.5),
+           (unsigned long long)APEX_histogram_percentile(distance, 0.99),
+           (unsigned long long)distance->max);
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+               bucket ? 1ULL << (bucket - 1) : 0ULL);
+    }
+    APPEND(buf, size, len, "], \"buckets\": [");
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+               (unsigned long long)distance->buckets[bucket]);
+    }
+    APPEND(buf, size, len, "]}}");
+    return len;
+}
@@ -0,0 +1,517 @@
+/*
+ * apex_diff.c
+ * apex-diff, attributes the cycle difference between two runs of a program
+ * to its instructions and to the stall causes behind it
+ *
+ * The runs are either two retirement traces written by apex_sim
+ * --retire-trace, from either build and with any timing options, or two
+ * instances of this build run in lockstep with the timing options given
+ * before and after --vs. Both are read one retirement at a time and aligned
+ * by their position in the dynamic instruction stream, which holds as long
+ * as they follow the same path; the first retirement at which they do not
+ * ends the comparison.
+ *
+ * A retirement is charged the cycles since the one before it: the cycles
+ * that retired nothing, by CPI stack cause, and its own. The difference
+ * between the runs goes to its static instruction, so a load-use stall
+ * falls on the consumer and a flush on the first instruction fetched after
+ * the branch. Traces are mapped and decoded a block at a time and lockstep
+ * instances hand over each retirement as it happens, so all that is kept
+ * is one entry per instruction of the program, however long the runs.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+/* Cycle difference charged to one instruction of the program */
+typedef struct Diff_Entry
+{
+    int pc;
+    int opcode;
+    uint64_t count;                     /* Aligned retirements */
+    int64_t cycles;                     /* Second run less the first */
+    int64_t causes[APEX_CPI_CAUSES];    /* The same by cause */
+} Diff_Entry;
+
+/* One of the runs compared, a trace or an instance in lockstep */
+typedef struct Diff_Run
+{
+    const char *name;
+    void *map;
+    size_t map_len;
+    APEX_RetireReader *reader;
+    APEX_CPU *cpu;
+    APEX_RetireRecord record;   /* Its next retirement */
+    int ready;                  /* Set by the retire function */
+    uint64_t last_cycle;        /* Of the last retirement aligned */
+} Diff_Run;
+
+typedef struct Diff
+{
+    Diff_Entry *entries;        /* By code memory index */
+    int size;
+    uint64_t aligned;
+    int64_t cycles;
+    int64_t causes[APEX_CPI_CAUSES];
+} Diff;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--top <N>] [--count <N>]"
+                    " [--program <file>] <trace file> <trace file>\n"
+                    "       %s [--top <N>] [--count <N>] --run <input.asm>"
+                    " <data file or -> [<timing options>] --vs"
+                    " [<timing options>]\n", prog, prog);
+    exit(1);
+}
+
+static void
+open_trace(Diff_Run *run, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    run->name = path;
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    run->map_len = st.st_size;
+    run->map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                          : MAP_FAILED;
+    close(fd);
+    run->reader = run->map != MAP_FAILED
+                      ? APEX_retire_reader_open(run->map, run->map_len)
+                      : NULL;
+    if (!run->reader)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a retirement trace\n", path);
+        exit(1);
+    }
+    if (APEX_retire_reader_version(run->reader) < 2)
+    {
+        fprintf(stderr, "APEX_Warning: %s is an old trace, its stall causes "
+                "may be wrong\n", path);
+    }
+}
+
+static void
+take_record(void *ctx, const APEX_RetireRecord *record)
+{
+    Diff_Run *run = ctx;
+
+    run->record = *record;
+    run->ready = TRUE;
+}
+
+static int
+record_taken(const APEX_CPU *cpu, void *ctx)
+{
+    (void)cpu;
+    return ((const Diff_Run *)ctx)->ready;
+}
+
+static void
+start_instance(Diff_Run *run, const char *name, APEX_Program *program,
+               const APEX_Config *config, const int *words, int count)
+{
+    run->name = name;
+    run->cpu = APEX_cpu_create(program, config);
+    if (!run->cpu || APEX_cpu_load_data(run->cpu, 0, words, count) < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the pipeline model\n");
+        exit(1);
+    }
+    APEX_cpu_set_retire_fn(run->cpu, take_record, run);
+}
+
+/* Reads the next retirement of 'run': 1 if there was one, 0 at the end */
+static int
+next_record(Diff_Run *run)
+{
+    int rc;
+
+    if (run->reader)
+    {
+        rc = APEX_retire_reader_next(run->reader, &run->record);
+        if (rc < 0)
+        {
+            fprintf(stderr, "APEX_Error: %s is corrupt\n", run->name);
+            exit(1);
+        }
+        return rc;
+    }
+
+    run->ready = FALSE;
+    while (!run->ready && APEX_cpu_get_status(run->cpu) == APEX_STATUS_RUNNING)
+    {
+        APEX_cpu_run_until(run->cpu, record_taken, run, 0);
+    }
+    return run->ready;
+}
+
+/* Entry of the instruction at 'pc', NULL if out of memory */
+static Diff_Entry *
+diff_entry(Diff *diff, int pc, int opcode)
+{
+    int index = (pc - 4000) / 4;
+
+    if (pc < 4000 || pc % 4)
+    {
+        fprintf(stderr, "APEX_Error: Retirement at pc %d\n", pc);
+        exit(1);
+    }
+    if (index >= diff->size)
+    {
+        int size = diff->size ? diff->size : 64;
+        Diff_Entry *entries;
+
+        while (size <= index)
+        {
+            size *= 2;
+        }
+        entries = realloc(diff->entries, sizeof(Diff_Entry) * size);
+        if (!entries)
+        {
+            return NULL;
+        }
+        memset(entries + diff->size, 0,
+               sizeof(Diff_Entry) * (size - diff->size));
+        diff->entries = entries;
+        diff->size = size;
+    }
+    diff->entries[index].pc = pc;
+    diff->entries[index].opcode = opcode;
+    return &diff->entries[index];
+}
+
+/*
+ * Cycles 'run' spent on its current retirement by cause, its own going
+ * to base: all of them for a trace written without the stall causes
+ */
+static uint64_t
+retire_cycles(Diff_Run *run, int64_t causes[])
+{
+    uint64_t cycles = run->record.cycle - run->last_cycle;
+    uint64_t stalled = 0;
+    int cause;
+
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        causes[cause] = run->record.stalls[cause];
+        stalled += run->record.stalls[cause];
+    }
+    causes[APEX_CPI_BASE] = (int64_t)(cycles - stalled);
+    run->last_cycle = run->record.cycle;
+    return cycles;
+}
+
+/* Charges the difference of one pair of aligned retirements, -1 if no memory */
+static int
+diff_add(Diff *diff, Diff_Run runs[2])
+{
+    Diff_Entry *entry = diff_entry(diff, runs[0].record.pc,
+                                   runs[0].record.opcode);
+    int64_t causes[2][APEX_CPI_CAUSES];
+    int64_t cycles;
+    int cause;
+
+    if (!entry)
+    {
+        return -1;
+    }
+    cycles = (int64_t)retire_cycles(&runs[1], causes[1]) -
+             (int64_t)retire_cycles(&runs[0], causes[0]);
+
+    entry->count++;
+    entry->cycles += cycles;
+    diff->cycles += cycles;
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        entry->causes[cause] += causes[1][cause] - causes[0][cause];
+        diff->causes[cause] += causes[1][cause] - causes[0][cause];
+    }
+    diff->aligned++;
+    return 0;
+}
+
+static int
+by_difference(const void *a, const void *b)
+{
+    const Diff_Entry *x = *(const Diff_Entry *const *)a;
+    const Diff_Entry *y = *(const Diff_Entry *const *)b;
+    int64_t dx = x->cycles < 0 ? -x->cycles : x->cycles;
+    int64_t dy = y->cycles < 0 ? -y->cycles : y->cycles;
+
+    if (dx != dy)
+    {
+        return dx > dy ? -1 : 1;
+    }
+    return x->pc - y->pc;
+}
+
+static void
+format_entry(const Diff_Entry *entry, const APEX_Program *program, char *buf,
+             size_t size)
+{
+    int index = (entry->pc - 4000) / 4;
+
+    if (program && index < APEX_program_size(program))
+    {
+        APEX_format_instruction(APEX_program_instruction(program, index), buf,
+                                size);
+    }
+    else
+    {
+        snprintf(buf, size, "%s", apex_opcode_name(entry->opcode));
+    }
+}
+
+static void
+print_report(const Diff *diff, const Diff_Run runs[2],
+             const APEX_Program *program, int top)
+{
+    const Diff_Entry **order;
+    char text[64];
+    int cause, count = 0, i;
+
+    printf("a=%s b=%s\n", runs[0].name, runs[1].name);
+    printf("aligned=%llu cycles_a=%llu cycles_b=%llu delta=%+lld (%+.2f%%)\n",
+           (unsigned long long)diff->aligned,
+           (unsigned long long)runs[0].last_cycle,
+           (unsigned long long)runs[1].last_cycle, (long long)diff->cycles,
+           runs[0].last_cycle ? 100.0 * diff->cycles / runs[0].last_cycle
+                              : 0.0);
+    printf("by cause:");
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        printf(" %s=%+lld", APEX_cpi_cause_name(cause),
+               (long long)diff->causes[cause]);
+    }
+    printf("\n");
+
+    order = malloc(sizeof(Diff_Entry *) * (diff->size ? diff->size : 1));
+    if (!order)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < diff->size; ++i)
+    {
+        if (diff->entries[i].count && diff->entries[i].cycles)
+        {
+            order[count++] = &diff->entries[i];
+        }
+    }
+    qsort(order, count, sizeof(Diff_Entry *), by_difference);
+
+    printf("top %d of %d instructions with a difference:\n",
+           count < top ? count : top, count);
+    printf("%6s  %-24s %10s %10s %9s", "pc", "instruction", "count", "delta",
+           "per_exec");
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        printf(" %10s", APEX_cpi_cause_name(cause));
+    }
+    printf("\n");
+    for (i = 0; i < count && i < top; ++i)
+    {
+        format_entry(order[i], program, text, sizeof(text));
+        printf("%6d  %-24s %10llu %+10lld %+9.3f", order[i]->pc, text,
+               (unsigned long long)order[i]->count, (long long)order[i]->cycles,
+               (double)order[i]->cycles / order[i]->count);
+        for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+        {
+            printf(" %+10lld", (long long)order[i]->causes[cause]);
+        }
+        printf("\n");
+    }
+    free(order);
+}
+
+static int *
+load_data(const char *path, int *count)
+{
+    int *words = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    size_t len;
+    char *text;
+
+    if (!words)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory\n");
+        exit(1);
+    }
+    *count = 0;
+    if (strcmp(path, "-") == 0)
+    {
+        return words;
+    }
+
+    text = apex_read_file(path, &len);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    *count = APEX_parse_data(text, len, words, DATA_MEMORY_SIZE);
+    free(text);
+    if (*count < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", path);
+        exit(1);
+    }
+    return words;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_Program *program = NULL;
+    APEX_Config configs[2];
+    Diff_Run runs[2];
+    Diff diff;
+    const char *paths[2] = {NULL, NULL};
+    const char *program_file = NULL, *data_file = NULL;
+    uint64_t count = UINT64_MAX;
+    int *words = NULL;
+    int lockstep = FALSE, side = 0, top = 10;
+    int num_words = 0, ended[2], i, rc;
+
+    APEX_config_default(&configs[0]);
+    APEX_config_default(&configs[1]);
+    for (i = 1; i < argc; ++i)
+    {
+        rc = lockstep ? apex_parse_config_option(&configs[side], argc, argv, &i)
+                      : 0;
+        if (rc < 0)
+        {
+            print_usage(argv[0]);
+        }
+        else if (rc > 0)
+        {
+            continue;
+        }
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+        {
+            top = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--program") == 0 && i + 1 < argc &&
+                 !lockstep)
+        {
+            program_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--run") == 0 && i + 2 < argc &&
+                 !lockstep && !paths[0] && !program_file)
+        {
+            lockstep = TRUE;
+            program_file = argv[++i];
+            data_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--vs") == 0 && lockstep && side == 0)
+        {
+            side = 1;
+        }
+        else if (argv[i][0] == '-' || lockstep || paths[1])
+        {
+            print_usage(argv[0]);
+        }
+        else
+        {
+            paths[paths[0] ? 1 : 0] = argv[i];
+        }
+    }
+    if (top < 0 || (lockstep ? side == 0 : !paths[1]))
+    {
+        print_usage(argv[0]);
+    }
+
+    if (program_file)
+    {
+        program = apex_load_program(program_file);
+        if (!program)
+        {
+            exit(1);
+        }
+    }
+    memset(runs, 0, sizeof(runs));
+    if (lockstep)
+    {
+        words = load_data(data_file, &num_words);
+        start_instance(&runs[0], "a", program, &configs[0], words, num_words);
+        start_instance(&runs[1], "b", program, &configs[1], words, num_words);
+    }
+    else
+    {
+        open_trace(&runs[0], paths[0]);
+        open_trace(&runs[1], paths[1]);
+    }
+
+    memset(&diff, 0, sizeof(diff));
+    ended[0] = ended[1] = FALSE;
+    while (diff.aligned < count)
+    {
+        ended[0] = !next_record(&runs[0]);
+        ended[1] = !next_record(&runs[1]);
+        if (ended[0] || ended[1])
+        {
+            break;
+        }
+        if (runs[0].record.pc != runs[1].record.pc)
+        {
+            printf("diverged at retirement %llu: a retired pc %d at cycle %llu,"
+                   " b pc %d at cycle %llu\n",
+                   (unsigned long long)diff.aligned + 1, runs[0].record.pc,
+                   (unsigned long long)runs[0].record.cycle,
+                   runs[1].record.pc, (unsigned long long)runs[1].record.cycle);
+            break;
+        }
+        if (diff_add(&diff, runs))
+        {
+            fprintf(stderr, "APEX_Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    if (ended[0] != ended[1])
+    {
+        printf("%s ended after %llu retirements, %s goes on\n",
+               ended[0] ? "a" : "b", (unsigned long long)diff.aligned,
+               ended[0] ? "b" : "a");
+    }
+
+    print_report(&diff, runs, program, top);
+
+    for (i = 0; i < 2; ++i)
+    {
+        if (runs[i].reader)
+        {
+            APEX_retire_reader_close(runs[i].reader);
+            munmap(runs[i].map, runs[i].map_len);
+        }
+        APEX_cpu_destroy(runs[i].cpu);
+    }
+    if (program)
+    {
+        APEX_program_release(program);
+    }
+    free(diff.entries);
+    free(words);
+    return 0;
+}
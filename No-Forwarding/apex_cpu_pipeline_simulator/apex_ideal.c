@@ -0,0 +1,139 @@
+/*
+ * apex_ideal.c
+ * Contains the idealized limits of the pipeline, for bound studies
+ *
+ * APEX_Config.ideal removes one bottleneck of the pipeline per APEX_IDEAL_*
+ * bit, leaving everything else as it is: with perfect forwarding Decode
+ * never waits for an operand, with single-cycle memory every data access
+ * takes one cycle, and with infinite decode bandwidth an instruction goes
+ * through Decode on the cycle Fetch hands it over.
+ *
+ * Zero-penalty branches need to know where a branch goes when it is
+ * fetched. An oracle, the functional model run one instruction ahead of
+ * Decode, gives Fetch the next pc of every instruction it hands over. A
+ * branch that reaches Execute going where Fetch already went redirects
+ * nothing; one that does not (the pipeline and the functional model
+ * disagree) is redirected from Memory1 as usual, and the oracle is stopped
+ * for the rest of the run. Results never depend on the oracle, timing does.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+static const char *const ideal_names[APEX_IDEAL_MODES] = {
+    "forwarding", "branches", "memory", "decode"};
+
+/* Name of idealization 'mode', the index of its APEX_IDEAL_* bit */
+const char *
+APEX_ideal_name(int mode)
+{
+    return mode >= 0 && mode < APEX_IDEAL_MODES ? ideal_names[mode] : "";
+}
+
+/* APEX_IDEAL_* bit named 'name', APEX_IDEAL_ALL for "all", 0 if none */
+int
+APEX_ideal_parse(const char *name)
+{
+    int mode;
+
+    if (strcmp(name, "all") == 0)
+    {
+        return APEX_IDEAL_ALL;
+    }
+    for (mode = 0; mode < APEX_IDEAL_MODES; ++mode)
+    {
+        if (strcmp(name, ideal_names[mode]) == 0)
+        {
+            return 1 << mode;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Called by APEX_cpu_reset once the configuration is set: gives 'cpu' the
+ * oracle of zero-penalty branches, reusing 'oracle' from its last run, or
+ * frees that. Returns -1 if out of memory.
+ */
+int
+apex_ideal_reset(APEX_CPU *cpu, APEX_ArchState *oracle)
+{
+    if (!(cpu->config.ideal & APEX_IDEAL_BRANCHES))
+    {
+        free(oracle);
+        return 0;
+    }
+
+    cpu->oracle = oracle ? oracle : malloc(sizeof(APEX_ArchState));
+    if (!cpu->oracle)
+    {
+        return -1;
+    }
+    APEX_func_init(cpu->oracle);
+    return 0;
+}
+
+/*
+ * Called by Fetch as it hands the instruction at 'pc' over to Decode:
+ * steps the oracle past it and returns where it went, pc + 4 once the
+ * oracle has stopped
+ */
+int
+apex_ideal_next_pc(APEX_CPU *cpu, int pc)
+{
+    APEX_ArchState *oracle = cpu->oracle;
+
+    if (oracle->status != APEX_STATUS_RUNNING || oracle->pc != pc)
+    {
+        return pc + 4;
+    }
+
+    /* The data the run starts from is loaded before the first fetch */
+    if (oracle->retired == 0)
+    {
+        memcpy(oracle->data_memory, cpu->data_memory,
+               sizeof(oracle->data_memory));
+    }
+    if (APEX_func_step(oracle, cpu->program, NULL) == APEX_STATUS_FAULT)
+    {
+        return pc + 4;
+    }
+    return oracle->pc;
+}
+
+/*
+ * Called by Execute once it has run a branch, JUMP or JALR, with whether
+ * Decode held an instruction and Fetch was held before it did. When Fetch
+ * went where the instruction goes, the redirect it asked for is cancelled
+ * and the instructions fetched behind it are kept. Otherwise it redirects
+ * to where it goes, taken or not, and the oracle is stopped.
+ */
+void
+apex_ideal_resolve(APEX_CPU *cpu, int decode_valid, int fetch_held)
+{
+    CPU_Stage *stage = &cpu->execute;
+    int next_pc = cpu->branch_pending ? cpu->branch_target : stage->pc + 4;
+
+    if (next_pc == stage->next_pc)
+    {
+        cpu->branch_pending = FALSE;
+        cpu->decode.has_insn = decode_valid;
+        cpu->fetch_from_next_cycle = fetch_held;
+        return;
+    }
+
+    /* Its state no longer matches the pipeline's, for good */
+    cpu->oracle->status = APEX_STATUS_FAULT;
+    if (!cpu->branch_pending)
+    {
+        cpu->branch_target = next_pc;
+        cpu->branch_pending = TRUE;
+        cpu->fetch_from_next_cycle = TRUE;
+        cpu->decode.has_insn = FALSE;
+    }
+}
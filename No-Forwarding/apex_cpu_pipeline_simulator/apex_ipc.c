@@ -0,0 +1,165 @@
+/*
+ * apex_ipc.c
+ * apex-ipc, prints the live IPC of a run started with apex_sim --stream
+ *
+ * The reference consumer of event streams: it reads the events in place
+ * in the shared ring and only sleeps when the ring is empty. Every
+ * interval it prints the IPC of the last interval and of the whole run,
+ * the share of cycles each kind of stall held up and the events it lost
+ * by falling behind. It waits for the stream to appear and exits when the
+ * run is over.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex.h"
+
+/* Totals over some span of events */
+typedef struct Ipc_Totals
+{
+    uint64_t cycles;
+    uint64_t retired;
+    uint64_t stalled[4];        /* Cycles, by APEX_STALL_* bit */
+    uint64_t redirects;
+} Ipc_Totals;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--interval <ms>] <stream name>\n",
+            prog);
+    exit(1);
+}
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+sleep_ms(int ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+
+    nanosleep(&ts, NULL);
+}
+
+static void
+add_event(Ipc_Totals *totals, const APEX_PipeEvent *event)
+{
+    int bit;
+
+    totals->cycles += event->cycles;
+    totals->retired += event->retired;
+    for (bit = 0; bit < 4; ++bit)
+    {
+        if (event->stalls & (1 << bit))
+        {
+            totals->stalled[bit] += event->cycles;
+        }
+    }
+    if (event->redirect_pc >= 0)
+    {
+        totals->redirects++;
+    }
+}
+
+static double
+share(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void
+print_line(const char *label, const Ipc_Totals *window,
+           const Ipc_Totals *total, uint64_t lost)
+{
+    printf("%s cycles=%llu retired=%llu ipc=%.3f total_ipc=%.3f"
+           " data=%.1f%% structural=%.1f%% mul=%.1f%% memory=%.1f%%"
+           " redirects=%llu lost=%llu\n",
+           label, (unsigned long long)total->cycles,
+           (unsigned long long)total->retired,
+           window->cycles ? (double)window->retired / window->cycles : 0.0,
+           total->cycles ? (double)total->retired / total->cycles : 0.0,
+           share(window->stalled[0], window->cycles),
+           share(window->stalled[1], window->cycles),
+           share(window->stalled[2], window->cycles),
+           share(window->stalled[3], window->cycles),
+           (unsigned long long)window->redirects, (unsigned long long)lost);
+    fflush(stdout);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_StreamReader *reader;
+    const APEX_PipeEvent *events;
+    const char *name = NULL;
+    Ipc_Totals window, total;
+    uint64_t last;
+    int interval = 1000;
+    int i, count;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+        {
+            interval = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-' || name)
+        {
+            print_usage(argv[0]);
+        }
+        else
+        {
+            name = argv[i];
+        }
+    }
+    if (!name || interval <= 0)
+    {
+        print_usage(argv[0]);
+    }
+
+    while (!(reader = APEX_stream_attach(name)))
+    {
+        sleep_ms(10);
+    }
+
+    memset(&window, 0, sizeof(window));
+    memset(&total, 0, sizeof(total));
+    last = now_ms();
+    while ((count = APEX_stream_poll(reader, &events)) >= 0)
+    {
+        if (count == 0)
+        {
+            sleep_ms(1);
+        }
+        for (i = 0; i < count; ++i)
+        {
+            add_event(&window, &events[i]);
+            add_event(&total, &events[i]);
+        }
+        APEX_stream_consume(reader, count);
+
+        if (now_ms() - last >= (uint64_t)interval)
+        {
+            print_line("live", &window, &total, APEX_stream_lost(reader));
+            memset(&window, 0, sizeof(window));
+            last = now_ms();
+        }
+    }
+    print_line("done", &total, &total, APEX_stream_lost(reader));
+
+    APEX_stream_detach(reader);
+    return 0;
+}
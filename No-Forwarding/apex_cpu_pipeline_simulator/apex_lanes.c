@@ -0,0 +1,770 @@
+/*
+ * apex_lanes.c
+ * Contains the batched functional engine, which runs one program over up to
+ * APEX_LANES_MAX data images at once
+ *
+ * State is kept as structure of arrays: every register, condition code and
+ * data memory word is a vector with one element per lane, so an ALU
+ * instruction is a few vector operations for all lanes. Lanes share one PC
+ * while they agree on control flow. When a branch diverges the lanes are
+ * split into groups by PC and the group with the lowest PC runs next under
+ * a lane mask, which lets the groups meet again after the branch rejoins.
+ * LOAD/LDR use gathers, STORE/STR scatters on AVX-512.
+ *
+ * The vector code is written once with GCC vector extensions and compiled
+ * for AVX-512, AVX2 and the baseline ISA; the best one the CPU supports is
+ * chosen at run time.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LANES_X86 1
+#else
+#define LANES_X86 0
+#endif
+
+#include "apex_cpu.h"
+
+/* log2(APEX_LANES_MAX), a memory word's vector index is address << LANE_SHIFT */
+#define LANE_SHIFT 4
+
+#define LANES_ISA_GENERIC 0
+#define LANES_ISA_AVX2 1
+#define LANES_ISA_AVX512 2
+
+typedef int32_t Lane_Vec __attribute__((vector_size(APEX_LANES_MAX * sizeof(int32_t))));
+typedef uint32_t Lane_UVec __attribute__((vector_size(APEX_LANES_MAX * sizeof(uint32_t))));
+
+/* Lanes of 'mask' (all ones or zero per lane) take 'a', the others 'b' */
+#define BLEND(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+static const char *const isa_names[] = {"generic", "avx2", "avx512"};
+
+static const Lane_Vec lane_ids = {0, 1, 2, 3, 4, 5, 6, 7,
+                                  8, 9, 10, 11, 12, 13, 14, 15};
+static const Lane_Vec lane_bits = {0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80,
+                                   0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000,
+                                   0x4000, 0x8000};
+
+struct APEX_Lanes
+{
+    Lane_Vec regs[REG_FILE_SIZE];
+    Lane_Vec z;                        /* Condition codes, 0 or 1 per lane */
+    Lane_Vec n;
+    Lane_Vec p;
+    Lane_Vec pc;                       /* Stale for lanes sharing a PC */
+    Lane_Vec retired;
+    Lane_Vec memory[DATA_MEMORY_SIZE]; /* memory[address][lane] */
+    int status[APEX_LANES_MAX];
+    int num_lanes;
+    int isa;                           /* LANES_ISA_* */
+    APEX_Program *program;
+    unsigned char *operands_valid;     /* Per instruction, see apex_func.c */
+};
+
+static void
+bits_to_vec(uint32_t bits, Lane_Vec *vec)
+{
+    *vec = (lane_bits & (int32_t)bits) != 0;
+}
+
+static uint32_t
+vec_to_bits(const Lane_Vec *vec)
+{
+    uint32_t bits = 0;
+    int i;
+
+    for (i = 0; i < APEX_LANES_MAX; ++i)
+    {
+        if ((*vec)[i])
+        {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+}
+
+#if LANES_X86
+__attribute__((target("avx512f"))) static void
+gather_avx512(const APEX_Lanes *lanes, const Lane_Vec *address,
+              const Lane_Vec *mask, Lane_Vec *dst)
+{
+    __m512i index = _mm512_add_epi32(
+        _mm512_slli_epi32(_mm512_loadu_si512(address), LANE_SHIFT),
+        _mm512_loadu_si512(&lane_ids));
+    __m512i m = _mm512_loadu_si512(mask);
+
+    _mm512_storeu_si512(dst, _mm512_mask_i32gather_epi32(
+                                 _mm512_loadu_si512(dst),
+                                 _mm512_test_epi32_mask(m, m), index,
+                                 lanes->memory, 4));
+}
+
+__attribute__((target("avx512f"))) static void
+scatter_avx512(APEX_Lanes *lanes, const Lane_Vec *address,
+               const Lane_Vec *mask, const Lane_Vec *value)
+{
+    __m512i index = _mm512_add_epi32(
+        _mm512_slli_epi32(_mm512_loadu_si512(address), LANE_SHIFT),
+        _mm512_loadu_si512(&lane_ids));
+    __m512i m = _mm512_loadu_si512(mask);
+
+    _mm512_mask_i32scatter_epi32(lanes->memory, _mm512_test_epi32_mask(m, m),
+                                 index, _mm512_loadu_si512(value), 4);
+}
+
+/* AVX2 gathers eight lanes at a time */
+__attribute__((target("avx2"))) static void
+gather_avx2(const APEX_Lanes *lanes, const Lane_Vec *address,
+            const Lane_Vec *mask, Lane_Vec *dst)
+{
+    int half;
+
+    for (half = 0; half < APEX_LANES_MAX; half += 8)
+    {
+        __m256i index = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_loadu_si256((const __m256i *)&(*address)[half]),
+                              LANE_SHIFT),
+            _mm256_loadu_si256((const __m256i *)&lane_ids[half]));
+
+        _mm256_storeu_si256(
+            (__m256i *)&(*dst)[half],
+            _mm256_mask_i32gather_epi32(
+                _mm256_loadu_si256((const __m256i *)&(*dst)[half]),
+                (const int *)lanes->memory, index,
+                _mm256_loadu_si256((const __m256i *)&(*mask)[half]), 4));
+    }
+}
+#endif
+
+static void
+gather_generic(const APEX_Lanes *lanes, const Lane_Vec *address,
+               const Lane_Vec *mask, Lane_Vec *dst)
+{
+    int i;
+
+    for (i = 0; i < APEX_LANES_MAX; ++i)
+    {
+        if ((*mask)[i])
+        {
+            (*dst)[i] = lanes->memory[(*address)[i]][i];
+        }
+    }
+}
+
+static void
+scatter_generic(APEX_Lanes *lanes, const Lane_Vec *address,
+                const Lane_Vec *mask, const Lane_Vec *value)
+{
+    int i;
+
+    for (i = 0; i < APEX_LANES_MAX; ++i)
+    {
+        if ((*mask)[i])
+        {
+            lanes->memory[(*address)[i]][i] = (*value)[i];
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void
+lanes_gather(const APEX_Lanes *lanes, const Lane_Vec *address,
+             const Lane_Vec *mask, Lane_Vec *dst, int isa)
+{
+#if LANES_X86
+    if (isa == LANES_ISA_AVX512)
+    {
+        gather_avx512(lanes, address, mask, dst);
+        return;
+    }
+    if (isa == LANES_ISA_AVX2)
+    {
+        gather_avx2(lanes, address, mask, dst);
+        return;
+    }
+#endif
+    gather_generic(lanes, address, mask, dst);
+}
+
+/* AVX2 has no scatter, its lanes store one by one */
+static inline __attribute__((always_inline)) void
+lanes_scatter(APEX_Lanes *lanes, const Lane_Vec *address,
+              const Lane_Vec *mask, const Lane_Vec *value, int isa)
+{
+#if LANES_X86
+    if (isa == LANES_ISA_AVX512)
+    {
+        scatter_avx512(lanes, address, mask, value);
+        return;
+    }
+#endif
+    scatter_generic(lanes, address, mask, value);
+}
+
+/* Writes 'result' to rd and sets the condition codes, in the lanes of 'mask' */
+static inline __attribute__((always_inline)) void
+write_result(APEX_Lanes *lanes, int rd, const Lane_Vec *result,
+             const Lane_Vec *mask)
+{
+    lanes->regs[rd] = BLEND(*mask, *result, lanes->regs[rd]);
+    lanes->z = BLEND(*mask, (*result == 0) & 1, lanes->z);
+    lanes->n = BLEND(*mask, (*result < 0) & 1, lanes->n);
+    lanes->p = BLEND(*mask, (*result > 0) & 1, lanes->p);
+}
+
+static inline __attribute__((always_inline)) void
+compare(APEX_Lanes *lanes, const Lane_Vec *a, const Lane_Vec *b,
+        const Lane_Vec *mask)
+{
+    lanes->z = BLEND(*mask, (*a == *b) & 1, lanes->z);
+    lanes->n = BLEND(*mask, (*a < *b) & 1, lanes->n);
+    lanes->p = BLEND(*mask, (*a > *b) & 1, lanes->p);
+}
+
+/*
+ * Lanes that may still execute: running, and below 'max_insns' retired
+ * instructions when it is positive. 'budget' receives the number of steps
+ * every one of them can take before any reaches the limit.
+ */
+static uint32_t
+runnable_lanes(const APEX_Lanes *lanes, int max_insns, int *budget)
+{
+    uint32_t bits = 0;
+    int i;
+
+    *budget = INT_MAX;
+    for (i = 0; i < lanes->num_lanes; ++i)
+    {
+        if (lanes->status[i] != APEX_STATUS_RUNNING)
+        {
+            continue;
+        }
+        if (max_insns > 0)
+        {
+            int left = max_insns - lanes->retired[i];
+
+            if (left <= 0)
+            {
+                continue;
+            }
+            if (left < *budget)
+            {
+                *budget = left;
+            }
+        }
+        bits |= 1u << i;
+    }
+    return bits;
+}
+
+/* The lowest PC among 'runnable', and in 'group' the lanes at that PC */
+static int
+lowest_pc(const APEX_Lanes *lanes, uint32_t runnable, uint32_t *group)
+{
+    int i, pc = INT_MAX;
+
+    *group = 0;
+    for (i = 0; i < APEX_LANES_MAX; ++i)
+    {
+        if (!(runnable & (1u << i)))
+        {
+            continue;
+        }
+        if (lanes->pc[i] < pc)
+        {
+            pc = lanes->pc[i];
+            *group = 0;
+        }
+        if (lanes->pc[i] == pc)
+        {
+            *group |= 1u << i;
+        }
+    }
+    return pc;
+}
+
+/*
+ * Executes 'lanes' until no lane can run. Inlined into one function per
+ * ISA, the vector extensions then compile to that ISA's instructions.
+ */
+static inline __attribute__((always_inline)) void
+lanes_run_body(APEX_Lanes *lanes, int max_insns, int isa)
+{
+    const APEX_Program *program = lanes->program;
+    const Lane_Vec zero = {0};
+    uint32_t runnable, exec_bits = 0;
+    Lane_Vec exec = zero;
+    int budget, converged, shared_pc;
+
+    runnable = runnable_lanes(lanes, max_insns, &budget);
+    shared_pc = lowest_pc(lanes, runnable, &exec_bits);
+    converged = exec_bits == runnable;
+    exec_bits = 0;
+
+    while (runnable)
+    {
+        const APEX_Instruction *insn;
+        Lane_Vec a, b, result, address, valid, next, done;
+        uint32_t group, faults = 0, halts = 0, taken;
+        int i, pc, index, uniform = TRUE, next_pc;
+
+        if (budget == 0)
+        {
+            /* Some lane may be at its limit, leave the PCs for it to keep */
+            if (converged)
+            {
+                bits_to_vec(runnable, &done);
+                lanes->pc = BLEND(done, zero + shared_pc, lanes->pc);
+            }
+            runnable = runnable_lanes(lanes, max_insns, &budget);
+            shared_pc = lowest_pc(lanes, runnable, &group);
+            converged = group == runnable;
+            continue;
+        }
+        budget--;
+
+        if (converged)
+        {
+            pc = shared_pc;
+            group = runnable;
+        }
+        else
+        {
+            pc = lowest_pc(lanes, runnable, &group);
+        }
+        if (group != exec_bits)
+        {
+            exec_bits = group;
+            bits_to_vec(group, &exec);
+        }
+        next_pc = pc + 4;
+        next = zero;
+
+        index = (pc - 4000) / 4;
+        if (pc < 4000 || (pc - 4000) % 4 || index >= program->size ||
+            !lanes->operands_valid[index])
+        {
+            faults = group;
+            goto retire;
+        }
+        insn = &program->code[index];
+
+        switch (insn->opcode)
+        {
+            case OPCODE_ADD:
+                result = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] +
+                                    (Lane_UVec)lanes->regs[insn->rs2]);
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_SUB:
+                result = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] -
+                                    (Lane_UVec)lanes->regs[insn->rs2]);
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_MUL:
+                result = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] *
+                                    (Lane_UVec)lanes->regs[insn->rs2]);
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_AND:
+                result = lanes->regs[insn->rs1] & lanes->regs[insn->rs2];
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_OR:
+                result = lanes->regs[insn->rs1] | lanes->regs[insn->rs2];
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_XOR:
+                result = lanes->regs[insn->rs1] ^ lanes->regs[insn->rs2];
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_ADDL:
+                result = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] +
+                                    (uint32_t)insn->imm);
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_SUBL:
+                result = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] -
+                                    (uint32_t)insn->imm);
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_MOVC:
+                result = zero + insn->imm;
+                write_result(lanes, insn->rd, &result, &exec);
+                break;
+            case OPCODE_DIV:
+                /* No vector integer division, the lanes divide one by one */
+                a = lanes->regs[insn->rs1];
+                b = lanes->regs[insn->rs2];
+                result = lanes->regs[insn->rd];
+                for (i = 0; i < APEX_LANES_MAX; ++i)
+                {
+                    if (!(group & (1u << i)))
+                    {
+                        continue;
+                    }
+                    if (b[i] == 0)
+                    {
+                        faults |= 1u << i;
+                    }
+                    else
+                    {
+                        result[i] = b[i] == -1 ? (int32_t)(0u - (uint32_t)a[i])
+                                               : a[i] / b[i];
+                    }
+                }
+                bits_to_vec(group & ~faults, &valid);
+                write_result(lanes, insn->rd, &result, &valid);
+                break;
+            case OPCODE_CML:
+                b = zero + insn->imm;
+                compare(lanes, &lanes->regs[insn->rs1], &b, &exec);
+                break;
+            case OPCODE_CMP:
+                compare(lanes, &lanes->regs[insn->rs1], &lanes->regs[insn->rs2],
+                        &exec);
+                break;
+            case OPCODE_LOAD:
+            case OPCODE_LDR:
+                b = insn->opcode == OPCODE_LOAD ? zero + insn->imm
+                                                : lanes->regs[insn->rs2];
+                address = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] +
+                                     (Lane_UVec)b);
+                valid = exec & (address >= 0) & (address < DATA_MEMORY_SIZE);
+                faults = group & ~vec_to_bits(&valid);
+                lanes_gather(lanes, &address, &valid, &lanes->regs[insn->rd],
+                             isa);
+                break;
+            case OPCODE_STORE:
+            case OPCODE_STR:
+                b = insn->opcode == OPCODE_STORE ? zero + insn->imm
+                                                 : lanes->regs[insn->rs3];
+                address = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs2] +
+                                     (Lane_UVec)b);
+                valid = exec & (address >= 0) & (address < DATA_MEMORY_SIZE);
+                faults = group & ~vec_to_bits(&valid);
+                lanes_scatter(lanes, &address, &valid, &lanes->regs[insn->rs1],
+                              isa);
+                break;
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_BP:
+            case OPCODE_BN:
+            case OPCODE_BNP:
+                switch (insn->opcode)
+                {
+                    case OPCODE_BZ:
+                        valid = lanes->z != 0;
+                        break;
+                    case OPCODE_BNZ:
+                        valid = lanes->z == 0;
+                        break;
+                    case OPCODE_BP:
+                        valid = lanes->p != 0;
+                        break;
+                    case OPCODE_BN:
+                        valid = lanes->n != 0;
+                        break;
+                    default:
+                        valid = (lanes->n | lanes->z) != 0;
+                        break;
+                }
+                valid &= exec;
+                taken = vec_to_bits(&valid);
+                if (taken == group)
+                {
+                    next_pc = pc + insn->imm;
+                }
+                else if (taken)
+                {
+                    /* Divergence, the two groups continue under masks */
+                    uniform = FALSE;
+                    next = BLEND(valid, zero + (pc + insn->imm), zero + next_pc);
+                }
+                break;
+            case OPCODE_JALR:
+            case OPCODE_JUMP:
+                next = (Lane_Vec)((Lane_UVec)lanes->regs[insn->rs1] +
+                                  (uint32_t)insn->imm);
+                if (insn->opcode == OPCODE_JALR)
+                {
+                    lanes->regs[insn->rd] = BLEND(exec, zero + (pc + 4),
+                                                  lanes->regs[insn->rd]);
+                }
+                next_pc = INT_MIN;
+                for (i = 0; i < APEX_LANES_MAX && uniform; ++i)
+                {
+                    if (group & (1u << i))
+                    {
+                        uniform = next_pc == INT_MIN || next[i] == next_pc;
+                        next_pc = next[i];
+                    }
+                }
+                break;
+            case OPCODE_HALT:
+                halts = group;
+                break;
+        }
+
+retire:
+        /* Faulting lanes keep their PC and do not retire */
+        done = exec;
+        if (faults)
+        {
+            bits_to_vec(group & ~faults, &done);
+            for (i = 0; i < APEX_LANES_MAX; ++i)
+            {
+                if (faults & (1u << i))
+                {
+                    lanes->status[i] = APEX_STATUS_FAULT;
+                }
+            }
+        }
+        for (i = 0; halts && i < APEX_LANES_MAX; ++i)
+        {
+            if (halts & (1u << i))
+            {
+                lanes->status[i] = APEX_STATUS_HALTED;
+            }
+        }
+        lanes->retired -= done;
+        runnable &= ~(faults | halts);
+
+        if (converged && uniform && !faults && !halts)
+        {
+            shared_pc = next_pc;
+            continue;
+        }
+
+        if (uniform)
+        {
+            next = zero + next_pc;
+        }
+
+        if (converged)
+        {
+            lanes->pc = BLEND(exec, zero + pc, lanes->pc);
+        }
+        lanes->pc = BLEND(done, next, lanes->pc);
+        shared_pc = lowest_pc(lanes, runnable, &group);
+        converged = group == runnable;
+    }
+}
+
+#if LANES_X86
+__attribute__((target("avx512f"))) static void
+lanes_run_avx512(APEX_Lanes *lanes, int max_insns)
+{
+    lanes_run_body(lanes, max_insns, LANES_ISA_AVX512);
+}
+
+__attribute__((target("avx2"))) static void
+lanes_run_avx2(APEX_Lanes *lanes, int max_insns)
+{
+    lanes_run_body(lanes, max_insns, LANES_ISA_AVX2);
+}
+#endif
+
+static void
+lanes_run_generic(APEX_Lanes *lanes, int max_insns)
+{
+    lanes_run_body(lanes, max_insns, LANES_ISA_GENERIC);
+}
+
+static int
+isa_supported(int isa)
+{
+#if LANES_X86
+    __builtin_cpu_init();
+    if (isa == LANES_ISA_AVX512)
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (isa == LANES_ISA_AVX2)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return isa == LANES_ISA_GENERIC;
+}
+
+/*
+ * Creates 'num_lanes' instances of 'program' (which is retained), all at the
+ * first instruction with zeroed registers and data memory
+ */
+APEX_Lanes *
+APEX_lanes_create(APEX_Program *program, int num_lanes)
+{
+    APEX_Lanes *lanes;
+    void *block;
+    int i;
+
+    if (!program || num_lanes < 1 || num_lanes > APEX_LANES_MAX)
+    {
+        return NULL;
+    }
+
+    if (posix_memalign(&block, sizeof(Lane_Vec), sizeof(APEX_Lanes)))
+    {
+        return NULL;
+    }
+    lanes = block;
+    memset(lanes, 0, sizeof(APEX_Lanes));
+
+    lanes->operands_valid = malloc(program->size);
+    if (!lanes->operands_valid)
+    {
+        free(lanes);
+        return NULL;
+    }
+    for (i = 0; i < program->size; ++i)
+    {
+        lanes->operands_valid[i] = apex_operands_valid(&program->code[i]);
+    }
+
+    for (i = 0; i < APEX_LANES_MAX; ++i)
+    {
+        lanes->pc[i] = 4000;
+        lanes->status[i] = i < num_lanes ? APEX_STATUS_RUNNING
+                                         : APEX_STATUS_HALTED;
+    }
+    lanes->num_lanes = num_lanes;
+    lanes->program = APEX_program_retain(program);
+
+    lanes->isa = LANES_ISA_AVX512;
+    while (!isa_supported(lanes->isa))
+    {
+        lanes->isa--;
+    }
+    return lanes;
+}
+
+void
+APEX_lanes_destroy(APEX_Lanes *lanes)
+{
+    if (lanes)
+    {
+        APEX_program_release(lanes->program);
+        free(lanes->operands_valid);
+        free(lanes);
+    }
+}
+
+int
+APEX_lanes_count(const APEX_Lanes *lanes)
+{
+    return lanes->num_lanes;
+}
+
+/* Name of the instruction set the lanes run with */
+const char *
+APEX_lanes_get_isa(const APEX_Lanes *lanes)
+{
+    return isa_names[lanes->isa];
+}
+
+/*
+ * Selects an instruction set by name, "generic", "avx2" or "avx512".
+ * Returns -1 if it is unknown or this CPU does not support it.
+ */
+int
+APEX_lanes_set_isa(APEX_Lanes *lanes, const char *isa)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(isa_names) / sizeof(isa_names[0])); ++i)
+    {
+        if (strcmp(isa, isa_names[i]) == 0 && isa_supported(i))
+        {
+            lanes->isa = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* As APEX_cpu_load_data, for the data memory of one lane */
+int
+APEX_lanes_load_data(APEX_Lanes *lanes, int lane, int address,
+                     const int *words, int count)
+{
+    int i;
+
+    if (lane < 0 || lane >= lanes->num_lanes || address < 0 ||
+        address >= DATA_MEMORY_SIZE || count < 0)
+    {
+        return -1;
+    }
+
+    if (count > DATA_MEMORY_SIZE - address)
+    {
+        count = DATA_MEMORY_SIZE - address;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        lanes->memory[address + i][lane] = words[i];
+    }
+    return count;
+}
+
+/*
+ * Runs until every lane has halted, faulted or retired 'max_insns'
+ * instructions in total (max_insns <= 0: no limit). Returns the number of
+ * lanes still running.
+ */
+int
+APEX_lanes_run(APEX_Lanes *lanes, int max_insns)
+{
+    int i, running = 0;
+
+#if LANES_X86
+    if (lanes->isa == LANES_ISA_AVX512)
+    {
+        lanes_run_avx512(lanes, max_insns);
+    }
+    else if (lanes->isa == LANES_ISA_AVX2)
+    {
+        lanes_run_avx2(lanes, max_insns);
+    }
+    else
+#endif
+    {
+        lanes_run_generic(lanes, max_insns);
+    }
+
+    for (i = 0; i < lanes->num_lanes; ++i)
+    {
+        running += lanes->status[i] == APEX_STATUS_RUNNING;
+    }
+    return running;
+}
+
+/* Copies the architectural state of one lane */
+void
+APEX_lanes_get_state(const APEX_Lanes *lanes, int lane, APEX_ArchState *state)
+{
+    int i;
+
+    state->pc = lanes->pc[lane];
+    state->status = lanes->status[lane];
+    state->retired = lanes->retired[lane];
+    state->z = lanes->z[lane];
+    state->n = lanes->n[lane];
+    state->p = lanes->p[lane];
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        state->regs[i] = lanes->regs[i][lane];
+    }
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
+    {
+        state->data_memory[i] = lanes->memory[i][lane];
+    }
+}
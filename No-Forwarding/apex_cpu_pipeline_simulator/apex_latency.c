@@ -0,0 +1,287 @@
+/*
+ * apex_latency.c
+ * Contains the lifecycle latencies of retired instructions, as histograms
+ *
+ * Fetch numbers every instruction it takes in, and each stage latch notes
+ * the clock an instruction entered it on. When Writeback retires one, the
+ * cycles from its fetch to its retirement, and the cycles Decode held it
+ * for beyond the one it needs, go into histograms kept per opcode class.
+ * A histogram counts values in log2 buckets, so the tail of a run of many
+ * millions of instructions takes as little space as its bulk.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+
+#include "apex_cpu.h"
+
+static const char *const class_names[APEX_OPCLASSES] = {
+    "alu", "mul", "load", "store", "branch", "other"};
+
+static const char *const histogram_names[] = {"fetch_to_retire",
+                                              "decode_wait"};
+
+int
+APEX_opcode_class(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_MUL:
+            return APEX_OPCLASS_MUL;
+
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+            return APEX_OPCLASS_LOAD;
+
+        case OPCODE_STORE:
+        case OPCODE_STR:
+            return APEX_OPCLASS_STORE;
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BN:
+        case OPCODE_BNP:
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+            return APEX_OPCLASS_BRANCH;
+
+        case OPCODE_NOP:
+        case OPCODE_HALT:
+            return APEX_OPCLASS_OTHER;
+
+        default:
+            return APEX_OPCLASS_ALU;
+    }
+}
+
+const char *
+APEX_opclass_name(int opclass)
+{
+    return opclass >= 0 && opclass < APEX_OPCLASSES ? class_names[opclass] : "";
+}
+
+const APEX_Latencies *
+APEX_cpu_get_latencies(const APEX_CPU *cpu)
+{
+    return &cpu->latencies;
+}
+
+static int
+bucket_of(uint64_t value)
+{
+    int bucket = 0;
+
+    while (value && bucket < APEX_HIST_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Smallest value bucket 'bucket' counts */
+static uint64_t
+bucket_low(int bucket)
+{
+    return bucket ? (uint64_t)1 << (bucket - 1) : 0;
+}
+
+/* Counts 'value' in 'hist'; the memory traces use it too */
+void
+apex_histogram_add(APEX_Histogram *hist, uint64_t value)
+{
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+    hist->buckets[bucket_of(value)]++;
+}
+
+/*
+ * Called by Writeback for every instruction it retires. The class is that
+ * of the instruction in code memory, as Memory1 turns branches into NOPs.
+ */
+void
+apex_latency_retire(APEX_CPU *cpu)
+{
+    const CPU_Stage *stage = &cpu->writeback;
+    int index = get_code_memory_index_from_pc(stage->pc);
+    int opcode = (unsigned)index < (unsigned)cpu->code_memory_size
+                     ? cpu->code_memory[index].opcode
+                     : stage->opcode;
+    int opclass = APEX_opcode_class(opcode);
+
+    apex_histogram_add(&cpu->latencies.fetch_to_retire[opclass],
+                  cpu->clock - stage->stage_cycle[APEX_STAGE_FETCH] + 1);
+    apex_histogram_add(&cpu->latencies.decode_wait[opclass],
+                  stage->stage_cycle[APEX_STAGE_EXECUTE] -
+                      stage->stage_cycle[APEX_STAGE_DECODE] - 1);
+}
+
+/*
+ * Upper bound of the value below which 'fraction' of the counted values
+ * fall, the largest value of the bucket that holds it; 0 if none were
+ */
+uint64_t
+APEX_histogram_percentile(const APEX_Histogram *hist, double fraction)
+{
+    uint64_t seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        seen += hist->buckets[bucket];
+        if (seen && seen >= fraction * hist->count)
+        {
+            uint64_t high = bucket ? ((uint64_t)1 << bucket) - 1 : 0;
+
+            return high < hist->max ? high : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/* The histograms of all classes summed, for the "all" rows */
+static void
+histogram_total(const APEX_Histogram *hists, APEX_Histogram *total)
+{
+    int opclass, bucket;
+
+    *total = hists[0];
+    for (opclass = 1; opclass < APEX_OPCLASSES; ++opclass)
+    {
+        total->count += hists[opclass].count;
+        total->sum += hists[opclass].sum;
+        if (hists[opclass].max > total->max)
+        {
+            total->max = hists[opclass].max;
+        }
+        for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+        {
+            total->buckets[bucket] += hists[opclass].buckets[bucket];
+        }
+    }
+}
+
+/* Histogram 'kind' of 'latencies', the total of its classes for the last */
+static const APEX_Histogram *
+latency_histogram(const APEX_Latencies *latencies, int kind, int opclass,
+                  APEX_Histogram *total)
+{
+    const APEX_Histogram *hists =
+        kind ? latencies->decode_wait : latencies->fetch_to_retire;
+
+    if (opclass < APEX_OPCLASSES)
+    {
+        return &hists[opclass];
+    }
+    histogram_total(hists, total);
+    return total;
+}
+
+/* snprintf at the end of what has been written so far */
+#define APPEND(buf, size, len, ...)                                            \
+    ((len) += snprintf((len) < (size) ? (buf) + (len) : NULL,                  \
+                       (len) < (size) ? (size) - (len) : 0, __VA_ARGS__))
+
+/*
+ * Writes 'latencies' as a JSON object into 'buf': the smallest value of
+ * each bucket, then for each histogram and class, and "all" of them, the
+ * count, mean, median, 99th percentile, maximum and bucket counts
+ */
+int
+APEX_latencies_json(const APEX_Latencies *latencies, char *buf, size_t size)
+{
+    APEX_Histogram total;
+    size_t len = 0;
+    int kind, opclass, bucket;
+
+    APPEND(buf, size, len, "{\"bucket_low\": [");
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+               (unsigned long long)bucket_low(bucket));
+    }
+    APPEND(buf, size, len, "]");
+
+    for (kind = 0; kind < 2; ++kind)
+    {
+        APPEND(buf, size, len, ", \"%s\": {", histogram_names[kind]);
+        for (opclass = 0; opclass <= APEX_OPCLASSES; ++opclass)
+        {
+            const APEX_Histogram *hist =
+                latency_histogram(latencies, kind, opclass, &total);
+
+            APPEND(buf, size, len,
+                   "%s\"%s\": {\"count\": %llu, \"mean\": %.3f, "
+                   "\"p50\": %llu, \"p99\": %llu, \"max\": %llu, \"buckets\": [",
+                   opclass ? ", " : "",
+                   opclass < APEX_OPCLASSES ? class_names[opclass] : "all",
+                   (unsigned long long)hist->count,
+                   hist->count ? (double)hist->sum / hist->count : 0.0,
+                   (unsigned long long)APEX_histogram_percentile(hist, 0.5),
+                   (unsigned long long)APEX_histogram_percentile(hist, 0.99),
+                   (unsigned long long)hist->max);
+            for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+            {
+                APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+                       (unsigned long long)hist->buckets[bucket]);
+            }
+            APPEND(buf, size, len, "]}");
+        }
+        APPEND(buf, size, len, "}");
+    }
+    APPEND(buf, size, len, "}");
+    return len;
+}
+
+/*
+ * Writes 'latencies' as a CSV table into 'buf', one row per histogram and
+ * class, "all" of them included; the bucket columns are headed by the
+ * smallest value they count
+ */
+int
+APEX_latencies_csv(const APEX_Latencies *latencies, char *buf, size_t size)
+{
+    APEX_Histogram total;
+    size_t len = 0;
+    int kind, opclass, bucket;
+
+    APPEND(buf, size, len, "histogram,class,count,sum,mean,p50,p99,max");
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, ",%llu", (unsigned long long)bucket_low(bucket));
+    }
+    APPEND(buf, size, len, "\n");
+
+    for (kind = 0; kind < 2; ++kind)
+    {
+        for (opclass = 0; opclass <= APEX_OPCLASSES; ++opclass)
+        {
+            const APEX_Histogram *hist =
+                latency_histogram(latencies, kind, opclass, &total);
+
+            APPEND(buf, size, len, "%s,%s,%llu,%llu,%.3f,%llu,%llu,%llu",
+                   histogram_names[kind],
+                   opclass < APEX_OPCLASSES ? class_names[opclass] : "all",
+                   (unsigned long long)hist->count,
+                   (unsigned long long)hist->sum,
+                   hist->count ? (double)hist->sum / hist->count : 0.0,
+                   (unsigned long long)APEX_histogram_percentile(hist, 0.5),
+                   (unsigned long long)APEX_histogram_percentile(hist, 0.99),
+                   (unsigned long long)hist->max);
+            for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+            {
+                APPEND(buf, size, len, ",%llu",
+                       (unsigned long long)hist->buckets[bucket]);
+            }
+            APPEND(buf, size, len, "\n");
+        }
+    }
+    return len;
+}
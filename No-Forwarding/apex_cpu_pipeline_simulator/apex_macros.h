@@ -19,6 +19,130 @@
 /* Size of integer register file */
 #define REG_FILE_SIZE 32
 
+/* Default latencies (in cycles) of the multi-cycle pipeline resources */
+#define DEFAULT_MEMORY_LATENCY 1
+#define DEFAULT_MUL_LATENCY 1
+
+/* Cycles without a retirement after which the watchdog aborts the run */
+#define DEFAULT_WATCHDOG_CYCLES 1000
+
+/* Number of retired PCs kept for the watchdog diagnostic dump */
+#define RETIRED_PC_HISTORY 16
+
+/* Watchdog trip reasons, and the exit code of apex_sim when it trips */
+#define WATCHDOG_NO_RETIREMENT 1
+#define WATCHDOG_PC_OUT_OF_RANGE 2
+#define WATCHDOG_EXIT_CODE 3
+
+/* Exit code of apex_sim when co-simulation finds a divergence */
+#define DIVERGED_EXIT_CODE 4
+
+/* State of a libapex instance, returned by the run functions */
+#define APEX_STATUS_RUNNING 0
+#define APEX_STATUS_HALTED 1
+#define APEX_STATUS_WATCHDOG 2
+#define APEX_STATUS_FAULT 3     /* Functional models: invalid PC, operand or address */
+#define APEX_STATUS_DIVERGED 4  /* Co-simulation: the functional model disagrees */
+
+/* Lanes run in lockstep by one batched functional engine */
+#define APEX_LANES_MAX 16
+
+/* Incremental re-simulation: access tracking granule and checkpoint spacing */
+#define APEX_RECORD_PAGE_WORDS 16
+#define APEX_RECORD_CHECKPOINTS 64
+#define DEFAULT_CHECKPOINT_INTERVAL 100
+
+/* Stages of the pipeline, in order, as the trace timing model numbers them */
+#define APEX_STAGE_FETCH 0
+#define APEX_STAGE_DECODE 1
+#define APEX_STAGE_EXECUTE 2
+#define APEX_STAGE_MEMORY1 3
+#define APEX_STAGE_MEMORY 4
+#define APEX_STAGE_WRITEBACK 5
+#define APEX_NUM_STAGES 6
+
+/* Condition codes after a retired instruction, as the retirement trace holds them */
+#define APEX_FLAG_Z 0x1
+#define APEX_FLAG_N 0x2
+#define APEX_FLAG_P 0x4
+
+/* Retirement trace: records per block, the unit of compression and seeking */
+#define APEX_RETIRE_BLOCK_RECORDS 4096
+
+/* Event streams: default ring size, and reasons a cycle was held up */
+#define APEX_STREAM_DEFAULT_EVENTS 65536
+#define APEX_STALL_DATA 0x1          /* Decode waited for an operand */
+#define APEX_STALL_STRUCTURAL 0x2    /* A stage waited for a full latch */
+#define APEX_STALL_MUL 0x4           /* Execute busy with a multi-cycle MUL */
+#define APEX_STALL_MEMORY 0x8        /* Memory busy with a multi-cycle access */
+
+/* Stages Execute took forwarded operands from */
+#define APEX_FORWARD_MEMORY1 0x1
+#define APEX_FORWARD_MEMORY 0x2
+#define APEX_FORWARD_WRITEBACK 0x4
+
+/* CPI stack: what the cycles of a run were spent on */
+#define APEX_CPI_BASE 0          /* An instruction retired */
+#define APEX_CPI_DATA 1          /* Load-use hazard held Decode */
+#define APEX_CPI_BRANCH 2        /* Bubbles of a taken branch or jump */
+#define APEX_CPI_FETCH 3         /* Nothing fetched: pipeline fill, PC outside code */
+#define APEX_CPI_HALT 4          /* Pipeline draining behind a HALT */
+#define APEX_CPI_STRUCTURAL 5    /* A stage waited for a full latch */
+#define APEX_CPI_MUL 6           /* Execute busy with a multi-cycle MUL */
+#define APEX_CPI_MEMORY 7        /* Memory busy with a multi-cycle access */
+#define APEX_CPI_CAUSES 8
+
+/* Pipeline views: formats they are written in */
+#define APEX_PIPEVIEW_KANATA 0   /* Konata log, Kanata 0004 */
+#define APEX_PIPEVIEW_CHROME 1   /* Chrome trace event JSON */
+
+/* Latency histograms: opcode classes, and buckets of a histogram */
+#define APEX_OPCLASS_ALU 0       /* Arithmetic, logic, compares, MOVC */
+#define APEX_OPCLASS_MUL 1
+#define APEX_OPCLASS_LOAD 2      /* LOAD, LDR */
+#define APEX_OPCLASS_STORE 3     /* STORE, STR */
+#define APEX_OPCLASS_BRANCH 4    /* Branches, JUMP, JALR */
+#define APEX_OPCLASS_OTHER 5     /* NOP, HALT */
+#define APEX_OPCLASSES 6
+#define APEX_HIST_BUCKETS 32
+
+/* Interval series: formats, and what the length of an interval counts */
+#define APEX_SERIES_CSV 0
+#define APEX_SERIES_BINARY 1     /* Columnar, in blocks of records */
+#define APEX_SERIES_CYCLES 0
+#define APEX_SERIES_RETIRED 1
+#define APEX_SERIES_DEFAULT_LENGTH 10000
+
+/* Idealized limits: the bottlenecks APEX_Config.ideal removes, by bit */
+#define APEX_IDEAL_FORWARDING 0x1 /* No operand stalls in Decode */
+#define APEX_IDEAL_BRANCHES 0x2   /* Fetch follows taken branches at once */
+#define APEX_IDEAL_MEMORY 0x4     /* Data accesses take a single cycle */
+#define APEX_IDEAL_DECODE 0x8     /* Decode passes on what it is handed */
+#define APEX_IDEAL_ALL 0xf
+#define APEX_IDEAL_MODES 4
+
+/* Co-simulation: what the first divergence from the functional model was */
+#define APEX_COSIM_NONE 0
+#define APEX_COSIM_PC 1           /* Retired elsewhere than the model went */
+#define APEX_COSIM_FAULT 2        /* The model faults on the instruction */
+#define APEX_COSIM_REGISTER 3     /* Destination register or its value */
+#define APEX_COSIM_MEMORY 4       /* Data address accessed, or value stored */
+#define APEX_COSIM_PAST_HALT 5    /* Retired after the model halted */
+#define APEX_COSIM_NO_HALT 6      /* Halted before the model did */
+#define APEX_COSIM_REG_FILE 7     /* A register differs once both halted */
+#define APEX_COSIM_DATA_MEMORY 8  /* A data word differs once both halted */
+#define APEX_COSIM_HASH 9         /* State hashes of an interval differ */
+
+/* Memory traces: words of a page of the heatmap */
+#define APEX_MEMTRACE_PAGE_WORDS 64
+
+/* Monitors: default cycles between two publications of the counters */
+#define APEX_MONITOR_DEFAULT_INTERVAL 65536
+
+/* Log channels: the per-cycle pipeline trace, and diagnostics */
+#define APEX_LOG_TRACE 0
+#define APEX_LOG_DIAG 1
+
 /* Numeric OPCODE identifiers for instructions */
 #define OPCODE_ADD 0x0
 #define OPCODE_SUB 0x1
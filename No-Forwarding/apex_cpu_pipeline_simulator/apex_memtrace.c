@@ -0,0 +1,479 @@
+/*
+ * apex_memtrace.c
+ * Contains memory traces, every data access of a run analysed as it
+ * happens: reuse distances, a heatmap of the pages, reads and writes
+ *
+ * The memory stage hands over the word address of every LOAD, LDR, STORE
+ * and STR it performs. Addresses are grouped in blocks of a power of two
+ * words, the lines of the caches the trace stands for. The reuse distance
+ * of an access is the number of distinct blocks accessed since the last
+ * access to its block: a fully associative LRU cache of C blocks hits
+ * exactly the accesses at a distance below C, so one histogram of the
+ * distances gives the miss ratio of every cache size.
+ *
+ * Distances are counted in O(log n) with a Fenwick tree over the access
+ * times, where only the last access of each block is marked: the distance
+ * is the number of marks after it. Once the times fill the tree, the marks
+ * still set, one per block at most, are renumbered from 0, so the tree
+ * stays a few times the number of blocks however long the run.
+ *
+ * The heatmap counts the accesses of each page of APEX_MEMTRACE_PAGE_WORDS
+ * over MEMTRACE_TIME_BINS spans of the run. When the run outgrows them,
+ * adjacent spans are merged and their length doubled.
+ *
+ * The accesses themselves are only written out when a write function is
+ * given: Mem_FileHeader, then a Mem_Record per access, buffered in blocks
+ * of MEMTRACE_BUFFER_RECORDS.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define MEMTRACE_MAGIC "APEXMEM1"
+#define MEMTRACE_BUFFER_RECORDS 4096
+#define MEMTRACE_TIME_BINS 64
+#define MEMTRACE_FIRST_SPAN 64      /* Cycles of a heatmap span at first */
+#define MEMTRACE_PAGES (DATA_MEMORY_SIZE / APEX_MEMTRACE_PAGE_WORDS)
+
+typedef struct Mem_FileHeader
+{
+    char magic[8];
+    uint32_t block_words;
+    uint32_t reserved;
+} Mem_FileHeader;
+
+typedef struct Mem_Record
+{
+    uint64_t cycle;
+    int32_t address;            /* Word, as the instruction computed it */
+    uint32_t write;             /* 1 for STORE and STR */
+} Mem_Record;
+
+struct APEX_MemTrace
+{
+    int block_shift;            /* Log2 of the words in a block */
+    int num_blocks;
+    APEX_MemStats stats;
+    /* Reuse distances */
+    int *last_time;             /* Of each block's last access, -1 if none */
+    int *block_at;              /* Block whose last access a time is, or -1 */
+    int *tree;                  /* Fenwick tree of the marked times, from 1 */
+    int capacity;               /* Times the tree holds */
+    int now;                    /* Time of the next access */
+    /* Heatmap */
+    int span;                   /* Cycles of a span */
+    uint64_t heat[MEMTRACE_TIME_BINS][MEMTRACE_PAGES][2]; /* Reads, writes */
+    /* Accesses written out */
+    APEX_WriteFn write_fn;
+    void *ctx;
+    int failed;
+    int buffered;
+    Mem_Record *buffer;
+};
+
+/*
+ * Creates a memory trace grouping addresses in blocks of 'block_words', a
+ * power of two, 0 for one word. With a write function, every access is
+ * written out as well. Returns NULL if out of memory or the block size is
+ * not valid.
+ */
+APEX_MemTrace *
+APEX_memtrace_create(int block_words, APEX_WriteFn write_fn, void *ctx)
+{
+    APEX_MemTrace *trace;
+    int i;
+
+    if (block_words == 0)
+    {
+        block_words = 1;
+    }
+    if (block_words < 0 || block_words > DATA_MEMORY_SIZE ||
+        (block_words & (block_words - 1)))
+    {
+        return NULL;
+    }
+    trace = calloc(1, sizeof(APEX_MemTrace));
+    if (!trace)
+    {
+        return NULL;
+    }
+    while ((1 << trace->block_shift) < block_words)
+    {
+        trace->block_shift++;
+    }
+    trace->num_blocks = DATA_MEMORY_SIZE >> trace->block_shift;
+    trace->capacity = 4 * trace->num_blocks;
+    trace->span = MEMTRACE_FIRST_SPAN;
+    trace->write_fn = write_fn;
+    trace->ctx = ctx;
+    trace->last_time = malloc(sizeof(int) * trace->num_blocks);
+    trace->block_at = malloc(sizeof(int) * trace->capacity);
+    trace->tree = calloc(trace->capacity + 1, sizeof(int));
+    if (write_fn)
+    {
+        trace->buffer = malloc(sizeof(Mem_Record) * MEMTRACE_BUFFER_RECORDS);
+    }
+    if (!trace->last_time || !trace->block_at || !trace->tree ||
+        (write_fn && !trace->buffer))
+    {
+        APEX_memtrace_destroy(trace);
+        return NULL;
+    }
+    for (i = 0; i < trace->num_blocks; ++i)
+    {
+        trace->last_time[i] = -1;
+    }
+    for (i = 0; i < trace->capacity; ++i)
+    {
+        trace->block_at[i] = -1;
+    }
+    if (write_fn)
+    {
+        Mem_FileHeader header;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MEMTRACE_MAGIC, sizeof(header.magic));
+        header.block_words = block_words;
+        if (write_fn(ctx, &header, sizeof(header)) != 0)
+        {
+            trace->failed = TRUE;
+        }
+    }
+    return trace;
+}
+
+void
+APEX_memtrace_destroy(APEX_MemTrace *trace)
+{
+    if (trace)
+    {
+        free(trace->last_time);
+        free(trace->block_at);
+        free(trace->tree);
+        free(trace->buffer);
+        free(trace);
+    }
+}
+
+const APEX_MemStats *
+APEX_memtrace_stats(const APEX_MemTrace *trace)
+{
+    return &trace->stats;
+}
+
+/*
+ * Traces every data access of 'cpu' from now on; NULL stops it, as does
+ * APEX_cpu_reset
+ */
+void
+APEX_cpu_set_memtrace(APEX_CPU *cpu, APEX_MemTrace *trace)
+{
+    cpu->memtrace = trace;
+}
+
+static void
+tree_add(APEX_MemTrace *trace, int time, int delta)
+{
+    for (++time; time <= trace->capacity; time += time & -time)
+    {
+        trace->tree[time] += delta;
+    }
+}
+
+/* Marks at the times before 'time' */
+static int
+tree_count(const APEX_MemTrace *trace, int time)
+{
+    int count = 0;
+
+    for (; time > 0; time -= time & -time)
+    {
+        count += trace->tree[time];
+    }
+    return count;
+}
+
+/* Numbers the marked times from 0 again, keeping their order */
+static void
+tree_compact(APEX_MemTrace *trace)
+{
+    int time, next = 0;
+
+    memset(trace->tree, 0, sizeof(int) * (trace->capacity + 1));
+    for (time = 0; time < trace->capacity; ++time)
+    {
+        int block = trace->block_at[time];
+
+        if (block < 0)
+        {
+            continue;
+        }
+        trace->block_at[time] = -1;
+        trace->block_at[next] = block;
+        trace->last_time[block] = next;
+        tree_add(trace, next, 1);
+        next++;
+    }
+    trace->now = next;
+}
+
+static void
+reuse_access(APEX_MemTrace *trace, int block)
+{
+    int last = trace->last_time[block];
+
+    if (trace->now == trace->capacity)
+    {
+        tree_compact(trace);
+        last = trace->last_time[block];
+    }
+    if (last < 0)
+    {
+        trace->stats.cold++;
+    }
+    else
+    {
+        uint64_t distance = tree_count(trace, trace->now) -
+                            tree_count(trace, last + 1);
+
+        apex_histogram_add(&trace->stats.reuse, distance);
+        tree_add(trace, last, -1);
+        trace->block_at[last] = -1;
+    }
+    tree_add(trace, trace->now, 1);
+    trace->block_at[trace->now] = block;
+    trace->last_time[block] = trace->now++;
+}
+
+/* Bin of the heatmap 'cycle' falls in, merging spans until there is one */
+static int
+heat_bin(APEX_MemTrace *trace, int cycle)
+{
+    while (cycle / trace->span >= MEMTRACE_TIME_BINS)
+    {
+        int bin, page, kind;
+
+        for (bin = 0; bin < MEMTRACE_TIME_BINS / 2; ++bin)
+        {
+            for (page = 0; page < MEMTRACE_PAGES; ++page)
+            {
+                for (kind = 0; kind < 2; ++kind)
+                {
+                    trace->heat[bin][page][kind] =
+                        trace->heat[2 * bin][page][kind] +
+                        trace->heat[2 * bin + 1][page][kind];
+                }
+            }
+        }
+        memset(trace->heat[MEMTRACE_TIME_BINS / 2], 0,
+               sizeof(trace->heat) / 2);
+        trace->span *= 2;
+    }
+    return cycle / trace->span;
+}
+
+static void
+trace_flush(APEX_MemTrace *trace)
+{
+    if (trace->buffered && !trace->failed &&
+        trace->write_fn(trace->ctx, trace->buffer,
+                        trace->buffered * sizeof(Mem_Record)) != 0)
+    {
+        trace->failed = TRUE;
+    }
+    trace->buffered = 0;
+}
+
+/* Called by the memory stage of a traced instance for every data access */
+void
+apex_memtrace_access(APEX_CPU *cpu, int address, int write)
+{
+    APEX_MemTrace *trace = cpu->memtrace;
+
+    if (trace->buffer)
+    {
+        Mem_Record *record = &trace->buffer[trace->buffered++];
+
+        record->cycle = cpu->clock;
+        record->address = address;
+        record->write = write;
+        if (trace->buffered == MEMTRACE_BUFFER_RECORDS)
+        {
+            trace_flush(trace);
+        }
+    }
+
+    if (write)
+    {
+        trace->stats.writes++;
+    }
+    else
+    {
+        trace->stats.reads++;
+    }
+    if (address < 0 || address >= DATA_MEMORY_SIZE)
+    {
+        trace->stats.outside++;
+        return;
+    }
+    reuse_access(trace, address >> trace->block_shift);
+    trace->heat[heat_bin(trace, cpu->clock)]
+               [address / APEX_MEMTRACE_PAGE_WORDS][write]++;
+}
+
+/* Writes out the accesses still buffered, returns -1 if any write failed */
+int
+APEX_memtrace_finish(APEX_MemTrace *trace)
+{
+    if (trace->buffer)
+    {
+        trace_flush(trace);
+    }
+    return trace->failed ? -1 : 0;
+}
+
+/*
+ * Misses of a fully associative LRU cache of 'blocks' blocks, rounded down
+ * to a power of two, over the accesses traced: the first access to each
+ * block, and every access at a reuse distance of 'blocks' or more
+ */
+uint64_t
+APEX_memtrace_lru_misses(const APEX_MemTrace *trace, int blocks)
+{
+    uint64_t misses = trace->stats.cold;
+    int bucket = 1;
+
+    while (bucket < APEX_HIST_BUCKETS && (2 << (bucket - 1)) <= blocks)
+    {
+        bucket++;
+    }
+    for (; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        misses += trace->stats.reuse.buckets[bucket];
+    }
+    return misses;
+}
+
+/* snprintf at the end of what has been written so far */
+#define APPEND(buf, size, len, ...)                                            \
+    ((len) += snprintf((len) < (size) ? (buf) + (len) : NULL,                  \
+                       (len) < (size) ? (size) - (len) : 0, __VA_ARGS__))
+
+/*
+ * Writes the analysis as a JSON object into 'buf': the reads, writes and
+ * their ratio, the reuse distance histogram, the LRU miss ratio of every
+ * cache size that is a power of two, and the heatmap, reads and writes of
+ * each page in each span. Returns the length of the whole object, like
+ * snprintf.
+ */
+int
+APEX_memtrace_json(const APEX_MemTrace *trace, char *buf, size_t size)
+{
+    const APEX_MemStats *stats = &trace->stats;
+    uint64_t inside = stats->reads + stats->writes - stats->outside;
+    size_t len = 0;
+    int bins = 0;
+    int bucket, blocks, bin, page;
+
+    for (bin = 0; bin < MEMTRACE_TIME_BINS; ++bin)
+    {
+        for (page = 0; page < MEMTRACE_PAGES; ++page)
+        {
+            if (trace->heat[bin][page][0] || trace->heat[bin][page][1])
+            {
+                bins = bin + 1;
+            }
+        }
+    }
+
+    APPEND(buf, size, len,
+           "{\"block_words\": %d, \"reads\": %llu, \"writes\": %llu, "
+           "\"read_ratio\": %.4f, \"outside\": %llu, \"cold\": %llu, "
+           "\"reuse\": {\"count\": %llu, \"mean\": %.3f, \"max\": %llu, "
+           "\"bucket_low\": [",
+           1 << trace->block_shift, (unsigned long long)stats->reads,
+           (unsigned long long)stats->writes,
+           stats->reads + stats->writes
+               ? (double)stats->reads / (stats->reads + stats->writes)
+               : 0.0,
+           (unsigned long long)stats->outside, (unsigned long long)stats->cold,
+           (unsigned long long)stats->reuse.count,
+           stats->reuse.count ? (double)stats->reuse.sum / stats->reuse.count
+                              : 0.0,
+           (unsigned long long)stats->reuse.max);
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+               bucket ? 1ULL << (bucket - 1) : 0ULL);
+    }
+    APPEND(buf, size, len, "], \"buckets\": [");
+    for (bucket = 0; bucket < APEX_HIST_BUCKETS; ++bucket)
+    {
+        APPEND(buf, size, len, "%s%llu", bucket ? ", " : "",
+               (unsigned long long)stats->reuse.buckets[bucket]);
+    }
+
+    APPEND(buf, size, len, "]}, \"lru_miss_ratio\": {");
+    for (blocks = 1; blocks <= trace->num_blocks; blocks *= 2)
+    {
+        APPEND(buf, size, len, "%s\"%d\": %.6f", blocks > 1 ? ", " : "", blocks,
+               inside ? (double)APEX_memtrace_lru_misses(trace, blocks) / inside
+                      : 0.0);
+    }
+
+    APPEND(buf, size, len,
+           "}, \"heatmap\": {\"page_words\": %d, \"span_cycles\": %d, "
+           "\"reads\": [",
+           APEX_MEMTRACE_PAGE_WORDS, trace->span);
+    for (bin = 0; bin < bins; ++bin)
+    {
+        APPEND(buf, size, len, "%s[", bin ? ", " : "");
+        for (page = 0; page < MEMTRACE_PAGES; ++page)
+        {
+            APPEND(buf, size, len, "%s%llu", page ? ", " : "",
+                   (unsigned long long)trace->heat[bin][page][0]);
+        }
+        APPEND(buf, size, len, "]");
+    }
+    APPEND(buf, size, len, "], \"writes\": [");
+    for (bin = 0; bin < bins; ++bin)
+    {
+        APPEND(buf, size, len, "%s[", bin ? ", " : "");
+        for (page = 0; page < MEMTRACE_PAGES; ++page)
+        {
+            APPEND(buf, size, len, "%s%llu", page ? ", " : "",
+                   (unsigned long long)trace->heat[bin][page][1]);
+        }
+        APPEND(buf, size, len, "]");
+    }
+    APPEND(buf, size, len, "]}}");
+    return len;
+}
+
+/*
+ * Accesses of page 'page' over the whole run; 'reads' and 'writes' are
+ * set to each kind
+ */
+void
+APEX_memtrace_page(const APEX_MemTrace *trace, int page, uint64_t *reads,
+                   uint64_t *writes)
+{
+    int bin;
+
+    *reads = *writes = 0;
+    if (page < 0 || page >= MEMTRACE_PAGES)
+    {
+        return;
+    }
+    for (bin = 0; bin < MEMTRACE_TIME_BINS; ++bin)
+    {
+        *reads += trace->heat[bin][page][0];
+        *writes += trace->heat[bin][page][1];
+    }
+}
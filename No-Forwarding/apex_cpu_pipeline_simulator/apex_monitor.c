@@ -0,0 +1,239 @@
+/*
+ * apex_monitor.c
+ * Contains monitors, the progress of a long run published while it goes on
+ *
+ * A monitor keeps the APEX_Counters of the instance it watches in a shared
+ * mapping of a file, or in private memory when it has none. The cycle loop
+ * only compares the clock against the cycle the next publication is due
+ * and checks whether a snapshot was requested; every 'interval' cycles the
+ * counters are rewritten under a sequence count, so a poller that copies
+ * them while they change sees it and tries again. A requested snapshot
+ * publishes the counters at once and is logged with them, at the end of
+ * the cycle under way, where the pipeline state is consistent.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+
+#define COUNTERS_MAGIC "APEXCTR1"
+#define COUNTERS_MAX_ATTEMPTS 1000
+
+struct APEX_Monitor
+{
+    APEX_Counters *counters;    /* The file mapping, or private memory */
+    int mapped;
+    int interval;               /* Cycles between two publications */
+    int snapshot;               /* Requested, not logged yet */
+    uint64_t start_ns;
+    uint64_t last_ns;           /* Of the last publication */
+    int last_clock;
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Creates a monitor publishing every 'interval' cycles, 0 for the default,
+ * into the file at 'path', created or overwritten; with a NULL path it only
+ * logs snapshots. Returns NULL if the file cannot be mapped.
+ */
+APEX_Monitor *
+APEX_monitor_create(const char *path, int interval)
+{
+    APEX_Monitor *monitor = calloc(1, sizeof(APEX_Monitor));
+    void *map;
+    int fd;
+
+    if (!monitor)
+    {
+        return NULL;
+    }
+    monitor->interval = interval > 0 ? interval : APEX_MONITOR_DEFAULT_INTERVAL;
+    monitor->start_ns = monotonic_ns();
+    monitor->last_ns = monitor->start_ns;
+
+    if (!path)
+    {
+        monitor->counters = calloc(1, sizeof(APEX_Counters));
+        if (!monitor->counters)
+        {
+            free(monitor);
+            return NULL;
+        }
+        return monitor;
+    }
+
+    /* Not truncated, a poller may still map the file of an earlier run */
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        free(monitor);
+        return NULL;
+    }
+    map = ftruncate(fd, sizeof(APEX_Counters)) == 0
+              ? mmap(NULL, sizeof(APEX_Counters), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0)
+              : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        free(monitor);
+        return NULL;
+    }
+    monitor->counters = map;
+    monitor->mapped = TRUE;
+    memset(monitor->counters, 0, sizeof(APEX_Counters));
+    monitor->counters->pid = getpid();
+    monitor->counters->status = APEX_STATUS_RUNNING;
+    memcpy(monitor->counters->magic, COUNTERS_MAGIC,
+           sizeof(monitor->counters->magic));
+    return monitor;
+}
+
+/* The file keeps the counters last published */
+void
+APEX_monitor_destroy(APEX_Monitor *monitor)
+{
+    if (!monitor)
+    {
+        return;
+    }
+    if (monitor->mapped)
+    {
+        munmap(monitor->counters, sizeof(APEX_Counters));
+    }
+    else
+    {
+        free(monitor->counters);
+    }
+    free(monitor);
+}
+
+/*
+ * Has the instance publish and log a snapshot at the end of the cycle
+ * under way, safe to call from a handler
+ */
+void
+APEX_monitor_request_snapshot(APEX_Monitor *monitor)
+{
+    __atomic_store_n(&monitor->snapshot, TRUE, __ATOMIC_RELAXED);
+}
+
+/* TRUE if a snapshot was requested and not logged yet */
+int
+apex_monitor_snapshot_requested(const APEX_Monitor *monitor)
+{
+    return __atomic_load_n(&monitor->snapshot, __ATOMIC_RELAXED);
+}
+
+/*
+ * Copies the counters of an instance into the file of 'monitor' and logs
+ * a snapshot if one was requested. Called by the cycle loop when due or
+ * asked for a snapshot.
+ */
+void
+apex_monitor_publish(APEX_CPU *cpu)
+{
+    APEX_Monitor *monitor = cpu->monitor;
+    APEX_Counters *counters = monitor->counters;
+    uint64_t now = monotonic_ns();
+    uint32_t sequence = counters->sequence;
+
+    __atomic_store_n(&counters->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    counters->status = cpu->status;
+    counters->pc = cpu->pc;
+    counters->cycles = cpu->clock;
+    counters->retired = cpu->insn_completed;
+    counters->data_stalls = cpu->stats.data_stalls;
+    counters->structural_stalls = cpu->stats.structural_stalls;
+    counters->execute_busy_cycles = cpu->stats.execute_busy_cycles;
+    counters->memory_busy_cycles = cpu->stats.memory_busy_cycles;
+    counters->flushes = cpu->stats.flushes;
+    counters->skipped_cycles = cpu->stats.skipped_cycles;
+    counters->host_ns = now - monitor->start_ns;
+    if (now > monitor->last_ns && cpu->clock > monitor->last_clock)
+    {
+        counters->cycles_per_sec = (uint64_t)(cpu->clock - monitor->last_clock) *
+                                   1000000000 / (now - monitor->last_ns);
+    }
+    __atomic_store_n(&counters->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    monitor->last_ns = now;
+    monitor->last_clock = cpu->clock;
+    cpu->monitor_due = cpu->clock < INT_MAX - monitor->interval
+                           ? cpu->clock + monitor->interval
+                           : INT_MAX;
+
+    if (__atomic_exchange_n(&monitor->snapshot, FALSE, __ATOMIC_RELAXED))
+    {
+        apex_log_snapshot(cpu);
+    }
+}
+
+/*
+ * Publishes the progress of 'cpu' through 'monitor' from now on; NULL
+ * stops it, as does APEX_cpu_reset. The monitor a run stops with holds
+ * its final counters.
+ */
+void
+APEX_cpu_set_monitor(APEX_CPU *cpu, APEX_Monitor *monitor)
+{
+    if (cpu->monitor)
+    {
+        apex_monitor_publish(cpu);
+    }
+    cpu->monitor = monitor;
+    if (monitor)
+    {
+        monitor->last_clock = cpu->clock;
+        cpu->monitor_due = cpu->clock;
+    }
+}
+
+/*
+ * Copies counters published in 'shared' as they were after one
+ * publication. Returns -1 if 'shared' holds no counters, or a simulator
+ * that died while rewriting them left them inconsistent.
+ */
+int
+APEX_counters_read(const APEX_Counters *shared, APEX_Counters *copy)
+{
+    uint32_t before, after;
+    int attempt;
+
+    if (memcmp(shared->magic, COUNTERS_MAGIC, sizeof(shared->magic)) != 0)
+    {
+        return -1;
+    }
+    for (attempt = 0; attempt < COUNTERS_MAX_ATTEMPTS; ++attempt)
+    {
+        before = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        memcpy(copy, shared, sizeof(APEX_Counters));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&shared->sequence, __ATOMIC_RELAXED);
+        if (!(before & 1) && before == after)
+        {
+            return 0;
+        }
+        sched_yield();
+    }
+    return -1;
+}
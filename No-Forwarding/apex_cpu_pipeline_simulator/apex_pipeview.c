@@ -0,0 +1,508 @@
+/*
+ * apex_pipeview.c
+ * Contains pipeline views, every dynamic instruction's way through the
+ * stages written for a pipeline diagram viewer
+ *
+ * After every advance the latches are looked at once. An instruction is
+ * known by the sequence number Fetch gave it; it is in Fetch on the cycle
+ * it is fetched and in every later stage from the cycle after the latch
+ * before it handed it on. An instruction no latch holds any more either
+ * left Writeback, which always retires, or was squashed by a taken branch.
+ * While a stage holds on to its instruction, the hold is shown with the
+ * cause the CPI stack would give it, on a lane of its own.
+ *
+ * Two formats are written, both as plain text streamed through the write
+ * function in blocks of VIEW_BUFFER_SIZE bytes:
+ *  - Kanata 0004, the log format of the Konata viewer: stages on lane 0,
+ *    holds on lane 1, retirements and flushes as R commands
+ *  - the Chrome trace event format, a JSON array for chrome://tracing and
+ *    Perfetto: a track per stage with a slice per instruction, a track per
+ *    stage with its holds, and an instant event per flush. A cycle is
+ *    shown as one microsecond.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define VIEW_BUFFER_SIZE 65536
+#define VIEW_LINE_MAX 512
+
+/* Room for every latch and the instructions leaving them */
+#define VIEW_MAX_LIVE (2 * APEX_NUM_STAGES)
+
+static const char *const kanata_stages[APEX_NUM_STAGES] = {
+    "F", "DRF", "EX", "MEM1", "MEM", "WB"};
+
+static const char *const chrome_tracks[APEX_NUM_STAGES] = {
+    "Fetch", "Decode/RF", "Execute", "Memory1", "Memory", "Writeback"};
+
+/* An instruction in flight, as the view shows it */
+typedef struct View_Insn
+{
+    int pc;
+    uint64_t seq;               /* Given by Fetch */
+    uint64_t id;                /* In the view, from 0 */
+    int stage;                  /* APEX_STAGE_* shown in */
+    int stage_start;            /* Cycle it entered that stage */
+    int hold;                   /* APEX_CPI_* cause of the hold, -1 if none */
+    int hold_start;
+    int found;                  /* APEX_STAGE_* of the latch holding it, or -1 */
+    char text[64];
+} View_Insn;
+
+struct APEX_PipeView
+{
+    int format;                 /* APEX_PIPEVIEW_* */
+    APEX_WriteFn write_fn;
+    void *ctx;
+    int failed;                 /* A write failed, the rest is dropped */
+    char *buf;
+    size_t len;
+    int cycle;                  /* Of the last Kanata cycle command, -1 if none */
+    int clock;                  /* Of the instance after the last advance */
+    uint64_t fetched;
+    uint64_t retired;
+    int num_live;
+    View_Insn live[VIEW_MAX_LIVE];
+};
+
+static void
+view_flush(APEX_PipeView *view)
+{
+    if (view->len && !view->failed &&
+        view->write_fn(view->ctx, view->buf, view->len) != 0)
+    {
+        view->failed = TRUE;
+    }
+    view->len = 0;
+}
+
+static void
+view_printf(APEX_PipeView *view, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+view_printf(APEX_PipeView *view, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    if (view->len > VIEW_BUFFER_SIZE - VIEW_LINE_MAX)
+    {
+        view_flush(view);
+    }
+    va_start(args, fmt);
+    n = vsnprintf(view->buf + view->len, VIEW_LINE_MAX, fmt, args);
+    va_end(args);
+    view->len += n < VIEW_LINE_MAX ? n : VIEW_LINE_MAX - 1;
+}
+
+/* Moves the Kanata log on to 'cycle' */
+static void
+kanata_cycle(APEX_PipeView *view, int cycle)
+{
+    if (view->cycle < 0)
+    {
+        view_printf(view, "C=\t%d\n", cycle);
+        view->cycle = cycle;
+    }
+    else if (cycle > view->cycle)
+    {
+        view_printf(view, "C\t%d\n", cycle - view->cycle);
+        view->cycle = cycle;
+    }
+}
+
+/* Separates a Chrome event from the one before it */
+static void
+chrome_event(APEX_PipeView *view, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+chrome_event(APEX_PipeView *view, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    if (view->len > VIEW_BUFFER_SIZE - VIEW_LINE_MAX)
+    {
+        view_flush(view);
+    }
+    view->buf[view->len++] = ',';
+    view->buf[view->len++] = '\n';
+    va_start(args, fmt);
+    n = vsnprintf(view->buf + view->len, VIEW_LINE_MAX - 2, fmt, args);
+    va_end(args);
+    view->len += n < VIEW_LINE_MAX - 2 ? n : VIEW_LINE_MAX - 3;
+}
+
+/*
+ * Creates a view writing in 'format', APEX_PIPEVIEW_*, through 'write_fn'.
+ * Returns NULL for an unknown format or if out of memory.
+ */
+APEX_PipeView *
+APEX_pipeview_create(int format, APEX_WriteFn write_fn, void *ctx)
+{
+    APEX_PipeView *view;
+    int stage;
+
+    if (format != APEX_PIPEVIEW_KANATA && format != APEX_PIPEVIEW_CHROME)
+    {
+        return NULL;
+    }
+    view = calloc(1, sizeof(APEX_PipeView));
+    if (!view)
+    {
+        return NULL;
+    }
+    view->buf = malloc(VIEW_BUFFER_SIZE);
+    if (!view->buf)
+    {
+        free(view);
+        return NULL;
+    }
+    view->format = format;
+    view->write_fn = write_fn;
+    view->ctx = ctx;
+    view->cycle = -1;
+
+    if (format == APEX_PIPEVIEW_KANATA)
+    {
+        view_printf(view, "Kanata\t0004\n");
+        return view;
+    }
+
+    /* Names and order of the tracks, which every later event follows */
+    view_printf(view, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+                      "\"args\": {\"name\": \"APEX pipeline\"}}");
+    for (stage = 0; stage < APEX_NUM_STAGES; ++stage)
+    {
+        chrome_event(view, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                           "\"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                     stage, chrome_tracks[stage]);
+        chrome_event(view, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                           "\"tid\": %d, \"args\": {\"name\": \"%s holds\"}}",
+                     APEX_NUM_STAGES + stage, chrome_tracks[stage]);
+    }
+    for (stage = 0; stage < 2 * APEX_NUM_STAGES; ++stage)
+    {
+        chrome_event(view, "{\"name\": \"thread_sort_index\", \"ph\": \"M\", "
+                           "\"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}",
+                     stage, stage % APEX_NUM_STAGES * 2 + stage / APEX_NUM_STAGES);
+    }
+    return view;
+}
+
+void
+APEX_pipeview_destroy(APEX_PipeView *view)
+{
+    if (view)
+    {
+        free(view->buf);
+        free(view);
+    }
+}
+
+/*
+ * Shows every cycle 'cpu' simulates from now on in 'view', which must only
+ * serve this instance; NULL stops it, as does APEX_cpu_reset
+ */
+void
+APEX_cpu_set_pipeview(APEX_CPU *cpu, APEX_PipeView *view)
+{
+    cpu->pipeview = view;
+    if (view)
+    {
+        view->clock = cpu->clock;
+    }
+}
+
+static void
+view_stage_start(APEX_PipeView *view, View_Insn *insn, int stage, int cycle)
+{
+    insn->stage = stage;
+    insn->stage_start = cycle;
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        kanata_cycle(view, cycle);
+        view_printf(view, "S\t%llu\t0\t%s\n", (unsigned long long)insn->id,
+                    kanata_stages[stage]);
+    }
+}
+
+static void
+view_stage_end(APEX_PipeView *view, const View_Insn *insn, int cycle)
+{
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        kanata_cycle(view, cycle);
+        view_printf(view, "E\t%llu\t0\t%s\n", (unsigned long long)insn->id,
+                    kanata_stages[insn->stage]);
+        return;
+    }
+
+    /* Entered on the cycle the run stopped at, never worked on */
+    if (cycle == insn->stage_start)
+    {
+        return;
+    }
+    chrome_event(view, "{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", "
+                       "\"ts\": %d, \"dur\": %d, \"pid\": 1, \"tid\": %d, "
+                       "\"args\": {\"id\": %llu, \"pc\": %d}}",
+                 insn->text, insn->stage_start, cycle - insn->stage_start,
+                 insn->stage, (unsigned long long)insn->id, insn->pc);
+}
+
+static void
+view_hold_start(APEX_PipeView *view, View_Insn *insn, int cause, int cycle)
+{
+    insn->hold = cause;
+    insn->hold_start = cycle;
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        kanata_cycle(view, cycle);
+        view_printf(view, "S\t%llu\t1\t%s\n", (unsigned long long)insn->id,
+                    APEX_cpi_cause_name(cause));
+    }
+}
+
+static void
+view_hold_end(APEX_PipeView *view, View_Insn *insn, int cycle)
+{
+    if (insn->hold < 0)
+    {
+        return;
+    }
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        kanata_cycle(view, cycle);
+        view_printf(view, "E\t%llu\t1\t%s\n", (unsigned long long)insn->id,
+                    APEX_cpi_cause_name(insn->hold));
+    }
+    else
+    {
+        chrome_event(view, "{\"name\": \"%s\", \"cat\": \"hold\", \"ph\": \"X\", "
+                           "\"ts\": %d, \"dur\": %d, \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"id\": %llu, \"pc\": %d, \"insn\": \"%s\"}}",
+                     APEX_cpi_cause_name(insn->hold), insn->hold_start,
+                     cycle - insn->hold_start, APEX_NUM_STAGES + insn->stage,
+                     (unsigned long long)insn->id, insn->pc, insn->text);
+    }
+    insn->hold = -1;
+}
+
+/* Ends the way of 'insn' through the pipeline, retired or squashed */
+static void
+view_leave(APEX_PipeView *view, View_Insn *insn, int cycle, int retired)
+{
+    view_hold_end(view, insn, cycle);
+    view_stage_end(view, insn, cycle);
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        view_printf(view, "R\t%llu\t%llu\t%d\n", (unsigned long long)insn->id,
+                    (unsigned long long)(retired ? view->retired : insn->id),
+                    retired ? 0 : 1);
+    }
+    else if (!retired)
+    {
+        chrome_event(view, "{\"name\": \"flush\", \"cat\": \"flush\", \"ph\": \"i\", "
+                           "\"s\": \"t\", \"ts\": %d, \"pid\": 1, \"tid\": %d, "
+                           "\"args\": {\"id\": %llu, \"pc\": %d, \"insn\": \"%s\"}}",
+                     cycle, insn->stage, (unsigned long long)insn->id, insn->pc,
+                     insn->text);
+    }
+    if (retired)
+    {
+        view->retired++;
+    }
+}
+
+static View_Insn *
+view_find(APEX_PipeView *view, const CPU_Stage *latch)
+{
+    int i;
+
+    for (i = 0; i < view->num_live; ++i)
+    {
+        if (view->live[i].seq == latch->seq)
+        {
+            return &view->live[i];
+        }
+    }
+    return NULL;
+}
+
+/* Starts showing the instruction in 'latch', in Fetch from 'cycle' */
+static View_Insn *
+view_add(APEX_PipeView *view, const APEX_CPU *cpu, const CPU_Stage *latch,
+         int cycle)
+{
+    View_Insn *insn = &view->live[view->num_live++];
+    size_t len;
+
+    insn->pc = latch->pc;
+    insn->seq = latch->seq;
+    insn->id = view->fetched++;
+    insn->hold = -1;
+    insn->found = -1;
+    APEX_format_instruction(
+        &cpu->code_memory[get_code_memory_index_from_pc(latch->pc)],
+        insn->text, sizeof(insn->text));
+    len = strlen(insn->text);
+    while (len > 0 && insn->text[len - 1] == ' ')
+    {
+        insn->text[--len] = '\0';
+    }
+
+    if (view->format == APEX_PIPEVIEW_KANATA)
+    {
+        kanata_cycle(view, cycle);
+        view_printf(view, "I\t%llu\t%llu\t0\n", (unsigned long long)insn->id,
+                    (unsigned long long)insn->id);
+        view_printf(view, "L\t%llu\t0\t%d: %s\n", (unsigned long long)insn->id,
+                    insn->pc, insn->text);
+    }
+    view_stage_start(view, insn, APEX_STAGE_FETCH, cycle);
+    return insn;
+}
+
+/*
+ * Called after every advance of an instance with a view, with the
+ * statistics, clock and retirements from before it. Cycle 'now' was
+ * simulated; the latches after it are what the stages work on next.
+ */
+void
+apex_pipeview_cycle(APEX_CPU *cpu, const APEX_Stats *before, int start_clock,
+                    int start_retired)
+{
+    APEX_PipeView *view = cpu->pipeview;
+    const CPU_Stage *stages[APEX_NUM_STAGES] = {
+        &cpu->fetch, &cpu->decode, &cpu->execute,
+        &cpu->memory1, &cpu->memory, &cpu->writeback};
+    int now = start_clock;
+    int next = start_clock + 1;
+    View_Insn *insn;
+    int stage, i, j;
+
+    view->clock = cpu->clock;
+    for (i = 0; i < view->num_live; ++i)
+    {
+        view->live[i].found = -1;
+    }
+
+    /* Fetch hands a copy on, the furthest latch holding one is where it is */
+    for (stage = APEX_STAGE_WRITEBACK; stage >= APEX_STAGE_FETCH; --stage)
+    {
+        const CPU_Stage *latch = stages[stage];
+        int index = get_code_memory_index_from_pc(latch->pc);
+
+        if (!latch->has_insn || latch->pc < 4000 || (latch->pc - 4000) % 4 ||
+            index >= cpu->code_memory_size)
+        {
+            continue;
+        }
+        insn = view_find(view, latch);
+        if (!insn)
+        {
+            if (view->num_live == VIEW_MAX_LIVE)
+            {
+                continue;
+            }
+            insn = view_add(view, cpu, latch, now);
+        }
+        if (insn->found < 0)
+        {
+            insn->found = stage;
+        }
+    }
+
+    /* On this cycle: holds, and fetches squashed before they were used */
+    for (i = 0; i < view->num_live; ++i)
+    {
+        insn = &view->live[i];
+
+        /* Still where it was, and not because it was only fetched now */
+        if (insn->found == insn->stage &&
+            !(insn->stage == APEX_STAGE_FETCH && insn->stage_start == now))
+        {
+            int cause = apex_cpi_held_cause(cpu, before,
+                                            insn->stage == APEX_STAGE_FETCH
+                                                ? APEX_STAGE_DECODE
+                                                : insn->stage);
+
+            if (insn->hold != cause)
+            {
+                view_hold_end(view, insn, now);
+                view_hold_start(view, insn, cause, now);
+            }
+        }
+        else
+        {
+            view_hold_end(view, insn, now);
+        }
+        if (insn->found < 0 && insn->stage == APEX_STAGE_FETCH)
+        {
+            view_leave(view, insn, now, FALSE);
+        }
+    }
+
+    /* On the next cycle: moves, retirements and squashes */
+    for (i = 0, j = 0; i < view->num_live; ++i)
+    {
+        insn = &view->live[i];
+        if (insn->found < 0)
+        {
+            if (insn->stage != APEX_STAGE_FETCH)
+            {
+                view_leave(view, insn, next,
+                           insn->stage == APEX_STAGE_WRITEBACK &&
+                               cpu->insn_completed != start_retired);
+            }
+            continue;
+        }
+        if (insn->found != insn->stage)
+        {
+            view_stage_end(view, insn, next);
+            view_stage_start(view, insn, insn->found, next);
+        }
+        view->live[j++] = *insn;
+    }
+    view->num_live = j;
+}
+
+/*
+ * Ends the instructions still in flight at the clock the instance stopped
+ * at and writes the rest of the view. Returns -1 if any write failed.
+ */
+int
+APEX_pipeview_finish(APEX_PipeView *view)
+{
+    int i;
+
+    for (i = 0; i < view->num_live; ++i)
+    {
+        view_hold_end(view, &view->live[i], view->clock);
+        view_stage_end(view, &view->live[i], view->clock);
+    }
+    view->num_live = 0;
+    if (view->format == APEX_PIPEVIEW_CHROME)
+    {
+        view_printf(view, "\n]\n");
+    }
+    view_flush(view);
+    return view->failed ? -1 : 0;
+}
+
+/* Dynamic instructions shown so far */
+uint64_t
+APEX_pipeview_instructions(const APEX_PipeView *view)
+{
+    return view->fetched;
+}
@@ -0,0 +1,125 @@
+/*
+ * apex_profile.c
+ * Contains profiles, the cost of each instruction of the program over a run
+ *
+ * A profile is a flat array of APEX_PcProfile, one per instruction of the
+ * program at its code memory index. Writeback counts every instruction it
+ * retires with the cycles since it was fetched. After every advance the
+ * instruction Decode held for an operand is charged the stall cycles,
+ * fast-forwarded ones included, and a branch that redirected fetch, which
+ * Memory1 has just passed on to Memory, is charged the flush.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+
+struct APEX_Profile
+{
+    int size;                   /* Instructions of the program */
+    APEX_PcProfile *entries;
+};
+
+/* Creates an empty profile for runs of 'program', NULL if out of memory */
+APEX_Profile *
+APEX_profile_create(const APEX_Program *program)
+{
+    APEX_Profile *profile = calloc(1, sizeof(APEX_Profile));
+
+    if (!profile)
+    {
+        return NULL;
+    }
+    profile->size = APEX_program_size(program);
+    profile->entries = calloc(profile->size > 0 ? profile->size : 1,
+                              sizeof(APEX_PcProfile));
+    if (!profile->entries)
+    {
+        free(profile);
+        return NULL;
+    }
+    return profile;
+}
+
+void
+APEX_profile_destroy(APEX_Profile *profile)
+{
+    if (profile)
+    {
+        free(profile->entries);
+        free(profile);
+    }
+}
+
+/*
+ * The entry of every instruction, at its code memory index; '*count' is
+ * set to the number of instructions
+ */
+const APEX_PcProfile *
+APEX_profile_entries(const APEX_Profile *profile, int *count)
+{
+    *count = profile->size;
+    return profile->entries;
+}
+
+/*
+ * Adds every cycle 'cpu' simulates from now on to 'profile', which must have
+ * been created for the program it runs; NULL stops it, as does
+ * APEX_cpu_reset. Returns -1 if the programs differ in size.
+ */
+int
+APEX_cpu_set_profile(APEX_CPU *cpu, APEX_Profile *profile)
+{
+    if (profile && profile->size != cpu->code_memory_size)
+    {
+        return -1;
+    }
+    cpu->profile = profile;
+    return 0;
+}
+
+static APEX_PcProfile *
+profile_entry(APEX_Profile *profile, int pc)
+{
+    int index = get_code_memory_index_from_pc(pc);
+
+    return (unsigned)index < (unsigned)profile->size ? &profile->entries[index]
+                                                     : NULL;
+}
+
+/* Called by Writeback for every instruction a profiled instance retires */
+void
+apex_profile_retire(APEX_CPU *cpu)
+{
+    APEX_PcProfile *entry = profile_entry(cpu->profile, cpu->writeback.pc);
+
+    if (entry)
+    {
+        entry->executions++;
+        entry->latency_cycles += cpu->clock - cpu->writeback.stage_cycle[APEX_STAGE_FETCH] + 1;
+    }
+}
+
+/*
+ * Called after every advance of a profiled instance, with the statistics
+ * taken before it
+ */
+void
+apex_profile_cycle(APEX_CPU *cpu, const APEX_Stats *before)
+{
+    APEX_Profile *profile = cpu->profile;
+    APEX_PcProfile *entry;
+
+    if (cpu->stats.data_stalls != before->data_stalls &&
+        (entry = profile_entry(profile, cpu->decode.pc)))
+    {
+        entry->stall_cycles += cpu->stats.data_stalls - before->data_stalls;
+    }
+    if (cpu->redirect_pc >= 0 && (entry = profile_entry(profile, cpu->memory.pc)))
+    {
+        entry->flushes++;
+    }
+}
@@ -0,0 +1,1136 @@
+/*
+ * apex_retire.c
+ * Contains the retirement trace, a compact record of every instruction the
+ * pipeline retires
+ *
+ * Records are gathered in blocks of APEX_RETIRE_BLOCK_RECORDS. Within a
+ * block every field goes to the stream of its kind: header bytes and
+ * opcodes, cycle and PC deltas, register values and memory accesses. Cycles
+ * and PCs are stored as the difference from the previous record, usually
+ * just a bit of the header, register values as the difference from the last
+ * value of that register and addresses from the last address. The cycles
+ * that retired nothing before a record, by CPI stack cause, follow its PC
+ * when there are any, a byte of the causes and a count for each. The streams
+ * of a loop then repeat almost byte for byte, which the LZ77 compressor
+ * below turns into a few bytes per iteration. The delta state starts over
+ * with every block, so each decodes on its own; the index after the last
+ * block gives the offset, first record and first cycle of all of them.
+ *
+ * File layout: Retire_FileHeader, the blocks (a Retire_BlockHeader and its
+ * bytes), the Retire_IndexEntry of every block, Retire_Footer.
+ *
+ * The version is the last character of the magic. Version 1 traces charged
+ * the idle cycles the pipeline skipped to the cause of the cycle before
+ * them, so their stall counts may be wrong; they are still read, and
+ * APEX_retire_reader_version tells them apart. The layout is the same.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define RETIRE_MAGIC "APEXRTR2"
+#define RETIRE_MAGIC_V1 "APEXRTR1"
+#define RETIRE_VERSION 2
+#define RETIRE_INDEX_MAGIC "APEXRTRX"
+
+/* Streams of a block, and the most bytes one record adds to any of them */
+#define STREAM_CONTROL 0   /* Header byte, opcode, register written */
+#define STREAM_TIME 1      /* Cycle and PC deltas, stall cycles */
+#define STREAM_VALUE 2     /* Register value deltas */
+#define STREAM_MEMORY 3    /* Address delta and word */
+#define RETIRE_STREAMS 4
+#define RETIRE_STREAM_BYTES 64
+
+/* Header byte of a record */
+#define RECORD_FLAGS 0x07       /* APEX_FLAG_* */
+#define RECORD_NEXT_CYCLE 0x08  /* Retired the cycle after the previous one */
+#define RECORD_NEXT_PC 0x10     /* At the PC after the previous one */
+#define RECORD_RD 0x20
+#define RECORD_MEMORY 0x40
+#define RECORD_STALLS 0x80
+
+/* Retire_BlockHeader flags */
+#define BLOCK_COMPRESSED 0x1
+
+/* Compressor: LZ77 with 64 KB window, sequences as in the LZ4 block format */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+typedef struct Retire_FileHeader
+{
+    char magic[8];
+    uint32_t block_records;
+    uint32_t reserved;
+} Retire_FileHeader;
+
+typedef struct Retire_BlockHeader
+{
+    uint32_t stored_len;        /* Bytes following the header */
+    uint32_t raw_len;           /* Bytes once decompressed */
+    uint32_t num_records;
+    uint32_t flags;
+} Retire_BlockHeader;
+
+typedef struct Retire_IndexEntry
+{
+    uint64_t offset;            /* Of the block header from the file start */
+    uint64_t first_record;
+    uint64_t first_cycle;
+} Retire_IndexEntry;
+
+typedef struct Retire_Footer
+{
+    uint64_t index_offset;
+    uint64_t num_blocks;
+    uint64_t num_records;
+    char magic[8];
+} Retire_Footer;
+
+/* What the next record is encoded against, reset at every block */
+typedef struct Retire_Context
+{
+    uint64_t cycle;
+    int pc;
+    int address;
+    int regs[REG_FILE_SIZE];
+} Retire_Context;
+
+typedef struct Retire_Stream
+{
+    uint8_t *data;
+    size_t len;
+} Retire_Stream;
+
+/* Read position in a stream of a decoded block */
+typedef struct Retire_Cursor
+{
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    int error;                  /* Read past the end */
+} Retire_Cursor;
+
+struct APEX_RetireWriter
+{
+    APEX_WriteFn write_fn;
+    void *ctx;
+    int failed;                 /* A write failed, the stream is lost */
+    int finished;
+    uint64_t bytes;             /* Written so far */
+    uint64_t records;
+    Retire_Context context;
+    uint32_t block_records;     /* In the block being gathered */
+    uint64_t block_first_cycle;
+    Retire_Stream streams[RETIRE_STREAMS];
+    uint8_t *raw;               /* Stream lengths, then the streams */
+    uint8_t *packed;
+    Retire_IndexEntry *index;
+    size_t num_blocks;
+    size_t index_capacity;
+    int32_t hash[1 << LZ_HASH_BITS];
+};
+
+struct APEX_RetireReader
+{
+    const uint8_t *data;
+    size_t len;
+    uint32_t block_records;
+    int version;
+    Retire_IndexEntry *index;
+    int num_blocks;
+    uint64_t num_records;
+    uint64_t index_offset;      /* End of the last block */
+    int next_block;             /* Decoded once the current one is used up */
+    uint32_t remaining;         /* Records left in the current block */
+    Retire_Context context;
+    Retire_Cursor streams[RETIRE_STREAMS];
+    uint8_t *raw;
+    size_t raw_capacity;
+};
+
+static size_t
+raw_capacity(uint32_t block_records)
+{
+    return sizeof(uint32_t) * RETIRE_STREAMS +
+           (size_t)block_records * RETIRE_STREAM_BYTES * RETIRE_STREAMS;
+}
+
+/* Largest output of lz_compress for 'len' bytes of input */
+static size_t
+lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+static uint32_t
+lz_read32(const uint8_t *p)
+{
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* The part of a literal or match length that does not fit its nibble */
+static uint8_t *
+lz_put_length(uint8_t *out, size_t length)
+{
+    while (length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+/* One sequence: literals, then a match unless 'match' is 0 (the last one) */
+static uint8_t *
+lz_put_sequence(uint8_t *out, const uint8_t *literals, size_t num_literals,
+                size_t offset, size_t match)
+{
+    uint8_t *token = out++;
+    size_t match_code = match ? match - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)((num_literals < 15 ? num_literals : 15) << 4 |
+                       (match_code < 15 ? match_code : 15));
+    if (num_literals >= 15)
+    {
+        out = lz_put_length(out, num_literals - 15);
+    }
+    memcpy(out, literals, num_literals);
+    out += num_literals;
+
+    if (match)
+    {
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+        if (match_code >= 15)
+        {
+            out = lz_put_length(out, match_code - 15);
+        }
+    }
+    return out;
+}
+
+/* Compresses 'len' bytes into 'dst', which holds lz_bound(len) */
+static size_t
+lz_compress(int32_t *table, const uint8_t *src, size_t len, uint8_t *dst)
+{
+    uint8_t *out = dst;
+    size_t pos = 0, anchor = 0;
+    int i;
+
+    for (i = 0; i < 1 << LZ_HASH_BITS; ++i)
+    {
+        table[i] = -1;
+    }
+
+    while (pos + LZ_MIN_MATCH <= len)
+    {
+        uint32_t word = lz_read32(src + pos);
+        uint32_t slot = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int32_t candidate = table[slot];
+
+        table[slot] = (int32_t)pos;
+        if (candidate >= 0 && pos - candidate <= LZ_MAX_OFFSET &&
+            lz_read32(src + candidate) == word)
+        {
+            size_t match = LZ_MIN_MATCH;
+
+            while (pos + match < len && src[candidate + match] == src[pos + match])
+            {
+                match++;
+            }
+            out = lz_put_sequence(out, src + anchor, pos - anchor,
+                                  pos - candidate, match);
+            pos += match;
+            anchor = pos;
+        }
+        else
+        {
+            pos++;
+        }
+    }
+
+    out = lz_put_sequence(out, src + anchor, len - anchor, 0, 0);
+    return out - dst;
+}
+
+/* Reads a length continued past its nibble, -1 past the end of the input */
+static int
+lz_get_length(const uint8_t *src, size_t len, size_t *in, size_t *length)
+{
+    uint8_t byte;
+
+    do
+    {
+        if (*in >= len)
+        {
+            return -1;
+        }
+        byte = src[(*in)++];
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/*
+ * Decompresses 'len' bytes into exactly 'raw_len' bytes of 'dst', -1 if the
+ * input is not a valid compressed block of that size
+ */
+static int
+lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t raw_len)
+{
+    size_t in = 0, out = 0;
+
+    while (in < len)
+    {
+        uint8_t token = src[in++];
+        size_t literals = token >> 4;
+        size_t match = (token & 15) + LZ_MIN_MATCH;
+        size_t offset;
+
+        if (literals == 15 && lz_get_length(src, len, &in, &literals))
+        {
+            return -1;
+        }
+        if (literals > len - in || literals > raw_len - out)
+        {
+            return -1;
+        }
+        memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+
+        if (in == len)
+        {
+            break;
+        }
+
+        if (len - in < 2)
+        {
+            return -1;
+        }
+        offset = src[in] | (size_t)src[in + 1] << 8;
+        in += 2;
+        if ((token & 15) == 15 && lz_get_length(src, len, &in, &match))
+        {
+            return -1;
+        }
+        if (offset == 0 || offset > out || match > raw_len - out)
+        {
+            return -1;
+        }
+
+        /* Byte by byte, the match may overlap what it produces */
+        while (match--)
+        {
+            dst[out] = dst[out - offset];
+            out++;
+        }
+    }
+    return out == raw_len ? 0 : -1;
+}
+
+static void
+put_byte(Retire_Stream *stream, int byte)
+{
+    stream->data[stream->len++] = (uint8_t)byte;
+}
+
+static void
+put_varint(Retire_Stream *stream, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        put_byte(stream, (int)(value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    put_byte(stream, (int)value);
+}
+
+/* Zigzag, so that small differences of either sign take one byte */
+static void
+put_signed(Retire_Stream *stream, int value)
+{
+    put_varint(stream, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static int
+get_byte(Retire_Cursor *cursor)
+{
+    if (cursor->pos >= cursor->len)
+    {
+        cursor->error = TRUE;
+        return 0;
+    }
+    return cursor->data[cursor->pos++];
+}
+
+static uint64_t
+get_varint(Retire_Cursor *cursor)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    int byte;
+
+    do
+    {
+        byte = get_byte(cursor);
+        if (shift < 64)
+        {
+            value |= (uint64_t)(byte & 0x7f) << shift;
+        }
+        shift += 7;
+    } while ((byte & 0x80) && !cursor->error);
+    return value;
+}
+
+static int
+get_signed(Retire_Cursor *cursor)
+{
+    uint32_t value = (uint32_t)get_varint(cursor);
+
+    return (int)((value >> 1) ^ (0u - (value & 1)));
+}
+
+/* Difference a - b of two words, wrapping like the register file does */
+static int
+word_delta(int a, int b)
+{
+    return (int)((uint32_t)a - (uint32_t)b);
+}
+
+/*
+ * Creates a writer handing the stream to 'write_fn'. Returns NULL if out
+ * of memory.
+ */
+APEX_RetireWriter *
+APEX_retire_writer_create(APEX_WriteFn write_fn, void *ctx)
+{
+    APEX_RetireWriter *writer = calloc(1, sizeof(APEX_RetireWriter));
+    size_t stream_size = (size_t)APEX_RETIRE_BLOCK_RECORDS * RETIRE_STREAM_BYTES;
+    int i;
+
+    if (!writer)
+    {
+        return NULL;
+    }
+
+    writer->write_fn = write_fn;
+    writer->ctx = ctx;
+    writer->raw = malloc(raw_capacity(APEX_RETIRE_BLOCK_RECORDS));
+    writer->packed = malloc(lz_bound(raw_capacity(APEX_RETIRE_BLOCK_RECORDS)));
+    writer->streams[0].data = malloc(stream_size * RETIRE_STREAMS);
+    if (!writer->raw || !writer->packed || !writer->streams[0].data)
+    {
+        APEX_retire_writer_destroy(writer);
+        return NULL;
+    }
+    for (i = 1; i < RETIRE_STREAMS; ++i)
+    {
+        writer->streams[i].data = writer->streams[0].data + stream_size * i;
+    }
+    return writer;
+}
+
+void
+APEX_retire_writer_destroy(APEX_RetireWriter *writer)
+{
+    if (writer)
+    {
+        free(writer->raw);
+        free(writer->packed);
+        free(writer->streams[0].data);
+        free(writer->index);
+        free(writer);
+    }
+}
+
+uint64_t
+APEX_retire_writer_records(const APEX_RetireWriter *writer)
+{
+    return writer->records;
+}
+
+/* Bytes of the stream written so far */
+uint64_t
+APEX_retire_writer_bytes(const APEX_RetireWriter *writer)
+{
+    return writer->bytes;
+}
+
+static int
+emit(APEX_RetireWriter *writer, const void *data, size_t len)
+{
+    if (!writer->failed && writer->write_fn(writer->ctx, data, len) != 0)
+    {
+        writer->failed = TRUE;
+    }
+    writer->bytes += len;
+    return writer->failed ? -1 : 0;
+}
+
+static int
+emit_file_header(APEX_RetireWriter *writer)
+{
+    Retire_FileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RETIRE_MAGIC, sizeof(header.magic));
+    header.block_records = APEX_RETIRE_BLOCK_RECORDS;
+    return emit(writer, &header, sizeof(header));
+}
+
+/* Compresses the records gathered so far into a block of the stream */
+static int
+flush_block(APEX_RetireWriter *writer)
+{
+    Retire_BlockHeader header;
+    Retire_IndexEntry *entry;
+    uint32_t lens[RETIRE_STREAMS];
+    size_t raw_len, packed_len;
+    int i;
+
+    if (writer->block_records == 0)
+    {
+        return writer->failed ? -1 : 0;
+    }
+    if (writer->bytes == 0 && emit_file_header(writer))
+    {
+        return -1;
+    }
+
+    if (writer->num_blocks == writer->index_capacity)
+    {
+        size_t capacity = writer->index_capacity ? writer->index_capacity * 2 : 64;
+        Retire_IndexEntry *index =
+            realloc(writer->index, sizeof(Retire_IndexEntry) * capacity);
+
+        if (!index)
+        {
+            writer->failed = TRUE;
+            return -1;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+    entry = &writer->index[writer->num_blocks++];
+    entry->offset = writer->bytes;
+    entry->first_record = writer->records - writer->block_records;
+    entry->first_cycle = writer->block_first_cycle;
+
+    raw_len = sizeof(lens);
+    for (i = 0; i < RETIRE_STREAMS; ++i)
+    {
+        lens[i] = (uint32_t)writer->streams[i].len;
+        memcpy(writer->raw + raw_len, writer->streams[i].data, lens[i]);
+        raw_len += lens[i];
+        writer->streams[i].len = 0;
+    }
+    memcpy(writer->raw, lens, sizeof(lens));
+    packed_len = lz_compress(writer->hash, writer->raw, raw_len, writer->packed);
+
+    /* Kept as it is when it does not compress */
+    header.raw_len = (uint32_t)raw_len;
+    header.num_records = writer->block_records;
+    header.flags = packed_len < raw_len ? BLOCK_COMPRESSED : 0;
+    header.stored_len = (uint32_t)(header.flags ? packed_len : raw_len);
+    writer->block_records = 0;
+    memset(&writer->context, 0, sizeof(writer->context));
+
+    if (emit(writer, &header, sizeof(header)))
+    {
+        return -1;
+    }
+    return emit(writer, header.flags ? writer->packed : writer->raw,
+                header.stored_len);
+}
+
+/*
+ * Adds the next retirement. Returns -1 once the stream is lost to a failed
+ * write, or if it has been finished.
+ */
+int
+APEX_retire_writer_append(APEX_RetireWriter *writer,
+                          const APEX_RetireRecord *record)
+{
+    Retire_Context *last = &writer->context;
+    Retire_Stream *streams = writer->streams;
+    int header = record->flags & RECORD_FLAGS;
+    int has_rd = record->rd >= 0 && record->rd < REG_FILE_SIZE;
+    int stalled = 0;
+    int cause;
+
+    if (writer->failed || writer->finished)
+    {
+        return -1;
+    }
+    if (writer->block_records == 0)
+    {
+        writer->block_first_cycle = record->cycle;
+    }
+
+    if (record->cycle == last->cycle + 1)
+    {
+        header |= RECORD_NEXT_CYCLE;
+    }
+    if (record->pc == last->pc + 4)
+    {
+        header |= RECORD_NEXT_PC;
+    }
+    if (has_rd)
+    {
+        header |= RECORD_RD;
+    }
+    if (record->mem_address >= 0)
+    {
+        header |= RECORD_MEMORY;
+    }
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        if (record->stalls[cause])
+        {
+            stalled |= 1 << cause;
+            header |= RECORD_STALLS;
+        }
+    }
+
+    put_byte(&streams[STREAM_CONTROL], header);
+    put_byte(&streams[STREAM_CONTROL], record->opcode);
+    if (!(header & RECORD_NEXT_CYCLE))
+    {
+        put_varint(&streams[STREAM_TIME], record->cycle - last->cycle);
+    }
+    if (!(header & RECORD_NEXT_PC))
+    {
+        put_signed(&streams[STREAM_TIME], word_delta(record->pc, last->pc));
+    }
+    if (stalled)
+    {
+        put_byte(&streams[STREAM_TIME], stalled);
+        for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+        {
+            if (stalled & (1 << cause))
+            {
+                put_varint(&streams[STREAM_TIME], record->stalls[cause]);
+            }
+        }
+    }
+    if (has_rd)
+    {
+        put_byte(&streams[STREAM_CONTROL], record->rd);
+        put_signed(&streams[STREAM_VALUE],
+                   word_delta(record->rd_value, last->regs[record->rd]));
+        last->regs[record->rd] = record->rd_value;
+    }
+    if (header & RECORD_MEMORY)
+    {
+        put_signed(&streams[STREAM_MEMORY],
+                   word_delta(record->mem_address, last->address));
+        put_signed(&streams[STREAM_MEMORY], record->mem_value);
+        last->address = record->mem_address;
+    }
+    last->cycle = record->cycle;
+    last->pc = record->pc;
+
+    writer->records++;
+    if (++writer->block_records == APEX_RETIRE_BLOCK_RECORDS)
+    {
+        return flush_block(writer);
+    }
+    return 0;
+}
+
+/*
+ * Writes the last block and the index, after which nothing can be
+ * appended. Returns -1 if any part of the stream could not be written.
+ */
+int
+APEX_retire_writer_finish(APEX_RetireWriter *writer)
+{
+    Retire_Footer footer;
+
+    if (writer->finished)
+    {
+        return writer->failed ? -1 : 0;
+    }
+    if (flush_block(writer) || (writer->bytes == 0 && emit_file_header(writer)))
+    {
+        writer->finished = TRUE;
+        return -1;
+    }
+    writer->finished = TRUE;
+
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = writer->bytes;
+    footer.num_blocks = writer->num_blocks;
+    footer.num_records = writer->records;
+    memcpy(footer.magic, RETIRE_INDEX_MAGIC, sizeof(footer.magic));
+    if (writer->num_blocks &&
+        emit(writer, writer->index, sizeof(Retire_IndexEntry) * writer->num_blocks))
+    {
+        return -1;
+    }
+    return emit(writer, &footer, sizeof(footer));
+}
+
+/*
+ * Sends every instruction 'cpu' retires from now on to 'writer', which must
+ * outlive the run; NULL stops it, as does APEX_cpu_reset
+ */
+void
+APEX_cpu_set_retire_trace(APEX_CPU *cpu, APEX_RetireWriter *writer)
+{
+    cpu->retire_trace = writer;
+    memcpy(cpu->retire_cpi, cpu->cpi.cycles, sizeof(cpu->retire_cpi));
+}
+
+/*
+ * Hands every instruction 'cpu' retires from now on to 'retire_fn', as the
+ * record a retirement trace would hold; NULL stops it, as does
+ * APEX_cpu_reset
+ */
+void
+APEX_cpu_set_retire_fn(APEX_CPU *cpu, APEX_RetireFn retire_fn, void *ctx)
+{
+    cpu->retire_fn = retire_fn;
+    cpu->retire_ctx = ctx;
+    memcpy(cpu->retire_cpi, cpu->cpi.cycles, sizeof(cpu->retire_cpi));
+}
+
+/*
+ * The record of the instruction Writeback retires, once it has written its
+ * register, but for the stall cycles before it
+ */
+void
+apex_retire_fill(const APEX_CPU *cpu, APEX_RetireRecord *record)
+{
+    const CPU_Stage *stage = &cpu->writeback;
+    int index = (stage->pc - 4000) / 4;
+
+    record->cycle = (uint64_t)cpu->clock + 1;
+    record->pc = stage->pc;
+    record->opcode = stage->opcode;
+    record->rd = -1;
+    record->rd_value = 0;
+    record->mem_address = -1;
+    record->mem_value = 0;
+    record->flags = stage->flags;
+
+    /* Memory1 has turned branches into NOPs by now, the program has not */
+    if (stage->pc >= 4000 && index < cpu->code_memory_size)
+    {
+        record->opcode = cpu->code_memory[index].opcode;
+    }
+
+    /* The opcodes Writeback writes a register for */
+    switch (stage->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_ADDL:
+        case OPCODE_SUB:
+        case OPCODE_SUBL:
+        case OPCODE_MUL:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MOVC:
+        case OPCODE_JALR:
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        {
+            record->rd = stage->rd;
+            record->rd_value = cpu->regs[stage->rd];
+            break;
+        }
+    }
+
+    switch (stage->opcode)
+    {
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        {
+            record->mem_address = stage->memory_address;
+            record->mem_value = stage->result_buffer;
+            break;
+        }
+
+        case OPCODE_STORE:
+        case OPCODE_STR:
+        {
+            record->mem_address = stage->memory_address;
+            record->mem_value = stage->memory_value;
+            break;
+        }
+    }
+}
+
+/* Called by Writeback for every instruction it retires, after the write */
+void
+apex_retire_record(APEX_CPU *cpu)
+{
+    APEX_RetireRecord record;
+    int cause;
+
+    apex_retire_fill(cpu, &record);
+
+    /* The CPI stack has every cycle before this one, the last retirement's
+     * base cycle included */
+    record.stalls[APEX_CPI_BASE] = 0;
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        if (cause != APEX_CPI_BASE)
+        {
+            record.stalls[cause] =
+                (uint32_t)(cpu->cpi.cycles[cause] - cpu->retire_cpi[cause]);
+        }
+        cpu->retire_cpi[cause] = cpu->cpi.cycles[cause];
+    }
+
+    if (cpu->retire_trace)
+    {
+        APEX_retire_writer_append(cpu->retire_trace, &record);
+    }
+    if (cpu->retire_fn)
+    {
+        cpu->retire_fn(cpu->retire_ctx, &record);
+    }
+}
+
+/*
+ * Opens the retirement trace in 'data', which must stay valid until the
+ * reader is closed. Returns NULL if it is not a complete trace.
+ */
+APEX_RetireReader *
+APEX_retire_reader_open(const void *data, size_t len)
+{
+    APEX_RetireReader *reader;
+    Retire_FileHeader header;
+    Retire_Footer footer;
+    uint64_t i;
+    int version;
+
+    if (len < sizeof(header) + sizeof(footer))
+    {
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(header));
+    memcpy(&footer, (const uint8_t *)data + len - sizeof(footer), sizeof(footer));
+    if (memcmp(header.magic, RETIRE_MAGIC, sizeof(header.magic)) == 0)
+    {
+        version = RETIRE_VERSION;
+    }
+    else if (memcmp(header.magic, RETIRE_MAGIC_V1, sizeof(header.magic)) == 0)
+    {
+        version = 1;
+    }
+    else
+    {
+        return NULL;
+    }
+    if (memcmp(footer.magic, RETIRE_INDEX_MAGIC, sizeof(footer.magic)) != 0 ||
+        header.block_records == 0 || header.block_records > 1 << 20 ||
+        footer.num_blocks > INT_MAX || footer.index_offset < sizeof(header) ||
+        footer.index_offset > len - sizeof(footer) ||
+        (len - sizeof(footer) - footer.index_offset) !=
+            footer.num_blocks * sizeof(Retire_IndexEntry) ||
+        (footer.num_blocks == 0 && footer.num_records != 0))
+    {
+        return NULL;
+    }
+
+    reader = calloc(1, sizeof(APEX_RetireReader));
+    if (!reader)
+    {
+        return NULL;
+    }
+    reader->data = data;
+    reader->len = len;
+    reader->block_records = header.block_records;
+    reader->version = version;
+    reader->num_blocks = (int)footer.num_blocks;
+    reader->num_records = footer.num_records;
+    reader->index_offset = footer.index_offset;
+    reader->raw_capacity = raw_capacity(header.block_records);
+    reader->raw = malloc(reader->raw_capacity);
+    reader->index = malloc(sizeof(Retire_IndexEntry) * (footer.num_blocks + 1));
+    if (!reader->raw || !reader->index)
+    {
+        APEX_retire_reader_close(reader);
+        return NULL;
+    }
+    memcpy(reader->index, (const uint8_t *)data + footer.index_offset,
+           sizeof(Retire_IndexEntry) * footer.num_blocks);
+
+    /* Blocks in order and between the header and the index */
+    for (i = 0; i < footer.num_blocks; ++i)
+    {
+        const Retire_IndexEntry *entry = &reader->index[i];
+        uint64_t end = i + 1 < footer.num_blocks ? entry[1].offset
+                                                 : footer.index_offset;
+        uint64_t records = i + 1 < footer.num_blocks ? entry[1].first_record
+                                                     : footer.num_records;
+
+        if (entry->offset < sizeof(header) || entry->offset >= end ||
+            end - entry->offset < sizeof(Retire_BlockHeader) ||
+            entry->first_record >= records ||
+            (i == 0 && entry->first_record != 0))
+        {
+            APEX_retire_reader_close(reader);
+            return NULL;
+        }
+    }
+    return reader;
+}
+
+void
+APEX_retire_reader_close(APEX_RetireReader *reader)
+{
+    if (reader)
+    {
+        free(reader->raw);
+        free(reader->index);
+        free(reader);
+    }
+}
+
+uint64_t
+APEX_retire_reader_records(const APEX_RetireReader *reader)
+{
+    return reader->num_records;
+}
+
+int
+APEX_retire_reader_blocks(const APEX_RetireReader *reader)
+{
+    return reader->num_blocks;
+}
+
+/* Format version of the trace, 1 if its stall counts may be wrong */
+int
+APEX_retire_reader_version(const APEX_RetireReader *reader)
+{
+    return reader->version;
+}
+
+/* First record and its cycle of 'block', -1 if there is no such block */
+int
+APEX_retire_reader_block_info(const APEX_RetireReader *reader, int block,
+                              uint64_t *first_record, uint64_t *first_cycle)
+{
+    if (block < 0 || block >= reader->num_blocks)
+    {
+        return -1;
+    }
+    *first_record = reader->index[block].first_record;
+    *first_cycle = reader->index[block].first_cycle;
+    return 0;
+}
+
+/* Decodes 'block' and makes its first record the next one, -1 if corrupt */
+static int
+load_block(APEX_RetireReader *reader, int block)
+{
+    const Retire_IndexEntry *entry = &reader->index[block];
+    uint64_t end = block + 1 < reader->num_blocks ? entry[1].offset
+                                                   : reader->index_offset;
+    uint64_t expected = (block + 1 < reader->num_blocks
+                             ? entry[1].first_record
+                             : reader->num_records) - entry->first_record;
+    Retire_BlockHeader header;
+    const uint8_t *stored = reader->data + entry->offset + sizeof(header);
+    uint32_t lens[RETIRE_STREAMS];
+    size_t pos = sizeof(lens);
+    int i;
+
+    memcpy(&header, reader->data + entry->offset, sizeof(header));
+    if (header.stored_len > end - entry->offset - sizeof(header) ||
+        header.raw_len > reader->raw_capacity || header.raw_len < sizeof(lens) ||
+        header.num_records != expected)
+    {
+        return -1;
+    }
+
+    if (header.flags & BLOCK_COMPRESSED)
+    {
+        if (lz_decompress(stored, header.stored_len, reader->raw, header.raw_len))
+        {
+            return -1;
+        }
+    }
+    else if (header.stored_len == header.raw_len)
+    {
+        memcpy(reader->raw, stored, header.raw_len);
+    }
+    else
+    {
+        return -1;
+    }
+
+    memcpy(lens, reader->raw, sizeof(lens));
+    for (i = 0; i < RETIRE_STREAMS; ++i)
+    {
+        if (lens[i] > header.raw_len - pos)
+        {
+            return -1;
+        }
+        reader->streams[i].data = reader->raw + pos;
+        reader->streams[i].len = lens[i];
+        reader->streams[i].pos = 0;
+        reader->streams[i].error = FALSE;
+        pos += lens[i];
+    }
+
+    memset(&reader->context, 0, sizeof(reader->context));
+    reader->remaining = header.num_records;
+    reader->next_block = block + 1;
+    return 0;
+}
+
+/*
+ * Makes the first record of 'block' the next one read, 'block' equal to the
+ * number of blocks being the end. Returns -1 if there is no such block.
+ */
+int
+APEX_retire_reader_seek(APEX_RetireReader *reader, int block)
+{
+    if (block < 0 || block > reader->num_blocks)
+    {
+        return -1;
+    }
+    reader->next_block = block;
+    reader->remaining = 0;
+    return 0;
+}
+
+/* Makes record number 'record' the next one read, -1 if past the end */
+int
+APEX_retire_reader_seek_record(APEX_RetireReader *reader, uint64_t record)
+{
+    APEX_RetireRecord skipped;
+    uint64_t skip;
+    int low = 0, high = reader->num_blocks - 1;
+
+    if (record > reader->num_records)
+    {
+        return -1;
+    }
+    if (record == reader->num_records)
+    {
+        return APEX_retire_reader_seek(reader, reader->num_blocks);
+    }
+
+    /* Last block starting at or before the record */
+    while (low < high)
+    {
+        int mid = low + (high - low + 1) / 2;
+
+        if (reader->index[mid].first_record <= record)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+
+    APEX_retire_reader_seek(reader, low);
+    for (skip = record - reader->index[low].first_record; skip > 0; --skip)
+    {
+        if (APEX_retire_reader_next(reader, &skipped) != 1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Reads the next record: 1 if there was one, 0 at the end, -1 if corrupt */
+int
+APEX_retire_reader_next(APEX_RetireReader *reader, APEX_RetireRecord *record)
+{
+    Retire_Context *last = &reader->context;
+    Retire_Cursor *streams = reader->streams;
+    int header, stalled, i;
+
+    while (reader->remaining == 0)
+    {
+        if (reader->next_block >= reader->num_blocks)
+        {
+            return 0;
+        }
+        if (load_block(reader, reader->next_block))
+        {
+            return -1;
+        }
+    }
+
+    header = get_byte(&streams[STREAM_CONTROL]);
+    record->opcode = get_byte(&streams[STREAM_CONTROL]);
+    record->flags = header & RECORD_FLAGS;
+    record->cycle = last->cycle + (header & RECORD_NEXT_CYCLE
+                                       ? 1
+                                       : get_varint(&streams[STREAM_TIME]));
+    record->pc = (int)((uint32_t)last->pc +
+                       (header & RECORD_NEXT_PC
+                            ? 4
+                            : (uint32_t)get_signed(&streams[STREAM_TIME])));
+
+    memset(record->stalls, 0, sizeof(record->stalls));
+    stalled = header & RECORD_STALLS ? get_byte(&streams[STREAM_TIME]) : 0;
+    for (i = 0; i < APEX_CPI_CAUSES; ++i)
+    {
+        if (stalled & (1 << i))
+        {
+            record->stalls[i] = (uint32_t)get_varint(&streams[STREAM_TIME]);
+        }
+    }
+
+    record->rd = -1;
+    record->rd_value = 0;
+    if (header & RECORD_RD)
+    {
+        record->rd = get_byte(&streams[STREAM_CONTROL]);
+        if (record->rd >= REG_FILE_SIZE)
+        {
+            return -1;
+        }
+        record->rd_value =
+            (int)((uint32_t)last->regs[record->rd] +
+                  (uint32_t)get_signed(&streams[STREAM_VALUE]));
+        last->regs[record->rd] = record->rd_value;
+    }
+
+    record->mem_address = -1;
+    record->mem_value = 0;
+    if (header & RECORD_MEMORY)
+    {
+        record->mem_address =
+            (int)((uint32_t)last->address +
+                  (uint32_t)get_signed(&streams[STREAM_MEMORY]));
+        record->mem_value = get_signed(&streams[STREAM_MEMORY]);
+        last->address = record->mem_address;
+    }
+
+    for (i = 0; i < RETIRE_STREAMS; ++i)
+    {
+        if (streams[i].error)
+        {
+            return -1;
+        }
+    }
+    last->cycle = record->cycle;
+    last->pc = record->pc;
+    reader->remaining--;
+    return 1;
+}
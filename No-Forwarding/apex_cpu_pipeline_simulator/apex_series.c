@@ -0,0 +1,438 @@
+/*
+ * apex_series.c
+ * Contains interval series, the statistics of a run taken every so many
+ * cycles or retired instructions, to show its phases
+ *
+ * After every advance the stages holding an instruction are counted, and
+ * once the interval is over the counters of the instance are compared with
+ * where they stood when it began: cycles, retirements, cycles by CPI stack
+ * cause, branch redirects, and the loads, stores and branches retired, as
+ * the latency histograms count them. An interval ending in skipped idle
+ * cycles takes all of them, so the cycles of every record are given.
+ * Detaching a series closes its last interval, however short.
+ *
+ * Two formats are written, streamed through the write function:
+ *  - CSV, a header line and a line per interval, buffered in blocks of
+ *    SERIES_BUFFER_SIZE bytes; it gives the IPC, and the occupancy of each
+ *    stage as the mean number of instructions it held
+ *  - a binary columnar file, Series_FileHeader, then the records in blocks
+ *    of up to SERIES_BLOCK_ROWS, each a Series_BlockHeader followed by one
+ *    column after the other as host order uint64_t, then Series_Footer. It
+ *    keeps the raw counts: a stage's occupancy is in instruction-cycles.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+#define SERIES_MAGIC "APEXSER1"
+#define SERIES_FOOTER_MAGIC "APEXSERX"
+#define SERIES_BUFFER_SIZE 65536
+#define SERIES_LINE_MAX 1024
+#define SERIES_BLOCK_ROWS 1024
+#define SERIES_NAME_LEN 16
+
+/* Columns of a record */
+#define COL_INTERVAL 0
+#define COL_START_CYCLE 1
+#define COL_CYCLES 2
+#define COL_RETIRED 3
+#define COL_CPI 4                               /* APEX_CPI_CAUSES of them */
+#define COL_REDIRECTS (COL_CPI + APEX_CPI_CAUSES)
+#define COL_LOADS (COL_REDIRECTS + 1)
+#define COL_STORES (COL_REDIRECTS + 2)
+#define COL_BRANCHES (COL_REDIRECTS + 3)
+#define COL_OCCUPANCY (COL_REDIRECTS + 4)       /* APEX_NUM_STAGES of them */
+#define SERIES_COLUMNS (COL_OCCUPANCY + APEX_NUM_STAGES)
+
+static const char *const stage_names[APEX_NUM_STAGES] = {
+    "fetch", "decode", "execute", "memory1", "memory", "writeback"};
+
+typedef struct Series_FileHeader
+{
+    char magic[8];
+    uint32_t columns;
+    uint32_t unit;              /* APEX_SERIES_CYCLES or APEX_SERIES_RETIRED */
+    uint64_t length;            /* Of an interval, in 'unit' */
+    /* Followed by the name of every column, SERIES_NAME_LEN bytes each */
+} Series_FileHeader;
+
+typedef struct Series_BlockHeader
+{
+    uint32_t rows;
+    uint32_t reserved;
+} Series_BlockHeader;
+
+typedef struct Series_Footer
+{
+    char magic[8];
+    uint64_t records;
+} Series_Footer;
+
+/* Counters of the instance when an interval began */
+typedef struct Series_Mark
+{
+    int clock;
+    int retired;
+    uint64_t flushes;
+    APEX_CpiStack cpi;
+    uint64_t classes[APEX_OPCLASSES];   /* Retirements by APEX_OPCLASS_* */
+} Series_Mark;
+
+struct APEX_Series
+{
+    int format;                 /* APEX_SERIES_CSV or APEX_SERIES_BINARY */
+    int unit;                   /* APEX_SERIES_CYCLES or APEX_SERIES_RETIRED */
+    int length;
+    APEX_WriteFn write_fn;
+    void *ctx;
+    int started;                /* Header written */
+    int failed;                 /* A write failed, the rest is dropped */
+    uint64_t records;
+    Series_Mark mark;
+    uint64_t occupancy[APEX_NUM_STAGES];
+    char *buf;                  /* CSV text not written yet */
+    size_t len;
+    int rows;                   /* Binary records not written yet */
+    uint64_t (*columns)[SERIES_BLOCK_ROWS];
+};
+
+static void
+column_name(int column, char *name)
+{
+    static const char *const fixed[] = {"interval", "start_cycle", "cycles",
+                                        "retired"};
+
+    if (column < COL_CPI)
+    {
+        snprintf(name, SERIES_NAME_LEN, "%s", fixed[column]);
+    }
+    else if (column < COL_REDIRECTS)
+    {
+        snprintf(name, SERIES_NAME_LEN, "cpi_%s",
+                 APEX_cpi_cause_name(column - COL_CPI));
+    }
+    else if (column < COL_OCCUPANCY)
+    {
+        static const char *const counts[] = {"redirects", "loads", "stores",
+                                             "branches"};
+
+        snprintf(name, SERIES_NAME_LEN, "%s", counts[column - COL_REDIRECTS]);
+    }
+    else
+    {
+        snprintf(name, SERIES_NAME_LEN, "occ_%s",
+                 stage_names[column - COL_OCCUPANCY]);
+    }
+}
+
+static void
+series_write(APEX_Series *series, const void *data, size_t len)
+{
+    if (len && !series->failed &&
+        series->write_fn(series->ctx, data, len) != 0)
+    {
+        series->failed = TRUE;
+    }
+}
+
+/*
+ * Creates a series with a record every 'length' cycles or retired
+ * instructions, 0 for the default, written in 'format' through 'write_fn'.
+ * Returns NULL if out of memory or the arguments are not valid.
+ */
+APEX_Series *
+APEX_series_create(int format, int unit, int length, APEX_WriteFn write_fn,
+                   void *ctx)
+{
+    APEX_Series *series;
+
+    if ((format != APEX_SERIES_CSV && format != APEX_SERIES_BINARY) ||
+        (unit != APEX_SERIES_CYCLES && unit != APEX_SERIES_RETIRED) ||
+        length < 0 || !write_fn)
+    {
+        return NULL;
+    }
+    series = calloc(1, sizeof(APEX_Series));
+    if (!series)
+    {
+        return NULL;
+    }
+    series->format = format;
+    series->unit = unit;
+    series->length = length ? length : APEX_SERIES_DEFAULT_LENGTH;
+    series->write_fn = write_fn;
+    series->ctx = ctx;
+    if (format == APEX_SERIES_CSV)
+    {
+        series->buf = malloc(SERIES_BUFFER_SIZE);
+    }
+    else
+    {
+        series->columns = calloc(SERIES_COLUMNS, sizeof(*series->columns));
+    }
+    if (!series->buf && !series->columns)
+    {
+        free(series);
+        return NULL;
+    }
+    return series;
+}
+
+void
+APEX_series_destroy(APEX_Series *series)
+{
+    if (series)
+    {
+        free(series->buf);
+        free(series->columns);
+        free(series);
+    }
+}
+
+uint64_t
+APEX_series_records(const APEX_Series *series)
+{
+    return series->records;
+}
+
+static void
+series_start(APEX_Series *series)
+{
+    char name[SERIES_NAME_LEN];
+    int column;
+
+    series->started = TRUE;
+    if (series->format == APEX_SERIES_CSV)
+    {
+        for (column = 0; column < SERIES_COLUMNS; ++column)
+        {
+            column_name(column, name);
+            series->len += sprintf(series->buf + series->len, "%s%s",
+                                   column ? "," : "", name);
+            if (column == COL_RETIRED)
+            {
+                series->len += sprintf(series->buf + series->len, ",ipc");
+            }
+        }
+        series->buf[series->len++] = '\n';
+    }
+    else
+    {
+        Series_FileHeader header;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SERIES_MAGIC, sizeof(header.magic));
+        header.columns = SERIES_COLUMNS;
+        header.unit = series->unit;
+        header.length = series->length;
+        series_write(series, &header, sizeof(header));
+        for (column = 0; column < SERIES_COLUMNS; ++column)
+        {
+            memset(name, 0, sizeof(name));
+            column_name(column, name);
+            series_write(series, name, sizeof(name));
+        }
+    }
+}
+
+/* Writes the binary records gathered so far as a block */
+static void
+series_flush_block(APEX_Series *series)
+{
+    Series_BlockHeader header;
+    int column;
+
+    if (!series->rows)
+    {
+        return;
+    }
+    header.rows = series->rows;
+    header.reserved = 0;
+    series_write(series, &header, sizeof(header));
+    for (column = 0; column < SERIES_COLUMNS; ++column)
+    {
+        series_write(series, series->columns[column],
+                     series->rows * sizeof(uint64_t));
+    }
+    series->rows = 0;
+}
+
+static void
+series_flush_text(APEX_Series *series)
+{
+    series_write(series, series->buf, series->len);
+    series->len = 0;
+}
+
+static void
+series_mark(APEX_Series *series, const APEX_CPU *cpu)
+{
+    int opclass;
+
+    series->mark.clock = cpu->clock;
+    series->mark.retired = cpu->insn_completed;
+    series->mark.flushes = cpu->stats.flushes;
+    series->mark.cpi = cpu->cpi;
+    for (opclass = 0; opclass < APEX_OPCLASSES; ++opclass)
+    {
+        series->mark.classes[opclass] =
+            cpu->latencies.fetch_to_retire[opclass].count;
+    }
+    memset(series->occupancy, 0, sizeof(series->occupancy));
+}
+
+/* Turns the interval since the mark into a record */
+static void
+series_record(APEX_Series *series, const APEX_CPU *cpu)
+{
+    const APEX_Histogram *classes = cpu->latencies.fetch_to_retire;
+    uint64_t row[SERIES_COLUMNS];
+    int column;
+
+    if (!series->started)
+    {
+        series_start(series);
+    }
+
+    row[COL_INTERVAL] = series->records;
+    row[COL_START_CYCLE] = series->mark.clock;
+    row[COL_CYCLES] = cpu->clock - series->mark.clock;
+    row[COL_RETIRED] = cpu->insn_completed - series->mark.retired;
+    for (column = 0; column < APEX_CPI_CAUSES; ++column)
+    {
+        row[COL_CPI + column] =
+            cpu->cpi.cycles[column] - series->mark.cpi.cycles[column];
+    }
+    row[COL_REDIRECTS] = cpu->stats.flushes - series->mark.flushes;
+    row[COL_LOADS] = classes[APEX_OPCLASS_LOAD].count -
+                     series->mark.classes[APEX_OPCLASS_LOAD];
+    row[COL_STORES] = classes[APEX_OPCLASS_STORE].count -
+                      series->mark.classes[APEX_OPCLASS_STORE];
+    row[COL_BRANCHES] = classes[APEX_OPCLASS_BRANCH].count -
+                        series->mark.classes[APEX_OPCLASS_BRANCH];
+    memcpy(&row[COL_OCCUPANCY], series->occupancy, sizeof(series->occupancy));
+    series->records++;
+
+    if (series->format == APEX_SERIES_CSV)
+    {
+        double cycles = row[COL_CYCLES] ? (double)row[COL_CYCLES] : 1.0;
+
+        if (series->len > SERIES_BUFFER_SIZE - SERIES_LINE_MAX)
+        {
+            series_flush_text(series);
+        }
+        for (column = 0; column < SERIES_COLUMNS; ++column)
+        {
+            if (column < COL_OCCUPANCY)
+            {
+                series->len += sprintf(series->buf + series->len, "%s%llu",
+                                       column ? "," : "",
+                                       (unsigned long long)row[column]);
+            }
+            else
+            {
+                series->len += sprintf(series->buf + series->len, ",%.3f",
+                                       row[column] / cycles);
+            }
+            if (column == COL_RETIRED)
+            {
+                series->len += sprintf(series->buf + series->len, ",%.4f",
+                                       row[COL_RETIRED] / cycles);
+            }
+        }
+        series->buf[series->len++] = '\n';
+    }
+    else
+    {
+        for (column = 0; column < SERIES_COLUMNS; ++column)
+        {
+            series->columns[column][series->rows] = row[column];
+        }
+        if (++series->rows == SERIES_BLOCK_ROWS)
+        {
+            series_flush_block(series);
+        }
+    }
+    series_mark(series, cpu);
+}
+
+/*
+ * Called after every advance of an instance with a series, with the clock
+ * from before it
+ */
+void
+apex_series_cycle(APEX_CPU *cpu, int start_clock)
+{
+    APEX_Series *series = cpu->series;
+    const CPU_Stage *latches[APEX_NUM_STAGES] = {
+        &cpu->fetch, &cpu->decode, &cpu->execute,
+        &cpu->memory1, &cpu->memory, &cpu->writeback};
+    int cycles = cpu->clock - start_clock;
+    int stage;
+
+    for (stage = 0; stage < APEX_NUM_STAGES; ++stage)
+    {
+        if (latches[stage]->has_insn)
+        {
+            series->occupancy[stage] += cycles;
+        }
+    }
+    if (series->unit == APEX_SERIES_CYCLES
+            ? cpu->clock - series->mark.clock >= series->length
+            : cpu->insn_completed - series->mark.retired >= series->length)
+    {
+        series_record(series, cpu);
+    }
+}
+
+/*
+ * Records the run of 'cpu' from now on into 'series'; NULL stops it, as
+ * does APEX_cpu_reset. The series detached closes its last interval.
+ */
+void
+APEX_cpu_set_series(APEX_CPU *cpu, APEX_Series *series)
+{
+    if (cpu->series && cpu->clock > cpu->series->mark.clock)
+    {
+        series_record(cpu->series, cpu);
+    }
+    cpu->series = series;
+    if (series)
+    {
+        series_mark(series, cpu);
+    }
+}
+
+/*
+ * Writes out what is still buffered, and the footer of a binary series.
+ * Returns -1 if any write failed.
+ */
+int
+APEX_series_finish(APEX_Series *series)
+{
+    if (!series->started)
+    {
+        series_start(series);
+    }
+    if (series->format == APEX_SERIES_CSV)
+    {
+        series_flush_text(series);
+    }
+    else
+    {
+        Series_Footer footer;
+
+        series_flush_block(series);
+        memset(&footer, 0, sizeof(footer));
+        memcpy(footer.magic, SERIES_FOOTER_MAGIC, sizeof(footer.magic));
+        footer.records = series->records;
+        series_write(series, &footer, sizeof(footer));
+    }
+    return series->failed ? -1 : 0;
+}
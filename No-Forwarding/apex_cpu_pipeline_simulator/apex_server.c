@@ -0,0 +1,621 @@
+/*
+ * apex_server.c
+ * Server mode of apex_sim: runs simulation jobs sent over stdin/stdout or
+ * a Unix domain socket, keeping parsed programs and CPU instances warm
+ * between jobs
+ *
+ * Requests are a header line, optionally followed by a payload of the byte
+ * counts it announces:
+ *
+ *  PROGRAM <bytes>\n<program text>
+ *      Caches a program, replies 'OK <hash>'.
+ *  JOB <id> <bytes | @hash> <data bytes> [options]\n<program text><data text>
+ *      Runs a program, given inline or as the hash of a cached one, on an
+ *      optional data image. The options are the timing options of apex_sim
+ *      plus '--cycles <budget>'. Replies 'RESULT <id> <fields>' or
+ *      'ERROR <id> <message>'.
+ *  STATS\n
+ *      Replies with the job, cache and pool counters.
+ *  QUIT\n
+ *      Closes the connection.
+ *
+ * Programs are cached by a hash of their text, so a program that is sent
+ * again, or referred to by hash, is not parsed again. A program sent as
+ * text only hits an entry whose text is the same, not just its hash.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_client.h"
+#include "apex_server.h"
+
+#define PROGRAM_CACHE_SIZE 256
+#define CPU_POOL_SIZE 64
+#define MAX_PAYLOAD (16 * 1024 * 1024)
+#define MAX_REQUEST_TOKENS 64
+
+typedef struct Cache_Entry
+{
+    uint64_t hash;
+    size_t len;
+    char *text;                 /* Of the program, compared on lookups by text */
+    APEX_Program *program;
+    uint64_t last_use;          /* For least-recently-used eviction */
+} Cache_Entry;
+
+typedef struct Server
+{
+    pthread_mutex_t lock;       /* Guards everything below */
+    Cache_Entry cache[PROGRAM_CACHE_SIZE];
+    uint64_t tick;
+    APEX_CPU *pool[CPU_POOL_SIZE]; /* Idle instances, ready to be reset */
+    int pool_size;
+    uint64_t jobs;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t cpus_created;
+} Server;
+
+typedef struct Connection
+{
+    Server *server;
+    int fd;
+} Connection;
+
+/*
+ * Looks up a cached program, taking a reference on it: the one with the
+ * given 'text', or with a NULL 'text' the one with the given hash. Needs
+ * the lock.
+ */
+static APEX_Program *
+cache_find(Server *server, uint64_t hash, const char *text, size_t len)
+{
+    int i;
+
+    for (i = 0; i < PROGRAM_CACHE_SIZE; ++i)
+    {
+        Cache_Entry *entry = &server->cache[i];
+
+        if (entry->program && entry->hash == hash &&
+            (!text ||
+             (entry->len == len && memcmp(entry->text, text, len) == 0)))
+        {
+            entry->last_use = ++server->tick;
+            return APEX_program_retain(entry->program);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Caches 'program' with a copy of its text, evicting the least recently
+ * used entry. Out of memory, it is not cached. Needs the lock.
+ */
+static void
+cache_insert(Server *server, uint64_t hash, const char *text, size_t len,
+             APEX_Program *program)
+{
+    Cache_Entry *victim = &server->cache[0];
+    char *copy = malloc(len ? len : 1);
+    int i;
+
+    if (!copy)
+    {
+        return;
+    }
+    memcpy(copy, text, len);
+
+    for (i = 0; i < PROGRAM_CACHE_SIZE; ++i)
+    {
+        if (!server->cache[i].program)
+        {
+            victim = &server->cache[i];
+            break;
+        }
+        if (server->cache[i].last_use < victim->last_use)
+        {
+            victim = &server->cache[i];
+        }
+    }
+
+    APEX_program_release(victim->program);
+    free(victim->text);
+    victim->hash = hash;
+    victim->len = len;
+    victim->text = copy;
+    victim->program = APEX_program_retain(program);
+    victim->last_use = ++server->tick;
+}
+
+/*
+ * Returns a reference to the program with the given text, parsing it only
+ * if it is not cached yet. Parse errors are stored in 'error'.
+ */
+static APEX_Program *
+get_program(Server *server, const char *text, size_t len, uint64_t *hash,
+            char *error, size_t error_size)
+{
+    APEX_Program *program, *cached;
+
+    *hash = apex_hash(APEX_HASH_INIT, text, len);
+
+    pthread_mutex_lock(&server->lock);
+    program = cache_find(server, *hash, text, len);
+    if (program)
+    {
+        server->cache_hits++;
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (program)
+    {
+        return program;
+    }
+
+    program = APEX_program_parse(text, len, error, error_size);
+    if (!program)
+    {
+        return NULL;
+    }
+
+    /* Another connection may have parsed the same program meanwhile */
+    pthread_mutex_lock(&server->lock);
+    server->cache_misses++;
+    cached = cache_find(server, *hash, text, len);
+    if (cached)
+    {
+        APEX_program_release(program);
+        program = cached;
+    }
+    else
+    {
+        cache_insert(server, *hash, text, len, program);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return program;
+}
+
+/* Takes an idle CPU from the pool and resets it, or creates one */
+static APEX_CPU *
+pool_get(Server *server, APEX_Program *program, const APEX_Config *config)
+{
+    APEX_CPU *cpu = NULL;
+
+    pthread_mutex_lock(&server->lock);
+    server->jobs++;
+    if (server->pool_size)
+    {
+        cpu = server->pool[--server->pool_size];
+    }
+    else
+    {
+        server->cpus_created++;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (!cpu)
+    {
+        return APEX_cpu_create(program, config);
+    }
+    if (APEX_cpu_reset(cpu, program, config))
+    {
+        APEX_cpu_destroy(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+static void
+pool_put(Server *server, APEX_CPU *cpu)
+{
+    pthread_mutex_lock(&server->lock);
+    if (server->pool_size < CPU_POOL_SIZE)
+    {
+        server->pool[server->pool_size++] = cpu;
+        cpu = NULL;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    APEX_cpu_destroy(cpu);
+}
+
+/* Reads a payload of 'len' bytes, NULL on a short read */
+static char *
+read_payload(FILE *in, long len)
+{
+    char *payload;
+
+    if (len < 0 || len > MAX_PAYLOAD)
+    {
+        return NULL;
+    }
+
+    payload = malloc(len + 1);
+    if (payload && fread(payload, 1, len, in) != (size_t)len)
+    {
+        free(payload);
+        return NULL;
+    }
+    if (payload)
+    {
+        payload[len] = '\0';
+    }
+    return payload;
+}
+
+static void
+write_result(FILE *out, const char *id, const APEX_CPU *cpu, uint64_t hash)
+{
+    const APEX_Stats *stats = APEX_cpu_get_stats(cpu);
+    int i;
+
+    fprintf(out,
+            "RESULT %s program=%016llx status=%s cycles=%d instructions=%d "
+            "pc=%d execute_busy=%llu memory_busy=%llu structural_stalls=%llu "
+            "skipped=%llu state=%08x regs=",
+            id, (unsigned long long)hash,
+            apex_status_name(APEX_cpu_get_status(cpu),
+                             APEX_cpu_get_watchdog_reason(cpu)),
+            APEX_cpu_get_clock(cpu), APEX_cpu_get_retired(cpu),
+            APEX_cpu_get_pc(cpu),
+            (unsigned long long)stats->execute_busy_cycles,
+            (unsigned long long)stats->memory_busy_cycles,
+            (unsigned long long)stats->structural_stalls,
+            (unsigned long long)stats->skipped_cycles, apex_state_hash(cpu));
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        fprintf(out, i ? ",%d" : "%d", APEX_cpu_get_reg(cpu, i));
+    }
+    fprintf(out, "\n");
+}
+
+/*
+ * Handles 'JOB <id> <bytes | @hash> <data bytes> [options]'. Returns -1 if
+ * the stream is out of sync and the connection has to be dropped.
+ */
+static int
+serve_job(Server *server, FILE *in, FILE *out, int argc, const char *argv[])
+{
+    char error[256] = "";
+    const char *id = argc > 1 ? argv[1] : "-";
+    APEX_Program *program = NULL;
+    APEX_Config config;
+    APEX_CPU *cpu;
+    char *text = NULL, *data = NULL;
+    int *words = NULL;
+    int max_cycles = 0, count = 0, i;
+    uint64_t hash = 0;
+    long text_len = 0, data_len;
+
+    if (argc < 4)
+    {
+        fprintf(out, "ERROR %s expected 'JOB <id> <bytes | @hash> <data bytes>'\n", id);
+        return -1;
+    }
+
+    /* Payloads come first, so the stream stays in sync on any error */
+    if (argv[2][0] != '@')
+    {
+        text_len = atol(argv[2]);
+        text = read_payload(in, text_len);
+        if (!text)
+        {
+            fprintf(out, "ERROR %s bad program payload\n", id);
+            return -1;
+        }
+    }
+    data_len = atol(argv[3]);
+    if (data_len)
+    {
+        data = read_payload(in, data_len);
+        if (!data)
+        {
+            free(text);
+            fprintf(out, "ERROR %s bad data payload\n", id);
+            return -1;
+        }
+    }
+
+    APEX_config_default(&config);
+    for (i = 4; i < argc && !error[0]; ++i)
+    {
+        int parsed = apex_parse_config_option(&config, argc, argv, &i);
+
+        if (parsed == 0 && strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            max_cycles = atoi(argv[++i]);
+            parsed = max_cycles >= 0 ? 1 : -1;
+        }
+        if (parsed != 1)
+        {
+            snprintf(error, sizeof(error), "bad option '%s'", argv[i]);
+        }
+    }
+
+    if (!error[0] && text)
+    {
+        program = get_program(server, text, text_len, &hash, error,
+                              sizeof(error));
+    }
+    else if (!error[0])
+    {
+        hash = strtoull(argv[2] + 1, NULL, 16);
+        pthread_mutex_lock(&server->lock);
+        program = cache_find(server, hash, NULL, 0);
+        pthread_mutex_unlock(&server->lock);
+        if (!program)
+        {
+            snprintf(error, sizeof(error), "program %s is not cached", argv[2]);
+        }
+    }
+
+    if (!error[0] && data)
+    {
+        words = malloc(sizeof(int) * DATA_MEMORY_SIZE);
+        count = words ? APEX_parse_data(data, data_len, words, DATA_MEMORY_SIZE) : -1;
+        if (count < 0)
+        {
+            snprintf(error, sizeof(error), "data is not a list of integers");
+        }
+    }
+
+    if (!error[0])
+    {
+        cpu = pool_get(server, program, &config);
+        if (cpu)
+        {
+            if (words)
+            {
+                APEX_cpu_load_data(cpu, 0, words, count);
+            }
+            APEX_cpu_run_until(cpu, NULL, NULL, max_cycles);
+            write_result(out, id, cpu, hash);
+            pool_put(server, cpu);
+        }
+        else
+        {
+            snprintf(error, sizeof(error), "out of memory");
+        }
+    }
+
+    if (error[0])
+    {
+        fprintf(out, "ERROR %s %s\n", id, error);
+    }
+    APEX_program_release(program);
+    free(words);
+    free(data);
+    free(text);
+    return 0;
+}
+
+/* Serves requests from 'in' until QUIT, end of file or a framing error */
+static void
+serve_stream(Server *server, FILE *in, FILE *out)
+{
+    const char *argv[MAX_REQUEST_TOKENS];
+    char *line = NULL, *save, *token;
+    size_t size = 0;
+    int argc;
+
+    while (getline(&line, &size, in) > 0)
+    {
+        argc = 0;
+        for (token = strtok_r(line, " \t\r\n", &save);
+             token && argc < MAX_REQUEST_TOKENS;
+             token = strtok_r(NULL, " \t\r\n", &save))
+        {
+            argv[argc++] = token;
+        }
+
+        if (argc == 0)
+        {
+            continue;
+        }
+        else if (strcmp(argv[0], "QUIT") == 0)
+        {
+            break;
+        }
+        else if (strcmp(argv[0], "JOB") == 0)
+        {
+            if (serve_job(server, in, out, argc, argv))
+            {
+                break;
+            }
+        }
+        else if (strcmp(argv[0], "PROGRAM") == 0 && argc == 2)
+        {
+            char error[256];
+            long len = atol(argv[1]);
+            char *text = read_payload(in, len);
+            APEX_Program *program;
+            uint64_t hash;
+
+            if (!text)
+            {
+                fprintf(out, "ERROR - bad program payload\n");
+                break;
+            }
+            program = get_program(server, text, len, &hash, error,
+                                  sizeof(error));
+            if (program)
+            {
+                fprintf(out, "OK %016llx\n", (unsigned long long)hash);
+            }
+            else
+            {
+                fprintf(out, "ERROR - %s\n", error);
+            }
+            APEX_program_release(program);
+            free(text);
+        }
+        else if (strcmp(argv[0], "STATS") == 0)
+        {
+            pthread_mutex_lock(&server->lock);
+            fprintf(out, "STATS jobs=%llu cache_hits=%llu cache_misses=%llu "
+                         "cpus_created=%llu pooled=%d\n",
+                    (unsigned long long)server->jobs,
+                    (unsigned long long)server->cache_hits,
+                    (unsigned long long)server->cache_misses,
+                    (unsigned long long)server->cpus_created,
+                    server->pool_size);
+            pthread_mutex_unlock(&server->lock);
+        }
+        else
+        {
+            fprintf(out, "ERROR - unknown request '%s'\n", argv[0]);
+        }
+        fflush(out);
+    }
+    fflush(out);
+    free(line);
+}
+
+static void *
+connection_main(void *arg)
+{
+    Connection *connection = arg;
+    int out_fd = dup(connection->fd);
+    FILE *in = fdopen(connection->fd, "r");
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+
+    if (in && out)
+    {
+        serve_stream(connection->server, in, out);
+    }
+
+    if (in)
+    {
+        fclose(in);
+    }
+    else
+    {
+        close(connection->fd);
+    }
+    if (out)
+    {
+        fclose(out);
+    }
+    else if (out_fd >= 0)
+    {
+        close(out_fd);
+    }
+    free(connection);
+    return NULL;
+}
+
+/* Accepts connections on 'socket_path', one thread per connection */
+static int
+serve_socket(Server *server, const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "APEX_Error: Socket path too long\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+    {
+        perror(socket_path);
+        close(fd);
+        return 1;
+    }
+    fprintf(stderr, "APEX_Server: Listening on %s\n", socket_path);
+
+    for (;;)
+    {
+        Connection *connection;
+        pthread_t thread;
+        int client = accept(fd, NULL, NULL);
+
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+
+        connection = malloc(sizeof(Connection));
+        if (!connection)
+        {
+            close(client);
+            continue;
+        }
+        connection->server = server;
+        connection->fd = client;
+        if (pthread_create(&thread, NULL, connection_main, connection) != 0)
+        {
+            close(client);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(fd);
+    return 1;
+}
+
+/*
+ * Runs the server on stdin/stdout, or on a Unix domain socket when
+ * 'socket_path' is not NULL. Returns the exit code of apex_sim.
+ */
+int
+apex_server_main(const char *socket_path)
+{
+    Server server;
+    int i, rc = 0;
+
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+
+    if (socket_path)
+    {
+        rc = serve_socket(&server, socket_path);
+    }
+    else
+    {
+        serve_stream(&server, stdin, stdout);
+    }
+
+    for (i = 0; i < PROGRAM_CACHE_SIZE; ++i)
+    {
+        APEX_program_release(server.cache[i].program);
+        free(server.cache[i].text);
+    }
+    for (i = 0; i < server.pool_size; ++i)
+    {
+        APEX_cpu_destroy(server.pool[i]);
+    }
+    pthread_mutex_destroy(&server.lock);
+    return rc;
+}
@@ -0,0 +1,13 @@
+/*
+ * apex_server.h
+ * Contains the server mode of apex_sim
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_SERVER_H_
+#define _APEX_SERVER_H_
+
+int apex_server_main(const char *socket_path);
+#endif
@@ -0,0 +1,222 @@
+/*
+ * apex_timing.c
+ * Contains the trace timing model, the pipeline timing of a stream of
+ * retired instructions
+ *
+ * The functional model decides what every instruction does, this model only
+ * when. Each record is placed into Fetch, Decode, Execute, Memory1, Memory
+ * and Writeback at the earliest cycles the in-order pipeline allows: a stage
+ * is entered once the previous instruction has left it, Execute once the
+ * operands can be read, and the fetch after a taken branch once the branch
+ * reaches the stage redirecting fetch. Wrong-path instructions are never in the trace; the cycles
+ * they would have spent in the pipeline before the flush are the delay of
+ * the next fetch. All the model keeps is the cycle the previous instruction
+ * entered every stage and the cycle each register becomes available, so a
+ * record costs the same however long the trace is.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+/* The condition codes are read and written as one more register */
+#define TIMING_FLAGS REG_FILE_SIZE
+
+struct APEX_Timing
+{
+    APEX_TimingConfig config;
+    int64_t entry[APEX_NUM_STAGES];     /* Of the previous instruction */
+    int64_t fetch_ready;                /* First cycle of the next fetch */
+    int64_t ready[REG_FILE_SIZE + 1];   /* First cycle Execute can read it */
+    APEX_TimingStats stats;
+};
+
+APEX_Timing *
+APEX_timing_create(const APEX_TimingConfig *config)
+{
+    APEX_Timing *timing = malloc(sizeof(APEX_Timing));
+
+    if (!timing)
+    {
+        return NULL;
+    }
+
+    timing->config = *config;
+    if (timing->config.memory_latency < 1)
+    {
+        timing->config.memory_latency = 1;
+    }
+    if (timing->config.mul_latency < 1)
+    {
+        timing->config.mul_latency = 1;
+    }
+    if (timing->config.branch_stage < APEX_STAGE_DECODE ||
+        timing->config.branch_stage > APEX_STAGE_WRITEBACK)
+    {
+        timing->config.branch_stage = APEX_STAGE_MEMORY1;
+    }
+    APEX_timing_reset(timing);
+    return timing;
+}
+
+void
+APEX_timing_destroy(APEX_Timing *timing)
+{
+    free(timing);
+}
+
+/* Back to an empty pipeline, the first fetch happens in cycle 1 */
+void
+APEX_timing_reset(APEX_Timing *timing)
+{
+    memset(timing->entry, 0, sizeof(timing->entry));
+    memset(timing->ready, 0, sizeof(timing->ready));
+    memset(&timing->stats, 0, sizeof(timing->stats));
+    timing->fetch_ready = 1;
+}
+
+const APEX_TimingStats *
+APEX_timing_get_stats(const APEX_Timing *timing)
+{
+    return &timing->stats;
+}
+
+static int
+is_memory_op(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_LDR ||
+           opcode == OPCODE_STORE || opcode == OPCODE_STR;
+}
+
+static int
+reads_flags(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_BP ||
+           opcode == OPCODE_BN || opcode == OPCODE_BNP;
+}
+
+/* As the functional model: CMP/CML, and every register write but loads and JALR */
+static int
+writes_flags(const APEX_TraceRecord *record)
+{
+    if (record->opcode == OPCODE_CMP || record->opcode == OPCODE_CML)
+    {
+        return TRUE;
+    }
+    return record->rd >= 0 && record->opcode != OPCODE_LOAD &&
+           record->opcode != OPCODE_LDR && record->opcode != OPCODE_JALR;
+}
+
+static int64_t
+max64(int64_t a, int64_t b)
+{
+    return a > b ? a : b;
+}
+
+/* Cycle from which Execute can use register 'reg', 0 for no register */
+static int64_t
+operand_ready(const APEX_Timing *timing, int reg)
+{
+    return reg >= 0 && reg < REG_FILE_SIZE ? timing->ready[reg] : 0;
+}
+
+/* Times the next retired instruction of the trace */
+void
+APEX_timing_issue(APEX_Timing *timing, const APEX_TraceRecord *record)
+{
+    const int64_t *prev = timing->entry;
+    int64_t entry[APEX_NUM_STAGES];
+    int64_t done[APEX_NUM_STAGES];      /* First cycle it could be in the next stage */
+    int64_t operands, held;
+    int stage;
+
+    /* Fetch and Decode are one cycle, and entered once the previous left them */
+    entry[APEX_STAGE_FETCH] = max64(prev[APEX_STAGE_DECODE], timing->fetch_ready);
+    done[APEX_STAGE_FETCH] = entry[APEX_STAGE_FETCH] + 1;
+    entry[APEX_STAGE_DECODE] = max64(done[APEX_STAGE_FETCH],
+                                     prev[APEX_STAGE_EXECUTE]);
+    done[APEX_STAGE_DECODE] = entry[APEX_STAGE_DECODE] + 1;
+
+    /* Decode holds the instruction until Execute is free and its operands are */
+    operands = max64(operand_ready(timing, record->rs1),
+                     max64(operand_ready(timing, record->rs2),
+                           operand_ready(timing, record->rs3)));
+    if (reads_flags(record->opcode))
+    {
+        operands = max64(operands, timing->ready[TIMING_FLAGS]);
+    }
+    held = max64(done[APEX_STAGE_DECODE], prev[APEX_STAGE_MEMORY1]);
+    entry[APEX_STAGE_EXECUTE] = max64(held, operands);
+    timing->stats.data_stalls += entry[APEX_STAGE_EXECUTE] - held;
+    done[APEX_STAGE_EXECUTE] =
+        entry[APEX_STAGE_EXECUTE] +
+        (record->opcode == OPCODE_MUL ? timing->config.mul_latency : 1);
+
+    entry[APEX_STAGE_MEMORY1] = max64(done[APEX_STAGE_EXECUTE],
+                                      prev[APEX_STAGE_MEMORY]);
+    done[APEX_STAGE_MEMORY1] = entry[APEX_STAGE_MEMORY1] + 1;
+    entry[APEX_STAGE_MEMORY] = max64(done[APEX_STAGE_MEMORY1],
+                                     prev[APEX_STAGE_WRITEBACK]);
+    done[APEX_STAGE_MEMORY] =
+        entry[APEX_STAGE_MEMORY] +
+        (is_memory_op(record->opcode) ? timing->config.memory_latency : 1);
+    entry[APEX_STAGE_WRITEBACK] = max64(done[APEX_STAGE_MEMORY],
+                                        prev[APEX_STAGE_WRITEBACK] + 1);
+    done[APEX_STAGE_WRITEBACK] = entry[APEX_STAGE_WRITEBACK] + 1;
+
+    for (stage = APEX_STAGE_DECODE; stage < APEX_NUM_STAGES; ++stage)
+    {
+        if (stage != APEX_STAGE_EXECUTE)
+        {
+            timing->stats.structural_stalls += entry[stage] - done[stage - 1];
+        }
+    }
+    timing->stats.structural_stalls += held - done[APEX_STAGE_DECODE];
+
+    /*
+     * A result is forwarded from the end of the stage computing it, loads
+     * from Memory; without forwarding Decode reads it after Writeback
+     */
+    if (record->rd >= 0 && record->rd < REG_FILE_SIZE)
+    {
+        if (!timing->config.forwarding)
+        {
+            timing->ready[record->rd] = done[APEX_STAGE_WRITEBACK];
+        }
+        else if (record->opcode == OPCODE_LOAD || record->opcode == OPCODE_LDR)
+        {
+            timing->ready[record->rd] = done[APEX_STAGE_MEMORY];
+        }
+        else
+        {
+            timing->ready[record->rd] = done[APEX_STAGE_EXECUTE];
+        }
+    }
+    if (writes_flags(record))
+    {
+        timing->ready[TIMING_FLAGS] = done[APEX_STAGE_EXECUTE];
+    }
+
+    /*
+     * The stage redirecting fetch flushes the younger stages and fetches the
+     * target in the last cycle the branch spends in it
+     */
+    if (record->next_pc != record->pc + 4)
+    {
+        stage = timing->config.branch_stage;
+        timing->fetch_ready = stage == APEX_STAGE_WRITEBACK
+                                  ? entry[stage]
+                                  : entry[stage + 1] - 1;
+        timing->stats.flush_cycles +=
+            timing->fetch_ready - entry[APEX_STAGE_DECODE];
+        timing->stats.taken_branches++;
+    }
+
+    memcpy(timing->entry, entry, sizeof(entry));
+    timing->stats.cycles = entry[APEX_STAGE_WRITEBACK];
+    timing->stats.instructions++;
+}
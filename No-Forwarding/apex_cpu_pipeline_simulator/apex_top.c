@@ -0,0 +1,171 @@
+/*
+ * apex_top.c
+ * apex-top, follows the progress of a run started with apex_sim --counters
+ *
+ * The counters file is mapped and polled every interval, the simulator is
+ * never interrupted: each poll prints the cycles and instructions so far,
+ * the IPC since the last poll and overall, the share of cycles each kind
+ * of stall took, the flushes, and how many cycles the simulator gets
+ * through per second. It stops once the run is over or the simulator is
+ * gone; --once prints a single line.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--interval <ms>] [--once]"
+                    " <counters file>\n", prog);
+    exit(1);
+}
+
+static void
+sleep_ms(int ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+
+    nanosleep(&ts, NULL);
+}
+
+static double
+share(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void
+print_counters(const APEX_Counters *now, const APEX_Counters *last,
+               const char *status)
+{
+    uint64_t cycles = now->cycles - last->cycles;
+    uint64_t retired = now->retired - last->retired;
+
+    printf("%-8s cycles=%llu retired=%llu ipc=%.3f total_ipc=%.3f"
+           " data=%.1f%% structural=%.1f%% mul=%.1f%% memory=%.1f%%"
+           " flushes=%llu speed=%.2fM/s elapsed=%.1fs pc=%d\n",
+           status, (unsigned long long)now->cycles,
+           (unsigned long long)now->retired,
+           cycles ? (double)retired / cycles : 0.0,
+           now->cycles ? (double)now->retired / now->cycles : 0.0,
+           share(now->data_stalls, now->cycles),
+           share(now->structural_stalls, now->cycles),
+           share(now->execute_busy_cycles, now->cycles),
+           share(now->memory_busy_cycles, now->cycles),
+           (unsigned long long)now->flushes, now->cycles_per_sec / 1e6,
+           now->host_ns / 1e9, now->pc);
+    fflush(stdout);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    const APEX_Counters *shared;
+    APEX_Counters now, last;
+    const char *path = NULL;
+    const char *status;
+    struct stat st;
+    void *map;
+    int interval = 1000;
+    int once = FALSE;
+    int fd, i;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+        {
+            interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--once") == 0)
+        {
+            once = TRUE;
+        }
+        else if (argv[i][0] == '-' || path)
+        {
+            print_usage(argv[0]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (!path || interval <= 0)
+    {
+        print_usage(argv[0]);
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    map = (size_t)st.st_size >= sizeof(APEX_Counters)
+              ? mmap(NULL, sizeof(APEX_Counters), PROT_READ, MAP_SHARED, fd, 0)
+              : MAP_FAILED;
+    close(fd);
+    shared = map;
+    if (map == MAP_FAILED || APEX_counters_read(shared, &last) != 0)
+    {
+        fprintf(stderr, "APEX_Error: %s holds no counters\n", path);
+        exit(1);
+    }
+    if (once)
+    {
+        memset(&last, 0, sizeof(last));
+    }
+
+    for (;;)
+    {
+        if (!once)
+        {
+            sleep_ms(interval);
+        }
+        if (APEX_counters_read(shared, &now) != 0)
+        {
+            fprintf(stderr, "APEX_Error: %s was left inconsistent\n", path);
+            return 1;
+        }
+
+        /* A run that never got to publish its end */
+        if (now.status == APEX_STATUS_RUNNING &&
+            kill(now.pid, 0) != 0 && errno == ESRCH)
+        {
+            print_counters(&now, &last, "exited");
+            break;
+        }
+        /* Nothing published since the last poll */
+        if (!once && now.status == APEX_STATUS_RUNNING &&
+            now.sequence == last.sequence)
+        {
+            continue;
+        }
+        status = now.status == APEX_STATUS_RUNNING
+                     ? "running"
+                     : apex_status_name(now.status, 0);
+        print_counters(&now, &last, status);
+        if (once || now.status != APEX_STATUS_RUNNING)
+        {
+            break;
+        }
+        last = now;
+    }
+
+    munmap(map, sizeof(APEX_Counters));
+    return 0;
+}
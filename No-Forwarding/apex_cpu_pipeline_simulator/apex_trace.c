@@ -0,0 +1,222 @@
+/*
+ * apex_trace.c
+ * apex-trace, prints a retirement trace written by apex_sim --retire-trace
+ * as text or CSV
+ *
+ * The file is mapped and decoded a block at a time, so printing a window
+ * of a long trace only decodes the blocks it covers: --block starts at a
+ * block of the index, --from at a record number, --count bounds the
+ * records printed. --info prints the format version and size of the trace
+ * instead.
+ *
+ * Author:
+ * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "apex_client.h"
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--csv] [--block <N> | --from <record>]"
+                    " [--count <N>] <trace file>\n"
+                    "       %s --info <trace file>\n", prog, prog);
+    exit(1);
+}
+
+static void
+print_text(const APEX_RetireRecord *record)
+{
+    int cause;
+
+    printf("cycle=%llu pc=%d %-5s", (unsigned long long)record->cycle,
+           record->pc, apex_opcode_name(record->opcode));
+    if (record->rd >= 0)
+    {
+        printf(" R%d=%d", record->rd, record->rd_value);
+    }
+    if (record->mem_address >= 0)
+    {
+        printf(" MEM[%d]=%d", record->mem_address, record->mem_value);
+    }
+    printf(" flags=%c%c%c", record->flags & APEX_FLAG_Z ? 'z' : '-',
+           record->flags & APEX_FLAG_N ? 'n' : '-',
+           record->flags & APEX_FLAG_P ? 'p' : '-');
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        if (record->stalls[cause])
+        {
+            printf(" %s=%u", APEX_cpi_cause_name(cause),
+                   (unsigned)record->stalls[cause]);
+        }
+    }
+    printf("\n");
+}
+
+static void
+print_csv(const APEX_RetireRecord *record)
+{
+    int cause;
+
+    printf("%llu,%d,%s,%d,%d,%d,%d,%d,%d,%d",
+           (unsigned long long)record->cycle, record->pc,
+           apex_opcode_name(record->opcode), record->rd, record->rd_value,
+           record->mem_address, record->mem_value,
+           !!(record->flags & APEX_FLAG_Z), !!(record->flags & APEX_FLAG_N),
+           !!(record->flags & APEX_FLAG_P));
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        if (cause != APEX_CPI_BASE)
+        {
+            printf(",%u", (unsigned)record->stalls[cause]);
+        }
+    }
+    printf("\n");
+}
+
+static void
+print_info(const APEX_RetireReader *reader, size_t size)
+{
+    uint64_t records = APEX_retire_reader_records(reader);
+    uint64_t first_record, first_cycle;
+    int blocks = APEX_retire_reader_blocks(reader);
+
+    printf("version=%d records=%llu blocks=%d bytes=%llu "
+           "bytes_per_record=%.3f\n", APEX_retire_reader_version(reader),
+           (unsigned long long)records, blocks, (unsigned long long)size,
+           records ? (double)size / records : 0.0);
+    if (blocks && APEX_retire_reader_block_info(reader, blocks - 1,
+                                                &first_record, &first_cycle) == 0)
+    {
+        printf("last block: first_record=%llu first_cycle=%llu\n",
+               (unsigned long long)first_record,
+               (unsigned long long)first_cycle);
+    }
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_RetireReader *reader;
+    APEX_RetireRecord record;
+    const char *path = NULL;
+    struct stat st;
+    void *map;
+    uint64_t from = 0, count = UINT64_MAX;
+    int block = -1;
+    int csv = FALSE, info = FALSE;
+    int fd, i, rc = 0;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--csv") == 0)
+        {
+            csv = TRUE;
+        }
+        else if (strcmp(argv[i], "--info") == 0)
+        {
+            info = TRUE;
+        }
+        else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc)
+        {
+            block = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+        {
+            from = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+        {
+            count = strtoull(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] == '-' || path)
+        {
+            print_usage(argv[0]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (!path || (block >= 0 && from))
+    {
+        print_usage(argv[0]);
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read %s\n", path);
+        exit(1);
+    }
+    map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                     : MAP_FAILED;
+    close(fd);
+    reader = map != MAP_FAILED ? APEX_retire_reader_open(map, st.st_size) : NULL;
+    if (!reader)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a retirement trace\n", path);
+        exit(1);
+    }
+
+    if (info)
+    {
+        print_info(reader, st.st_size);
+        APEX_retire_reader_close(reader);
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    if ((block >= 0 && APEX_retire_reader_seek(reader, block)) ||
+        (from && APEX_retire_reader_seek_record(reader, from)))
+    {
+        fprintf(stderr, "APEX_Error: %s has no %s %llu\n", path,
+                block >= 0 ? "block" : "record",
+                block >= 0 ? (unsigned long long)block
+                           : (unsigned long long)from);
+        exit(1);
+    }
+
+    if (csv)
+    {
+        printf("cycle,pc,opcode,rd,rd_value,mem_address,mem_value,z,n,p");
+        for (i = 0; i < APEX_CPI_CAUSES; ++i)
+        {
+            if (i != APEX_CPI_BASE)
+            {
+                printf(",%s", APEX_cpi_cause_name(i));
+            }
+        }
+        printf("\n");
+    }
+    while (count > 0 && (rc = APEX_retire_reader_next(reader, &record)) == 1)
+    {
+        if (csv)
+        {
+            print_csv(&record);
+        }
+        else
+        {
+            print_text(&record);
+        }
+        count--;
+    }
+
+    APEX_retire_reader_close(reader);
+    munmap(map, st.st_size);
+    if (count > 0 && rc < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s is corrupt\n", path);
+        return 1;
+    }
+    return 0;
+}
@@ -7,7 +7,8 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
-#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,7 +27,7 @@ get_num_from_string(const char *buffer)
     char str[16];
     int i, j = 0;
 
-    for (i = 1; buffer[i] != '\0'; ++i)
+    for (i = 1; buffer[i] != '\0' && j < (int)sizeof(str) - 1; ++i)
     {
         str[j] = buffer[i];
         j++;
@@ -37,7 +38,8 @@ get_num_from_string(const char *buffer)
 }
 
 /*
- * This function sets the numeric opcode to an instruction based on string value
+ * This function sets the numeric opcode to an instruction based on string
+ * value, or returns -1 for an unknown opcode
  *
  * Note : you can edit this function to add new instructions
  */
@@ -158,36 +160,38 @@ set_opcode_str(const char *opcode_str)
         return OPCODE_BN;
     }
 
-    assert(0 && "Invalid opcode");
-    return 0;
+    return -1;
 }
 
 static void
 split_opcode_from_insn_string(char *buffer, char tokens[2][128])
 {
     int token_num = 0;
+    char *save;
 
-    char *token = strtok(buffer, " ");
+    char *token = strtok_r(buffer, " \t", &save);
 
-    while (token != NULL)
+    while (token != NULL && token_num < 2)
     {
-        strcpy(tokens[token_num], token);
+        snprintf(tokens[token_num], 128, "%s", token);
         token_num++;
-        token = strtok(NULL, " ");
+        token = strtok_r(NULL, " \t", &save);
     }
 }
 
 /*
- * This function is related to parsing input file
+ * This function is related to parsing input file, returns -1 if the line is
+ * not a valid instruction
  *
  * Note : you can edit this function to add new instructions
  */
-static void
+static int
 create_APEX_instruction(APEX_Instruction *ins, char *buffer)
 {
     int i, token_num = 0;
-    char tokens[6][128];
+    char tokens[6][128] = {""};
     char top_level_tokens[2][128];
+    char *save;
     ins->rd = -1;
     ins->rs1 = -1;
     ins->rs2 = -1;
@@ -201,17 +205,21 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
 
     split_opcode_from_insn_string(buffer, top_level_tokens);
 
-    char *token = strtok(top_level_tokens[1], ",");
+    char *token = strtok_r(top_level_tokens[1], ",", &save);
 
-    while (token != NULL)
+    while (token != NULL && token_num < 6)
     {
-        strcpy(tokens[token_num], token);
+        snprintf(tokens[token_num], 128, "%s", token);
         token_num++;
-        token = strtok(NULL, ",");
+        token = strtok_r(NULL, ",", &save);
     }
 
     strcpy(ins->opcode_str, top_level_tokens[0]);
     ins->opcode = set_opcode_str(ins->opcode_str);
+    if (ins->opcode < 0)
+    {
+        return -1;
+    }
 
     switch (ins->opcode)
     {
@@ -312,61 +320,166 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
         }
     }
     /* Fill in rest of the instructions accordingly */
+    return 0;
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Parses the text of an .asm file, one instruction per line. Returns NULL
+ * if the text holds no instructions or a line does not parse, with a
+ * message in 'error' when it is not NULL.
  */
-APEX_Instruction *
-create_code_memory(const char *filename, int *size)
+APEX_Program *
+APEX_program_parse(const char *text, size_t len, char *error, size_t error_size)
 {
-    FILE *fp;
-    ssize_t nread;
-    size_t len = 0;
-    char *line = NULL;
+    char line[512];
+    size_t pos, end, line_len;
     int code_memory_size = 0;
     int current_instruction = 0;
-    APEX_Instruction *code_memory;
+    APEX_Program *program;
 
-    if (!filename)
+    for (pos = 0; pos < len; pos = end + 1)
+    {
+        for (end = pos; end < len && text[end] != '\n'; ++end)
+        {
+        }
+        code_memory_size++;
+    }
+    if (!code_memory_size)
     {
+        if (error)
+        {
+            snprintf(error, error_size, "program is empty");
+        }
         return NULL;
     }
 
-    fp = fopen(filename, "r");
-    if (!fp)
+    program = calloc(1, sizeof(APEX_Program));
+    if (!program)
     {
         return NULL;
     }
+    program->code = calloc(code_memory_size, sizeof(APEX_Instruction));
+    if (!program->code)
+    {
+        free(program);
+        return NULL;
+    }
+    program->size = code_memory_size;
+    program->refs = 1;
 
-    while ((nread = getline(&line, &len, fp)) != -1)
+    for (pos = 0; pos < len; pos = end + 1)
     {
-        code_memory_size++;
+        for (end = pos; end < len && text[end] != '\n'; ++end)
+        {
+        }
+
+        line_len = end - pos;
+        if (line_len && text[end - 1] == '\r')
+        {
+            line_len--;
+        }
+        if (line_len >= sizeof(line))
+        {
+            line_len = sizeof(line) - 1;
+        }
+        memcpy(line, text + pos, line_len);
+        line[line_len] = '\0';
+
+        if (create_APEX_instruction(&program->code[current_instruction], line))
+        {
+            if (error)
+            {
+                snprintf(error, error_size, "line %d: invalid instruction '%.*s'",
+                         current_instruction + 1, (int)line_len, text + pos);
+            }
+            APEX_program_release(program);
+            return NULL;
+        }
+        current_instruction++;
     }
-    *size = code_memory_size;
-    if (!code_memory_size)
+
+    return program;
+}
+
+APEX_Program *
+APEX_program_retain(APEX_Program *program)
+{
+    __atomic_add_fetch(&program->refs, 1, __ATOMIC_RELAXED);
+    return program;
+}
+
+/* Drops a reference, the program is freed with the last one */
+void
+APEX_program_release(APEX_Program *program)
+{
+    if (program && __atomic_sub_fetch(&program->refs, 1, __ATOMIC_ACQ_REL) == 0)
     {
-        fclose(fp);
-        return NULL;
+        free(program->code);
+        free(program);
     }
+}
 
-    code_memory = calloc(code_memory_size, sizeof(APEX_Instruction));
-    if (!code_memory)
+int
+APEX_program_size(const APEX_Program *program)
+{
+    return program->size;
+}
+
+const APEX_Instruction *
+APEX_program_instruction(const APEX_Program *program, int index)
+{
+    if (index < 0 || index >= program->size)
     {
-        fclose(fp);
         return NULL;
     }
+    return &program->code[index];
+}
+
+/*
+ * Parses the text of a data memory file: integers separated by commas or
+ * white space. Returns the number of words stored in 'words', at most
+ * 'max_words', or -1 on anything that is not an integer.
+ */
+int
+APEX_parse_data(const char *text, size_t len, int *words, int max_words)
+{
+    size_t pos = 0;
+    int count = 0;
 
-    rewind(fp);
-    while ((nread = getline(&line, &len, fp)) != -1)
+    while (count < max_words)
     {
-        create_APEX_instruction(&code_memory[current_instruction], line);
-        current_instruction++;
+        long long value = 0;
+        int negative = FALSE;
+
+        while (pos < len && (isspace((unsigned char)text[pos]) || text[pos] == ','))
+        {
+            pos++;
+        }
+        if (pos == len)
+        {
+            break;
+        }
+
+        if (text[pos] == '-' || text[pos] == '+')
+        {
+            negative = text[pos] == '-';
+            pos++;
+        }
+        if (pos == len || !isdigit((unsigned char)text[pos]))
+        {
+            return -1;
+        }
+        while (pos < len && isdigit((unsigned char)text[pos]))
+        {
+            if (value <= INT_MAX)
+            {
+                value = value * 10 + (text[pos] - '0');
+            }
+            pos++;
+        }
+
+        words[count++] = (int)(negative ? -value : value);
     }
 
-    free(line);
-    fclose(fp);
-    return code_memory;
-}
\ No newline at end of file
+    return count;
+}
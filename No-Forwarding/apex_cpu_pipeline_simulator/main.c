@@ -1,40 +1,1531 @@
 /*
  * main.c
+ * apex_sim, the interactive command line client of libapex
  *
  * Author:
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "apex_cpu.h"
+#include "apex.h"
+#include "apex_cache.h"
+#include "apex_client.h"
+#include "apex_server.h"
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s <input.asm> [--mem-latency <cycles>]"
+                    " [--mul-latency <cycles>] [--watchdog <cycles>]"
+                    " [--cache <dir>] [--record <file> | --resume <file>]"
+                    " [--retire-trace <file>] [--stream <name>]"
+                    " [--counters <file>] [--cpi] [--cpi-json <file>]"
+                    " [--profile] [--kanata <file> | --chrome-trace <file>]"
+                    " [--latency] [--latency-json <file>] [--latency-csv <file>]"
+                    " [--series <file> | --series-bin <file>]"
+                    " [--series-cycles <n> | --series-insns <n>]"
+                    " [--mem-report] [--mem-json <file>] [--mem-trace <file>]"
+                    " [--mem-block <words>] [--dataflow]"
+                    " [--dataflow-json <file>] [--ideal <mode>]..."
+                    " [--cosim | --cosim-hash <period>]\n"
+                    "       %s --server [<socket path>]\n", prog, prog);
+    exit(1);
+}
+
+/* Result cache of runs with a cycle count, see apex_cache.c */
+typedef struct Sim_Cache
+{
+    const char *dir;            /* NULL when caching is off */
+    const APEX_Program *program;
+    APEX_Config config;
+} Sim_Cache;
+
+/* Incremental re-simulation against a recorded reference run */
+typedef struct Sim_Replay
+{
+    const char *record_path;    /* Record this run and save it here */
+    const char *resume_path;    /* Resume from the recording saved here */
+    APEX_Recording *recording;  /* Being recorded, NULL if not */
+} Sim_Replay;
+
+/* Pipeline view of the run, see apex_pipeview.c */
+typedef struct Sim_View
+{
+    const char *path;           /* NULL when not written */
+    int format;                 /* APEX_PIPEVIEW_* */
+    FILE *fp;
+    APEX_PipeView *view;
+} Sim_View;
+
+/* Interval series of the run, see apex_series.c */
+typedef struct Sim_Series
+{
+    const char *path;           /* NULL when not written */
+    int format;                 /* APEX_SERIES_CSV or APEX_SERIES_BINARY */
+    int unit;                   /* APEX_SERIES_CYCLES or APEX_SERIES_RETIRED */
+    int length;
+    FILE *fp;
+    APEX_Series *series;
+} Sim_Series;
+
+/* Analysis of the data accesses of the run, see apex_memtrace.c */
+typedef struct Sim_MemTrace
+{
+    int report;                 /* Print it */
+    const char *json_path;      /* Write it as JSON, NULL if not */
+    const char *trace_path;     /* Write every access, NULL if not */
+    int block_words;
+    FILE *fp;
+    APEX_MemTrace *trace;       /* NULL when not analysed */
+} Sim_MemTrace;
+
+/* Dataflow limit of the run, see apex_dataflow.c */
+typedef struct Sim_Dataflow
+{
+    int report;                 /* Print it */
+    const char *json_path;      /* Write it as JSON, NULL if not */
+    APEX_Dataflow *dataflow;    /* NULL when not analysed */
+} Sim_Dataflow;
+
+/* Lockstep co-simulation against the functional model, see apex_cosim.c */
+typedef struct Sim_Cosim
+{
+    int enabled;
+    int period;                 /* Retirements per hash check, 0 for all */
+    APEX_Cosim *cosim;          /* NULL when not co-simulated */
+} Sim_Cosim;
+
+/* Retirement trace of the run, see apex_retire.c */
+typedef struct Sim_Trace
+{
+    const char *path;           /* NULL when not tracing */
+    FILE *fp;
+    APEX_RetireWriter *writer;
+} Sim_Trace;
+
+/* Prints what the cycles of the run were spent on, one line per cause */
+static void
+print_cpi_stack(const APEX_CpiStack *stack)
+{
+    uint64_t instructions = stack->cycles[APEX_CPI_BASE];
+    uint64_t cycles = 0;
+    int cause;
+
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        cycles += stack->cycles[cause];
+    }
+    printf("APEX_CPU: CPI stack, cycles = %llu, instructions = %llu, CPI = %.3f\n",
+           (unsigned long long)cycles, (unsigned long long)instructions,
+           instructions ? (double)cycles / instructions : 0.0);
+    for (cause = 0; cause < APEX_CPI_CAUSES; ++cause)
+    {
+        printf("  %-10s %12llu  %5.1f%%  CPI %.3f\n", APEX_cpi_cause_name(cause),
+               (unsigned long long)stack->cycles[cause],
+               cycles ? 100.0 * stack->cycles[cause] / cycles : 0.0,
+               instructions ? (double)stack->cycles[cause] / instructions : 0.0);
+    }
+}
+
+/* Writes the CPI stack of the run as JSON, returns -1 if it cannot */
+static int
+save_cpi_stack(const APEX_CpiStack *stack, const char *path)
+{
+    char json[1024];
+    FILE *fp;
+    int failed;
+
+    APEX_cpi_stack_json(stack, json, sizeof(json));
+    fp = fopen(path, "w");
+    failed = !fp || fprintf(fp, "%s\n", json) < 0;
+    if (fp && fclose(fp))
+    {
+        failed = TRUE;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Prints the latency of the instructions of the run, one line per class */
+static void
+print_latencies(const APEX_Latencies *latencies)
+{
+    int opclass;
+
+    printf("APEX_CPU: Latencies in cycles, from fetch to retirement and waiting in decode\n");
+    printf("  %-8s %12s %8s %6s %6s %6s %10s %6s\n", "class", "retired",
+           "mean", "p50", "p99", "max", "wait", "max");
+    for (opclass = 0; opclass < APEX_OPCLASSES; ++opclass)
+    {
+        const APEX_Histogram *total = &latencies->fetch_to_retire[opclass];
+        const APEX_Histogram *wait = &latencies->decode_wait[opclass];
+
+        if (!total->count)
+        {
+            continue;
+        }
+        printf("  %-8s %12llu %8.2f %6llu %6llu %6llu %10.2f %6llu\n",
+               APEX_opclass_name(opclass), (unsigned long long)total->count,
+               (double)total->sum / total->count,
+               (unsigned long long)APEX_histogram_percentile(total, 0.5),
+               (unsigned long long)APEX_histogram_percentile(total, 0.99),
+               (unsigned long long)total->max,
+               (double)wait->sum / wait->count,
+               (unsigned long long)wait->max);
+    }
+}
+
+/*
+ * Writes the latency histograms of the run as JSON or CSV, returns -1 if
+ * it cannot
+ */
+static int
+save_latencies(const APEX_Latencies *latencies, const char *path, int csv)
+{
+    char *text;
+    int len = csv ? APEX_latencies_csv(latencies, NULL, 0)
+                  : APEX_latencies_json(latencies, NULL, 0);
+    FILE *fp;
+    int failed;
+
+    text = malloc(len + 1);
+    if (!text)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the latencies\n");
+        return -1;
+    }
+    if (csv)
+    {
+        APEX_latencies_csv(latencies, text, len + 1);
+    }
+    else
+    {
+        APEX_latencies_json(latencies, text, len + 1);
+    }
+    fp = fopen(path, "w");
+    failed = !fp || fprintf(fp, csv ? "%s" : "%s\n", text) < 0;
+    if (fp && fclose(fp))
+    {
+        failed = TRUE;
+    }
+    free(text);
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* One instruction of the profile listing */
+typedef struct Sim_ProfileLine
+{
+    int index;                  /* In code memory */
+    const APEX_PcProfile *entry;
+} Sim_ProfileLine;
+
+/* Costliest first: most cycles from fetch to retirement, then most stalls */
+static int
+compare_profile_lines(const void *a, const void *b)
+{
+    const APEX_PcProfile *x = ((const Sim_ProfileLine *)a)->entry;
+    const APEX_PcProfile *y = ((const Sim_ProfileLine *)b)->entry;
+
+    if (x->latency_cycles != y->latency_cycles)
+    {
+        return x->latency_cycles > y->latency_cycles ? -1 : 1;
+    }
+    if (x->stall_cycles != y->stall_cycles)
+    {
+        return x->stall_cycles > y->stall_cycles ? -1 : 1;
+    }
+    return ((const Sim_ProfileLine *)a)->index -
+           ((const Sim_ProfileLine *)b)->index;
+}
+
+/* Prints the program annotated with the cost of each instruction */
+static void
+print_profile(const APEX_Profile *profile, const APEX_Program *program)
+{
+    const APEX_PcProfile *entries;
+    Sim_ProfileLine *lines;
+    uint64_t cycles = 0;
+    char insn[256];
+    int count, i;
+
+    entries = APEX_profile_entries(profile, &count);
+    lines = malloc(sizeof(Sim_ProfileLine) * (count > 0 ? count : 1));
+    if (!lines)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the profile\n");
+        return;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        lines[i].index = i;
+        lines[i].entry = &entries[i];
+        cycles += entries[i].latency_cycles;
+    }
+    qsort(lines, count, sizeof(Sim_ProfileLine), compare_profile_lines);
+
+    printf("APEX_CPU: Profile of %d instructions, by cycles from fetch to retirement\n",
+           count);
+    printf("  %-6s %10s %12s %6s %8s %10s %8s  %s\n", "pc", "executed",
+           "cycles", "share", "latency", "stalls", "flushes", "instruction");
+    for (i = 0; i < count; ++i)
+    {
+        const APEX_PcProfile *entry = lines[i].entry;
+
+        APEX_format_instruction(APEX_program_instruction(program, lines[i].index),
+                                insn, sizeof(insn));
+        printf("  %-6d %10llu %12llu %5.1f%% %8.2f %10llu %8llu  %s\n",
+               4000 + 4 * lines[i].index,
+               (unsigned long long)entry->executions,
+               (unsigned long long)entry->latency_cycles,
+               cycles ? 100.0 * entry->latency_cycles / cycles : 0.0,
+               entry->executions
+                   ? (double)entry->latency_cycles / entry->executions
+                   : 0.0,
+               (unsigned long long)entry->stall_cycles,
+               (unsigned long long)entry->flushes, insn);
+    }
+    free(lines);
+}
+
+/* Monitor of the run, SIGUSR1 has it log a snapshot to stderr */
+static APEX_Monitor *sim_monitor;
+
+static void
+request_snapshot(int sig)
+{
+    (void)sig;
+    APEX_monitor_request_snapshot(sim_monitor);
+}
+
+/* Publishes the counters of the run, to 'path' unless it is NULL */
+static int
+start_monitor(APEX_CPU *cpu, const char *path)
+{
+    struct sigaction action;
+
+    sim_monitor = APEX_monitor_create(path, 0);
+    if (!sim_monitor)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n",
+                path ? path : "the monitor");
+        return -1;
+    }
+    APEX_cpu_set_monitor(cpu, sim_monitor);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_snapshot;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    return 0;
+}
+
+/* Leaves the final counters in the file */
+static void
+finish_monitor(APEX_CPU *cpu)
+{
+    signal(SIGUSR1, SIG_IGN);
+    APEX_cpu_set_monitor(cpu, NULL);
+    APEX_monitor_destroy(sim_monitor);
+    sim_monitor = NULL;
+}
+
+/* Log sink of the simulator: trace to stdout, diagnostics to stderr */
+static void
+log_to_stdio(void *ctx, int channel, const char *text)
+{
+    fputs(text, channel == APEX_LOG_DIAG ? stderr : stdout);
+}
+
+void SetMem(APEX_CPU *cpu, const char *filename) {
+    int words[DATA_MEMORY_SIZE];
+    size_t len;
+    char *text;
+    int count;
+
+    text = apex_read_file(filename, &len); // Read the data file
+    if (text == NULL) {
+        perror("Error opening file"); // Print error if file can't be opened
+        return;
+    }
+
+    count = APEX_parse_data(text, len, words, DATA_MEMORY_SIZE);
+    free(text);
+    if (count < 0) {
+        fprintf(stderr, "APEX_Error: %s is not a list of integers\n", filename);
+        return;
+    }
+    APEX_cpu_load_data(cpu, 0, words, count); // Set data in the CPU's data memory
+
+    printf("Memory initialized from file.\n");
+    printf("Data Memory Contents:\n");
+    for (int i = 0; i < 10; i++) {
+        printf("Address %d: %d\n", i, APEX_cpu_get_mem(cpu, i));
+    }
+
+}
+
+static void
+print_code_memory(const APEX_CPU *cpu, const APEX_Program *program)
+{
+    int i;
+
+    fprintf(stderr,
+            "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
+            APEX_program_size(program));
+    fprintf(stderr, "APEX_CPU: PC initialized to %d\n", APEX_cpu_get_pc(cpu));
+    fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
+    printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
+           "imm");
+
+    for (i = 0; i < APEX_program_size(program); ++i)
+    {
+        const APEX_Instruction *ins = APEX_program_instruction(program, i);
+
+        printf("%-9s %-9d %-9d %-9d %-9d\n", ins->opcode_str, ins->rd,
+               ins->rs1, ins->rs2, ins->imm);
+    }
+}
+
+/* Prints the stall statistics, only when the run produced any */
+static void
+print_stats(const APEX_Stats *stats)
+{
+    if (!stats->skipped_cycles && !stats->execute_busy_cycles &&
+        !stats->memory_busy_cycles && !stats->structural_stalls)
+    {
+        return;
+    }
+
+    printf("APEX_CPU: Execute busy = %llu, Memory busy = %llu, "
+           "structural stalls = %llu, skipped cycles = %llu\n",
+           (unsigned long long)stats->execute_busy_cycles,
+           (unsigned long long)stats->memory_busy_cycles,
+           (unsigned long long)stats->structural_stalls,
+           (unsigned long long)stats->skipped_cycles);
+}
+
+/*
+ * APEX CPU simulation loop
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+print_simulation_result(int status, int cycles, int retired,
+                        const APEX_Stats *stats)
+{
+    if (status == APEX_STATUS_HALTED)
+    {
+        /* Halt in writeback stage */
+        printf("APEX_CPU: Simulation Complete, cycles = %d, instructions completed = %d\n", cycles, retired);
+        print_stats(stats);
+    }
+    else if (status == APEX_STATUS_RUNNING)
+    {
+        printf("APEX_CPU: Simulation stopped after %d cycles, instructions completed = %d\n", cycles, retired);
+    }
+}
+
+void APEX_cpu_simulate(APEX_CPU *cpu, int num_cycles) {
+    /* A resumed run has already simulated part of the cycles */
+    int status = APEX_cpu_step(cpu, num_cycles - APEX_cpu_get_clock(cpu));
+
+    print_simulation_result(status, APEX_cpu_get_clock(cpu),
+                            APEX_cpu_get_retired(cpu), APEX_cpu_get_stats(cpu));
+}
+
+/*
+ * Starts recording the run, or moves it forward to the last checkpoint of
+ * the saved recording that the data memory it was given does not change.
+ * 'num_cycles' is the cycle the run stops at, 0 if none.
+ */
+static void
+start_replay(APEX_CPU *cpu, Sim_Replay *replay, int num_cycles)
+{
+    APEX_Recording *recording;
+    size_t len;
+    char *data;
+    int cycle;
+
+    if (replay->record_path)
+    {
+        replay->recording = APEX_recording_create(0);
+        if (!replay->recording || APEX_cpu_record(cpu, replay->recording))
+        {
+            fprintf(stderr, "APEX_Error: Unable to record the run\n");
+            APEX_recording_destroy(replay->recording);
+            replay->recording = NULL;
+        }
+    }
+    if (!replay->resume_path)
+    {
+        return;
+    }
+
+    data = apex_read_file(replay->resume_path, &len);
+    recording = data ? APEX_recording_load(data, len) : NULL;
+    free(data);
+    if (!recording)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a recording of this model\n",
+                replay->resume_path);
+        return;
+    }
+
+    cycle = APEX_cpu_resume(cpu, recording, num_cycles);
+    if (cycle < 0)
+    {
+        fprintf(stderr, "APEX_Error: %s records another program or timing\n",
+                replay->resume_path);
+    }
+    else if (cycle == 0)
+    {
+        fprintf(stderr, "APEX_CPU: The changed data is used before the first"
+                        " checkpoint, simulating from cycle 0\n");
+    }
+    else
+    {
+        fprintf(stderr, "APEX_CPU: Resumed at cycle %d from %s\n", cycle,
+                replay->resume_path);
+    }
+    APEX_recording_destroy(recording);
+}
+
+/* Saves the recording of the run, returns -1 if it could not be written */
+static int
+save_replay(const Sim_Replay *replay)
+{
+    size_t len;
+    void *data;
+    FILE *fp;
+    int failed;
+
+    if (!replay->recording)
+    {
+        return 0;
+    }
+
+    data = APEX_recording_save(replay->recording, &len);
+    fp = data ? fopen(replay->record_path, "wb") : NULL;
+    failed = !fp || fwrite(data, 1, len, fp) != len;
+    if (fp && fclose(fp))
+    {
+        failed = TRUE;
+    }
+    free(data);
+
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", replay->record_path);
+        return -1;
+    }
+    fprintf(stderr, "APEX_CPU: Recorded %d checkpoints to %s\n",
+            APEX_recording_checkpoints(replay->recording), replay->record_path);
+    return 0;
+}
+
+/* Write sink of the traces, the pipeline view and the series */
+static int
+write_to_file(void *ctx, const void *data, size_t len)
+{
+    return fwrite(data, 1, len, ctx) == len ? 0 : -1;
+}
+
+/* Shows every cycle of the run in the view file, -1 if it cannot */
+static int
+start_view(APEX_CPU *cpu, Sim_View *view)
+{
+    view->fp = fopen(view->path, "w");
+    view->view = view->fp ? APEX_pipeview_create(view->format, write_to_file,
+                                                 view->fp)
+                          : NULL;
+    if (!view->view)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n", view->path);
+        if (view->fp)
+        {
+            fclose(view->fp);
+        }
+        return -1;
+    }
+    APEX_cpu_set_pipeview(cpu, view->view);
+    return 0;
+}
+
+/* Completes the view file, returns -1 if it could not be written */
+static int
+finish_view(Sim_View *view)
+{
+    int failed;
+
+    if (!view->view)
+    {
+        return 0;
+    }
+
+    failed = APEX_pipeview_finish(view->view) != 0;
+    if (fclose(view->fp))
+    {
+        failed = TRUE;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", view->path);
+    }
+    else
+    {
+        fprintf(stderr, "APEX_CPU: Wrote the pipeline view of %llu instructions to %s\n",
+                (unsigned long long)APEX_pipeview_instructions(view->view),
+                view->path);
+    }
+    APEX_pipeview_destroy(view->view);
+    return failed ? -1 : 0;
+}
+
+/* Records every interval of the run in the series file, -1 if it cannot */
+static int
+start_series(APEX_CPU *cpu, Sim_Series *series)
+{
+    series->fp = fopen(series->path, "w");
+    series->series = series->fp
+                         ? APEX_series_create(series->format, series->unit,
+                                              series->length, write_to_file,
+                                              series->fp)
+                         : NULL;
+    if (!series->series)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n", series->path);
+        if (series->fp)
+        {
+            fclose(series->fp);
+        }
+        return -1;
+    }
+    APEX_cpu_set_series(cpu, series->series);
+    return 0;
+}
+
+/* Completes the series file, returns -1 if it could not be written */
+static int
+finish_series(APEX_CPU *cpu, Sim_Series *series)
+{
+    int failed;
+
+    if (!series->series)
+    {
+        return 0;
+    }
+
+    APEX_cpu_set_series(cpu, NULL);
+    failed = APEX_series_finish(series->series) != 0;
+    if (fclose(series->fp))
+    {
+        failed = TRUE;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", series->path);
+    }
+    else
+    {
+        fprintf(stderr, "APEX_CPU: Wrote %llu intervals to %s\n",
+                (unsigned long long)APEX_series_records(series->series),
+                series->path);
+    }
+    APEX_series_destroy(series->series);
+    return failed ? -1 : 0;
+}
+
+/* Analyses every data access of the run, -1 if it cannot */
+static int
+start_memtrace(APEX_CPU *cpu, Sim_MemTrace *mem)
+{
+    if (mem->trace_path)
+    {
+        mem->fp = fopen(mem->trace_path, "w");
+        if (!mem->fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to create %s\n", mem->trace_path);
+            return -1;
+        }
+    }
+    mem->trace = APEX_memtrace_create(mem->block_words,
+                                      mem->fp ? write_to_file : NULL, mem->fp);
+    if (!mem->trace)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the memory trace\n");
+        if (mem->fp)
+        {
+            fclose(mem->fp);
+        }
+        return -1;
+    }
+    APEX_cpu_set_memtrace(cpu, mem->trace);
+    return 0;
+}
+
+/* Prints the data accesses of the run, their reuse and the hottest pages */
+static void
+print_memtrace(const APEX_MemTrace *trace, int block_words)
+{
+    const APEX_MemStats *stats = APEX_memtrace_stats(trace);
+    uint64_t total = stats->reads + stats->writes;
+    uint64_t inside = total - stats->outside;
+    uint64_t hot[8][2] = {{0}};
+    int hot_page[8];
+    int blocks, page, i;
+
+    printf("APEX_CPU: Data accesses = %llu, reads = %llu (%.1f%%), writes = %llu,"
+           " outside memory = %llu\n",
+           (unsigned long long)total, (unsigned long long)stats->reads,
+           total ? 100.0 * stats->reads / total : 0.0,
+           (unsigned long long)stats->writes,
+           (unsigned long long)stats->outside);
+    printf("APEX_CPU: Reuse distance in blocks of %d words, first accesses = %llu,"
+           " mean = %.2f, max = %llu\n",
+           block_words, (unsigned long long)stats->cold,
+           stats->reuse.count ? (double)stats->reuse.sum / stats->reuse.count
+                              : 0.0,
+           (unsigned long long)stats->reuse.max);
+    printf("  %-8s %12s %10s\n", "blocks", "LRU misses", "miss ratio");
+    for (blocks = 1; blocks * block_words <= DATA_MEMORY_SIZE; blocks *= 2)
+    {
+        uint64_t misses = APEX_memtrace_lru_misses(trace, blocks);
+
+        printf("  %-8d %12llu %9.2f%%\n", blocks, (unsigned long long)misses,
+               inside ? 100.0 * misses / inside : 0.0);
+    }
+
+    for (i = 0; i < 8; ++i)
+    {
+        hot_page[i] = -1;
+    }
+    for (page = 0; page < DATA_MEMORY_SIZE / APEX_MEMTRACE_PAGE_WORDS; ++page)
+    {
+        uint64_t reads, writes;
+
+        APEX_memtrace_page(trace, page, &reads, &writes);
+        for (i = 0; i < 8; ++i)
+        {
+            if (reads + writes > hot[i][0] + hot[i][1])
+            {
+                memmove(&hot[i + 1], &hot[i], sizeof(hot[0]) * (7 - i));
+                memmove(&hot_page[i + 1], &hot_page[i], sizeof(int) * (7 - i));
+                hot[i][0] = reads;
+                hot[i][1] = writes;
+                hot_page[i] = page;
+                break;
+            }
+        }
+    }
+    printf("APEX_CPU: Hottest pages of %d words\n", APEX_MEMTRACE_PAGE_WORDS);
+    printf("  %-12s %12s %12s\n", "addresses", "reads", "writes");
+    for (i = 0; i < 8 && hot_page[i] >= 0; ++i)
+    {
+        printf("  %5d-%-6d %12llu %12llu\n",
+               hot_page[i] * APEX_MEMTRACE_PAGE_WORDS,
+               (hot_page[i] + 1) * APEX_MEMTRACE_PAGE_WORDS - 1,
+               (unsigned long long)hot[i][0], (unsigned long long)hot[i][1]);
+    }
+}
+
+/* Writes the analysis of the data accesses as JSON, -1 if it cannot */
+static int
+save_memtrace(const APEX_MemTrace *trace, const char *path)
+{
+    int len = APEX_memtrace_json(trace, NULL, 0);
+    char *json = malloc(len + 1);
+    FILE *fp;
+    int failed;
+
+    if (!json)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the memory analysis\n");
+        return -1;
+    }
+    APEX_memtrace_json(trace, json, len + 1);
+    fp = fopen(path, "w");
+    failed = !fp || fprintf(fp, "%s\n", json) < 0;
+    if (fp && fclose(fp))
+    {
+        failed = TRUE;
+    }
+    free(json);
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reports on the data accesses of the run, returns -1 if it could not */
+static int
+finish_memtrace(APEX_CPU *cpu, Sim_MemTrace *mem)
+{
+    int failed = FALSE;
+
+    if (!mem->trace)
+    {
+        return 0;
+    }
+
+    APEX_cpu_set_memtrace(cpu, NULL);
+    if (mem->fp)
+    {
+        failed = APEX_memtrace_finish(mem->trace) != 0;
+        if (fclose(mem->fp))
+        {
+            failed = TRUE;
+        }
+        if (failed)
+        {
+            fprintf(stderr, "APEX_Error: Unable to write %s\n", mem->trace_path);
+        }
+    }
+    if (mem->report)
+    {
+        print_memtrace(mem->trace, mem->block_words ? mem->block_words : 1);
+    }
+    if (mem->json_path && save_memtrace(mem->trace, mem->json_path))
+    {
+        failed = TRUE;
+    }
+    APEX_memtrace_destroy(mem->trace);
+    return failed ? -1 : 0;
+}
+
+/* Analyses the dependences of every retirement of the run, -1 if it cannot */
+static int
+start_dataflow(APEX_CPU *cpu, Sim_Dataflow *df)
+{
+    df->dataflow = APEX_dataflow_create();
+    if (!df->dataflow)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the dataflow analysis\n");
+        return -1;
+    }
+    APEX_cpu_set_dataflow(cpu, df->dataflow);
+    return 0;
+}
+
+/* Checks every retirement of the run in lockstep, -1 if it cannot */
+static int
+start_cosim(APEX_CPU *cpu, Sim_Cosim *cs)
+{
+    cs->cosim = APEX_cosim_create(cs->period);
+    if (!cs->cosim || APEX_cpu_set_cosim(cpu, cs->cosim))
+    {
+        fprintf(stderr, "APEX_Error: Unable to create the co-simulation\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Reports on the co-simulation, returns -1 if the run diverged */
+static int
+finish_cosim(APEX_CPU *cpu, Sim_Cosim *cs)
+{
+    char what[256];
+    int diverged;
+
+    if (!cs->cosim)
+    {
+        return 0;
+    }
+
+    APEX_cpu_set_cosim(cpu, NULL);
+    diverged = APEX_cosim_report(cs->cosim)->mismatch != APEX_COSIM_NONE;
+    APEX_cosim_describe(cs->cosim, what, sizeof(what));
+    printf("APEX_COSIM: %s%s\n", diverged ? "Diverged, " : "", what);
+    if (diverged && cs->period)
+    {
+        printf("APEX_COSIM: Rerun with --cosim to find the instruction\n");
+    }
+    APEX_cosim_destroy(cs->cosim);
+    return diverged ? -1 : 0;
+}
+
+/* Prints the dataflow limit of the run against the cycles it took */
+static void
+print_dataflow(const APEX_DataflowStats *stats, uint64_t cycles)
+{
+    const APEX_Histogram *distance = &stats->distance;
+
+    printf("APEX_CPU: Dataflow limit of %llu instructions, in %llu cycles"
+           " (IPC %.3f)\n",
+           (unsigned long long)stats->instructions, (unsigned long long)cycles,
+           cycles ? (double)stats->instructions / cycles : 0.0);
+    printf("  critical path = %llu instructions, ILP = %.3f\n",
+           (unsigned long long)stats->critical_path,
+           stats->critical_path
+               ? (double)stats->instructions / stats->critical_path
+               : 0.0);
+    printf("  critical path = %llu cycles of latency, IPC limit = %.3f,"
+           " pipeline at %.1f%% of it\n",
+           (unsigned long long)stats->critical_cycles,
+           stats->critical_cycles
+               ? (double)stats->instructions / stats->critical_cycles
+               : 0.0,
+           cycles ? 100.0 * stats->critical_cycles / cycles : 0.0);
+    printf("  dependences = %llu, through memory = %llu, distance mean = %.2f,"
+           " p50 = %llu, p99 = %llu, max = %llu\n",
+           (unsigned long long)stats->dependences,
+           (unsigned long long)stats->memory_dependences,
+           distance->count ? (double)distance->sum / distance->count : 0.0,
+           (unsigned long long)APEX_histogram_percentile(distance, 0.5),
+           (unsigned long long)APEX_histogram_percentile(distance, 0.99),
+           (unsigned long long)distance->max);
+}
+
+/* Writes the dataflow limit of the run as JSON, -1 if it cannot */
+static int
+save_dataflow(const APEX_Dataflow *dataflow, uint64_t cycles, const char *path)
+{
+    int len = APEX_dataflow_json(dataflow, cycles, NULL, 0);
+    char *json = malloc(len + 1);
+    FILE *fp;
+    int failed;
+
+    if (!json)
+    {
+        fprintf(stderr,
+                "APEX_Error: Out of memory for the dataflow analysis\n");
+        return -1;
+    }
+    APEX_dataflow_json(dataflow, cycles, json, len + 1);
+    fp = fopen(path, "w");
+    failed = !fp || fprintf(fp, "%s\n", json) < 0;
+    if (fp && fclose(fp))
+    {
+        failed = TRUE;
+    }
+    free(json);
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reports on the dataflow limit of the run, returns -1 if it could not */
+static int
+finish_dataflow(APEX_CPU *cpu, Sim_Dataflow *df)
+{
+    uint64_t cycles = APEX_cpu_get_clock(cpu);
+    int failed = FALSE;
+
+    if (!df->dataflow)
+    {
+        return 0;
+    }
+
+    APEX_cpu_set_dataflow(cpu, NULL);
+    if (df->report)
+    {
+        print_dataflow(APEX_dataflow_stats(df->dataflow), cycles);
+    }
+    if (df->json_path && save_dataflow(df->dataflow, cycles, df->json_path))
+    {
+        failed = TRUE;
+    }
+    APEX_dataflow_destroy(df->dataflow);
+    return failed ? -1 : 0;
+}
+
+/* Sends every retirement of the run to the trace file, -1 if it cannot */
+static int
+start_trace(APEX_CPU *cpu, Sim_Trace *trace)
+{
+    trace->fp = fopen(trace->path, "wb");
+    trace->writer = trace->fp ? APEX_retire_writer_create(write_to_file, trace->fp)
+                              : NULL;
+    if (!trace->writer)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n", trace->path);
+        if (trace->fp)
+        {
+            fclose(trace->fp);
+        }
+        return -1;
+    }
+    APEX_cpu_set_retire_trace(cpu, trace->writer);
+    return 0;
+}
+
+/* Completes the trace file, returns -1 if it could not be written */
+static int
+finish_trace(Sim_Trace *trace)
+{
+    int failed;
+
+    if (!trace->writer)
+    {
+        return 0;
+    }
+
+    failed = APEX_retire_writer_finish(trace->writer) != 0;
+    if (fclose(trace->fp))
+    {
+        failed = TRUE;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", trace->path);
+    }
+    else
+    {
+        fprintf(stderr, "APEX_CPU: Traced %llu retirements to %s, %llu bytes\n",
+                (unsigned long long)APEX_retire_writer_records(trace->writer),
+                trace->path,
+                (unsigned long long)APEX_retire_writer_bytes(trace->writer));
+    }
+    APEX_retire_writer_destroy(trace->writer);
+    return failed ? -1 : 0;
+}
+
+/*
+ * APEX_cpu_simulate through the result cache. A hit prints the outcome of
+ * the earlier run, without its trace, and leaves 'cpu' as it is. Returns
+ * the watchdog reason of the run.
+ */
+static int
+simulate_cached(APEX_CPU *cpu, int num_cycles, const Sim_Cache *cache,
+                Sim_Replay *replay)
+{
+    char key[APEX_CACHE_KEY_SIZE];
+    Cache_Result *result;
+    int watchdog_reason;
+
+    result = malloc(sizeof(Cache_Result));
+    if (!result)
+    {
+        start_replay(cpu, replay, num_cycles);
+        APEX_cpu_simulate(cpu, num_cycles);
+        return APEX_cpu_get_watchdog_reason(cpu);
+    }
+
+    apex_cache_key(key, cache->program, APEX_cpu_get_data_memory(cpu),
+                   &cache->config, num_cycles);
+    if (apex_cache_lookup(cache->dir, key, result) == 0)
+    {
+        fprintf(stderr, "APEX_CPU: Result %s from the cache\n", key);
+        if (result->state.status == APEX_STATUS_WATCHDOG)
+        {
+            fprintf(stderr, "APEX_CPU: Watchdog tripped (%s)\n",
+                    apex_status_name(result->state.status,
+                                     result->watchdog_reason));
+        }
+        print_simulation_result(result->state.status, result->cycles,
+                                result->state.retired, &result->stats);
+    }
+    else
+    {
+        start_replay(cpu, replay, num_cycles);
+        APEX_cpu_simulate(cpu, num_cycles);
+        apex_cache_capture(cpu, result);
+        apex_cache_store(cache->dir, key, result);
+    }
+
+    watchdog_reason = result->watchdog_reason;
+    free(result);
+    return watchdog_reason;
+}
+
+/* Single-step prompt, polled after every cycle; <q> stops the run */
+static int
+prompt_user(const APEX_CPU *cpu, void *ctx)
+{
+    char *user_prompt_val = ctx;
+
+    printf("Press any key to advance CPU Clock or <q> to quit:\n");
+    scanf("%c", user_prompt_val);
+
+    return (*user_prompt_val == 'Q') || (*user_prompt_val == 'q');
+}
+
+// Function to display the current state of the APEX CPU
+void APEX_cpu_display(APEX_CPU *cpu) {
+    printf("=== APEX CPU State ===\n");
+    printf("Program Counter (PC): %d\n", APEX_cpu_get_pc(cpu));
+    printf("Instructions Completed: %d\n", APEX_cpu_get_retired(cpu));
+    
+    // Display Registers
+    printf("\nRegisters:\n");
+    for (int i = 0; i < REG_FILE_SIZE; i++) {
+        printf("R%d: %d\n", i, APEX_cpu_get_reg(cpu, i));
+    }
+    // Display Data Memory Contents (First 10 locations)
+    printf("\nData Memory Contents (First 10 Locations):\n");
+    for (int i = 0; i < 10; i++) {
+        printf("Data Memory[%d]: %d\n", i, APEX_cpu_get_mem(cpu, i));
+    }
+
+
+    printf("======================\n");
+}
+
+// Function to display memory values
+void show_memory(APEX_CPU *cpu, int start_address, int end_address) {
+    if (start_address < 0 || start_address >= DATA_MEMORY_SIZE ||
+        end_address < 0 || end_address >= DATA_MEMORY_SIZE || start_address > end_address) {
+        printf("Error: Invalid memory range [%d, %d]. Valid range is 0 to %d.\n",
+               start_address, end_address, DATA_MEMORY_SIZE - 1);
+        return;
+    }
+
+    printf("Memory Values [%d to %d]:\n", start_address, end_address);
+    for (int i = start_address; i <= end_address; i++) {
+        printf("Memory[0x%04X] = %d\n", i, APEX_cpu_get_mem(cpu, i));
+    }
+}
+
+/* Returns the watchdog reason of the run, 0 if the watchdog did not trip */
+int
+APEX_cpu_run(APEX_CPU *cpu, const Sim_Cache *cache, Sim_Replay *replay)
+{
+    char user_prompt_val;
+    int num_cycles = 0;
+    int status;
+    printf("Do you want to set memory from a file? (y/n): ");
+    scanf(" %c", &user_prompt_val); // Note the space before %c to consume newline
+
+    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
+        char filename[256]; // Adjust size as needed
+        printf("Enter the filename: ");
+        scanf("%255s", filename); // Read filename from user
+        SetMem(cpu, filename); // Call SetMem with the user-provided filename
+    }
+    printf("Do you want to simulate? (y/n): ");
+    scanf(" %c", &user_prompt_val);
+    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
+
+    printf("Enter the number of cycles to simulate (or enter 0 to run indefinitely): ");
+    scanf("%d", &num_cycles);
+    }
+
+    if (num_cycles > 0) {
+        /* Run simulation for specified number of cycles */
+        if (cache->dir) {
+            return simulate_cached(cpu, num_cycles, cache, replay);
+        }
+        start_replay(cpu, replay, num_cycles);
+        APEX_cpu_simulate(cpu, num_cycles);
+    } 
+    else
+     {
+    start_replay(cpu, replay, 0);
+    status = APEX_cpu_run_until(cpu, ENABLE_SINGLE_STEP ? prompt_user : NULL,
+                                &user_prompt_val, 0);
+    if (status == APEX_STATUS_WATCHDOG)
+    {
+        return APEX_cpu_get_watchdog_reason(cpu);
+    }
+
+    if (status == APEX_STATUS_HALTED)
+    {
+        /* Halt in writeback stage */
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", APEX_cpu_get_clock(cpu), APEX_cpu_get_retired(cpu));
+        print_stats(APEX_cpu_get_stats(cpu));
+    }
+    else
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", APEX_cpu_get_clock(cpu), APEX_cpu_get_retired(cpu));
+    }
+    
+    printf("Do you want to display the CPU state? (y/n): ");
+    scanf(" %c", &user_prompt_val);  // Note the space before %c to consume newline
+
+    if (user_prompt_val == 'y' || user_prompt_val == 'Y') {
+        APEX_cpu_display(cpu);  // Call the display function if user wants
+            }
+
+       char command[100]; // Buffer to hold user commands
+    while (TRUE) {
+        printf("\nEnter command ('ShowMem <start_address> <end_address>' or 'q' to quit): ");
+        if (!fgets(command, sizeof(command), stdin)) { // Get user input
+            break;
+        }
+        command[strcspn(command, "\n")] = 0; // Remove newline character
+
+        if (strncmp(command, "ShowMem", 7) == 0) {
+            int start_address, end_address;
+
+            // Parse the command for memory addresses
+            if (sscanf(command + 8, "%d %d", &start_address, &end_address) == 2) {
+                show_memory(cpu, start_address, end_address);
+            } else if (sscanf(command + 8, "%d", &start_address) == 1) {
+                show_memory(cpu, start_address, start_address);
+            } else {
+                printf("Invalid command.\n");
+            }
+        } else if (strcmp(command, "q") == 0) {
+         
+            break;
+        } else {
+            printf("Unknown command. V\n");
+        }
+        
+    }
+    }
+    return APEX_cpu_get_watchdog_reason(cpu);
+}
 
 int
 main(int argc, char const *argv[])
 {
+    APEX_Program *program;
     APEX_CPU *cpu;
+    APEX_Config config;
+    Sim_Cache cache;
+    Sim_Replay replay;
+    Sim_Trace trace;
+    Sim_View view;
+    Sim_Series series;
+    Sim_MemTrace mem;
+    Sim_Dataflow df;
+    Sim_Cosim cs;
+    APEX_Stream *stream = NULL;
+    APEX_Profile *profile = NULL;
+    const char *stream_name = NULL;
+    const char *counters_path = NULL;
+    const char *cpi_path = NULL;
+    const char *latency_json = NULL;
+    const char *latency_csv = NULL;
+    int cpi = FALSE;
+    int latency = FALSE;
+    int profiling = FALSE;
+    int i, rc;
 
-    // Test the get_code_memory_index_from_pc function
+    fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
+    if (argc < 2) { // Expecting at least two arguments
+        print_usage(argv[0]);
+    }
 
-    fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
+    if (strcmp(argv[1], "--server") == 0)
+    {
+        if (argc > 3)
+        {
+            print_usage(argv[0]);
+        }
+        return apex_server_main(argc == 3 ? argv[2] : NULL);
+    }
 
-    if (argc != 2) { // Expecting two arguments
-        fprintf(stderr, "APEX_Help: Usage %s <input.asm> \n", argv[0]);
-        exit(1);
+    APEX_config_default(&config);
+    memset(&cache, 0, sizeof(cache));
+    memset(&replay, 0, sizeof(replay));
+    memset(&trace, 0, sizeof(trace));
+    memset(&view, 0, sizeof(view));
+    memset(&series, 0, sizeof(series));
+    memset(&mem, 0, sizeof(mem));
+    memset(&df, 0, sizeof(df));
+    memset(&cs, 0, sizeof(cs));
+    for (i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            cache.dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            replay.record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            replay.resume_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--retire-trace") == 0 && i + 1 < argc)
+        {
+            trace.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+        {
+            stream_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--counters") == 0 && i + 1 < argc)
+        {
+            counters_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cpi") == 0)
+        {
+            cpi = TRUE;
+        }
+        else if (strcmp(argv[i], "--cpi-json") == 0 && i + 1 < argc)
+        {
+            cpi_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--latency") == 0)
+        {
+            latency = TRUE;
+        }
+        else if (strcmp(argv[i], "--latency-json") == 0 && i + 1 < argc)
+        {
+            latency_json = argv[++i];
+        }
+        else if (strcmp(argv[i], "--latency-csv") == 0 && i + 1 < argc)
+        {
+            latency_csv = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profiling = TRUE;
+        }
+        else if ((strcmp(argv[i], "--kanata") == 0 ||
+                  strcmp(argv[i], "--chrome-trace") == 0) &&
+                 i + 1 < argc && !view.path)
+        {
+            view.format = strcmp(argv[i], "--kanata") == 0
+                              ? APEX_PIPEVIEW_KANATA
+                              : APEX_PIPEVIEW_CHROME;
+            view.path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--series") == 0 ||
+                  strcmp(argv[i], "--series-bin") == 0) &&
+                 i + 1 < argc && !series.path)
+        {
+            series.format = strcmp(argv[i], "--series") == 0
+                                ? APEX_SERIES_CSV
+                                : APEX_SERIES_BINARY;
+            series.path = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--series-cycles") == 0 ||
+                  strcmp(argv[i], "--series-insns") == 0) &&
+                 i + 1 < argc && !series.length)
+        {
+            series.unit = strcmp(argv[i], "--series-cycles") == 0
+                              ? APEX_SERIES_CYCLES
+                              : APEX_SERIES_RETIRED;
+            series.length = atoi(argv[++i]);
+            if (series.length <= 0)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--mem-report") == 0)
+        {
+            mem.report = TRUE;
+        }
+        else if (strcmp(argv[i], "--mem-json") == 0 && i + 1 < argc)
+        {
+            mem.json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mem-trace") == 0 && i + 1 < argc)
+        {
+            mem.trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mem-block") == 0 && i + 1 < argc)
+        {
+            mem.block_words = atoi(argv[++i]);
+            if (mem.block_words <= 0 || mem.block_words > DATA_MEMORY_SIZE ||
+                (mem.block_words & (mem.block_words - 1)))
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--dataflow") == 0)
+        {
+            df.report = TRUE;
+        }
+        else if (strcmp(argv[i], "--dataflow-json") == 0 && i + 1 < argc)
+        {
+            df.json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cosim") == 0 && !cs.enabled)
+        {
+            cs.enabled = TRUE;
+        }
+        else if (strcmp(argv[i], "--cosim-hash") == 0 && i + 1 < argc &&
+                 !cs.enabled)
+        {
+            cs.enabled = TRUE;
+            cs.period = atoi(argv[++i]);
+            if (cs.period <= 0)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else if (apex_parse_config_option(&config, argc, argv, &i) != 1)
+        {
+            print_usage(argv[0]);
+        }
+    }
+    /*
+     * Traces, profiles, views, series, memory and dataflow analyses and
+     * co-simulation need every cycle simulated, from the first
+     */
+    if ((replay.record_path && replay.resume_path) ||
+        (series.length && !series.path) ||
+        (mem.block_words && !mem.report && !mem.json_path && !mem.trace_path) ||
+        ((trace.path || profiling || view.path || series.path || mem.report ||
+          mem.json_path || mem.trace_path || df.report || df.json_path ||
+          cs.enabled) &&
+         (replay.resume_path || cache.dir)))
+    {
+        print_usage(argv[0]);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
+    program = apex_load_program(argv[1]);
+    cpu = program ? APEX_cpu_create(program, &config) : NULL;
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
-    APEX_cpu_run(cpu);
-    APEX_cpu_stop(cpu);
-    
+    APEX_cpu_set_log(cpu, log_to_stdio, NULL);
+    if (trace.path && start_trace(cpu, &trace))
+    {
+        exit(1);
+    }
+    if (view.path && start_view(cpu, &view))
+    {
+        exit(1);
+    }
+    if (series.path && start_series(cpu, &series))
+    {
+        exit(1);
+    }
+    if ((mem.report || mem.json_path || mem.trace_path) &&
+        start_memtrace(cpu, &mem))
+    {
+        exit(1);
+    }
+    if ((df.report || df.json_path) && start_dataflow(cpu, &df))
+    {
+        exit(1);
+    }
+    if (cs.enabled && start_cosim(cpu, &cs))
+    {
+        exit(1);
+    }
+    if (stream_name)
+    {
+        stream = APEX_stream_create(stream_name, APEX_STREAM_DEFAULT_EVENTS);
+        if (!stream)
+        {
+            fprintf(stderr, "APEX_Error: Unable to create stream %s\n",
+                    stream_name);
+            exit(1);
+        }
+        APEX_cpu_set_stream(cpu, stream);
+        fprintf(stderr, "APEX_CPU: Streaming cycles to %s\n", stream_name);
+    }
+    if (start_monitor(cpu, counters_path))
+    {
+        exit(1);
+    }
+    if (profiling)
+    {
+        profile = APEX_profile_create(program);
+        if (!profile || APEX_cpu_set_profile(cpu, profile))
+        {
+            fprintf(stderr, "APEX_Error: Unable to create the profile\n");
+            exit(1);
+        }
+    }
 
-    return 0;
-    
-}
\ No newline at end of file
+    printf("Simulator initialized. PC set to 4000.\n");
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        print_code_memory(cpu, program);
+    }
+
+    /* The cpu holds a reference to the program, which the cache hashes */
+    cache.program = program;
+    cache.config = config;
+    APEX_program_release(program);
+
+    rc = APEX_cpu_run(cpu, &cache, &replay) ? WATCHDOG_EXIT_CODE : 0;
+    if (save_replay(&replay) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_trace(&trace) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_view(&view) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_series(cpu, &series) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_memtrace(cpu, &mem) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_dataflow(cpu, &df) && !rc)
+    {
+        rc = 1;
+    }
+    if (finish_cosim(cpu, &cs))
+    {
+        rc = DIVERGED_EXIT_CODE;
+    }
+    if ((cpi || cpi_path) && APEX_cpu_get_clock(cpu) == 0)
+    {
+        fprintf(stderr, "APEX_CPU: No CPI stack, the run was not simulated\n");
+    }
+    else
+    {
+        if (cpi)
+        {
+            print_cpi_stack(APEX_cpu_get_cpi_stack(cpu));
+        }
+        if (cpi_path && save_cpi_stack(APEX_cpu_get_cpi_stack(cpu), cpi_path) &&
+            !rc)
+        {
+            rc = 1;
+        }
+    }
+    if ((latency || latency_json || latency_csv) && APEX_cpu_get_clock(cpu) == 0)
+    {
+        fprintf(stderr, "APEX_CPU: No latencies, the run was not simulated\n");
+    }
+    else
+    {
+        if (latency)
+        {
+            print_latencies(APEX_cpu_get_latencies(cpu));
+        }
+        if (latency_json &&
+            save_latencies(APEX_cpu_get_latencies(cpu), latency_json, FALSE) &&
+            !rc)
+        {
+            rc = 1;
+        }
+        if (latency_csv &&
+            save_latencies(APEX_cpu_get_latencies(cpu), latency_csv, TRUE) &&
+            !rc)
+        {
+            rc = 1;
+        }
+    }
+    if (profile)
+    {
+        print_profile(profile, cache.program);
+    }
+    finish_monitor(cpu);
+    APEX_recording_destroy(replay.recording);
+    APEX_stream_destroy(stream);
+    APEX_profile_destroy(profile);
+    APEX_cpu_destroy(cpu);
+
+    return rc;
+}